@@ -0,0 +1,125 @@
+// ==================================================================
+// MitoGraph: Quantifying Mitochondrial Content in Living Cells
+// Inputs of a batch and the worker threads that process them.
+// ==================================================================
+
+#include <mutex>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "MitoBatch.h"
+#include "MitoManifest.h"
+
+#ifdef _WIN32
+    #include "includes/dirent.h"
+#else
+    #include <dirent.h>
+#endif
+
+int ScanFolderForThisExtension(std::string _root, std::string ext, std::vector<std::string> *List) {
+    DIR *dir;
+    int ext_p;
+    struct dirent *ent;
+    std::string _dir_name;
+    if ((dir = opendir (_root.c_str())) != NULL) {
+      while ((ent = readdir (dir)) != NULL) {
+        _dir_name = std::string(ent->d_name);
+        ext_p = (int)_dir_name.find(ext);
+        if (ext_p > 0) {
+            List -> push_back(std::string(_root)+_dir_name.substr(0,ext_p));
+        }
+      }
+      closedir (dir);
+    } else {
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+bool ReadInputList(const std::string &FileName, std::vector<std::string> &List) {
+
+    FILE *fin = fopen(FileName.c_str(),"r");
+    if (!fin) return false;
+
+    char line[4096];
+    bool manifest = false;
+    std::vector<std::string> Lines;
+    for (int n = 0; fgets(line,sizeof(line),fin); n++) {
+        if (n == 0 && !strncmp(line,"# MitoGraph manifest",20)) manifest = true;
+        std::string Name(line);
+        while (!Name.empty() && (Name[Name.size()-1] == '\n' || Name[Name.size()-1] == '\r')) Name.erase(Name.size()-1);
+        if (!Name.empty() && Name[0] != '#') Lines.push_back(Name);
+    }
+    fclose(fin);
+
+    if (!manifest) {
+        List.insert(List.end(),Lines.begin(),Lines.end());
+        return true;
+    }
+
+    // Names in a manifest are relative to its folder
+    size_t slash = FileName.find_last_of("/\\");
+    std::string Folder = (slash == std::string::npos) ? "" : FileName.substr(0,slash+1);
+
+    _mitoManifest Manifest;
+    std::vector<std::string> Names;
+    if (!Manifest.Read(FileName)) return false;
+    Manifest.GetDone(Names);
+    for (size_t i = 0; i < Names.size(); i++) List.push_back(Folder+Names[i]);
+
+    return true;
+}
+
+// State shared by the workers of RunJobs
+struct _jobState {
+    std::mutex Mutex;
+    size_t next;
+    std::vector<std::string> Failed;
+};
+
+static void JobWorker(const std::vector<std::string> *Files, int (*Process)(const std::string &FileName), _jobState *State) {
+
+    while (true) {
+
+        size_t i;
+        {
+            std::lock_guard<std::mutex> lock(State->Mutex);
+            if (State->next == Files->size()) return;
+            i = State->next++;
+        }
+
+        int status = Process((*Files)[i]);
+
+        if (status != EXIT_SUCCESS) {
+            std::lock_guard<std::mutex> lock(State->Mutex);
+            State->Failed.push_back((*Files)[i]);
+        }
+
+    }
+
+}
+
+int RunJobs(const std::vector<std::string> &Files, int njobs, int (*Process)(const std::string &FileName)) {
+
+    _jobState State;
+    State.next = 0;
+
+    // A single job runs in the calling thread
+    if (njobs <= 1) {
+        JobWorker(&Files,Process,&State);
+    } else {
+        std::vector<std::thread> Workers;
+        for (int j = 0; j < njobs; j++) {
+            Workers.push_back(std::thread(JobWorker,&Files,Process,&State));
+        }
+        for (int j = 0; j < njobs; j++) Workers[j].join();
+    }
+
+    printf("Batch finished: %d of %d files processed.\n",(int)(Files.size()-State.Failed.size()),(int)Files.size());
+    for (size_t i = 0; i < State.Failed.size(); i++) {
+        printf("\tFailed: %s\n",State.Failed[i].c_str());
+    }
+
+    return (int)State.Failed.size();
+}
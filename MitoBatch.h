@@ -0,0 +1,34 @@
+#ifndef MITOBATCH_H
+#define MITOBATCH_H
+
+#include <string>
+#include <vector>
+
+	//===========================================================================
+	//
+	//   Inputs of a batch and the worker threads that process them, shared
+	//   by MitoGraph and by the tools in tools/. A batch is a folder, a
+	//   text file listing the inputs or the manifest of a previous MitoGraph
+	//   run (see MitoManifest.h). Like the rest of the kernels it does not
+	//   depend on VTK.
+	//
+	//===========================================================================
+
+	// Stores in List the files of the folder _root whose name contains
+	// ext, with _root prepended and without ext and what follows it
+	int ScanFolderForThisExtension(std::string _root, std::string ext, std::vector<std::string> *List);
+
+	// Reads the inputs listed in FileName into List. A manifest gives
+	// the files whose last line is done, in the folder of the manifest
+	// and without extension, as ScanFolderForThisExtension does. Any
+	// other file holds one input per line; blank lines and lines that
+	// start with # are skipped. Returns false if it cannot be read.
+	bool ReadInputList(const std::string &FileName, std::vector<std::string> &List);
+
+	// Calls Process on every file of Files from njobs worker threads, each
+	// taking the next file as soon as it is done with the previous one.
+	// Process must return EXIT_SUCCESS for the file to count as processed.
+	// Prints a summary and returns the number of files that failed.
+	int RunJobs(const std::vector<std::string> &Files, int njobs, int (*Process)(const std::string &FileName));
+
+#endif
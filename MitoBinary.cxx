@@ -0,0 +1,145 @@
+// ==================================================================
+// MitoGraph: Quantifying Mitochondrial Content in Living Cells
+// Columnar binary container for the graph and skeleton outputs.
+// ==================================================================
+
+#include <cstdio>
+#include <cstring>
+#include "MitoBinary.h"
+
+#ifdef MITOGRAPH_HAVE_ZLIB
+    #include <zlib.h>
+#endif
+
+static bool IsLittleEndian() {
+    const uint16_t one = 1;
+    return *(const unsigned char*)&one == 1;
+}
+
+void _mitoColumns::Add(const std::string &Name, uint32_t type, const void *V, size_t count) {
+    _column C;
+    C.Name = Name.substr(0,sizeof(((mgb_column*)0)->name)-1);
+    C.type = type;
+    C.count = count;
+    C.Data.resize(count*mgb_type_size(type));
+    if (count) memcpy(&C.Data[0],V,C.Data.size());
+    Columns.push_back(C);
+}
+
+void _mitoColumns::Add(const std::string &Name, const std::vector<int32_t> &V) {
+    Add(Name,MGB_INT32,V.empty() ? NULL : &V[0],V.size());
+}
+
+void _mitoColumns::Add(const std::string &Name, const std::vector<float> &V) {
+    Add(Name,MGB_FLOAT32,V.empty() ? NULL : &V[0],V.size());
+}
+
+void _mitoColumns::Add(const std::string &Name, const std::vector<double> &V) {
+    Add(Name,MGB_FLOAT64,V.empty() ? NULL : &V[0],V.size());
+}
+
+const _mitoColumns::_column *_mitoColumns::Find(const std::string &Name, uint32_t type) const {
+    for (size_t i = 0; i < Columns.size(); i++) {
+        if (Columns[i].Name == Name) return (Columns[i].type == type) ? &Columns[i] : NULL;
+    }
+    return NULL;
+}
+
+bool _mitoColumns::Get(const std::string &Name, std::vector<int32_t> &V) const {
+    const _column *C = Find(Name,MGB_INT32);
+    if (!C) return false;
+    V.resize((size_t)C->count);
+    if (C->count) memcpy(&V[0],&C->Data[0],C->Data.size());
+    return true;
+}
+
+bool _mitoColumns::Get(const std::string &Name, std::vector<float> &V) const {
+    const _column *C = Find(Name,MGB_FLOAT32);
+    if (!C) return false;
+    V.resize((size_t)C->count);
+    if (C->count) memcpy(&V[0],&C->Data[0],C->Data.size());
+    return true;
+}
+
+bool _mitoColumns::Get(const std::string &Name, std::vector<double> &V) const {
+    const _column *C = Find(Name,MGB_FLOAT64);
+    if (!C) return false;
+    V.resize((size_t)C->count);
+    if (C->count) memcpy(&V[0],&C->Data[0],C->Data.size());
+    return true;
+}
+
+bool _mitoColumns::CanCompress() {
+    #ifdef MITOGRAPH_HAVE_ZLIB
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+bool _mitoColumns::Save(const std::string &FileName, double dxy, double dz, bool compress) const {
+
+    // The format is little-endian and columns are copied as they are
+    // in memory.
+    if (!IsLittleEndian()) return false;
+
+    size_t i, n = Columns.size();
+    std::vector<mgb_column> Desc(n);
+    std::vector< std::vector<unsigned char> > Packed(n);
+
+    uint64_t offset = sizeof(mgb_header) + n * sizeof(mgb_column);
+    for (i = 0; i < n; i++) {
+        const _column &C = Columns[i];
+        mgb_column &D = Desc[i];
+        memset(&D,0,sizeof(D));
+        strncpy(D.name,C.Name.c_str(),sizeof(D.name)-1);
+        D.type = C.type;
+        D.codec = MGB_CODEC_RAW;
+        D.count = C.count;
+        D.size = C.Data.size();
+        #ifdef MITOGRAPH_HAVE_ZLIB
+            // Kept raw when compression does not pay off, so that small
+            // columns can still be mapped.
+            if (compress && !C.Data.empty()) {
+                uLongf size = compressBound((uLong)C.Data.size());
+                Packed[i].resize(size);
+                if (compress2(&Packed[i][0],&size,&C.Data[0],(uLong)C.Data.size(),Z_DEFAULT_COMPRESSION) == Z_OK && size < C.Data.size()) {
+                    Packed[i].resize(size);
+                    D.codec = MGB_CODEC_ZLIB;
+                    D.size = size;
+                } else {
+                    Packed[i].clear();
+                }
+            }
+        #else
+            (void)compress;
+        #endif
+        offset = (offset + 7) & ~(uint64_t)7;
+        D.offset = offset;
+        offset += D.size;
+    }
+
+    mgb_header H;
+    memset(&H,0,sizeof(H));
+    memcpy(H.magic,MGB_MAGIC,8);
+    H.version = MGB_VERSION;
+    H.ncolumns = (uint32_t)n;
+    H.dxy = dxy;
+    H.dz = dz;
+
+    FILE *f = fopen(FileName.c_str(),"wb");
+    if (!f) return false;
+    bool ok = fwrite(&H,sizeof(H),1,f) == 1;
+    if (n) ok = ok && fwrite(&Desc[0],sizeof(mgb_column),n,f) == n;
+    uint64_t position = sizeof(mgb_header) + n * sizeof(mgb_column);
+    const unsigned char zeros[8] = {0};
+    for (i = 0; i < n && ok; i++) {
+        ok = fwrite(zeros,1,(size_t)(Desc[i].offset-position),f) == Desc[i].offset-position;
+        const std::vector<unsigned char> &Data = (Desc[i].codec == MGB_CODEC_ZLIB) ? Packed[i] : Columns[i].Data;
+        if (ok && Desc[i].size) ok = fwrite(&Data[0],1,(size_t)Desc[i].size,f) == Desc[i].size;
+        position = Desc[i].offset + Desc[i].size;
+    }
+    if (fclose(f)) ok = false;
+
+    return ok;
+}
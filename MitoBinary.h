@@ -0,0 +1,54 @@
+#ifndef MITOBINARY_H
+#define MITOBINARY_H
+
+#include <string>
+#include <vector>
+#include "MitoBinaryFormat.h"
+
+	//===========================================================================
+	//
+	//   Writer of the columnar .mgb files described in MitoBinaryFormat.h.
+	//   Columns are appended while the outputs of a file are produced and
+	//   the whole container is written at once by Save. Columns are
+	//   compressed with zlib when MitoGraph is built with it (see
+	//   MITOGRAPH_WITH_ZLIB) and compression is requested; otherwise they
+	//   are stored raw. Like the rest of the kernels it does not depend on
+	//   VTK.
+	//
+	//===========================================================================
+
+	struct _mitoColumns {
+
+		void Add(const std::string &Name, const std::vector<int32_t> &V);
+		void Add(const std::string &Name, const std::vector<float> &V);
+		void Add(const std::string &Name, const std::vector<double> &V);
+
+		// Writes all the columns to FileName. Returns false if the file
+		// cannot be written.
+		bool Save(const std::string &FileName, double dxy, double dz, bool compress) const;
+
+		// Whether Save can compress the columns.
+		static bool CanCompress();
+
+		// Copies the column Name into V. Returns false if there is no
+		// such column or it was added with another type.
+		bool Get(const std::string &Name, std::vector<int32_t> &V) const;
+		bool Get(const std::string &Name, std::vector<float> &V) const;
+		bool Get(const std::string &Name, std::vector<double> &V) const;
+
+	  private:
+
+		struct _column {
+			std::string Name;
+			uint32_t type;
+			uint64_t count;
+			std::vector<unsigned char> Data;
+		};
+
+		std::vector<_column> Columns;
+
+		void Add(const std::string &Name, uint32_t type, const void *V, size_t count);
+		const _column *Find(const std::string &Name, uint32_t type) const;
+	};
+
+#endif
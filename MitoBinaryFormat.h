@@ -0,0 +1,96 @@
+#ifndef MITOBINARYFORMAT_H
+#define MITOBINARYFORMAT_H
+
+/*
+ * Layout of the .mgb files written with -output-format binary. This
+ * header has no dependencies besides the C standard library so it can
+ * be copied into downstream tools, in C or C++.
+ *
+ * A file starts with an mgb_header followed by ncolumns mgb_column
+ * descriptors. The data of each column is stored at its offset, which
+ * is a multiple of 8, so a mapped file can be read in place. Values are
+ * little-endian. Columns with codec MGB_CODEC_ZLIB hold a zlib stream
+ * of count elements and must be inflated first.
+ *
+ * Columns written by MitoGraph (absent when the data is not exported):
+ *
+ *   node.x, node.y, node.z         float64  node coordinates (um), as in .coo
+ *   edge.source, edge.target       int32    node ids of each edge, as in .gnet
+ *   edge.length                    float64  edge length (um)
+ *   point.line, point.index        int32    edge and position of each skeleton point, as in .txt
+ *   point.x, point.y, point.z      float32  point coordinates (um)
+ *   point.width                    float32  tubule width (um)
+ *   point.intensity                float32  pixel intensity
+ *   cc.node, cc.component          int32    connected component of each node, as in .cc
+ *   cc.volume                      float64  volume of the component (um3)
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define MGB_MAGIC "MGBINARY"
+#define MGB_VERSION 1
+
+#define MGB_INT32   1
+#define MGB_INT64   2
+#define MGB_FLOAT32 3
+#define MGB_FLOAT64 4
+
+#define MGB_CODEC_RAW  0
+#define MGB_CODEC_ZLIB 1
+
+typedef struct {
+    char magic[8];          /* MGB_MAGIC, not null-terminated */
+    uint32_t version;       /* MGB_VERSION */
+    uint32_t ncolumns;
+    double dxy;             /* pixel size in xy (um) */
+    double dz;              /* pixel size in z (um) */
+    uint64_t reserved[4];
+} mgb_header;
+
+typedef struct {
+    char name[32];          /* null-terminated */
+    uint32_t type;          /* MGB_INT32, ... */
+    uint32_t codec;         /* MGB_CODEC_RAW or MGB_CODEC_ZLIB */
+    uint64_t count;         /* number of elements */
+    uint64_t offset;        /* from the start of the file */
+    uint64_t size;          /* bytes stored at offset */
+} mgb_column;
+
+static inline size_t mgb_type_size(uint32_t type) {
+    switch (type) {
+        case MGB_INT32: case MGB_FLOAT32: return 4;
+        case MGB_INT64: case MGB_FLOAT64: return 8;
+        default: return 0;
+    }
+}
+
+/* Header of the size bytes at base, or NULL if they are not a valid file. */
+static inline const mgb_header *mgb_get_header(const void *base, size_t size) {
+    const mgb_header *h = (const mgb_header *)base;
+    if (size < sizeof(mgb_header) || memcmp(h->magic,MGB_MAGIC,8) || h->version != MGB_VERSION) return NULL;
+    if ((size - sizeof(mgb_header)) / sizeof(mgb_column) < h->ncolumns) return NULL;
+    return h;
+}
+
+/* Descriptor of the column called name, or NULL if there is none or its
+   data does not fit in the file. */
+static inline const mgb_column *mgb_find_column(const void *base, size_t size, const char *name) {
+    const mgb_header *h = mgb_get_header(base,size);
+    if (!h) return NULL;
+    const mgb_column *c = (const mgb_column *)((const char *)base + sizeof(mgb_header));
+    for (uint32_t i = 0; i < h->ncolumns; i++) {
+        if (strncmp(c[i].name,name,sizeof(c[i].name))) continue;
+        if (c[i].offset > size || c[i].size > size - c[i].offset) return NULL;
+        return &c[i];
+    }
+    return NULL;
+}
+
+/* Data of an uncompressed column, to be cast to the type of the column. */
+static inline const void *mgb_column_data(const void *base, const mgb_column *c) {
+    return (c && c->codec == MGB_CODEC_RAW) ? (const char *)base + c->offset : NULL;
+}
+
+#endif
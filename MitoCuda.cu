@@ -0,0 +1,242 @@
+// ==================================================================
+// MitoGraph: Quantifying Mitochondrial Content in Living Cells
+// Vesselness and divergence filter on a CUDA device.
+// ==================================================================
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <cuda_runtime.h>
+#include "MitoCuda.h"
+#include "MitoFilters.h"
+#include "MitoVoxel.h"
+
+// Threads per block of the grid-stride kernels, a multiple of the warp
+#define MITO_CUDA_THREADS 256
+#define MITO_CUDA_MAX_BLOCKS 65535
+
+// Device buffer released with the scope
+struct _cudaBuffer {
+    void *p;
+    _cudaBuffer() : p(NULL) {}
+    ~_cudaBuffer() { Release(); }
+    cudaError_t Allocate(size_t bytes) { Release(); return cudaMalloc(&p,bytes); }
+    void Release() { if (p) cudaFree(p); p = NULL; }
+  private:
+    _cudaBuffer(const _cudaBuffer&);
+    _cudaBuffer& operator=(const _cudaBuffer&);
+};
+
+static bool Failed(cudaError_t status, const char *what, std::string &Error) {
+    if (status == cudaSuccess) return false;
+    Error = std::string(what) + ": " + cudaGetErrorString(status);
+    return true;
+}
+
+static int GetBlocks(long long N) {
+    return (int)std::min((N + MITO_CUDA_THREADS - 1) / MITO_CUDA_THREADS,(long long)MITO_CUDA_MAX_BLOCKS);
+}
+
+/* ================================================================
+   KERNELS
+=================================================================*/
+
+// ConvolveAxis of MitoFilters.cxx: the products are accumulated in the
+// same order and the sum is scaled by the inverse of the kernel mass
+// inside the volume, Norm[p] at position p along the axis.
+__global__ void ConvolveAxisKernel(const float *In, float *Out, int nx, int ny, int nz, int axis, const float *W, int r, const float *Norm) {
+    const long long nxy = (long long)nx*ny, N = nxy*nz;
+    const long long stride = (axis == 0) ? 1 : (axis == 1) ? nx : nxy;
+    const int n = (axis == 0) ? nx : (axis == 1) ? ny : nz;
+    for (long long id = blockIdx.x*(long long)blockDim.x + threadIdx.x; id < N; id += (long long)gridDim.x*blockDim.x) {
+        const int p = (axis == 0) ? (int)(id % nx) : (axis == 1) ? (int)((id / nx) % ny) : (int)(id / nxy);
+        float acc = 0.0f;
+        for (int k = max(-r,-p); k <= min(r,n-1-p); k++) acc += W[k+r] * In[id+k*stride];
+        Out[id] = acc * Norm[p];
+    }
+}
+
+// Maximum Frobenius norm of the Hessian of G, rounded to float. The
+// norms are not negative, so their bits order like unsigned integers.
+__global__ void FrobeniusMaxKernel(const float *G, int nx, int ny, int nz, unsigned int *Max) {
+    const int Dim[3] = {nx, ny, nz};
+    const long long nxy = (long long)nx*ny, N = nxy*nz;
+    float tmax = 0.0f, H[6];
+    for (long long id = blockIdx.x*(long long)blockDim.x + threadIdx.x; id < N; id += (long long)gridDim.x*blockDim.x) {
+        GetHessianAt(G,Dim,(int)(id % nx),(int)((id / nx) % ny),(int)(id / nxy),H);
+        float fro = (float)GetHessianFrobeniusNorm(H[MITO_HXX],H[MITO_HYY],H[MITO_HZZ],H[MITO_HXY],H[MITO_HXZ],H[MITO_HYZ]);
+        tmax = (fro > tmax) ? fro : tmax;
+    }
+    for (int offset = 16; offset; offset >>= 1) {
+        float t = __shfl_down_sync(0xffffffff,tmax,offset);
+        tmax = (t > tmax) ? t : tmax;
+    }
+    if ((threadIdx.x & 31) == 0) atomicMax(Max,__float_as_uint(tmax));
+}
+
+// HessianVesselnessPass without -adaptive: V keeps the maximum
+// vesselness of the voxels with negative trace whose norm is not below
+// fthresh.
+template <typename Real>
+__global__ void VesselnessKernel(const float *G, int nx, int ny, int nz, double fthresh, Real *V) {
+    const int Dim[3] = {nx, ny, nz};
+    const long long nxy = (long long)nx*ny, N = nxy*nz;
+    float H[6];
+    double l1, l2, l3;
+    for (long long id = blockIdx.x*(long long)blockDim.x + threadIdx.x; id < N; id += (long long)gridDim.x*blockDim.x) {
+        GetHessianAt(G,Dim,(int)(id % nx),(int)((id / nx) % ny),(int)(id / nxy),H);
+        double xx = H[MITO_HXX], yy = H[MITO_HYY], zz = H[MITO_HZZ];
+        double xy = H[MITO_HXY], xz = H[MITO_HXZ], yz = H[MITO_HYZ];
+        if (!(xx+yy+zz<0.0)) continue;
+        if ( (float)GetHessianFrobeniusNorm(xx,yy,zz,xy,xz,yz) < fthresh ) continue;
+        GetSymmetricEigenvaluesAt(xx,yy,zz,xy,xz,yz,l1,l2,l3);
+        double v = GetVesselnessAt(l1,l2,l3);
+        if ( v > V[id] ) V[id] = (Real)v;
+    }
+}
+
+// GetDivergenceFilter, zero closer than MITO_DIVERGENCE_STEP+1 to the
+// border
+template <typename Real>
+__global__ void DivergenceKernel(const Real *S, int nx, int ny, int nz, Real *Out) {
+    const int r = MITO_DIVERGENCE_STEP+1;
+    const long long nxy = (long long)nx*ny, N = nxy*nz;
+    for (long long id = blockIdx.x*(long long)blockDim.x + threadIdx.x; id < N; id += (long long)gridDim.x*blockDim.x) {
+        const int x = (int)(id % nx), y = (int)((id / nx) % ny), z = (int)(id / nxy);
+        bool inside = x >= r && x < nx-r && y >= r && y < ny-r && z >= r && z < nz-r;
+        Out[id] = (inside) ? (Real)GetDivergenceAt(S,id,nx,nxy) : (Real)0;
+    }
+}
+
+/* ================================================================
+   DIVERGENCE OF THE MULTISCALE VESSELNESS
+=================================================================*/
+
+bool CanUseCudaDevice(std::string &Error) {
+    int n = 0;
+    if (Failed(cudaGetDeviceCount(&n),"cudaGetDeviceCount",Error)) return false;
+    if (n < 1) {
+        Error = "no CUDA device found";
+        return false;
+    }
+    return true;
+}
+
+template <typename Real>
+int GetDivergenceCuda(const float *Input, const int *Dim, const std::vector<double> &Sigmas, Real *Divergence, _mitoProfile *Profile, std::string &Error) {
+
+    if (!CanUseCudaDevice(Error)) return EXIT_FAILURE;
+
+    const int nx = Dim[0], ny = Dim[1], nz = Dim[2];
+    const long long N = (long long)nx*ny*nz;
+    const int nblocks = GetBlocks(N);
+    const int nmax = std::max(nx,std::max(ny,nz));
+
+    size_t free_bytes, total_bytes;
+    if (Failed(cudaMemGetInfo(&free_bytes,&total_bytes),"cudaMemGetInfo",Error)) return EXIT_FAILURE;
+    if ((double)free_bytes < (double)N*MITO_CUDA_BYTES_PER_VOXEL(Real)) {
+        char buffer[128];
+        snprintf(buffer,sizeof(buffer),"%1.0f MB of device memory needed, %1.0f MB free",N*MITO_CUDA_BYTES_PER_VOXEL(Real)/1048576.0,free_bytes/1048576.0);
+        Error = buffer;
+        return EXIT_FAILURE;
+    }
+
+    // The scale-space ping-pongs between three float volumes: the
+    // previous level, which starts as the input, and two scratch ones.
+    _cudaBuffer Volumes[3], Vesselness, Weights, Norms, Max;
+    for (int k = 0; k < 3; k++) {
+        if (Failed(Volumes[k].Allocate(N*sizeof(float)),"cudaMalloc",Error)) return EXIT_FAILURE;
+    }
+    if (Failed(Vesselness.Allocate(N*sizeof(Real)),"cudaMalloc",Error)) return EXIT_FAILURE;
+    if (Failed(Weights.Allocate((2*nmax+1)*sizeof(float)),"cudaMalloc",Error)) return EXIT_FAILURE;
+    if (Failed(Norms.Allocate(nmax*sizeof(float)),"cudaMalloc",Error)) return EXIT_FAILURE;
+    if (Failed(Max.Allocate(sizeof(unsigned int)),"cudaMalloc",Error)) return EXIT_FAILURE;
+
+    {
+        _mitoStageTimer Timer(Profile,"Upload",N);
+        if (Failed(cudaMemcpy(Volumes[0].p,Input,N*sizeof(float),cudaMemcpyHostToDevice),"cudaMemcpy",Error)) return EXIT_FAILURE;
+        if (Failed(cudaMemset(Vesselness.p,0,N*sizeof(Real)),"cudaMemset",Error)) return EXIT_FAILURE;
+    }
+
+    Real *V = (Real*)Vesselness.p;
+    float *Level = (float*)Volumes[0].p;
+    double s0 = 0.0;
+
+    for (size_t i = 0; i < Sigmas.size(); i++) {
+
+        const double s = Sigmas[i];
+        char name[64];
+        snprintf(name,sizeof(name),"Vesselness sigma=%1.3f",s);
+        _mitoStageTimer ScaleTimer(Profile,name,N);
+
+        // Level at s from the level at s0, as _mitoScaleSpace::GetLevel
+        {
+            _mitoStageTimer Timer(Profile,"Gaussian",N);
+            float *Scratch[2], *Cur = Level;
+            for (int k = 0, j = 0; k < 3; k++) {
+                if (Volumes[k].p != Level) Scratch[j++] = (float*)Volumes[k].p;
+            }
+            for (int axis = 0; axis < 3; axis++) {
+                double sd = sqrt(std::max(0.0,s*s-s0*s0));
+                if (sd < 1E-3 || Dim[axis] < 2) continue;
+                int r = std::min((int)ceil(MITO_GAUSS_TRUNCATE*sd),Dim[axis]-1);
+                std::vector<float> W(2*r+1), Norm(Dim[axis]);
+                for (int k = -r; k <= r; k++) W[k+r] = (float)exp(-0.5*k*k/(sd*sd));
+                for (int p = 0; p < Dim[axis]; p++) {
+                    double sum = 0.0;
+                    for (int k = std::max(-r,-p); k <= std::min(r,Dim[axis]-1-p); k++) sum += W[k+r];
+                    Norm[p] = (float)(1.0/sum);
+                }
+                if (Failed(cudaMemcpy(Weights.p,&W[0],W.size()*sizeof(float),cudaMemcpyHostToDevice),"cudaMemcpy",Error)) return EXIT_FAILURE;
+                if (Failed(cudaMemcpy(Norms.p,&Norm[0],Norm.size()*sizeof(float),cudaMemcpyHostToDevice),"cudaMemcpy",Error)) return EXIT_FAILURE;
+                float *Dst = (Cur == Scratch[0]) ? Scratch[1] : Scratch[0];
+                ConvolveAxisKernel<<<nblocks,MITO_CUDA_THREADS>>>(Cur,Dst,nx,ny,nz,axis,(const float*)Weights.p,r,(const float*)Norms.p);
+                if (Failed(cudaGetLastError(),"ConvolveAxisKernel",Error)) return EXIT_FAILURE;
+                Cur = Dst;
+            }
+            Level = Cur;
+            s0 = s;
+            if (Failed(cudaDeviceSynchronize(),"Gaussian",Error)) return EXIT_FAILURE;
+        }
+
+        // The threshold of the scale is the square root of the largest
+        // norm, as in GetVesselness
+        {
+            _mitoStageTimer Timer(Profile,"Hessian",N);
+            unsigned int fbits;
+            if (Failed(cudaMemset(Max.p,0,sizeof(unsigned int)),"cudaMemset",Error)) return EXIT_FAILURE;
+            FrobeniusMaxKernel<<<nblocks,MITO_CUDA_THREADS>>>(Level,nx,ny,nz,(unsigned int*)Max.p);
+            if (Failed(cudaGetLastError(),"FrobeniusMaxKernel",Error)) return EXIT_FAILURE;
+            if (Failed(cudaMemcpy(&fbits,Max.p,sizeof(unsigned int),cudaMemcpyDeviceToHost),"cudaMemcpy",Error)) return EXIT_FAILURE;
+            float fmax;
+            memcpy(&fmax,&fbits,sizeof(float));
+            VesselnessKernel<<<nblocks,MITO_CUDA_THREADS>>>(Level,nx,ny,nz,sqrt((double)fmax),V);
+            if (Failed(cudaGetLastError(),"VesselnessKernel",Error)) return EXIT_FAILURE;
+            if (Failed(cudaDeviceSynchronize(),"Hessian",Error)) return EXIT_FAILURE;
+        }
+    }
+
+    // The float volumes make room for the divergence
+    for (int k = 0; k < 3; k++) Volumes[k].Release();
+    _cudaBuffer Output;
+    if (Failed(Output.Allocate(N*sizeof(Real)),"cudaMalloc",Error)) return EXIT_FAILURE;
+
+    {
+        _mitoStageTimer Timer(Profile,"Divergence",N);
+        DivergenceKernel<<<nblocks,MITO_CUDA_THREADS>>>(V,nx,ny,nz,(Real*)Output.p);
+        if (Failed(cudaGetLastError(),"DivergenceKernel",Error)) return EXIT_FAILURE;
+        if (Failed(cudaDeviceSynchronize(),"Divergence",Error)) return EXIT_FAILURE;
+    }
+
+    {
+        _mitoStageTimer Timer(Profile,"Download",N);
+        if (Failed(cudaMemcpy(Divergence,Output.p,N*sizeof(Real),cudaMemcpyDeviceToHost),"cudaMemcpy",Error)) return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+template int GetDivergenceCuda<float>(const float*, const int*, const std::vector<double>&, float*, _mitoProfile*, std::string&);
+template int GetDivergenceCuda<double>(const float*, const int*, const std::vector<double>&, double*, _mitoProfile*, std::string&);
@@ -0,0 +1,41 @@
+#ifndef MITOCUDA_H
+#define MITOCUDA_H
+
+#include <string>
+#include <vector>
+#include "MitoProfile.h"
+
+	//===========================================================================
+	//
+	//   Vesselness and divergence filter on a CUDA device (-device gpu).
+	//   The input is copied to the device once. The smoothed volume of
+	//   each scale, the Hessian, eigenvalues and vesselness never leave
+	//   the device, and only the divergence is copied back. The scales
+	//   are derived from each other as _mitoScaleSpace does it, and every
+	//   voxel goes through the formulas of MitoVoxel.h, so the result
+	//   is that of the CPU with -scale-space up to the last bits of acos,
+	//   cos and exp. Defined in MitoCuda.cu, which is only built with
+	//   MITOGRAPH_WITH_CUDA; the build then defines MITOGRAPH_HAVE_CUDA.
+	//   Like the rest of the kernels it does not depend on VTK.
+	//
+	//===========================================================================
+
+	// Whether there is a CUDA device to run on. Error says why not.
+	bool CanUseCudaDevice(std::string &Error);
+
+	// Bytes per voxel held on the device at the peak of
+	// GetDivergenceCuda: three float volumes for the scale-space and the
+	// vesselness, which is float or double as the host volume.
+	#define MITO_CUDA_BYTES_PER_VOXEL(Real) (12 + sizeof(Real))
+
+	// Divergence filter of the maximum over the scales Sigmas (in voxels,
+	// increasing) of the vesselness of the Dim[0]xDim[1]xDim[2] volume
+	// Input, written to the float or double Divergence, the vesselness
+	// being held on the device with the same precision. Voxels pass the
+	// Frobenius threshold of each scale as in GetVesselness without
+	// -adaptive. Returns EXIT_FAILURE with the reason in Error if the
+	// device cannot be used or runs out of memory; Divergence is then
+	// left untouched.
+	template <typename Real> int GetDivergenceCuda(const float *Input, const int *Dim, const std::vector<double> &Sigmas, Real *Divergence, _mitoProfile *Profile, std::string &Error);
+
+#endif
@@ -0,0 +1,1018 @@
+// ==================================================================
+// MitoGraph: Quantifying Mitochondrial Content in Living Cells
+// Raw-buffer voxel kernels shared by the vesselness and skeleton code.
+// ==================================================================
+
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+#include "MitoFilters.h"
+#include "MitoVoxel.h"
+
+/* ================================================================
+   DISCRETE DIFFERENCES
+=================================================================*/
+
+// The difference rules are shared with the CUDA kernels through
+// MitoVoxel.h.
+
+void GetHessianTile(const float *G, const int *Dim, int z, int y0, int y1, int x0, int x1, float *H[6]) {
+
+    const long long sx = 1;
+    const long long sy = (long long)Dim[0];
+    const long long sz = (long long)Dim[0]*Dim[1];
+    const int nx = x1 - x0;
+
+    // x-rules for x0-1 <= x <= x1, so that the rules at the two points
+    // sampled by Dxx are available for every voxel of the tile.
+    std::vector<_diffRule> Rx(nx+2);
+    for (int i = 0; i < nx+2; i++) {
+        SetDiffRule(x0-1+i,Dim[0],Rx[i]);
+    }
+
+    _diffRule Rz, Rz1, Rz2, Ry, Ry1, Ry2;
+    SetDiffRule(z,Dim[2],Rz);
+    SetDiffRule(z+Rz.d1,Dim[2],Rz1);
+    SetDiffRule(z+Rz.d2,Dim[2],Rz2);
+
+    for (int y = y0; y < y1; y++) {
+        SetDiffRule(y,Dim[1],Ry);
+        SetDiffRule(y+Ry.d1,Dim[1],Ry1);
+        SetDiffRule(y+Ry.d2,Dim[1],Ry2);
+
+        const long long row = (long long)y*sy + (long long)z*sz;
+        const long long t = (long long)(y-y0)*nx;
+
+        for (int i = 0; i < nx; i++) {
+            const long long p = row + x0 + i;
+            const _diffRule &R = Rx[i+1];
+            H[MITO_HXX][t+i] = Diff2(G,p,R,sx,Rx[i+1+R.d1],Rx[i+1+R.d2],sx);
+            H[MITO_HYY][t+i] = Diff2(G,p,Ry,sy,Ry1,Ry2,sy);
+            H[MITO_HZZ][t+i] = Diff2(G,p,Rz,sz,Rz1,Rz2,sz);
+            H[MITO_HXY][t+i] = Diff2(G,p,R,sx,Ry,Ry,sy);
+            H[MITO_HXZ][t+i] = Diff2(G,p,R,sx,Rz,Rz,sz);
+            H[MITO_HYZ][t+i] = Diff2(G,p,Ry,sy,Rz,Rz,sz);
+        }
+    }
+
+}
+
+/* ================================================================
+   HESSIAN EIGENVALUES AND VESSELNESS
+=================================================================*/
+
+// The formulas of MitoVoxel.h are applied voxel by voxel. The loops
+// are not vectorized: acos, cos and exp are calls to the scalar math
+// library, and GCC only replaces them with vector variants under
+// -ffast-math, which changes the results.
+
+void GetSymmetricEigenvalues(const double *const H[6], size_t n, double *L1, double *L2, double *L3) {
+    for (size_t i = 0; i < n; i++) {
+        GetSymmetricEigenvaluesAt(H[MITO_HXX][i],H[MITO_HYY][i],H[MITO_HZZ][i],H[MITO_HXY][i],H[MITO_HXZ][i],H[MITO_HYZ][i],L1[i],L2[i],L3[i]);
+    }
+}
+
+void GetVesselnessFromEigenvalues(const double *L1, const double *L2, const double *L3, size_t n, double *V) {
+    for (size_t i = 0; i < n; i++) {
+        V[i] = GetVesselnessAt(L1[i],L2[i],L3[i]);
+    }
+}
+
+/* ================================================================
+   CONNECTED COMPONENTS
+=================================================================*/
+
+// Number of z-planes processed by a single thread before the
+// slabs are stitched together.
+#define MITO_CC_SLAB 16
+
+// The smallest run of a component is always its root.
+static inline void UnionRuns(std::vector<long long> &Parent, long long a, long long b) {
+    a = FindRoot(Parent,a);
+    b = FindRoot(Parent,b);
+    if (a < b) Parent[b] = a; else if (b < a) Parent[a] = b;
+}
+
+// Unions the runs of row r with the overlapping runs of row q. Runs
+// touching diagonally along x overlap when t = 1.
+static void UnionRows(const std::vector<_mitoRun> &Runs, const std::vector<long long> &RowFirst, std::vector<long long> &Parent, long long r, long long q, int t) {
+    long long a = RowFirst[r], a1 = RowFirst[r+1];
+    long long b = RowFirst[q], b1 = RowFirst[q+1];
+    while (a < a1 && b < b1) {
+        if (Runs[b].x0 <= Runs[a].x1+t && Runs[b].x1+t >= Runs[a].x0) {
+            UnionRuns(Parent,a,b);
+        }
+        if (Runs[a].x1 < Runs[b].x1) a++; else b++;
+    }
+}
+
+// Unions row (y,z) with the rows of plane z and z-1 that precede it
+// and may hold neighbors of its voxels.
+static void UnionWithPreviousRows(const std::vector<_mitoRun> &Runs, const std::vector<long long> &RowFirst, std::vector<long long> &Parent, const int *Dim, int y, int z, int maxnz, bool withz) {
+    // Row offsets (dy,dz) and the number of non-zero coordinates k
+    // of each one. dx = +/-1 adds one more non-zero coordinate.
+    static const int dy[4] = {-1, 0,-1, 1};
+    static const int dz[4] = { 0,-1,-1,-1};
+    static const int nz[4] = { 1, 1, 2, 2};
+    const long long r = (long long)y + (long long)z*Dim[1];
+    for (int k = 0; k < 4; k++) {
+        if (nz[k] > maxnz) continue;
+        if (dz[k] && !withz) continue;
+        int yn = y + dy[k], zn = z + dz[k];
+        if (yn < 0 || yn >= Dim[1] || zn < 0) continue;
+        UnionRows(Runs,RowFirst,Parent,r,(long long)yn+(long long)zn*Dim[1],(nz[k] < maxnz)?1:0);
+    }
+}
+
+long int LabelConnectedRuns(const unsigned char *Mask, const int *Dim, int ngbh, std::vector<_mitoRun> &Runs, std::vector<long int> &Label, std::vector<long int> &CSz) {
+
+    const long long nrows = (long long)Dim[1]*Dim[2];
+    const int maxnz = (ngbh >= 26) ? 3 : ((ngbh >= 18) ? 2 : 1);
+
+    // Number of runs in each row, then the index of the first run of
+    // each row after the prefix sum.
+    std::vector<long long> RowFirst(nrows+1,0);
+
+    #pragma omp parallel for schedule(static)
+    for (long long row = 0; row < nrows; row++) {
+        const unsigned char *M = Mask + row*Dim[0];
+        long long n = 0;
+        for (int x = 0; x < Dim[0]; x++) {
+            if (M[x] && (x == 0 || !M[x-1])) n++;
+        }
+        RowFirst[row+1] = n;
+    }
+    for (long long row = 0; row < nrows; row++) {
+        RowFirst[row+1] += RowFirst[row];
+    }
+
+    const long long nruns = RowFirst[nrows];
+    Runs.resize(nruns);
+
+    #pragma omp parallel for schedule(static)
+    for (long long row = 0; row < nrows; row++) {
+        const unsigned char *M = Mask + row*Dim[0];
+        long long r = RowFirst[row];
+        for (int x = 0; x < Dim[0]; x++) {
+            if (M[x] && (x == 0 || !M[x-1])) {
+                Runs[r].row = row;
+                Runs[r].x0 = x;
+            }
+            if (M[x] && (x == Dim[0]-1 || !M[x+1])) {
+                Runs[r++].x1 = x;
+            }
+        }
+    }
+
+    std::vector<long long> Parent(nruns);
+    for (long long r = 0; r < nruns; r++) Parent[r] = r;
+
+    // Each slab of z-planes only touches the runs it owns, so the
+    // slabs can be merged independently and stitched afterwards.
+    const int nslabs = (Dim[2] + MITO_CC_SLAB - 1) / MITO_CC_SLAB;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int s = 0; s < nslabs; s++) {
+        const int z0 = s * MITO_CC_SLAB;
+        const int z1 = std::min(z0 + MITO_CC_SLAB, Dim[2]);
+        for (int z = z0; z < z1; z++) {
+            for (int y = 0; y < Dim[1]; y++) {
+                UnionWithPreviousRows(Runs,RowFirst,Parent,Dim,y,z,maxnz,z > z0);
+            }
+        }
+    }
+    for (int s = 1; s < nslabs; s++) {
+        const int z = s * MITO_CC_SLAB;
+        for (int y = 0; y < Dim[1]; y++) {
+            UnionWithPreviousRows(Runs,RowFirst,Parent,Dim,y,z,maxnz,true);
+        }
+    }
+
+    // Runs are sorted by voxel id, so the last run of a component
+    // holds its largest voxel id.
+    std::vector<long long> Last(nruns,-1);
+    std::vector<long long> Size(nruns,0);
+    for (long long r = 0; r < nruns; r++) {
+        Parent[r] = FindRoot(Parent,r);
+        Last[Parent[r]] = r;
+        Size[Parent[r]] += Runs[r].x1 - Runs[r].x0 + 1;
+    }
+
+    std::vector<long long> Roots;
+    for (long long r = nruns; r--;) {
+        if (Last[r] >= 0) Roots.push_back(r);
+    }
+    std::sort(Roots.begin(),Roots.end(),[&Last](long long a, long long b) { return Last[a] > Last[b]; });
+
+    // Last is reused to map each root to its label.
+    for (size_t l = 0; l < Roots.size(); l++) {
+        Last[Roots[l]] = (long long)l + 1;
+        CSz.push_back((long int)Size[Roots[l]]);
+    }
+
+    Label.resize(nruns);
+    for (long long r = 0; r < nruns; r++) {
+        Label[r] = (long int)Last[Parent[r]];
+    }
+
+    return (long int)Roots.size();
+}
+
+// Index of the lowest set bit of w, which must not be zero.
+static inline int LowestBit(uint64_t w) {
+    #ifdef _MSC_VER
+        unsigned long i;
+        _BitScanForward64(&i,w);
+        return (int)i;
+    #else
+        return __builtin_ctzll(w);
+    #endif
+}
+
+// Index of the highest set bit of w, which must not be zero.
+static inline int HighestBit(uint64_t w) {
+    #ifdef _MSC_VER
+        unsigned long i;
+        _BitScanReverse64(&i,w);
+        return (int)i;
+    #else
+        return 63 - __builtin_clzll(w);
+    #endif
+}
+
+// Bits x0 to x1 of the bit-packed row W.
+static void SetBits(uint64_t *W, int x0, int x1) {
+    int w0 = x0 >> 6, w1 = x1 >> 6;
+    uint64_t m0 = ~(uint64_t)0 << (x0 & 63);
+    uint64_t m1 = ~(uint64_t)0 >> (63 - (x1 & 63));
+    if (w0 == w1) {
+        W[w0] |= m0 & m1;
+    } else {
+        W[w0] |= m0;
+        for (int w = w0+1; w < w1; w++) W[w] = ~(uint64_t)0;
+        W[w1] |= m1;
+    }
+}
+
+// First x0 <= x <= x1 whose bit is set in A but not in B, or -1.
+static int FindSetAndClear(const uint64_t *A, const uint64_t *B, int x0, int x1) {
+    int w1 = x1 >> 6;
+    for (int w = x0 >> 6; w <= w1; w++) {
+        uint64_t c = A[w] & ~B[w];
+        if (w == (x0 >> 6)) c &= ~(uint64_t)0 << (x0 & 63);
+        if (w == w1) c &= ~(uint64_t)0 >> (63 - (x1 & 63));
+        if (c) return (w << 6) + LowestBit(c);
+    }
+    return -1;
+}
+
+// Last voxel of the run of set bits of W that starts at or before x,
+// in a row of nx voxels.
+static int RunEnd(const uint64_t *W, int x, int nx) {
+    int nw = (nx + 63) >> 6;
+    for (int w = x >> 6; w < nw; w++) {
+        uint64_t c = ~W[w];
+        if (w == (x >> 6)) c &= ~(uint64_t)0 << (x & 63);
+        if (c) return std::min(nx-1,(w << 6) + LowestBit(c) - 1);
+    }
+    return nx-1;
+}
+
+// First voxel of the run of set bits of W that ends at or after x.
+static int RunStart(const uint64_t *W, int x) {
+    for (int w = x >> 6; w >= 0; w--) {
+        uint64_t c = ~W[w];
+        if (w == (x >> 6)) c &= ~(uint64_t)0 >> (63 - (x & 63));
+        if (c) return (w << 6) + HighestBit(c) + 1;
+    }
+    return 0;
+}
+
+long long FillHolesFromFaces(unsigned char *B, const int *Dim) {
+
+    const int nx = Dim[0], ny = Dim[1], nz = Dim[2];
+    const long long nrows = (long long)ny * nz;
+    const long long nw = (nx + 63) / 64;
+
+    // Bit-packed background and reached voxels. Runs are always marked
+    // whole, so a background voxel that is not marked belongs to a run
+    // that has not been visited yet.
+    std::vector<uint64_t> Bg(nrows*nw,0), Reached(nrows*nw,0);
+
+    #pragma omp parallel for schedule(static)
+    for (long long row = 0; row < nrows; row++) {
+        const unsigned char *R = B + row*nx;
+        uint64_t *W = &Bg[row*nw];
+        for (long long w = 0; w < nw; w++) {
+            int n = std::min(64,nx-(int)(w << 6));
+            const unsigned char *Rw = R + (w << 6);
+            uint64_t m = 0;
+            for (int b = 0; b < n; b++) m |= (uint64_t)(Rw[b] == 0) << b;
+            W[w] = m;
+        }
+    }
+
+    // Seeds: every background run of the rows on the y and z faces, and
+    // the first and last voxel of the other rows.
+    std::vector<_mitoRun> Stack;
+    for (long long row = 0; row < nrows; row++) {
+        const uint64_t *W = &Bg[row*nw];
+        int y = (int)(row % ny), z = (int)(row / ny);
+        if (y == 0 || y == ny-1 || z == 0 || z == nz-1) {
+            for (int x = FindSetAndClear(W,&Reached[row*nw],0,nx-1); x >= 0; ) {
+                _mitoRun Seed = {row,x,x};
+                Stack.push_back(Seed);
+                int e = RunEnd(W,x,nx);
+                x = (e+1 < nx) ? FindSetAndClear(W,&Reached[row*nw],e+1,nx-1) : -1;
+            }
+        } else {
+            if (W[0] & 1) { _mitoRun Seed = {row,0,0}; Stack.push_back(Seed); }
+            if ((W[(nx-1) >> 6] >> ((nx-1) & 63)) & 1) { _mitoRun Seed = {row,nx-1,nx-1}; Stack.push_back(Seed); }
+        }
+    }
+
+    while (!Stack.empty()) {
+        _mitoRun Run = Stack.back();
+        Stack.pop_back();
+        uint64_t *W = &Reached[Run.row*nw];
+        if ((W[Run.x0 >> 6] >> (Run.x0 & 63)) & 1) continue;
+
+        // Background run through the seed
+        const uint64_t *G = &Bg[Run.row*nw];
+        int x0 = RunStart(G,Run.x0);
+        int x1 = RunEnd(G,Run.x0,nx);
+        SetBits(W,x0,x1);
+
+        // Unvisited runs of the neighboring rows that overlap it
+        int y = (int)(Run.row % ny), z = (int)(Run.row / ny);
+        long long Ngbh[4] = {-1,-1,-1,-1};
+        if (y > 0) Ngbh[0] = Run.row - 1;
+        if (y < ny-1) Ngbh[1] = Run.row + 1;
+        if (z > 0) Ngbh[2] = Run.row - ny;
+        if (z < nz-1) Ngbh[3] = Run.row + ny;
+        for (int k = 0; k < 4; k++) {
+            if (Ngbh[k] < 0) continue;
+            const uint64_t *GN = &Bg[Ngbh[k]*nw];
+            const uint64_t *WN = &Reached[Ngbh[k]*nw];
+            for (int x = FindSetAndClear(GN,WN,x0,x1); x >= 0; ) {
+                _mitoRun Seed = {Ngbh[k],x,x};
+                Stack.push_back(Seed);
+                int e = RunEnd(GN,x,nx);
+                x = (e < x1) ? FindSetAndClear(GN,WN,e+1,x1) : -1;
+            }
+        }
+    }
+
+    long long nfilled = 0;
+    #pragma omp parallel for schedule(static) reduction(+:nfilled)
+    for (long long row = 0; row < nrows; row++) {
+        unsigned char *R = B + row*nx;
+        const uint64_t *G = &Bg[row*nw];
+        const uint64_t *W = &Reached[row*nw];
+        for (long long w = 0; w < nw; w++) {
+            for (uint64_t c = G[w] & ~W[w]; c; c &= c-1) {
+                R[(w << 6) + LowestBit(c)] = 255;
+                nfilled++;
+            }
+        }
+    }
+
+    return nfilled;
+}
+
+/* ================================================================
+   GAUSSIAN SCALE-SPACE
+=================================================================*/
+
+void ConvolveAxis(const float *In, float *Out, const int *Dim, int axis, const std::vector<float> &W) {
+
+    const int r = ((int)W.size()-1) / 2;
+    const int n = Dim[axis];
+    const long long stride = (axis == 0) ? 1 : ((axis == 1) ? (long long)Dim[0] : (long long)Dim[0]*Dim[1]);
+    const long long nrows = (long long)Dim[1]*Dim[2];
+
+    // Inverse of the kernel mass that falls inside the volume
+    // at each position along the axis.
+    std::vector<float> Norm(n);
+    for (int p = 0; p < n; p++) {
+        double sum = 0.0;
+        for (int k = std::max(-r,-p); k <= std::min(r,n-1-p); k++) sum += W[k+r];
+        Norm[p] = (float)(1.0/sum);
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (long long row = 0; row < nrows; row++) {
+        const float *I = In + row*Dim[0];
+        float *O = Out + row*Dim[0];
+        if (axis == 0) {
+            for (int x = 0; x < Dim[0]; x++) {
+                float acc = 0.0f;
+                for (int k = std::max(-r,-x); k <= std::min(r,n-1-x); k++) acc += W[k+r] * I[x+k];
+                O[x] = acc * Norm[x];
+            }
+        } else {
+            // Rows are accumulated whole so that the inner
+            // loop runs over contiguous memory.
+            const int p = (axis == 1) ? (int)(row % Dim[1]) : (int)(row / Dim[1]);
+            for (int x = 0; x < Dim[0]; x++) O[x] = 0.0f;
+            for (int k = std::max(-r,-p); k <= std::min(r,n-1-p); k++) {
+                const float w = W[k+r];
+                const float *Ik = I + k*stride;
+                for (int x = 0; x < Dim[0]; x++) O[x] += w * Ik[x];
+            }
+            for (int x = 0; x < Dim[0]; x++) O[x] *= Norm[p];
+        }
+    }
+
+}
+
+void _mitoScaleSpace::SetInput(const float *Image, const int *ImageDim) {
+    Input = Image;
+    Dim[0] = ImageDim[0];
+    Dim[1] = ImageDim[1];
+    Dim[2] = ImageDim[2];
+    Levels.clear();
+}
+
+const float *_mitoScaleSpace::GetLevel(double sx, double sy, double sz) {
+
+    const double s[3] = {sx, sy, sz};
+    const long long N = (long long)Dim[0]*Dim[1]*Dim[2];
+
+    // Coarsest cached level below the requested one.
+    const float *Src = Input;
+    double s0[3] = {0.0, 0.0, 0.0};
+    for (std::list<_mitoScaleLevel>::iterator L = Levels.begin(); L != Levels.end(); L++) {
+        if (L->s[0] > s[0]+1E-6 || L->s[1] > s[1]+1E-6 || L->s[2] > s[2]+1E-6) continue;
+        if (fabs(L->s[0]-s[0]) < 1E-6 && fabs(L->s[1]-s[1]) < 1E-6 && fabs(L->s[2]-s[2]) < 1E-6) {
+            return L->V.data();
+        }
+        if (L->s[0]*L->s[0]+L->s[1]*L->s[1]+L->s[2]*L->s[2] > s0[0]*s0[0]+s0[1]*s0[1]+s0[2]*s0[2]) {
+            Src = L->V.data();
+            s0[0] = L->s[0]; s0[1] = L->s[1]; s0[2] = L->s[2];
+        }
+    }
+
+    _mitoScaleLevel Level;
+    Level.s[0] = s[0]; Level.s[1] = s[1]; Level.s[2] = s[2];
+    Level.V.resize(N);
+    Tmp.resize(N);
+
+    // Ping-pong between the new level and Tmp, skipping the
+    // axes along which there is nothing left to smooth.
+    const float *Cur = Src;
+    for (int axis = 0; axis < 3; axis++) {
+        double sd = sqrt(std::max(0.0,s[axis]*s[axis]-s0[axis]*s0[axis]));
+        if (sd < 1E-3 || Dim[axis] < 2) continue;
+        int r = std::min((int)ceil(MITO_GAUSS_TRUNCATE*sd),Dim[axis]-1);
+        std::vector<float> W(2*r+1);
+        for (int k = -r; k <= r; k++) W[k+r] = (float)exp(-0.5*k*k/(sd*sd));
+        float *Dst = (Cur == Level.V.data()) ? Tmp.data() : Level.V.data();
+        ConvolveAxis(Cur,Dst,Dim,axis,W);
+        Cur = Dst;
+    }
+    if (Cur != Level.V.data()) {
+        std::copy(Cur,Cur+N,Level.V.begin());
+    }
+
+    if (Levels.size() >= MaxLevels) Levels.pop_front();
+    Levels.push_back(_mitoScaleLevel());
+    Levels.back().s[0] = s[0]; Levels.back().s[1] = s[1]; Levels.back().s[2] = s[2];
+    Levels.back().V.swap(Level.V);
+
+    return Levels.back().V.data();
+}
+
+/* ================================================================
+   POINT PAIRS
+=================================================================*/
+
+void FindPointPairs(const std::vector<double> &X, double rmin, double rmax, std::vector<_mitoPointPair> &Pairs) {
+
+    Pairs.clear();
+    const long long n = (long long)X.size() / 3;
+    if (n < 2 || !(rmax > 0)) return;
+
+    int d;
+    long long i;
+    double lo[3], hi[3];
+    for (d = 0; d < 3; d++) lo[d] = hi[d] = X[d];
+    for (i = 1; i < n; i++) {
+        for (d = 0; d < 3; d++) {
+            lo[d] = std::min(lo[d],X[3*i+d]);
+            hi[d] = std::max(hi[d],X[3*i+d]);
+        }
+    }
+
+    // Cell of every point, points sorted by cell
+    long long G[3];
+    for (d = 0; d < 3; d++) G[d] = (long long)floor((hi[d]-lo[d])/rmax) + 1;
+    std::vector<long long> C(n*3), Key(n), Order(n);
+    for (i = 0; i < n; i++) {
+        for (d = 0; d < 3; d++) {
+            C[3*i+d] = std::min(G[d]-1,(long long)floor((X[3*i+d]-lo[d])/rmax));
+        }
+        Key[i] = C[3*i] + G[0]*(C[3*i+1] + G[1]*C[3*i+2]);
+        Order[i] = i;
+    }
+    std::sort(Order.begin(),Order.end(),[&Key](long long a, long long b) { return (Key[a] != Key[b]) ? Key[a] < Key[b] : a < b; });
+    std::vector<long long> SortedKey(n);
+    for (i = 0; i < n; i++) SortedKey[i] = Key[Order[i]];
+
+    const double rmin2 = rmin*rmin, rmax2 = rmax*rmax;
+    for (i = 0; i < n; i++) {
+        for (int dz = -1; dz <= 1; dz++) {
+            long long cz = C[3*i+2] + dz;
+            if (cz < 0 || cz >= G[2]) continue;
+            for (int dy = -1; dy <= 1; dy++) {
+                long long cy = C[3*i+1] + dy;
+                if (cy < 0 || cy >= G[1]) continue;
+                for (int dx = -1; dx <= 1; dx++) {
+                    long long cx = C[3*i] + dx;
+                    if (cx < 0 || cx >= G[0]) continue;
+                    long long key = cx + G[0]*(cy + G[1]*cz);
+                    std::vector<long long>::const_iterator it = std::lower_bound(SortedKey.begin(),SortedKey.end(),key);
+                    for (long long k = it - SortedKey.begin(); k < n && SortedKey[k] == key; k++) {
+                        long long j = Order[k];
+                        if (j <= i) continue;
+                        double d2 = 0.0;
+                        for (d = 0; d < 3; d++) d2 += (X[3*i+d]-X[3*j+d])*(X[3*i+d]-X[3*j+d]);
+                        if (d2 > rmin2 && d2 <= rmax2) {
+                            _mitoPointPair P = {i, j, sqrt(d2)};
+                            Pairs.push_back(P);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    std::sort(Pairs.begin(),Pairs.end(),[](const _mitoPointPair &a, const _mitoPointPair &b) {
+        if (a.d != b.d) return a.d < b.d;
+        return (a.i != b.i) ? a.i < b.i : a.j < b.j;
+    });
+}
+
+/* ================================================================
+   Z-BLOCK BINARIZATION
+=================================================================*/
+
+template <typename Real>
+void _mitoPlaneStats::Compute(const Real *V, const int *Dim) {
+
+    int z, nz = Dim[2];
+    PlaneSize = (long long)Dim[0] * Dim[1];
+    Min.assign(nz,DBL_MAX);
+    Max.assign(nz,-DBL_MAX);
+    Mean.assign(nz,0.0);
+    M2.assign(nz,0.0);
+    std::vector<long double> S(nz,0.0L), S2(nz,0.0L);
+
+    #pragma omp parallel for schedule(static)
+    for (z = 0; z < nz; z++) {
+        const Real *P = V + z * PlaneSize;
+        double min = DBL_MAX, max = -DBL_MAX;
+        long double s = 0.0L, s2 = 0.0L;
+        for (long long i = 0; i < PlaneSize; i++) {
+            double v = P[i];
+            if (v < min) min = v;
+            if (v > max) max = v;
+            s += v;
+            s2 += (long double)v * v;
+        }
+        // Deviations from the plane mean, in a second pass over the
+        // plane while it is still in cache
+        double mean = (double)(s / PlaneSize), m2 = 0.0;
+        for (long long i = 0; i < PlaneSize; i++) {
+            double d = P[i] - mean;
+            m2 += d * d;
+        }
+        Min[z] = min;
+        Max[z] = max;
+        S[z] = s;
+        S2[z] = s2;
+        Mean[z] = mean;
+        M2[z] = m2;
+    }
+
+    Sum.assign(nz+1,0.0L);
+    Sum2.assign(nz+1,0.0L);
+    for (z = 0; z < nz; z++) {
+        Sum[z+1] = Sum[z] + S[z];
+        Sum2[z+1] = Sum2[z] + S2[z];
+    }
+}
+
+void _mitoPlaneStats::GetRange(int z0, int z1, double &min, double &max) const {
+    for (int z = z0; z < z1; z++) {
+        if (Min[z] < min) min = Min[z];
+        if (Max[z] > max) max = Max[z];
+    }
+}
+
+void _mitoPlaneStats::GetMeanStd(int z0, int z1, double &mean, double &std) const {
+    double n = 0.0, m2 = 0.0;
+    mean = 0.0;
+    for (int z = z0; z < z1; z++) {
+        double np = (double)PlaneSize;
+        double delta = Mean[z] - mean;
+        mean += delta * np / (n + np);
+        m2 += M2[z] + delta * delta * n * np / (n + np);
+        n += np;
+    }
+    std = (n > 0) ? sqrt(m2 / n) : 0.0;
+}
+
+template <typename Real>
+void ThresholdPlanes(const Real *V, const int *Dim, const std::vector<double> &T, unsigned char *B) {
+
+    const long long n = (long long)Dim[0] * Dim[1];
+
+    #pragma omp parallel for schedule(static)
+    for (int z = 0; z < Dim[2]; z++) {
+        const double t = T[z];
+        const Real *P = V + z * n;
+        unsigned char *Q = B + z * n;
+        for (long long i = 0; i < n; i++) Q[i] = (P[i] <= t) ? 0 : 255;
+    }
+}
+
+template <typename Real>
+void VotePlanes(const Real *V, const int *Dim, const std::vector< std::vector<double> > &T, unsigned char *B) {
+
+    const long long n = (long long)Dim[0] * Dim[1];
+
+    #pragma omp parallel for schedule(static)
+    for (int z = 0; z < Dim[2]; z++) {
+        const std::vector<double> &Tz = T[z];
+        const size_t nt = Tz.size();
+        const Real *P = V + z * n;
+        unsigned char *Q = B + z * n;
+        for (long long i = 0; i < n; i++) {
+            size_t votes = 0;
+            for (size_t k = 0; k < nt; k++) votes += (P[i] > Tz[k]) ? 1 : 0;
+            Q[i] = (nt > 0 && 2 * votes >= nt) ? 255 : 0;
+        }
+    }
+}
+
+template void _mitoPlaneStats::Compute<double>(const double*, const int*);
+template void _mitoPlaneStats::Compute<float>(const float*, const int*);
+template void ThresholdPlanes<double>(const double*, const int*, const std::vector<double>&, unsigned char*);
+template void ThresholdPlanes<float>(const float*, const int*, const std::vector<double>&, unsigned char*);
+template void VotePlanes<double>(const double*, const int*, const std::vector< std::vector<double> >&, unsigned char*);
+template void VotePlanes<float>(const float*, const int*, const std::vector< std::vector<double> >&, unsigned char*);
+
+/* ================================================================
+   DISTANCE TRANSFORM
+=================================================================*/
+
+// Squared distance transform of the n samples f along a line, the
+// samples being s apart: d[q] = min over p of (s*(q-p))^2 + f[p]. v, g
+// and z hold the parabolas of the lower envelope, their values at the
+// origin and the left end of their interval.
+static void DistanceTransformLine(const float *f, int n, double s, float *d, int *v, double *g, double *z) {
+    int k = -1;
+    for (int q = 0; q < n; q++) {
+        if (f[q] == HUGE_VALF) continue;
+        const double fq = (double)f[q] + (q*s)*(q*s);
+        double x = -HUGE_VAL;
+        while (k >= 0) {
+            x = (fq - g[k]) / (2.0*s*s*(q - v[k]));
+            if (x <= z[k]) k--; else break;
+        }
+        if (k < 0) x = -HUGE_VAL;
+        k++;
+        v[k] = q;
+        g[k] = fq;
+        z[k] = x;
+    }
+    if (k < 0) {
+        for (int q = 0; q < n; q++) d[q] = HUGE_VALF;
+        return;
+    }
+    for (int q = 0, j = 0; q < n; q++) {
+        while (j < k && z[j+1] < q) j++;
+        const double dx = s*(q - v[j]);
+        d[q] = (float)(dx*dx + f[v[j]]);
+    }
+}
+
+void GetDistanceTransform(const unsigned char *Mask, const int *Dim, const double *Spacing, float *D) {
+
+    const long long nx = Dim[0], nxy = (long long)Dim[0]*Dim[1];
+    const long long N = nxy * Dim[2];
+
+    // Along x the mask only holds zeros and infinities, so the squared
+    // distance is the one to the closest zero of the row on either side
+    const double sx = Spacing[0];
+    #pragma omp parallel for schedule(static)
+    for (long long row = 0; row < N / nx; row++) {
+        const unsigned char *M = Mask + row * nx;
+        float *P = D + row * nx;
+        long long last = -1;
+        for (long long x = 0; x < nx; x++) {
+            if (!M[x]) last = x;
+            P[x] = (last < 0) ? HUGE_VALF : (float)((sx*(x-last))*(sx*(x-last)));
+        }
+        last = -1;
+        for (long long x = nx; x--;) {
+            if (!M[x]) last = x;
+            if (last >= 0) P[x] = std::min(P[x],(float)((sx*(last-x))*(sx*(last-x))));
+        }
+    }
+
+    const int nmax = std::max(Dim[0],std::max(Dim[1],Dim[2]));
+    const long long stride[3] = {1, nx, nxy};
+
+    // Along y and z the lines of B consecutive x are copied together,
+    // so that the strided reads and writes cover whole cache lines.
+    // Lines of background only are left as they are.
+    const int B = 16;
+
+    for (int axis = 1; axis < 3; axis++) {
+        if (Dim[axis] < 2) continue;
+        const int n = Dim[axis];
+        const long long s = stride[axis];
+        // Lines start at (x,0,z) along y and at (x,y,0) along z
+        const long long nrows = Dim[3-axis];
+        const long long nblocks = (nx + B - 1) / B;
+        const long long rowstride = (axis == 1) ? nxy : nx;
+        #pragma omp parallel
+        {
+            std::vector<float> f((size_t)nmax*B), d(nmax);
+            std::vector<int> v(nmax);
+            std::vector<double> g(nmax), z(nmax);
+            #pragma omp for schedule(static)
+            for (long long l = 0; l < nrows*nblocks; l++) {
+                const long long x0 = (l % nblocks) * B;
+                const int nl = (int)std::min((long long)B,nx - x0);
+                float *P = D + (l / nblocks) * rowstride + x0;
+                bool any = false;
+                for (int q = 0; q < n; q++) {
+                    for (int j = 0; j < nl; j++) {
+                        f[j*n+q] = P[q*s+j];
+                        any |= (f[j*n+q] != 0.0f);
+                    }
+                }
+                if (!any) continue;
+                for (int j = 0; j < nl; j++) {
+                    DistanceTransformLine(&f[j*n],n,Spacing[axis],&d[0],&v[0],&g[0],&z[0]);
+                    std::copy(d.begin(),d.begin()+n,f.begin()+j*n);
+                }
+                for (int q = 0; q < n; q++) {
+                    for (int j = 0; j < nl; j++) P[q*s+j] = f[j*n+q];
+                }
+            }
+        }
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (long long id = 0; id < N; id++) D[id] = sqrtf(D[id]);
+}
+
+/* ================================================================
+   NARROW-BAND SURFACE
+=================================================================*/
+
+// Out is In dilated by r voxels along axis. Along y and z each row of
+// Out is the union of the rows of In within r planes.
+static void DilateAxis(const unsigned char *In, unsigned char *Out, const int *Dim, int axis, int r) {
+    const long long nx = Dim[0];
+    const long long nrows = (long long)Dim[1] * Dim[2];
+    #pragma omp parallel for schedule(static)
+    for (long long row = 0; row < nrows; row++) {
+        const unsigned char *I = In + row * nx;
+        unsigned char *O = Out + row * nx;
+        if (axis == 0) {
+            int last = -r-1;
+            for (int x = 0; x < nx; x++) {
+                if (I[x]) last = x;
+                O[x] = (x - last <= r) ? 1 : 0;
+            }
+            last = (int)nx+r+1;
+            for (int x = (int)nx; x--;) {
+                if (I[x]) last = x;
+                if (last - x <= r) O[x] = 1;
+            }
+        } else {
+            const int n = Dim[axis];
+            const int q = (axis == 1) ? (int)(row % Dim[1]) : (int)(row / Dim[1]);
+            const long long s = (axis == 1) ? nx : nx * Dim[1];
+            memset(O,0,nx);
+            for (int d = std::max(-r,-q); d <= std::min(r,n-1-q); d++) {
+                const unsigned char *J = I + d * s;
+                for (long long x = 0; x < nx; x++) O[x] |= J[x];
+            }
+        }
+    }
+}
+
+// Corner bits of a cell from the corner bits of its two faces normal
+// to x: bit k of a face is the corner (x,y+(k&1),z+(k>>1)).
+static const unsigned char SpreadFace[16] = {0x00,0x01,0x04,0x05,0x10,0x11,0x14,0x15,0x40,0x41,0x44,0x45,0x50,0x51,0x54,0x55};
+
+template <typename T>
+void GetNarrowBandSurface(const T *F, const unsigned char *Mask, const int *Dim, double value, int band, std::vector<double> &Points, std::vector<long long> &Quads) {
+
+    Points.clear();
+    Quads.clear();
+    if (Dim[0] < 2 || Dim[1] < 2 || Dim[2] < 2) return;
+
+    const long long nx = Dim[0], nxy = (long long)Dim[0]*Dim[1];
+    const long long N = nxy * Dim[2];
+    const long long stride[3] = {1, nx, nxy};
+    const int ncz = Dim[2] - 1;
+
+    // Cells within the band of the mask
+    std::vector<unsigned char> Near(N), Tmp(N);
+    DilateAxis(Mask,&Tmp[0],Dim,0,band);
+    DilateAxis(&Tmp[0],&Near[0],Dim,1,band);
+    DilateAxis(&Near[0],&Tmp[0],Dim,2,band);
+    Near.swap(Tmp);
+    std::vector<unsigned char>().swap(Tmp);
+
+    // Corner k of a cell is at (k&1, (k>>1)&1, (k>>2)&1) and the edges
+    // join the corners k and k|b that differ in bit b.
+    const long long Corner[8] = {0, 1, nx, nx+1, nxy, nxy+1, nxy+nx, nxy+nx+1};
+
+    std::vector< std::vector<long long> > Cells(ncz);
+    std::vector< std::vector<double> > Vertices(ncz);
+
+    #pragma omp parallel
+    {
+        std::vector<unsigned char> Face(nx);
+        double v[8];
+
+        #pragma omp for schedule(dynamic)
+        for (int z = 0; z < ncz; z++) {
+            for (int y = 0; y < Dim[1]-1; y++) {
+                const long long row = y*nx + z*nxy;
+                const unsigned char *NearRow = &Near[row];
+                bool any = false;
+                for (long long x = 0; x < nx-1 && !any; x++) any = NearRow[x];
+                if (!any) continue;
+                for (long long x = 0; x < nx; x++) {
+                    const long long c = row + x;
+                    Face[x] = ((double)F[c] >= value) | (((double)F[c+nx] >= value) << 1) | (((double)F[c+nxy] >= value) << 2) | (((double)F[c+nxy+nx] >= value) << 3);
+                }
+                for (int x = 0; x < Dim[0]-1; x++) {
+                    if (!NearRow[x]) continue;
+                    const int code = SpreadFace[Face[x]] | (SpreadFace[Face[x+1]] << 1);
+                    if (code == 0 || code == 255) continue;
+                    const long long c = row + x;
+                    for (int k = 0; k < 8; k++) v[k] = (double)F[c+Corner[k]];
+                    double r[3] = {0.0, 0.0, 0.0};
+                    int ncross = 0;
+                    for (int k = 0; k < 8; k++) {
+                        for (int b = 0; b < 3; b++) {
+                            const int k2 = k | (1 << b);
+                            if (k2 == k || ((code >> k) & 1) == ((code >> k2) & 1)) continue;
+                            const double t = (value - v[k]) / (v[k2] - v[k]);
+                            r[0] += (k & 1); r[1] += (k >> 1) & 1; r[2] += (k >> 2) & 1;
+                            r[b] += t;
+                            ncross++;
+                        }
+                    }
+                    Cells[z].push_back(c);
+                    Vertices[z].push_back(x + r[0]/ncross);
+                    Vertices[z].push_back(y + r[1]/ncross);
+                    Vertices[z].push_back(z + r[2]/ncross);
+                }
+            }
+        }
+    }
+
+    std::vector<long long> First(ncz+1,0);
+    for (int z = 0; z < ncz; z++) First[z+1] = First[z] + (long long)Cells[z].size();
+
+    // The crossed edge from cell c along axis a is shared with the cells
+    // c-e_b, c-e_b-e_c and c-e_c, (a,b,c) being a cyclic permutation of
+    // the axes. Taken in that order the quad faces +e_a. Vertices of
+    // the planes z-1 and z are looked up in a dense index of the two
+    // planes, cleared again after each plane.
+    std::vector< std::vector<long long> > PlaneQuads(ncz);
+
+    #pragma omp parallel
+    {
+        std::vector<long long> Index(2*nxy,-1);
+
+        #pragma omp for schedule(dynamic)
+        for (int z = 0; z < ncz; z++) {
+            const long long base = (z-1)*nxy;
+            for (int p = std::max(0,z-1); p <= z; p++) {
+                for (size_t i = 0; i < Cells[p].size(); i++) Index[Cells[p][i]-base] = First[p] + (long long)i;
+            }
+            std::vector<long long> &Q = PlaneQuads[z];
+            for (size_t i = 0; i < Cells[z].size(); i++) {
+                const long long c = Cells[z][i];
+                const int r[3] = {(int)(c % nx), (int)((c / nx) % Dim[1]), z};
+                const bool inside = (double)F[c] >= value;
+                for (int a = 0; a < 3; a++) {
+                    const int b = (a+1) % 3, e = (a+2) % 3;
+                    if (r[b] < 1 || r[e] < 1) continue;
+                    if (((double)F[c+stride[a]] >= value) == inside) continue;
+                    const long long q1 = Index[c-stride[b]-base];
+                    const long long q2 = Index[c-stride[b]-stride[e]-base];
+                    const long long q3 = Index[c-stride[e]-base];
+                    if (q1 < 0 || q2 < 0 || q3 < 0) continue;
+                    Q.push_back(First[z] + (long long)i);
+                    Q.push_back(inside ? q1 : q3);
+                    Q.push_back(q2);
+                    Q.push_back(inside ? q3 : q1);
+                }
+            }
+            for (int p = std::max(0,z-1); p <= z; p++) {
+                for (size_t i = 0; i < Cells[p].size(); i++) Index[Cells[p][i]-base] = -1;
+            }
+        }
+    }
+
+    Points.reserve(3*First[ncz]);
+    for (int z = 0; z < ncz; z++) {
+        Points.insert(Points.end(),Vertices[z].begin(),Vertices[z].end());
+        Quads.insert(Quads.end(),PlaneQuads[z].begin(),PlaneQuads[z].end());
+    }
+}
+
+template void GetNarrowBandSurface<double>(const double*, const unsigned char*, const int*, double, int, std::vector<double>&, std::vector<long long>&);
+template void GetNarrowBandSurface<float>(const float*, const unsigned char*, const int*, double, int, std::vector<double>&, std::vector<long long>&);
+template void GetNarrowBandSurface<unsigned char>(const unsigned char*, const unsigned char*, const int*, double, int, std::vector<double>&, std::vector<long long>&);
+
+/* ================================================================
+   GRAPH ANALYSIS
+=================================================================*/
+
+long int DecomposeGraph(const _mitoGraph &G, std::vector<_mitoGraphComponent> &Components) {
+
+    Components.clear();
+    size_t e, ne = G.Source.size();
+
+    long int maxid = -1;
+    for (e = 0; e < ne; e++) maxid = std::max(maxid,std::max(G.Source[e],G.Target[e]));
+    if (maxid < 0) return 0;
+
+    // Vertices in order of first appearance, sources before targets
+    long long v, nv = 0;
+    std::vector<long long> Vertex(maxid+1,-1);
+    for (e = 0; e < ne; e++) if (Vertex[G.Source[e]] < 0) Vertex[G.Source[e]] = nv++;
+    for (e = 0; e < ne; e++) if (Vertex[G.Target[e]] < 0) Vertex[G.Target[e]] = nv++;
+
+    std::vector<long long> Parent(nv);
+    for (v = 0; v < nv; v++) Parent[v] = v;
+    for (e = 0; e < ne; e++) {
+        long long a = FindRoot(Parent,Vertex[G.Source[e]]);
+        long long b = FindRoot(Parent,Vertex[G.Target[e]]);
+        if (a != b) Parent[std::max(a,b)] = std::min(a,b);
+    }
+
+    // Volume of each node, from its first row in the .cc table
+    std::vector<double> Volume(nv,NAN);
+    std::vector<char> Found(nv,0);
+    for (e = 0; e < G.CCNode.size(); e++) {
+        long int node = G.CCNode[e];
+        if (node < 0 || node > maxid || Vertex[node] < 0 || Found[Vertex[node]]) continue;
+        Found[Vertex[node]] = 1;
+        Volume[Vertex[node]] = G.CCVolume[e];
+    }
+
+    // Roots are the lowest vertex of each component, so numbering them
+    // in vertex order lists the components like igraph does.
+    std::vector<long long> Component(nv,-1);
+    for (v = 0; v < nv; v++) {
+        long long r = FindRoot(Parent,v);
+        if (Component[r] < 0) {
+            Component[r] = (long long)Components.size();
+            _mitoGraphComponent C = {0, 0, 0.0, -INFINITY};
+            Components.push_back(C);
+        }
+        _mitoGraphComponent &C = Components[Component[r]];
+        C.nodes++;
+        if (std::isnan(Volume[v]) || std::isnan(C.volume)) {
+            C.volume = NAN;
+        } else {
+            C.volume = std::max(C.volume,Volume[v]);
+        }
+    }
+
+    std::vector<long double> Length(Components.size(),0.0L);
+    for (e = 0; e < ne; e++) {
+        long long c = Component[FindRoot(Parent,Vertex[G.Source[e]])];
+        Components[c].edges++;
+        Length[c] += G.Length[e];
+    }
+    for (e = 0; e < Components.size(); e++) Components[e].length = (double)Length[e];
+
+    std::stable_sort(Components.begin(),Components.end(),[](const _mitoGraphComponent &a, const _mitoGraphComponent &b) {
+        if (std::isnan(a.volume)) return false;
+        if (std::isnan(b.volume)) return true;
+        return a.volume > b.volume;
+    });
+
+    return (long int)nv;
+}
@@ -0,0 +1,246 @@
+#ifndef MITOFILTERS_H
+#define MITOFILTERS_H
+
+#include <list>
+#include <vector>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+
+	//===========================================================================
+	//
+	//   Voxel kernels used by the vesselness pipeline and by the connected
+	//   component labeling of the binary images. All routines here work
+	//   on plain contiguous buffers laid out x-fastest,  i.e. the voxel (x,y,z)
+	//   lives at x + y*Dim[0] + z*Dim[0]*Dim[1], exactly like vtkImageData.
+	//   They do not depend on VTK so they can be timed and reused in isolation.
+	//
+	//===========================================================================
+
+	// Size of the tiles used to walk the volume. A tile is a block of
+	// MITO_TILE_Y rows of at most MITO_TILE_X voxels inside a single
+	// z-plane. Tile buffers hold six floats per voxel.
+	#define MITO_TILE_X 256
+	#define MITO_TILE_Y 8
+
+	// The six distinct entries of the symmetric Hessian matrix, in the
+	// order they are stored in the tile buffers.
+	enum { MITO_HXX = 0, MITO_HYY, MITO_HZZ, MITO_HXY, MITO_HXZ, MITO_HYZ };
+
+	// Discrete second derivatives of the x-fastest volume G of size
+	// Dim[0]xDim[1]xDim[2] over the tile x in [x0,x1), y in [y0,y1) of
+	// plane z. Entry e of voxel (x,y) is written to
+	// H[e][(y-y0)*(x1-x0)+(x-x0)].
+	// The result is bitwise identical to applying the first-order
+	// difference operator twice (central differences inside the volume,
+	// one-sided differences at the borders) with float intermediates,
+	// but Dx, Dy and Dz are never stored: each second derivative is
+	// evaluated directly from the smoothed volume.
+	void GetHessianTile(const float *G, const int *Dim, int z, int y0, int y1, int x0, int x1, float *H[6]);
+
+	// Eigenvalues of n symmetric 3x3 matrices whose six distinct entries
+	// are H[MITO_HXX][i], ..., H[MITO_HYZ][i], from the trigonometric
+	// solution of the characteristic polynomial. No eigenvectors are
+	// computed. The eigenvalues of matrix i are returned in L1[i], L2[i]
+	// and L3[i] sorted by increasing magnitude, equal magnitudes keeping
+	// the decreasing order vtkMath::Diagonalize3x3 returns them in. Near
+	// double roots they are accurate to about 1e-8 of the largest one,
+	// below the single precision of the Hessian entries.
+	void GetSymmetricEigenvalues(const double *const H[6], size_t n, double *L1, double *L2, double *L3);
+
+	// Vesselness of Frangi et al. of n voxels from their Hessian
+	// eigenvalues sorted by magnitude, zero unless l2 and l3 are negative.
+	void GetVesselnessFromEigenvalues(const double *L1, const double *L2, const double *L3, size_t n, double *V);
+
+	// Truncation radius of the scale-space kernels in standard deviations.
+	#define MITO_GAUSS_TRUNCATE 4.0
+
+	// One smoothed volume of a scale-space and its standard deviations
+	// along x, y and z, in voxels.
+	struct _mitoScaleLevel {
+		double s[3];
+		std::vector<float> V;
+	};
+
+	// Gaussian scale-space of a float volume. A level is derived from the
+	// coarsest cached level that does not exceed it along any axis (or from
+	// the input) by a separable convolution with the Gaussian of variance
+	// s^2-s0^2, so increasing scales only pay for a small delta kernel
+	// instead of a full radius-10 sigma convolution each. Kernels are
+	// truncated at MITO_GAUSS_TRUNCATE standard deviations and renormalized
+	// wherever they are clipped by the border. At most MaxLevels levels are
+	// kept; the oldest one is dropped when a new level is computed, so a
+	// pointer returned by GetLevel is valid for the next MaxLevels-1 calls.
+	// The input buffer is not copied and must outlive the scale-space.
+	struct _mitoScaleSpace {
+		int Dim[3];
+		size_t MaxLevels;
+		const float *Input;
+		std::list<_mitoScaleLevel> Levels;
+		std::vector<float> Tmp;
+
+		_mitoScaleSpace(size_t maxlevels = 1) : MaxLevels(maxlevels), Input(NULL) {
+			Dim[0] = Dim[1] = Dim[2] = 0;
+		}
+		void SetInput(const float *Image, const int *ImageDim);
+		const float *GetLevel(double sx, double sy, double sz);
+	};
+
+	// Convolves the volume In with the 1D kernel W of radius (W.size()-1)/2
+	// along axis (0, 1 or 2) and writes the result to Out. At every voxel
+	// the kernel is normalized by its mass that falls inside the volume.
+	void ConvolveAxis(const float *In, float *Out, const int *Dim, int axis, const std::vector<float> &W);
+
+	// Root of r in the union-find forest Parent, halving the path along
+	// the way.
+	inline long long FindRoot(std::vector<long long> &Parent, long long r) {
+		while (Parent[r] != r) {
+			Parent[r] = Parent[Parent[r]];
+			r = Parent[r];
+		}
+		return r;
+	}
+
+	// Maximal run of consecutive voxels x0 <= x <= x1 inside the row
+	// row = y + z*Dim[1], i.e. the voxels row*Dim[0]+x0 to row*Dim[0]+x1.
+	struct _mitoRun {
+		long long row;
+		int x0, x1;
+	};
+
+	// Labels the connected components of the non-zero voxels of Mask using
+	// 6, 18 or 26-connectivity (ngbh). Voxels outside the volume are never
+	// connected to anything. The foreground is split into x-runs, which are
+	// merged by union-find, so every voxel is touched a constant number of
+	// times. Runs receives the runs of the foreground in increasing order of
+	// voxel id and Label the component of each one. Labels go from 1 to the
+	// number of components in decreasing order of the largest voxel id of
+	// the component, the order in which a backward seed scan visits them.
+	// The size of component l is appended to CSz[l-1]. The result does not
+	// depend on the number of threads. Returns the number of components.
+	long int LabelConnectedRuns(const unsigned char *Mask, const int *Dim, int ngbh, std::vector<_mitoRun> &Runs, std::vector<long int> &Label, std::vector<long int> &CSz);
+
+	// Fills with 255 the zero voxels of B that cannot be reached from the
+	// faces of the volume through 6-connected zero voxels. The background
+	// reached from the faces is flooded once by scanline: each background
+	// x-run is visited once, marked in a bit-packed mask and the runs it
+	// touches in the four neighboring rows are queued. The voxels left
+	// unmarked are then filled in parallel. Returns the number of voxels
+	// filled.
+	long long FillHolesFromFaces(unsigned char *B, const int *Dim);
+
+
+	// Two points i < j at distance d.
+	struct _mitoPointPair {
+		long long i, j;
+		double d;
+	};
+
+	// Finds the pairs of points at a distance rmin < d <= rmax among the
+	// points whose coordinates are X[3*i], X[3*i+1] and X[3*i+2]. Points
+	// are bucketed in a uniform grid of cell size rmax, so each one is only
+	// compared with the points of the 27 cells around it and the cost grows
+	// with the number of points rather than its square. Pairs are sorted by
+	// distance, ties broken by i and then j.
+	void FindPointPairs(const std::vector<double> &X, double rmin, double rmax, std::vector<_mitoPointPair> &Pairs);
+
+	// Statistics of every z-plane of an x-fastest volume, gathered in a
+	// single pass. The range, sum and sum of squares of any run of
+	// consecutive planes (the z-blocks and overlapping windows of the
+	// z-adaptive binarizations) then come from the planes instead of the
+	// voxels. Sums are prefix sums in extended precision, so the sum of
+	// planes [z0,z1) costs two lookups. Each plane also keeps its mean and
+	// the sum of squared deviations from it (M2), computed in a second
+	// pass, for standard deviations that do not cancel on planes with a
+	// large mean and a low contrast. The volume is float or double, as
+	// are the volumes of ThresholdPlanes and VotePlanes.
+	struct _mitoPlaneStats {
+		long long PlaneSize;
+		std::vector<double> Min, Max;
+		std::vector<long double> Sum, Sum2;   // over the planes [0,z)
+		std::vector<double> Mean, M2;         // of each plane
+
+		template <typename Real> void Compute(const Real *V, const int *Dim);
+
+		// Extends min and max with the range of the planes [z0,z1).
+		void GetRange(int z0, int z1, double &min, double &max) const;
+
+		// Mean and standard deviation of the voxels of the planes [z0,z1),
+		// the planes being merged one by one with the pairwise update of
+		// Chan, Golub and LeVeque.
+		void GetMeanStd(int z0, int z1, double &mean, double &std) const;
+
+		long long GetCount(int z0, int z1) const { return PlaneSize * (z1 - z0); }
+		double GetSum(int z0, int z1) const { return (double)(Sum[z1] - Sum[z0]); }
+		double GetSum2(int z0, int z1) const { return (double)(Sum2[z1] - Sum2[z0]); }
+	};
+
+	// B[id] = 0 where V[id] <= T[z] and 255 elsewhere, z being the plane
+	// of voxel id.
+	template <typename Real> void ThresholdPlanes(const Real *V, const int *Dim, const std::vector<double> &T, unsigned char *B);
+
+	// Majority vote of the thresholds of several windows: T[z] holds the
+	// thresholds of the windows that cover plane z and a voxel is set to
+	// 255 when it is above at least half of them, to 0 otherwise or when
+	// no window covers its plane.
+	template <typename Real> void VotePlanes(const Real *V, const int *Dim, const std::vector< std::vector<double> > &T, unsigned char *B);
+
+	// Euclidean distance from every voxel of the x-fastest volume Mask to
+	// the closest zero voxel (0 at the zero voxels), the voxel centers
+	// being Spacing[0], Spacing[1] and Spacing[2] apart along x, y and z.
+	// The squared distance is the lower envelope of parabolas along x,
+	// then y, then z (Felzenszwalb and Huttenlocher), so the cost is
+	// linear in the number of voxels, and the rows along each axis are
+	// transformed in parallel. Voxels of a volume without zero voxels
+	// are at infinity.
+	void GetDistanceTransform(const unsigned char *Mask, const int *Dim, const double *Spacing, float *D);
+
+	// Level set F = value of an x-fastest volume, a voxel being inside
+	// when F >= value, extracted only in the cells (cubes of 8 voxels
+	// identified by their lowest voxel) within band voxels of a non-zero
+	// voxel of Mask along each axis. Each cell crossed by the level set
+	// gets one vertex, the average of the crossings of its edges
+	// interpolated linearly as in marching cubes, and the four cells
+	// around each crossed edge are joined by a quad facing the outside
+	// (naive surface nets). Points receives the coordinates of the
+	// vertices in voxels and Quads the four vertex ids of each quad.
+	// z-planes of cells are processed in parallel; the result does not
+	// depend on the number of threads. Defined for double, float and
+	// unsigned char volumes.
+	template <typename T> void GetNarrowBandSurface(const T *F, const unsigned char *Mask, const int *Dim, double value, int band, std::vector<double> &Points, std::vector<long long> &Quads);
+
+	// Value of x as read back from the text outputs, which print it with
+	// 5 decimals.
+	inline double RoundAsText(double x) {
+		char buf[512];
+		snprintf(buf,sizeof(buf),"%1.5f",x);
+		return strtod(buf,NULL);
+	}
+
+	// Graph of a skeleton as written to the .gnet file, and the node
+	// table of the .cc file. Lengths and volumes hold the values read back
+	// from those files, i.e. rounded to 5 decimals.
+	struct _mitoGraph {
+		std::vector<long int> Source, Target;
+		std::vector<double> Length;
+		std::vector<long int> CCNode;
+		std::vector<double> CCVolume;
+	};
+
+	// Connected component of a _mitoGraph. Volume is the largest volume of
+	// its nodes in the .cc table, NaN if any node is missing from it.
+	struct _mitoGraphComponent {
+		long int nodes, edges;
+		double length, volume;
+	};
+
+	// Splits G in connected components the way GraphAnalyzer.R does with
+	// igraph: vertices are the nodes with at least one edge, numbered in
+	// order of first appearance in Source and then in Target, and
+	// components are listed by their lowest vertex, then stably sorted by
+	// decreasing volume with NaN last. Lengths of a component are added in
+	// edge order in extended precision, like sum() in R. Returns the number
+	// of vertices.
+	long int DecomposeGraph(const _mitoGraph &G, std::vector<_mitoGraphComponent> &Components);
+
+#endif
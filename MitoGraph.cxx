@@ -18,21 +18,6 @@
 #include "ssThinning.h"
 #include "MitoThinning.h"
 
-    double _rad = 0.150;
-    double _dxy, _dz = -1.0;
-    bool _export_graph_files = true;
-    bool _export_image_binary = false;
-    bool _export_image_resampled = false;
-    bool _scale_polydata_before_save = true;
-    bool _export_nodes_label = true;
-    double _div_threshold = 0.1666667;
-    bool _checkonly = false;
-    double _resample = -1.0;
-    bool _improve_skeleton_quality = true; // when this is true nodes with degree zero
-                                           // expanded and detected. Additional checking
-                                           // is also done to garantee that all non-zero
-                                           // voxels were analysized.
-
     std::string MITOGRAPH_VERSION = "v3.1";
 
     //                    |------06------|
@@ -74,13 +59,18 @@ void Sort(double *l1, double *l2, double *l3);
 // http://mathworld.wolfram.com/FrobeniusNorm.html
 double FrobeniusNorm(double M[3][3]);
 
+// Returns a contiguous float view of a single-component array.
+// Float arrays are used in place; other types are converted
+// into Buffer, which must outlive the returned pointer.
+const float *GetScalarsAsFloat(vtkDataArray *Scalars, std::vector<float> &Buffer);
+
+// Same for a contiguous double view.
+const double *GetScalarsAsDouble(vtkDataArray *Scalars, std::vector<double> &Buffer);
+
 // This routine scales the polydata points to the correct dimension
-// given by parameters _dxy and _dz.
+// given by the pixel sizes _dxy and _dz of mitoObject.
 void ScalePolyData(vtkSmartPointer<vtkPolyData> PolyData, _mitoObject *mitoObject);
 
-// Stores all files with a given extension in a vector
-int ScanFolderForThisExtension(std::string _impath, std::string ext, std::vector<std::string> List);
-
 /* ================================================================
    IMAGE TRANSFORM
 =================================================================*/
@@ -115,14 +105,18 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZBlockSimple(vtkSmar
 // Enhanced z-block version with overlapping blocks and foreground detection
 vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZBlockEnhanced(vtkSmartPointer<vtkImageData> Image, double threshold, int z_block_size);
 
-// Enhance structural connectivity before binarization
-vtkSmartPointer<vtkImageData> EnhanceStructuralConnectivity(vtkSmartPointer<vtkImageData> Image, double sigma);
+// Enhance structural connectivity before binarization. The two
+// smoothed copies of the image come from a float scale-space when
+// scale_space is true.
+vtkSmartPointer<vtkImageData> EnhanceStructuralConnectivity(vtkSmartPointer<vtkImageData> Image, double sigma, bool scale_space);
 
 // Connect fragmented skeleton segments
 vtkSmartPointer<vtkPolyData> ConnectSkeletonFragments(vtkSmartPointer<vtkPolyData> Skeleton, double max_gap_distance);
 
-// Fill holes in the 3D image
-void FillHoles(vtkSmartPointer<vtkImageData> ImageData);
+// Fill holes in the 3D image. With flood the holes are the background
+// that cannot be reached from the faces of the image, otherwise every
+// background component but the one with the largest voxel id.
+void FillHoles(vtkSmartPointer<vtkImageData> ImageData, bool flood);
 
 // This routine uses a nearest neighbour filter to deblur the
 // 16bit original image before applying MitoGraph.
@@ -136,11 +130,13 @@ void FillHoles(vtkSmartPointer<vtkImageData> ImageData);
 
 // Export maximum projection of a given ImageData as a
 // PNG file.
-void ExportMaxProjection(vtkSmartPointer<vtkImageData> Image, const char FileName[], bool binary);
+void ExportMaxProjection(vtkSmartPointer<vtkImageData> Image, const char FileName[]);
 
 // Export maximum projection of bottom and top parts of
 // a given Tiff image as a PNG file as well as the polydata
-// surface points
+// surface points. All panels are built in a single pass over
+// the planes of the stack, _checkonly_bin x _checkonly_bin
+// voxels to a pixel.
 void ExportDetailedMaxProjection(_mitoObject *mitoObject);
 
 // Export results in global as well as individual files
@@ -153,45 +149,211 @@ void ExportConfigFile(_mitoObject *mitoObject);
    ROUTINES FOR VESSELNESS CALCUATION VIA DISCRETE APPROCH
 =================================================================*/
 
-// This routine uses a discrete differential operator to
-// calculate the derivatives of a given 3D volume
-void GetImageDerivativeDiscrete(vtkSmartPointer<vtkDataArray> Image, int *dim, char direction, vtkSmartPointer<vtkFloatArray> Derivative);
-
-// This routine calculate the Hessian matrix for each point
-// of a 3D volume and its eigenvalues (Discrete Approach)
-void GetHessianEigenvaluesDiscrete(double sigma, vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkDoubleArray> L1, vtkSmartPointer<vtkDoubleArray> L2, vtkSmartPointer<vtkDoubleArray> L3);
-void GetHessianEigenvaluesDiscreteZDependentThreshold(double sigma, vtkImageData *Image, vtkSmartPointer<vtkDoubleArray> L1, vtkSmartPointer<vtkDoubleArray> L2, vtkSmartPointer<vtkDoubleArray> L3, _mitoObject *mitoObjectt);
-
-// Calculate the vesselness at each point of a 3D volume based
-// based on the Hessian eigenvalues
-void GetVesselness(double sigma, vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkDoubleArray> L1, vtkSmartPointer<vtkDoubleArray> L2, vtkSmartPointer<vtkDoubleArray> L3, _mitoObject *mitoObjectt);
+// Calculate the vesselness at each point of a 3D volume from the
+// eigenvalues of its Hessian (Discrete Approach) and keep the maximum
+// with the values already in VSSS, a float or double array (see
+// NewVesselnessArray). The image is smoothed at scale
+// sigma by vtkImageGaussianSmooth, or taken from Space when a
+// scale-space is given. When FroMax is given it replaces the maximum
+// Frobenius norm of the volume in the threshold (used when the volume
+// is a z-slab).
+void GetVesselness(double sigma, vtkSmartPointer<vtkImageData> Image, vtkDataArray *VSSS, _mitoObject *mitoObjectt, _mitoScaleSpace *Space, const float *FroMax);
+
+// Array of N zeros for the vesselness and the divergence: float by
+// default, double with -storage double.
+vtkSmartPointer<vtkDataArray> NewVesselnessArray(const _mitoObject *mitoObject, vtkIdType N);
+
+// Reads the stack of mitoObject, pads 2D images, resamples it if
+// requested and converts it to 8-bit. Raw receives the stack as read,
+// used later for the intensities along the skeleton. Returns NULL if
+// the file cannot be read.
+vtkSmartPointer<vtkImageData> LoadStack(_mitoObject *mitoObject, vtkSmartPointer<vtkImageData> &Raw);
+
+// Vesselness of the 8-bit Image over the range of scales followed by
+// the divergence filter, on the device of mitoObject. Returns the
+// divergence image.
+vtkSmartPointer<vtkImageData> GetDivergenceImage(_mitoObject *mitoObject, vtkSmartPointer<vtkImageData> Image);
+
+// Component filtering, binarization and hole filling of the divergence
+// image with the threshold options of mitoObject. Returns the binary
+// image; ImageEnhanced is modified (and replaced with
+// -enhance-connectivity) and is the image the surface is built from.
+vtkSmartPointer<vtkImageData> SegmentDivergenceImage(_mitoObject *mitoObject, vtkSmartPointer<vtkImageData> &ImageEnhanced);
+
+// SegmentDivergenceImage followed by ProcessBinaryImage. ImageEnhanced
+// is released as soon as the surface no longer needs it. key is the
+// key of the cached divergence, used with -cache-stages to cache the
+// segmentation too; 0 when the divergence is not cached.
+int ProcessDivergenceImage(_mitoObject *mitoObject, vtkSmartPointer<vtkImageData> &ImageEnhanced, vtkSmartPointer<vtkImageData> Raw, uint64_t key);
 
 // Calculate the vesselness over a range of different scales
 int MultiscaleVesselness(_mitoObject *mitoObject);
 
+// Surface, skeleton, widths and intensities of a segmented image.
+// The surface is the iso-surface value of Field, which is released
+// once the surface is extracted. Raw is the original stack used for
+// the intensities along the skeleton; it is read again from the file
+// when NULL.
+int ProcessBinaryImage(_mitoObject *mitoObject, vtkSmartPointer<vtkImageData> Binary, vtkSmartPointer<vtkImageData> &Field, double value, vtkSmartPointer<vtkImageData> Raw);
+
+// Iso-surface value of Field, not yet scaled, with the method chosen
+// by -surface. The narrow band only goes over the voxels of Binary and
+// their neighbors. Empty with -surface off.
+vtkSmartPointer<vtkPolyData> ExtractSurface(_mitoObject *mitoObject, vtkSmartPointer<vtkImageData> Field, double value, vtkSmartPointer<vtkImageData> Binary);
+
+// Distance in microns of each voxel of Binary to the background, used
+// for the widths with -width dt or when there is no surface
+vtkSmartPointer<vtkImageData> GetDistanceImage(vtkSmartPointer<vtkImageData> Binary, _mitoObject *mitoObject);
+
+/* ================================================================
+   STAGE CACHE
+=================================================================*/
+
+// Divergence of the 8-bit Image. With -sweep-cache or -cache-stages it
+// is read from the cache file FileName.<key>.mgdiv when one matches,
+// and computed and written to it otherwise; either way it is rounded
+// to float like the file. key receives the key of the divergence, 0
+// when it is not cached.
+vtkSmartPointer<vtkImageData> GetCachedDivergence(_mitoObject *mitoObject, vtkSmartPointer<vtkImageData> Image, uint64_t &key);
+
+// Segmentation cache of -cache-stages (FileName.<key>.mgseg): the
+// binary mask and the divergence the surface is built from, keyed by
+// the key of the divergence and the segmentation options. Read
+// replaces the voxels of ImageEnhanced and returns false, leaving them
+// untouched, when there is no complete matching file or the cache is
+// off (key 0); Write rounds ImageEnhanced to float like the file.
+bool ReadSegmentationCache(_mitoObject *mitoObject, uint64_t key, vtkSmartPointer<vtkImageData> ImageEnhanced, vtkSmartPointer<vtkImageData> &Binary);
+void WriteSegmentationCache(_mitoObject *mitoObject, uint64_t key, vtkImageData *ImageEnhanced, vtkImageData *Binary);
+void RemoveSegmentationCache(_mitoObject *mitoObject, uint64_t key);
+
+/* ================================================================
+   SLAB STREAMING
+=================================================================*/
+
+// Whether the current settings can be run with -stream-slab. Prints
+// why not and returns false for the options that need the whole
+// volume at once.
+bool CanStreamSlabs(_mitoObject *mitoObject);
+
+// Vesselness, divergence filter and binarization of the TIFF stack
+// computed in overlapping z-slabs of mitoObject->_stream_slab planes.
+// Only one slab of the input and of the intermediate volumes is in
+// memory at a time; the result is the 8-bit binary image.
+vtkSmartPointer<vtkImageData> SegmentInSlabs(_mitoObject *mitoObject);
+
 /* ================================================================
    DIVERGENCE FILTER
 =================================================================*/
 
 // This routine calculates the divergence filter of a 3D volume
-// based on the orientation of the gradient vector field
-void GetDivergenceFilter(int *Dim, vtkSmartPointer<vtkDoubleArray> Scalars);
+// based on the orientation of the gradient vector field. Scalars,
+// float or double, is replaced by the result in place.
+void GetDivergenceFilter(int *Dim, vtkDataArray *Scalars);
+
+/* ================================================================
+   SKELETON ATTRIBUTES
+=================================================================*/
+
+// Width, length and intensity of every skeleton point, plus the
+// total length and volume of the network, in one multithreaded pass
+// over flat copies of the skeleton points and edges. Tubule width is
+// approximated by the distance of the skeleton to the closest
+// points of the surface or, when Distance is not NULL, by twice the
+// distance to the background less one pixel. Intensities of the
+// original image are averaged over the voxel under each point and
+// its nneigh-1 closest neighbors. The Width, Length and Intensity
+// arrays are added to the skeleton.
+void GetSkeletonAttributes(vtkSmartPointer<vtkPolyData> Skeleton, vtkSmartPointer<vtkPolyData> Surface, vtkSmartPointer<vtkImageData> Distance, vtkSmartPointer<vtkImageData> ImageData, int nneigh, _mitoObject *mitoObject);
 
 /* ================================================================
-   WIDTH ANALYSIS
+   BATCH PROCESSING
 =================================================================*/
 
-// Approximation of tubule width by the distance of the skeleton
-// to the closest point over the surface.
-void EstimateTubuleWidth(vtkSmartPointer<vtkPolyData> Skeleton, vtkSmartPointer<vtkPolyData> Surface, _mitoObject *mitoObject);
+// Bound of the bytes held per voxel at the peak of MultiscaleVesselness
+// with the default options. Two volumes are kept at full size: the raw
+// stack (2 bytes for 16-bit input) for the intensities, and the float
+// vesselness (4), which is turned into the divergence in place and
+// released once the surface is built. On top of them, the vesselness
+// holds the 8-bit stack and the gaussian of the current scale with its
+// float copy (6), and the component filtering its 32-bit labels and
+// mask (5). Rounded up for the temporary volumes of VTK's filters.
+#define MITO_BYTES_PER_VOXEL 16
+
+// Extra bytes per voxel of the options that hold more volumes at the
+// peak: the double vesselness of -storage double, the Frobenius norm
+// of -adaptive, the float input, level and scratch volume of
+// -scale-space, and the two smoothed volumes and the enhanced
+// divergence of -enhance-connectivity (twice as much with -storage
+// double).
+#define MITO_BYTES_PER_VOXEL_DOUBLE 4
+#define MITO_BYTES_PER_VOXEL_ADAPTIVE 4
+#define MITO_BYTES_PER_VOXEL_SCALE_SPACE 12
+#define MITO_BYTES_PER_VOXEL_CONNECTIVITY 12
+
+// Peak memory per voxel of the whole stack with -stream-slab: the
+// binary image, the hole-filling mask, the 32-bit component labels of
+// -analyze and the raw stack read back for the intensities. The
+// slab being segmented costs GetBytesPerVoxel on top of that.
+#define MITO_BYTES_PER_VOXEL_STREAMED 12
+
+// Bound of the bytes held per voxel at the peak of MultiscaleVesselness
+// with the options of mitoObject.
+double GetBytesPerVoxel(const _mitoObject *mitoObject);
+
+// Estimate the peak memory in bytes needed to process the file
+// FileName. Only the file header is read. Returns 0 if the file
+// cannot be opened or its header is not valid.
+double EstimateMemoryCost(const _mitoObject *mitoObject, std::string FileName);
+
+// Hash of every option that changes the outputs of a file, recorded
+// in the manifest next to the hash of the input.
+uint64_t GetParameterFingerprint(const _mitoObject *mitoObject);
+
+// Process a single file: vesselness, skeletonization and export
+// of the results, or the output sets of -sweep. The file is recorded
+// in mitoObject->Manifest and, with -resume, skipped when the manifest
+// has it done. Returns EXIT_SUCCESS or EXIT_FAILURE.
+int ProcessFile(_mitoObject *mitoObject);
+
+// Defaults of all the parameters, as used when no flag is given.
+void SetDefaultParameters(_mitoObject *mitoObject);
+
+// Process all Files using njobs workers fed by a bounded queue.
+// A file is only started if the estimated memory of all the files
+// being processed fits in max_memory bytes (0 means no limit); a
+// file that alone exceeds the limit runs when nothing else does.
+// Each file gets its own copy of mitoObject and a failing file
+// does not stop the batch. Returns the number of failed files.
+int RunBatch(const _mitoObject *mitoObject, std::vector<std::string> &Files, int njobs, double max_memory);
+
+// Process the TIFF stacks of Files as time-lapse series, one frame at
+// a time and in order, reading frame t+1 while frame t is processed.
+// Stacks with several frames (ImageJ hyperstacks, or planes z-planes
+// per frame when planes > 0) are series of their own, whose frames go
+// to FileName_t0001, FileName_t0002... The single-frame stacks make
+// one series in the natural order of their names. The .mitograph of
+// each frame is also appended to the table of its series, that is
+// FileName.mitograph, or timelapse.mitograph in the folder for the
+// single-frame stacks. Returns the number of failed frames.
+int RunTimeLapse(const _mitoObject *mitoObject, std::vector<std::string> &Files, int planes);
 
 /* ================================================================
-   INTENSITY MAPPING
+   PARAMETER SWEEP
 =================================================================*/
 
-// Intensities of the original TIFF image is mapped into a scalar
-// component of the skeleton.
-void MapImageIntensity(vtkSmartPointer<vtkPolyData> Skeleton, vtkSmartPointer<vtkImageData> ImageData, int nneigh);
+// Output sets of the key=v1,v2,... Lists given to -sweep: the
+// Cartesian product of the lists, with the options of mitoObject for
+// the keys not given. Prints the problem and returns false if a list
+// is not valid.
+bool ParseSweep(const _mitoObject *mitoObject, const std::vector<std::string> &Lists, std::vector<_mitoTrial> &Trials);
+
+// Process the output sets of mitoObject->Sweep for a single file. The
+// divergence is computed once for each 8-bit conversion (and read from
+// or written to a cache file with -sweep-cache), and the output sets
+// derived from it are segmented by _sweep_jobs workers, each into the
+// outputs of FileName followed by its suffix. Returns EXIT_FAILURE if
+// any output set fails.
+int SweepFile(_mitoObject *mitoObject);
 
 /**========================================================
  Auxiliar functions
@@ -241,12 +403,66 @@ double FrobeniusNorm(double M[3][3]) {
     return sqrt(f);
 }
 
+template <typename T> static void CopyToFloat(const T *Source, vtkIdType N, float *Target) {
+    for (vtkIdType id = 0; id < N; id++) Target[id] = (float)Source[id];
+}
+
+const float *GetScalarsAsFloat(vtkDataArray *Scalars, std::vector<float> &Buffer) {
+    vtkIdType N = Scalars -> GetNumberOfTuples();
+    if (Scalars -> GetDataType() == VTK_FLOAT) {
+        return (float*)Scalars -> GetVoidPointer(0);
+    }
+    Buffer.resize(N);
+    switch (Scalars -> GetDataType()) {
+        case VTK_UNSIGNED_CHAR: CopyToFloat((unsigned char*)Scalars->GetVoidPointer(0),N,&Buffer[0]); break;
+        case VTK_UNSIGNED_SHORT: CopyToFloat((unsigned short*)Scalars->GetVoidPointer(0),N,&Buffer[0]); break;
+        case VTK_DOUBLE: CopyToFloat((double*)Scalars->GetVoidPointer(0),N,&Buffer[0]); break;
+        default:
+            for (vtkIdType id = 0; id < N; id++) Buffer[id] = (float)Scalars -> GetTuple1(id);
+    }
+    return (N) ? &Buffer[0] : NULL;
+}
+
+const double *GetScalarsAsDouble(vtkDataArray *Scalars, std::vector<double> &Buffer) {
+    vtkIdType N = Scalars -> GetNumberOfTuples();
+    if (Scalars -> GetDataType() == VTK_DOUBLE) {
+        return (double*)Scalars -> GetVoidPointer(0);
+    }
+    Buffer.resize(N);
+    for (vtkIdType id = 0; id < N; id++) Buffer[id] = Scalars -> GetTuple1(id);
+    return (N) ? &Buffer[0] : NULL;
+}
+
+// The plane kernels of MitoFilters.h on the float or double
+// divergence, used in place. Other types are converted to double.
+struct _mitoRealView {
+    const float *F;
+    const double *D;
+    std::vector<double> Buffer;
+    _mitoRealView(vtkDataArray *Scalars) : F(NULL), D(NULL) {
+        if (Scalars -> GetDataType() == VTK_FLOAT) {
+            F = (float*)Scalars -> GetVoidPointer(0);
+        } else {
+            D = GetScalarsAsDouble(Scalars,Buffer);
+        }
+    }
+    void GetPlaneStats(const int *Dim, _mitoPlaneStats &Stats) const {
+        if (F) Stats.Compute(F,Dim); else Stats.Compute(D,Dim);
+    }
+    void Threshold(const int *Dim, const std::vector<double> &T, unsigned char *B) const {
+        if (F) ThresholdPlanes(F,Dim,T,B); else ThresholdPlanes(D,Dim,T,B);
+    }
+    void Vote(const int *Dim, const std::vector< std::vector<double> > &T, unsigned char *B) const {
+        if (F) VotePlanes(F,Dim,T,B); else VotePlanes(D,Dim,T,B);
+    }
+};
+
 void ScalePolyData(vtkSmartPointer<vtkPolyData> PolyData, _mitoObject *mitoObject) {
     double r[3];
     vtkPoints *Points = PolyData -> GetPoints();
     for (vtkIdType id = 0; id < Points -> GetNumberOfPoints(); id++) {
         Points -> GetPoint(id,r);
-        Points -> SetPoint(id,_dxy*(r[0]+mitoObject->Ox),_dxy*(r[1]+mitoObject->Oy),_dz*(r[2]+mitoObject->Oz));
+        Points -> SetPoint(id,mitoObject->_dxy*(r[0]+mitoObject->Ox),mitoObject->_dxy*(r[1]+mitoObject->Oy),mitoObject->_dz*(r[2]+mitoObject->Oz));
     }
     Points -> Modified();
 }
@@ -272,32 +488,42 @@ int PoissonGen(double mu) {
     return k;
 }
 
-int ScanFolderForThisExtension(std::string _root, std::string ext, std::vector<std::string> *List) {
-    DIR *dir;
-    int ext_p;
-    struct dirent *ent;
-    std::string _dir_name;
-    if ((dir = opendir (_root.c_str())) != NULL) {
-      while ((ent = readdir (dir)) != NULL) {
-        _dir_name = std::string(ent->d_name);
-        ext_p = (int)_dir_name.find(ext);
-        if (ext_p > 0) {
-            #ifdef DEBUG
-                // Debug output removed
-            #endif
-            List -> push_back(std::string(_root)+_dir_name.substr(0,ext_p));
-        }
-      }
-      closedir (dir);
+/* ================================================================
+   I/O ROUTINES
+=================================================================*/
+
+vtkSmartPointer<vtkImageData> ReadMappedStack(const _mitoStack &Stack, int z0, int z1) {
+
+    vtkSmartPointer<vtkImageData> Image = vtkSmartPointer<vtkImageData>::New();
+    Image -> SetDimensions(Stack.Dim[0],Stack.Dim[1],z1-z0+1);
+    Image -> SetSpacing(1,1,1);
+    Image -> SetOrigin(0,0,0);
+
+    vtkSmartPointer<vtkDataArray> Scalars;
+    if (Stack.BitsPerSample == 8) {
+        Scalars = vtkSmartPointer<vtkUnsignedCharArray>::New();
     } else {
-      return EXIT_FAILURE;
+        Scalars = vtkSmartPointer<vtkUnsignedShortArray>::New();
     }
-    return EXIT_SUCCESS;
+    Scalars -> SetNumberOfComponents(1);
+    Scalars -> SetNumberOfTuples((vtkIdType)Stack.Dim[0]*Stack.Dim[1]*(z1-z0+1));
+    Stack.ReadPlanes(z0,z1,Scalars->GetVoidPointer(0));
+    Scalars -> Modified();
+
+    Image -> GetPointData() -> SetScalars(Scalars);
+    return Image;
 }
 
-/* ================================================================
-   I/O ROUTINES
-=================================================================*/
+// Raw planes [za,zb] of the TIFF stack, from the memory-mapped
+// stack when there is one.
+static vtkSmartPointer<vtkImageData> ReadPlanes(vtkTIFFReader *TIFFReader, const _mitoStack *Stack, int *Dim, int za, int zb) {
+    if (Stack) {
+        return ReadMappedStack(*Stack,za,zb);
+    }
+    int ext[6] = {0,Dim[0]-1,0,Dim[1]-1,za,zb};
+    TIFFReader -> UpdateExtent(ext);
+    return TIFFReader -> GetOutput();
+}
 
 void ExportMaxProjection(vtkSmartPointer<vtkImageData> Image, const char FileName[]) {
 
@@ -313,19 +539,27 @@ void ExportMaxProjection(vtkSmartPointer<vtkImageData> Image, const char FileNam
     vtkSmartPointer<vtkUnsignedCharArray> MaxPArray = vtkSmartPointer<vtkUnsignedCharArray>::New();
     MaxPArray -> SetNumberOfComponents(1);
     MaxPArray -> SetNumberOfTuples(N);
+    unsigned char *P = MaxPArray -> GetPointer(0);
 
-    int x, y, z;
-    double v, vproj;
-    for (x = Dim[0]; x--;) {
-        for (y = Dim[1]; y--;) {
-            vproj = 0;
-            for (z = Dim[2]; z--;) {
-                v = Image -> GetScalarComponentAsFloat(x,y,z,0);
-                vproj = (v > vproj) ? v : vproj;
+    // Plane after plane, following the layout of the volume
+    int z;
+    vtkIdType id;
+    vtkDataArray *Scalars = Image -> GetPointData() -> GetScalars();
+    if (Scalars -> GetDataType() == VTK_UNSIGNED_CHAR) {
+        const unsigned char *S = (unsigned char*)Scalars -> GetVoidPointer(0);
+        for (id = N; id--;) P[id] = 0;
+        for (z = 0; z < Dim[2]; z++, S += N) {
+            for (id = N; id--;) P[id] = (S[id] > P[id]) ? S[id] : P[id];
+        }
+    } else {
+        std::vector<float> Proj(N,0.0);
+        for (z = 0; z < Dim[2]; z++) {
+            for (id = N; id--;) {
+                float v = (float)Scalars -> GetTuple1(id+z*N);
+                Proj[id] = (v > Proj[id]) ? v : Proj[id];
             }
-            double point[3] = {(double)x, (double)y, 0.0};
-            MaxPArray -> SetTuple1(MaxP->FindPoint(point),(unsigned char)vproj);
         }
+        for (id = N; id--;) P[id] = (unsigned char)Proj[id];
     }
     MaxPArray -> Modified();
 
@@ -351,6 +585,60 @@ void ExportMaxProjection(vtkSmartPointer<vtkImageData> Image, const char FileNam
 
 }
 
+// Planes read at a time by the -checkonly preview
+#define MITO_PREVIEW_SLAB 16
+
+// Image panels of the -checkonly preview, W x H pixels each. A pixel
+// is the maximum of bin x bin voxels of the raw stack, before the
+// 8-bit conversion, which is applied once all planes are read.
+struct _mitoPreview {
+    int W, H, bin;
+    int Bottom[2], Top[2];      // planes of the bottom and top projections
+    double range[2];            // intensity range of the whole stack
+    std::vector<int> Column;    // pixel column of each x
+    std::vector<float> Total, First, Last, PBottom, PTop;
+};
+
+// Maximum of the row R of Dim0 voxels into the pixels of row P
+template <typename T> static void AddPreviewRow(const T *R, int Dim0, const int *Column, float *P) {
+    for (int x = 0; x < Dim0; x++) {
+        float v = (float)R[x];
+        if (v > P[Column[x]]) P[Column[x]] = v;
+    }
+}
+
+// Adds the planes [za,zb] of the stack, whose voxels are S, to the
+// panels of Preview
+template <typename T> static void AddPreviewPlanes(const T *S, const int *Dim, int za, int zb, _mitoPreview &Preview) {
+    const int *Column = &Preview.Column[0];
+    for (int z = za; z <= zb; z++) {
+        bool bottom = (z >= Preview.Bottom[0] && z <= Preview.Bottom[1]);
+        bool top = (z >= Preview.Top[0] && z <= Preview.Top[1]);
+        for (int y = 0; y < Dim[1]; y++) {
+            const T *R = S + ((vtkIdType)(z-za)*Dim[1] + y) * Dim[0];
+            vtkIdType row = (vtkIdType)(y/Preview.bin) * Preview.W;
+            for (int x = 0; x < Dim[0]; x++) {
+                double v = (double)R[x];
+                Preview.range[0] = (v < Preview.range[0]) ? v : Preview.range[0];
+                Preview.range[1] = (v > Preview.range[1]) ? v : Preview.range[1];
+            }
+            AddPreviewRow(R,Dim[0],Column,&Preview.Total[row]);
+            if (z == 0) AddPreviewRow(R,Dim[0],Column,&Preview.First[row]);
+            if (z == Dim[2]-1) AddPreviewRow(R,Dim[0],Column,&Preview.Last[row]);
+            if (bottom) AddPreviewRow(R,Dim[0],Column,&Preview.PBottom[row]);
+            if (top) AddPreviewRow(R,Dim[0],Column,&Preview.PTop[row]);
+        }
+    }
+}
+
+// 8-bit value of the raw intensity v, converted as Convert16To8bit
+// does with the intensity range of the whole stack
+static unsigned char GetPreviewValue(double v, const double *range, int type) {
+    if (type == VTK_UNSIGNED_CHAR) return (unsigned char)v;
+    if (range[1] <= range[0]) return 0;
+    return (unsigned char)(255.0 * (v-range[0]) / (range[1]-range[0]));
+}
+
 void ExportDetailedMaxProjection(_mitoObject *mitoObject) {
 
     // =======================================================================================
@@ -369,191 +657,166 @@ void ExportDetailedMaxProjection(_mitoObject *mitoObject) {
         printf("Saving Detailed Max projection...\n");
     #endif
 
+    // The planes are read a slab at a time, from the memory-mapped
+    // stack with -mmap, and accumulated into all the panels at once
+    int Dim[3];
+    _mitoStack MappedStack, *Stack = NULL;
     vtkSmartPointer<vtkTIFFReader> TIFFReader = vtkSmartPointer<vtkTIFFReader>::New();
-    int errlog = TIFFReader -> CanReadFile((mitoObject->FileName+".tif").c_str());
-    // File cannot be opened
-    if (!errlog) {
-
-        printf("File %s connot be opened.\n",(mitoObject->FileName+".tif").c_str());
-
-    } else {
-
-        // Loading TIFF File
+    if ( mitoObject->_mmap_input && MappedStack.Open(mitoObject->FileName+".tif") ) {
+        Stack = &MappedStack;
+        Dim[0] = Stack->Dim[0]; Dim[1] = Stack->Dim[1]; Dim[2] = Stack->Dim[2];
+    } else if ( TIFFReader -> CanReadFile((mitoObject->FileName+".tif").c_str()) ) {
         TIFFReader -> SetFileName((mitoObject->FileName+".tif").c_str());
-        TIFFReader -> Update();
-        vtkSmartPointer<vtkImageData> Image = TIFFReader -> GetOutput();
-
-        //16bit to 8bit Conversion
-        Image = Convert16To8bit(Image);
+        TIFFReader -> UpdateInformation();
+        int *Ext = TIFFReader -> GetDataExtent();
+        Dim[0] = Ext[1]-Ext[0]+1; Dim[1] = Ext[3]-Ext[2]+1; Dim[2] = Ext[5]-Ext[4]+1;
+    } else {
+        printf("File %s connot be opened.\n",(mitoObject->FileName+".tif").c_str());
+        return;
+    }
+    if ( Dim[0] < 1 || Dim[1] < 1 || Dim[2] < 1 ) {
+        printf("File %s cannot be read.\n",(mitoObject->FileName+".tif").c_str());
+        return;
+    }
 
-        // Loading PolyData Surface
+    // Loading PolyData Surface, none with -surface off
+    vtkSmartPointer<vtkPolyData> Surface = vtkSmartPointer<vtkPolyData>::New();
+    if (mitoObject->_surface != MITO_SURFACE_OFF) {
         vtkSmartPointer<vtkPolyDataReader> PolyDaTaReader = vtkSmartPointer<vtkPolyDataReader>::New();
         PolyDaTaReader -> SetFileName((mitoObject->FileName+"_mitosurface.vtk").c_str());
         PolyDaTaReader -> Update();
-        vtkSmartPointer<vtkPolyData> Surface = PolyDaTaReader -> GetOutput();
-
-        // Loading Skeleton
-        vtkSmartPointer<vtkPolyDataReader> PolyDaTaReaderSkell = vtkSmartPointer<vtkPolyDataReader>::New();
-        PolyDaTaReaderSkell -> SetFileName((mitoObject->FileName+"_skeleton.vtk").c_str());
-        PolyDaTaReaderSkell -> Update();
-        vtkSmartPointer<vtkPolyData> Skeleton = PolyDaTaReaderSkell -> GetOutput();
-
-        #ifdef DEBUG
-            printf("\t#Points [%s] = %d\n",(mitoObject->FileName+"_mitosurface.vtk").c_str(),(int)Surface->GetNumberOfPoints());
-            printf("\t#Points [%s] = %d\n",(mitoObject->FileName+"_skeleton.vtk").c_str(),(int)Skeleton->GetNumberOfPoints());
-        #endif
-
-        // Stack Dimensions
-        int *Dim = Image -> GetDimensions();
-        
-        #ifdef DEBUG
-            // Debug output removed
-        #endif
-
-        // Surface Bounds
-        double *Bounds = Surface -> GetBounds();
-
-        int zi = round(Bounds[4]/_dz); zi -= (zi>1) ? 1 : 0;
-        int zf = round(Bounds[5]/_dz); zf += (zi<Dim[2]-1) ? 1 : 0;
-
-        #ifdef DEBUG
-            // Debug output removed
-        #endif
-
-        // Plane
-        vtkSmartPointer<vtkImageData> Plane = vtkSmartPointer<vtkImageData>::New();
-        Plane -> SetDimensions(5*Dim[0],2*Dim[1],1);
-        vtkIdType N = 10 * Dim[0] * Dim[1];
+        Surface = PolyDaTaReader -> GetOutput();
+    }
 
-        // Scalar VEctor
-        vtkSmartPointer<vtkUnsignedCharArray> MaxPArray = vtkSmartPointer<vtkUnsignedCharArray>::New();
-        MaxPArray -> SetNumberOfComponents(1);
-        MaxPArray -> SetNumberOfTuples(N);
-        double range[2];
-        Image -> GetScalarRange(range);
-        MaxPArray -> FillComponent(0,range[0]);
+    // Loading Skeleton
+    vtkSmartPointer<vtkPolyDataReader> PolyDaTaReaderSkell = vtkSmartPointer<vtkPolyDataReader>::New();
+    PolyDaTaReaderSkell -> SetFileName((mitoObject->FileName+"_skeleton.vtk").c_str());
+    PolyDaTaReaderSkell -> Update();
+    vtkSmartPointer<vtkPolyData> Skeleton = PolyDaTaReaderSkell -> GetOutput();
 
-        #ifdef DEBUG
-            // Debug output removed
-        #endif
+    #ifdef DEBUG
+        printf("\t#Points [%s] = %d\n",(mitoObject->FileName+"_mitosurface.vtk").c_str(),(int)Surface->GetNumberOfPoints());
+        printf("\t#Points [%s] = %d\n",(mitoObject->FileName+"_skeleton.vtk").c_str(),(int)Skeleton->GetNumberOfPoints());
+    #endif
 
-        //Max Projection bottom
-        int x, y, z;
-        double v, vproj;
-        for (x = Dim[0]; x--;) {
-            for (y = Dim[1]; y--;) {
-                vproj = 0;
-                for (z = zi; z <= zi+8; z++) {
-                    v = Image -> GetScalarComponentAsFloat(x,y,z,0);
-                    vproj = (v > vproj) ? v : vproj;
-                }
-                double point[3] = {(double)(x+2*Dim[0]), (double)y, 0.0};
-                MaxPArray -> SetTuple1(Plane->FindPoint(point),(unsigned char)vproj);
-            }
+    // Surface Bounds, or skeleton bounds without a surface
+    double *Bounds = (Surface -> GetNumberOfPoints()) ? Surface -> GetBounds() : Skeleton -> GetBounds();
+
+    int zi = round(Bounds[4]/mitoObject->_dz); zi -= (zi>1) ? 1 : 0;
+    int zf = round(Bounds[5]/mitoObject->_dz); zf += (zf<Dim[2]-1) ? 1 : 0;
+
+    _mitoPreview Preview;
+    Preview.bin = std::max(1,mitoObject->_checkonly_bin);
+    Preview.W = (Dim[0] + Preview.bin - 1) / Preview.bin;
+    Preview.H = (Dim[1] + Preview.bin - 1) / Preview.bin;
+    Preview.Bottom[0] = std::min(std::max(zi,0),Dim[2]-1);
+    Preview.Bottom[1] = std::min(std::max(zi+8,0),Dim[2]-1);
+    Preview.Top[0] = std::min(std::max(zf-8,0),Dim[2]-1);
+    Preview.Top[1] = std::min(std::max(zf,0),Dim[2]-1);
+    Preview.range[0] = DBL_MAX;
+    Preview.range[1] = -DBL_MAX;
+    Preview.Column.resize(Dim[0]);
+    for (int x = 0; x < Dim[0]; x++) Preview.Column[x] = x / Preview.bin;
+    vtkIdType NP = (vtkIdType)Preview.W * Preview.H;
+    Preview.Total.assign(NP,-1.0);
+    Preview.First.assign(NP,-1.0);
+    Preview.Last.assign(NP,-1.0);
+    Preview.PBottom.assign(NP,-1.0);
+    Preview.PTop.assign(NP,-1.0);
+
+    int type = VTK_VOID;
+    for (int za = 0; za < Dim[2]; za += MITO_PREVIEW_SLAB) {
+        int zb = std::min(za+MITO_PREVIEW_SLAB,Dim[2]) - 1;
+        vtkSmartPointer<vtkImageData> Part = ReadPlanes(TIFFReader,Stack,Dim,za,zb);
+        vtkDataArray *Scalars = (Part) ? Part -> GetPointData() -> GetScalars() : NULL;
+        if ( !Scalars || Scalars -> GetNumberOfTuples() < (vtkIdType)Dim[0]*Dim[1]*(zb-za+1) ) {
+            printf("File %s cannot be read.\n",(mitoObject->FileName+".tif").c_str());
+            return;
         }
-        //Max Projection top
-        for (x = Dim[0]; x--;) {
-            for (y = Dim[1]; y--;) {
-                vproj = 0;
-                for (z = zf-8; z <= zf; z++) {
-                    v = Image -> GetScalarComponentAsFloat(x,y,z,0);
-                    vproj = (v > vproj) ? v : vproj;
-                }
-                double point[3] = {(double)(x+2*Dim[0]), (double)(y+Dim[1]), 0.0};
-                MaxPArray -> SetTuple1(Plane->FindPoint(point),(unsigned char)vproj);
-            }
+        type = Scalars -> GetDataType();
+        if (type == VTK_UNSIGNED_CHAR) {
+            AddPreviewPlanes((unsigned char*)Scalars->GetVoidPointer(0),Dim,za,zb,Preview);
+        } else if (type == VTK_UNSIGNED_SHORT) {
+            AddPreviewPlanes((unsigned short*)Scalars->GetVoidPointer(0),Dim,za,zb,Preview);
+        } else {
+            printf("Format not supported.\n");
+            return;
         }
+    }
 
-        // Partial surface Projection
-        double r[3];
-        for (vtkIdType id=0; id < Surface -> GetPoints() -> GetNumberOfPoints(); id++) {
-            Surface -> GetPoints() -> GetPoint(id,r);
-            x = round(r[0]/_dxy);
-            y = round(r[1]/_dxy);
-            z = round(r[2]/_dz);
-            if ( z >= zi && z <= zi+8 ) {
-                double point[3] = {(double)(x+3*Dim[0]), (double)y, 0.0};
-                MaxPArray -> SetTuple1(Plane->FindPoint(point),255);
-            }
-            if ( z >= zf-8 && z <= zf ) {
-                double point2[3] = {(double)(x+3*Dim[0]), (double)(y+Dim[1]), 0.0};
-                MaxPArray -> SetTuple1(Plane->FindPoint(point2),255);
-            }
-        }
+    // Plane
+    int W = Preview.W, H = Preview.H;
+    vtkSmartPointer<vtkImageData> Plane = vtkSmartPointer<vtkImageData>::New();
+    Plane -> SetDimensions(5*W,2*H,1);
+    vtkIdType N = 10 * NP;
 
-        // Complete surface Projection
-        for (vtkIdType id=0; id < Surface -> GetPoints() -> GetNumberOfPoints(); id++) {
-            Surface -> GetPoints() -> GetPoint(id,r);
-            x = round(r[0]/_dxy);
-            y = round(r[1]/_dxy);
-            z = round(r[2]/_dz);
-            double point[3] = {(double)x, (double)y, 0.0};
-            MaxPArray -> SetTuple1(Plane->FindPoint(point),255);
+    // Scalar VEctor
+    vtkSmartPointer<vtkUnsignedCharArray> MaxPArray = vtkSmartPointer<vtkUnsignedCharArray>::New();
+    MaxPArray -> SetNumberOfComponents(1);
+    MaxPArray -> SetNumberOfTuples(N);
+    unsigned char *P = MaxPArray -> GetPointer(0);
+    unsigned char background = GetPreviewValue(Preview.range[0],Preview.range,type);
+    for (vtkIdType id = N; id--;) P[id] = background;
+
+    // Image panels: column c and row r of the grid above
+    const std::vector<float> *Panel[6] = {&Preview.Total,&Preview.First,&Preview.Last,&Preview.PBottom,&Preview.PTop,NULL};
+    const int PanelColumn[5] = {0,1,1,2,2};
+    const int PanelRow[5] = {1,0,1,0,1};
+    for (int k = 0; Panel[k]; k++) {
+        const float *V = &(*Panel[k])[0];
+        for (int y = 0; y < H; y++) {
+            unsigned char *R = P + (vtkIdType)(y+PanelRow[k]*H)*5*W + PanelColumn[k]*W;
+            for (int x = 0; x < W; x++) {
+                R[x] = GetPreviewValue(V[x+(vtkIdType)y*W],Preview.range,type);
+            }
         }
+    }
 
-        // Partial skeleton Projection
-        for (vtkIdType id=0; id < Skeleton -> GetPoints() -> GetNumberOfPoints(); id++) {
-            Skeleton -> GetPoints() -> GetPoint(id,r);
-            x = round(r[0]/_dxy);
-            y = round(r[1]/_dxy);
-            z = round(r[2]/_dz);
+    // Surface and skeleton points: the whole surface goes to the first
+    // panel, the points of the top and bottom planes to the others
+    int x, y, z;
+    double r[3];
+    vtkPoints *Points[2] = {Surface -> GetPoints(), Skeleton -> GetPoints()};
+    vtkIdType NPoints[2] = {Surface -> GetNumberOfPoints(), Skeleton -> GetNumberOfPoints()};
+    for (int k = 0; k < 2; k++) {
+        for (vtkIdType id = 0; id < NPoints[k]; id++) {
+            Points[k] -> GetPoint(id,r);
+            x = round(r[0]/mitoObject->_dxy);
+            y = round(r[1]/mitoObject->_dxy);
+            z = round(r[2]/mitoObject->_dz);
+            if ( x < 0 || x >= Dim[0] || y < 0 || y >= Dim[1] ) continue;
+            x /= Preview.bin;
+            y /= Preview.bin;
+            if ( k == 0 ) {
+                P[x+(vtkIdType)y*5*W] = 255;
+            }
             if ( z >= zi && z <= zi+8 ) {
-                double point[3] = {(double)(x+4*Dim[0]), (double)y, 0.0};
-                MaxPArray -> SetTuple1(Plane->FindPoint(point),255);
+                P[x+(3+k)*W+(vtkIdType)y*5*W] = 255;
             }
             if ( z >= zf-8 && z <= zf ) {
-                double point2[3] = {(double)(x+4*Dim[0]), (double)(y+Dim[1]), 0.0};
-                MaxPArray -> SetTuple1(Plane->FindPoint(point2),255);
+                P[x+(3+k)*W+(vtkIdType)(y+H)*5*W] = 255;
             }
         }
+    }
 
-        //Complete max projection
-        for (x = Dim[0]; x--;) {
-            for (y = Dim[1]; y--;) {
-                vproj = 0;
-                for (z = 0; z < Dim[2]; z++) {
-                    v = Image -> GetScalarComponentAsFloat(x,y,z,0);
-                    vproj = (v > vproj) ? v : vproj;
-                }
-                double point[3] = {(double)x, (double)(y+Dim[1]), 0.0};
-                MaxPArray -> SetTuple1(Plane->FindPoint(point),(unsigned char)vproj);
-            }
-        }
-
-        //First and last slice
-        for (x = Dim[0]; x--;) {
-            for (y = Dim[1]; y--;) {
-                v = Image -> GetScalarComponentAsFloat(x,y,0,0);
-                double point1[3] = {(double)(x+Dim[1]), (double)y, 0.0};
-                MaxPArray -> SetTuple1(Plane->FindPoint(point1),(unsigned char)v);
-                v = Image -> GetScalarComponentAsFloat(x,y,Dim[2]-1,0);
-                double point2[3] = {(double)(x+Dim[1]), (double)(y+Dim[1]), 0.0};
-                MaxPArray -> SetTuple1(Plane->FindPoint(point2),(unsigned char)v);
-            }
-        }
-
-        MaxPArray -> Modified();
-
-        Plane -> GetPointData() -> SetScalars(MaxPArray);
-
-        // Apply vertical flip specifically for PNG output
-        vtkSmartPointer<vtkImageFlip> FlipDetailed = vtkSmartPointer<vtkImageFlip>::New();
-        FlipDetailed -> SetInputData(Plane);
-        FlipDetailed -> SetFilteredAxis(1);
-        FlipDetailed -> PreserveImageExtentOn();
-        FlipDetailed -> Update();
+    MaxPArray -> Modified();
 
-        // Saving PNG File
-        vtkSmartPointer<vtkPNGWriter> PNGWriter = vtkSmartPointer<vtkPNGWriter>::New();
-        PNGWriter -> SetFileName((mitoObject->FileName+"_detailed.png").c_str());
-        PNGWriter -> SetFileDimensionality(2);
-        PNGWriter -> SetCompressionLevel(0);
-        PNGWriter -> SetInputData(FlipDetailed->GetOutput());
-        PNGWriter -> Write();
+    Plane -> GetPointData() -> SetScalars(MaxPArray);
 
-        // Debug output removed
+    // Apply vertical flip specifically for PNG output
+    vtkSmartPointer<vtkImageFlip> FlipDetailed = vtkSmartPointer<vtkImageFlip>::New();
+    FlipDetailed -> SetInputData(Plane);
+    FlipDetailed -> SetFilteredAxis(1);
+    FlipDetailed -> PreserveImageExtentOn();
+    FlipDetailed -> Update();
 
-    }
+    // Saving PNG File
+    vtkSmartPointer<vtkPNGWriter> PNGWriter = vtkSmartPointer<vtkPNGWriter>::New();
+    PNGWriter -> SetFileName((mitoObject->FileName+"_detailed.png").c_str());
+    PNGWriter -> SetFileDimensionality(2);
+    PNGWriter -> SetCompressionLevel(0);
+    PNGWriter -> SetInputData(FlipDetailed->GetOutput());
+    PNGWriter -> Write();
 
     #ifdef DEBUG
         // Debug output removed
@@ -609,16 +872,49 @@ void ExportConfigFile(const _mitoObject mitoObject) {
     } else {
         fprintf(f,"Smart Component Filtering: %s\n",_f);
     }
-    fprintf(f,"Pixel size: -xy %1.4fum, -z %1.4fum\n",_dxy,_dz);
-    fprintf(f,"Average tubule radius: -r %1.4fum\n",_rad);
+    fprintf(f,"Pixel size: -xy %1.4fum, -z %1.4fum\n",mitoObject._dxy,mitoObject._dz);
+    fprintf(f,"Average tubule radius: -r %1.4fum\n",mitoObject._rad);
     fprintf(f,"Scales: -scales %1.2f",mitoObject._sigmai);
     for ( double sigma = mitoObject._sigmai+mitoObject._dsigma; sigma < mitoObject._sigmaf+0.5*mitoObject._dsigma; sigma += mitoObject._dsigma )
         fprintf(f," %1.2f",sigma);
-    fprintf(f,"\nPost-divergence threshold: -threshold %1.5f\n",_div_threshold);
+    fprintf(f,"\nPost-divergence threshold: -threshold %1.5f\n",mitoObject._div_threshold);
     fprintf(f,"Input type: %s\n",mitoObject.Type.c_str());
     fprintf(f,"Analyze: %s\n",mitoObject._analyze?_t:_f);
     fprintf(f,"Binary input: %s\n",mitoObject._binary_input?_t:_f);
     fprintf(f,"Z-Adaptive: %s\n",mitoObject._z_adaptive?_t:_f);
+    if (mitoObject._stream_slab > 0) {
+        fprintf(f,"Stream slab: -stream-slab %d\n",mitoObject._stream_slab);
+    }
+    if (mitoObject._surface != MITO_SURFACE_CONTOUR) {
+        const char *Surfaces[4] = {"contour","flyingedges","narrowband","off"};
+        fprintf(f,"Surface: -surface %s\n",Surfaces[mitoObject._surface]);
+    }
+    if (mitoObject._width_dt || mitoObject._surface == MITO_SURFACE_OFF) {
+        fprintf(f,"Tubule width: -width dt\n");
+    }
+    if (mitoObject._device == MITO_DEVICE_GPU) {
+        fprintf(f,"Device: -device gpu\n");
+    }
+    if (mitoObject._storage_double) {
+        fprintf(f,"Storage: -storage double\n");
+    }
+    if (mitoObject._fill_holes_flood) {
+        fprintf(f,"Hole filling: -fill-holes-flood\n");
+    }
+    if (mitoObject._eigen_jacobi) {
+        fprintf(f,"Hessian eigenvalues: -eigen-jacobi\n");
+    }
+    if (mitoObject._cache_stages) {
+        fprintf(f,"Stage cache: -cache-stages\n");
+    }
+    if (!mitoObject.Sweep.empty()) {
+        fprintf(f,"Sweep output sets:");
+        for (size_t i = 0; i < mitoObject.Sweep.size(); i++) fprintf(f," %s",mitoObject.Sweep[i].Suffix.c_str());
+        fprintf(f,"%s\n",mitoObject._sweep_cache?" (-sweep-cache)":"");
+    }
+    if (mitoObject._output_binary) {
+        fprintf(f,"Output format: -output-format %s%s\n",mitoObject._output_text?"both":"binary",mitoObject._output_compress?" -output-compress":"");
+    }
     time_t now = time(0);
     fprintf(f,"%s\n",ctime(&now));
     fclose(f);
@@ -643,7 +939,7 @@ vtkSmartPointer<vtkImageData> Convert16To8bit(vtkSmartPointer<vtkImageData> Imag
             // Debug output removed
         #endif
 
-        vtkSmartPointer<vtkImageData> Image8 = vtkImageData::New();
+        vtkSmartPointer<vtkImageData> Image8 = vtkSmartPointer<vtkImageData>::New();
         Image8 -> ShallowCopy(Image);
 
         vtkDataArray *ScalarsShort = Image -> GetPointData() -> GetScalars();
@@ -690,7 +986,7 @@ vtkSmartPointer<vtkImageData> Convert16To8bitZAdaptive(vtkSmartPointer<vtkImageD
             // Debug output removed
 
         int *Dim = Image -> GetDimensions();
-        vtkSmartPointer<vtkImageData> Image8 = vtkImageData::New();
+        vtkSmartPointer<vtkImageData> Image8 = vtkSmartPointer<vtkImageData>::New();
         Image8 -> ShallowCopy(Image);
 
         vtkDataArray *ScalarsShort = Image -> GetPointData() -> GetScalars();
@@ -762,7 +1058,7 @@ vtkSmartPointer<vtkImageData> Convert16To8bitZAdaptiveBlocks(vtkSmartPointer<vtk
             // Debug output removed
 
         int *Dim = Image -> GetDimensions();
-        vtkSmartPointer<vtkImageData> Image8 = vtkImageData::New();
+        vtkSmartPointer<vtkImageData> Image8 = vtkSmartPointer<vtkImageData>::New();
         Image8 -> ShallowCopy(Image);
 
         vtkDataArray *ScalarsShort = Image -> GetPointData() -> GetScalars();
@@ -857,7 +1153,7 @@ vtkSmartPointer<vtkImageData> Convert16To8bitZAdaptiveGentle(vtkSmartPointer<vtk
             // Debug output removed
 
         int *Dim = Image -> GetDimensions();
-        vtkSmartPointer<vtkImageData> Image8 = vtkImageData::New();
+        vtkSmartPointer<vtkImageData> Image8 = vtkSmartPointer<vtkImageData>::New();
         Image8 -> ShallowCopy(Image);
 
         vtkDataArray *ScalarsShort = Image -> GetPointData() -> GetScalars();
@@ -958,7 +1254,7 @@ vtkSmartPointer<vtkImageData> Convert16To8bitZAdaptiveGentle(vtkSmartPointer<vtk
 
 vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToChar(vtkSmartPointer<vtkImageData> Image, double threshold) {
 
-    vtkSmartPointer<vtkImageData> Image8 = vtkImageData::New();
+    vtkSmartPointer<vtkImageData> Image8 = vtkSmartPointer<vtkImageData>::New();
     Image8 -> ShallowCopy(Image);
 
     vtkDataArray *ScalarsDouble = Image -> GetPointData() -> GetScalars();
@@ -996,7 +1292,7 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToChar(vtkSmartPointer<vtk
 
 vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZBlockSimple(vtkSmartPointer<vtkImageData> Image, double threshold, int z_block_size) {
 
-    vtkSmartPointer<vtkImageData> Image8 = vtkImageData::New();
+    vtkSmartPointer<vtkImageData> Image8 = vtkSmartPointer<vtkImageData>::New();
     Image8 -> ShallowCopy(Image);
 
     vtkDataArray *ScalarsDouble = Image -> GetPointData() -> GetScalars();
@@ -1011,6 +1307,13 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZBlockSimple(vtkSmar
         printf("Simple Z-block binarization: threshold=%.3f, z_block_size=%d, z_dim=%d\n", 
                threshold, z_block_size, Dim[2]);
     #endif
+
+    _mitoRealView V(ScalarsDouble);
+    _mitoPlaneStats Stats;
+    V.GetPlaneStats(Dim,Stats);
+
+    // Threshold of each z-plane
+    std::vector<double> T(Dim[2]);
     
     // Process z-planes in blocks, calculating local threshold for each block
     // Each z-block acts like its own independent segmentation
@@ -1024,17 +1327,7 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZBlockSimple(vtkSmar
         
         // Calculate the range for this z-block (after preprocessing)
         double block_min = DBL_MAX, block_max = DBL_MIN;
-        for (int z = z_start; z < z_end; z++) {
-            for (int x = 0; x < Dim[0]; x++) {
-                for (int y = 0; y < Dim[1]; y++) {
-                    double point[3] = {(double)x, (double)y, (double)z};
-                    vtkIdType id = Image -> FindPoint(point);
-                    double val = ScalarsDouble -> GetTuple1(id);
-                    if (val < block_min) block_min = val;
-                    if (val > block_max) block_max = val;
-                }
-            }
-        }
+        Stats.GetRange(z_start,z_end,block_min,block_max);
         
         // Calculate local threshold for this z-block
         // Map the user's threshold to the local intensity range of this block
@@ -1055,24 +1348,11 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZBlockSimple(vtkSmar
                    block_min, block_max, threshold, local_threshold);
         #endif
         
-        // Apply the local threshold to this z-block
-        for (int z = z_start; z < z_end; z++) {
-            for (int x = 0; x < Dim[0]; x++) {
-                for (int y = 0; y < Dim[1]; y++) {
-                    double point[3] = {(double)x, (double)y, (double)z};
-                    vtkIdType id = Image -> FindPoint(point);
-                    double val = ScalarsDouble -> GetTuple1(id);
-                    
-                    // Use the locally adapted threshold for this z-block
-                    if (val <= local_threshold) {
-                        ScalarsChar -> SetTuple1(id, 0);
-                    } else {
-                        ScalarsChar -> SetTuple1(id, 255);
-                    }
-                }
-            }
-        }
+        // Use the locally adapted threshold for this z-block
+        for (int z = z_start; z < z_end; z++) T[z] = local_threshold;
     }
+
+    V.Threshold(Dim,T,ScalarsChar->GetPointer(0));
     
     ScalarsChar -> Modified();
     Image8 -> GetPointData() -> SetScalars(ScalarsChar);
@@ -1081,7 +1361,7 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZBlockSimple(vtkSmar
 
 vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZBlockEnhanced(vtkSmartPointer<vtkImageData> Image, double threshold, int z_block_size) {
 
-    vtkSmartPointer<vtkImageData> Image8 = vtkImageData::New();
+    vtkSmartPointer<vtkImageData> Image8 = vtkSmartPointer<vtkImageData>::New();
     Image8 -> ShallowCopy(Image);
 
     vtkDataArray *ScalarsDouble = Image -> GetPointData() -> GetScalars();
@@ -1096,44 +1376,27 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZBlockEnhanced(vtkSm
         printf("Enhanced Z-block binarization: threshold=%.3f, z_block_size=%d, z_dim=%d\n", 
                threshold, z_block_size, Dim[2]);
     #endif
+
+    // Single pass over the voxels, the statistics of the overlapping
+    // blocks are then assembled from the z-planes
+    _mitoRealView V(ScalarsDouble);
+    _mitoPlaneStats Stats;
+    V.GetPlaneStats(Dim,Stats);
     
-    // First pass: Calculate global statistics for reference
+    // Global statistics for reference
     double global_min = DBL_MAX, global_max = DBL_MIN;
-    double global_sum = 0.0;
-    int global_count = 0;
+    Stats.GetRange(0,Dim[2],global_min,global_max);
     
-    for (int x = 0; x < Dim[0]; x++) {
-        for (int y = 0; y < Dim[1]; y++) {
-            for (int z = 0; z < Dim[2]; z++) {
-                double point[3] = {(double)x, (double)y, (double)z};
-                vtkIdType id = Image -> FindPoint(point);
-                double val = ScalarsDouble -> GetTuple1(id);
-                if (val < global_min) global_min = val;
-                if (val > global_max) global_max = val;
-                global_sum += val;
-                global_count++;
-            }
-        }
-    }
-    
-    double global_mean = global_sum / global_count;
     double global_range = global_max - global_min;
     double global_threshold = global_min + (global_range * threshold);
     
     #ifdef DEBUG
         printf("\tGlobal stats: range=[%.3f-%.3f], mean=%.3f, global_threshold=%.3f\n", 
-               global_min, global_max, global_mean, global_threshold);
+               global_min, global_max, Stats.GetSum(0,Dim[2]) / Stats.GetCount(0,Dim[2]), global_threshold);
     #endif
     
-    // Initialize result array with zeros and create a vote count array
-    vtkSmartPointer<vtkUnsignedCharArray> VoteCount = vtkSmartPointer<vtkUnsignedCharArray>::New();
-    VoteCount -> SetNumberOfComponents(1);
-    VoteCount -> SetNumberOfTuples(N);
-    
-    for (vtkIdType id = 0; id < N; id++) {
-        ScalarsChar -> SetTuple1(id, 0);
-        VoteCount -> SetTuple1(id, 0);
-    }
+    // Thresholds of the blocks that vote for each z-plane
+    std::vector< std::vector<double> > T(Dim[2]);
     
     // Process z-planes with overlapping blocks
     // Use smaller overlap to reduce computational load and improve consistency
@@ -1151,24 +1414,10 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZBlockEnhanced(vtkSm
         
         // Calculate block statistics
         double block_min = DBL_MAX, block_max = DBL_MIN;
-        double block_sum = 0.0, block_sum_sq = 0.0;
-        int block_count = 0;
-        
-        for (int z = z_start; z < z_end; z++) {
-            for (int x = 0; x < Dim[0]; x++) {
-                for (int y = 0; y < Dim[1]; y++) {
-                    double point[3] = {(double)x, (double)y, (double)z};
-                    vtkIdType id = Image -> FindPoint(point);
-                    double val = ScalarsDouble -> GetTuple1(id);
-                    
-                    if (val < block_min) block_min = val;
-                    if (val > block_max) block_max = val;
-                    block_sum += val;
-                    block_sum_sq += val * val;
-                    block_count++;
-                }
-            }
-        }
+        Stats.GetRange(z_start,z_end,block_min,block_max);
+        double block_sum = Stats.GetSum(z_start,z_end);
+        double block_sum_sq = Stats.GetSum2(z_start,z_end);
+        long long block_count = Stats.GetCount(z_start,z_end);
         
         double block_mean = block_sum / block_count;
         double block_variance = (block_sum_sq / block_count) - (block_mean * block_mean);
@@ -1251,26 +1500,8 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZBlockEnhanced(vtkSm
                    local_base_threshold, global_threshold, alpha, local_threshold);
         #endif
         
-        // Apply threshold with proper overlap voting
-        for (int z = z_start; z < z_end; z++) {
-            for (int x = 0; x < Dim[0]; x++) {
-                for (int y = 0; y < Dim[1]; y++) {
-                    double point[3] = {(double)x, (double)y, (double)z};
-                    vtkIdType id = Image -> FindPoint(point);
-                    double val = ScalarsDouble -> GetTuple1(id);
-                    
-                    // Increment vote count for this pixel (regardless of threshold result)
-                    unsigned char current_votes = VoteCount -> GetTuple1(id);
-                    VoteCount -> SetTuple1(id, current_votes + 1);
-                    
-                    if (val > local_threshold) {
-                        // Vote for foreground - increment positive votes
-                        unsigned char current_positive = ScalarsChar -> GetTuple1(id);
-                        ScalarsChar -> SetTuple1(id, current_positive + 1);
-                    }
-                }
-            }
-        }
+        // Every voxel of the block casts a vote against this threshold
+        for (int z = z_start; z < z_end; z++) T[z].push_back(local_threshold);
     }
     
     #ifdef DEBUG
@@ -1284,32 +1515,16 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZBlockEnhanced(vtkSm
             printf("\tNo blocks passed foreground detection - falling back to global thresholding\n");
         #endif
         
-        for (vtkIdType id = 0; id < N; id++) {
-            double val = ScalarsDouble -> GetTuple1(id);
-            if (val > global_threshold) {
-                ScalarsChar -> SetTuple1(id, 255);
-            } else {
-                ScalarsChar -> SetTuple1(id, 0);
-            }
-        }
+        V.Threshold(Dim,std::vector<double>(Dim[2],global_threshold),ScalarsChar->GetPointer(0));
         
         ScalarsChar -> Modified();
         Image8 -> GetPointData() -> SetScalars(ScalarsChar);
         return Image8;
     }
     
-    // Final pass: Convert vote counts to binary using majority voting
-    for (vtkIdType id = 0; id < N; id++) {
-        unsigned char positive_votes = ScalarsChar -> GetTuple1(id);
-        unsigned char total_votes = VoteCount -> GetTuple1(id);
-        
-        // Require at least 50% of votes to be positive for foreground classification
-        if (total_votes > 0 && positive_votes * 2 >= total_votes) {
-            ScalarsChar -> SetTuple1(id, 255);
-        } else {
-            ScalarsChar -> SetTuple1(id, 0);
-        }
-    }
+    // Convert votes to binary using majority voting: at least 50% of the
+    // votes must be positive for foreground classification
+    V.Vote(Dim,T,ScalarsChar->GetPointer(0));
     
     ScalarsChar -> Modified();
     Image8 -> GetPointData() -> SetScalars(ScalarsChar);
@@ -1321,7 +1536,7 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZAdaptive(vtkSmartPo
     // Debug output removed
 
     int *Dim = Image -> GetDimensions();
-    vtkSmartPointer<vtkImageData> Image8 = vtkImageData::New();
+    vtkSmartPointer<vtkImageData> Image8 = vtkSmartPointer<vtkImageData>::New();
     Image8 -> ShallowCopy(Image);
 
     vtkDataArray *ScalarsDouble = Image -> GetPointData() -> GetScalars();
@@ -1330,39 +1545,21 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZAdaptive(vtkSmartPo
     vtkSmartPointer<vtkUnsignedCharArray> ScalarsChar = vtkSmartPointer<vtkUnsignedCharArray>::New();
     ScalarsChar -> SetNumberOfComponents(1);
     ScalarsChar -> SetNumberOfTuples(N);
+
+    _mitoRealView V(ScalarsDouble);
+    _mitoPlaneStats Stats;
+    V.GetPlaneStats(Dim,Stats);
+
+    std::vector<double> T(Dim[2]);
     
     // Process each z-plane independently
     for (int z = 0; z < Dim[2]; z++) {
         
         // Calculate statistics for this z-plane
-        double z_sum = 0.0, z_mean = 0.0, z_std = 0.0;
         double z_min = DBL_MAX, z_max = DBL_MIN;
-        int z_pixels = Dim[0] * Dim[1];
-        
-        // First pass: calculate mean and range
-        for (int x = 0; x < Dim[0]; x++) {
-            for (int y = 0; y < Dim[1]; y++) {
-                double point[3] = {(double)x, (double)y, (double)z};
-                vtkIdType id = Image -> FindPoint(point);
-                double val = ScalarsDouble -> GetTuple1(id);
-                z_sum += val;
-                if (val < z_min) z_min = val;
-                if (val > z_max) z_max = val;
-            }
-        }
-        z_mean = z_sum / z_pixels;
-        
-        // Second pass: calculate standard deviation
-        double var_sum = 0.0;
-        for (int x = 0; x < Dim[0]; x++) {
-            for (int y = 0; y < Dim[1]; y++) {
-                double point[3] = {(double)x, (double)y, (double)z};
-                vtkIdType id = Image -> FindPoint(point);
-                double val = ScalarsDouble -> GetTuple1(id);
-                var_sum += (val - z_mean) * (val - z_mean);
-            }
-        }
-        z_std = sqrt(var_sum / z_pixels);
+        Stats.GetRange(z,z+1,z_min,z_max);
+        double z_mean, z_std;
+        Stats.GetMeanStd(z,z+1,z_mean,z_std);
         
         // Calculate adaptive threshold for this z-plane
         // Use mean + std deviation as threshold, scaled by base_threshold
@@ -1374,21 +1571,10 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZAdaptive(vtkSmartPo
         
                 // Debug output removed
         
-        // Apply threshold to this z-plane
-        for (int x = 0; x < Dim[0]; x++) {
-            for (int y = 0; y < Dim[1]; y++) {
-                double point[3] = {(double)x, (double)y, (double)z};
-                vtkIdType id = Image -> FindPoint(point);
-                double val = ScalarsDouble -> GetTuple1(id);
-                
-                if (val <= z_threshold) {
-                    ScalarsChar -> SetTuple1(id, 0);
-                } else {
-                    ScalarsChar -> SetTuple1(id, 255);
-                }
-            }
-        }
+        T[z] = z_threshold;
     }
+
+    V.Threshold(Dim,T,ScalarsChar->GetPointer(0));
     
     ScalarsChar -> Modified();
     Image8 -> GetPointData() -> SetScalars(ScalarsChar);
@@ -1400,7 +1586,7 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZAdaptiveConservativ
     // Debug output removed
 
     int *Dim = Image -> GetDimensions();
-    vtkSmartPointer<vtkImageData> Image8 = vtkImageData::New();
+    vtkSmartPointer<vtkImageData> Image8 = vtkSmartPointer<vtkImageData>::New();
     Image8 -> ShallowCopy(Image);
 
     vtkDataArray *ScalarsDouble = Image -> GetPointData() -> GetScalars();
@@ -1410,9 +1596,15 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZAdaptiveConservativ
     ScalarsChar -> SetNumberOfComponents(1);
     ScalarsChar -> SetNumberOfTuples(N);
     
+    _mitoRealView V(ScalarsDouble);
+    _mitoPlaneStats Stats;
+    V.GetPlaneStats(Dim,Stats);
+
+    std::vector<double> T(Dim[2]);
+
     // Calculate global threshold as reference
-    double global_range[2];
-    ScalarsDouble -> GetRange(global_range);
+    double global_range[2] = {DBL_MAX, -DBL_MAX};
+    Stats.GetRange(0,Dim[2],global_range[0],global_range[1]);
     double global_threshold = base_threshold;
     
     // Process z-planes in blocks to reduce noise sensitivity
@@ -1421,38 +1613,10 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZAdaptiveConservativ
         int z_end = (z_start + z_block_size < Dim[2]) ? z_start + z_block_size : Dim[2];
         
         // Calculate statistics for this z-block
-        double block_sum = 0.0, block_mean = 0.0, block_std = 0.0;
         double block_min = DBL_MAX, block_max = DBL_MIN;
-        int block_pixels = Dim[0] * Dim[1] * (z_end - z_start);
-        
-        // First pass: calculate mean and range for the block
-        for (int z = z_start; z < z_end; z++) {
-            for (int x = 0; x < Dim[0]; x++) {
-                for (int y = 0; y < Dim[1]; y++) {
-                    double point[3] = {(double)x, (double)y, (double)z};
-                    vtkIdType id = Image -> FindPoint(point);
-                    double val = ScalarsDouble -> GetTuple1(id);
-                    block_sum += val;
-                    if (val < block_min) block_min = val;
-                    if (val > block_max) block_max = val;
-                }
-            }
-        }
-        block_mean = block_sum / block_pixels;
-        
-        // Second pass: calculate standard deviation
-        double var_sum = 0.0;
-        for (int z = z_start; z < z_end; z++) {
-            for (int x = 0; x < Dim[0]; x++) {
-                for (int y = 0; y < Dim[1]; y++) {
-                    double point[3] = {(double)x, (double)y, (double)z};
-                    vtkIdType id = Image -> FindPoint(point);
-                    double val = ScalarsDouble -> GetTuple1(id);
-                    var_sum += (val - block_mean) * (val - block_mean);
-                }
-            }
-        }
-        block_std = sqrt(var_sum / block_pixels);
+        Stats.GetRange(z_start,z_end,block_min,block_max);
+        double block_mean, block_std;
+        Stats.GetMeanStd(z_start,z_end,block_mean,block_std);
         
         // Improved adaptive threshold that properly maps user's threshold to block statistics
         // The user's threshold should represent a percentile of the local intensity distribution
@@ -1529,22 +1693,10 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZAdaptiveConservativ
         // Debug output removed
         
         // Apply threshold to this z-block
-        for (int z = z_start; z < z_end; z++) {
-            for (int x = 0; x < Dim[0]; x++) {
-                for (int y = 0; y < Dim[1]; y++) {
-                    double point[3] = {(double)x, (double)y, (double)z};
-                    vtkIdType id = Image -> FindPoint(point);
-                    double val = ScalarsDouble -> GetTuple1(id);
-                    
-                    if (val <= adaptive_threshold) {
-                        ScalarsChar -> SetTuple1(id, 0);
-                    } else {
-                        ScalarsChar -> SetTuple1(id, 255);
-                    }
-                }
-            }
-        }
+        for (int z = z_start; z < z_end; z++) T[z] = adaptive_threshold;
     }
+
+    V.Threshold(Dim,T,ScalarsChar->GetPointer(0));
     
     ScalarsChar -> Modified();
     Image8 -> GetPointData() -> SetScalars(ScalarsChar);
@@ -1552,7 +1704,7 @@ vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZAdaptiveConservativ
 }
 
 // Enhanced structural connectivity function with advanced algorithms
-vtkSmartPointer<vtkImageData> EnhanceStructuralConnectivity(vtkSmartPointer<vtkImageData> Image, double sigma = 1.0) {
+vtkSmartPointer<vtkImageData> EnhanceStructuralConnectivity(vtkSmartPointer<vtkImageData> Image, double sigma, bool scale_space) {
     #ifdef DEBUG
         printf("Applying strong structural connectivity enhancement...\n");
     #endif
@@ -1562,26 +1714,45 @@ vtkSmartPointer<vtkImageData> EnhanceStructuralConnectivity(vtkSmartPointer<vtkI
     unsigned long int N = OriginalScalars -> GetNumberOfTuples();
     
     // 1. Multi-scale Gaussian smoothing to connect structures at different distances
+    vtkDataArray *SmoothedScalars1 = NULL;
+    vtkDataArray *SmoothedScalars2 = NULL;
+    const float *Smoothed1 = NULL, *Smoothed2 = NULL;
+    std::vector<float> Buffer;
+    _mitoScaleSpace Space(2);
     vtkSmartPointer<vtkImageGaussianSmooth> GaussSmooth1 = vtkSmartPointer<vtkImageGaussianSmooth>::New();
-    GaussSmooth1 -> SetInputData(Image);
-    GaussSmooth1 -> SetDimensionality(3);
-    GaussSmooth1 -> SetStandardDeviations(sigma, sigma, sigma * 0.3);
-    GaussSmooth1 -> Update();
-    
     vtkSmartPointer<vtkImageGaussianSmooth> GaussSmooth2 = vtkSmartPointer<vtkImageGaussianSmooth>::New();
-    GaussSmooth2 -> SetInputData(Image);
-    GaussSmooth2 -> SetDimensionality(3);
-    GaussSmooth2 -> SetStandardDeviations(sigma * 1.8, sigma * 1.8, sigma * 0.6);
-    GaussSmooth2 -> Update();
-    
-    vtkDataArray *SmoothedScalars1 = GaussSmooth1 -> GetOutput() -> GetPointData() -> GetScalars();
-    vtkDataArray *SmoothedScalars2 = GaussSmooth2 -> GetOutput() -> GetPointData() -> GetScalars();
+
+    if (scale_space) {
+        // The second level is computed from the first one
+        Space.SetInput(GetScalarsAsFloat(OriginalScalars,Buffer),Dim);
+        Smoothed1 = Space.GetLevel(sigma, sigma, sigma * 0.3);
+        Smoothed2 = Space.GetLevel(sigma * 1.8, sigma * 1.8, sigma * 0.6);
+    } else {
+        GaussSmooth1 -> SetInputData(Image);
+        GaussSmooth1 -> SetDimensionality(3);
+        GaussSmooth1 -> SetStandardDeviations(sigma, sigma, sigma * 0.3);
+        GaussSmooth1 -> Update();
+
+        GaussSmooth2 -> SetInputData(Image);
+        GaussSmooth2 -> SetDimensionality(3);
+        GaussSmooth2 -> SetStandardDeviations(sigma * 1.8, sigma * 1.8, sigma * 0.6);
+        GaussSmooth2 -> Update();
+
+        SmoothedScalars1 = GaussSmooth1 -> GetOutput() -> GetPointData() -> GetScalars();
+        SmoothedScalars2 = GaussSmooth2 -> GetOutput() -> GetPointData() -> GetScalars();
+    }
     
     // 2. Create enhanced image
-    vtkSmartPointer<vtkImageData> EnhancedImage = vtkImageData::New();
+    vtkSmartPointer<vtkImageData> EnhancedImage = vtkSmartPointer<vtkImageData>::New();
     EnhancedImage -> ShallowCopy(Image);
     
-    vtkSmartPointer<vtkDoubleArray> EnhancedScalars = vtkSmartPointer<vtkDoubleArray>::New();
+    // Same precision as the divergence
+    vtkSmartPointer<vtkDataArray> EnhancedScalars;
+    if (OriginalScalars -> GetDataType() == VTK_FLOAT) {
+        EnhancedScalars = vtkSmartPointer<vtkFloatArray>::New();
+    } else {
+        EnhancedScalars = vtkSmartPointer<vtkDoubleArray>::New();
+    }
     EnhancedScalars -> SetNumberOfComponents(1);
     EnhancedScalars -> SetNumberOfTuples(N);
     
@@ -1593,8 +1764,8 @@ vtkSmartPointer<vtkImageData> EnhanceStructuralConnectivity(vtkSmartPointer<vtkI
                 vtkIdType id = Image -> FindPoint(point);
                 
                 double original_val = OriginalScalars -> GetTuple1(id);
-                double smooth1_val = SmoothedScalars1 -> GetTuple1(id);
-                double smooth2_val = SmoothedScalars2 -> GetTuple1(id);
+                double smooth1_val = (Smoothed1) ? Smoothed1[id] : SmoothedScalars1 -> GetTuple1(id);
+                double smooth2_val = (Smoothed2) ? Smoothed2[id] : SmoothedScalars2 -> GetTuple1(id);
                 
                 // Check for strong signals in neighborhood
                 double max_neighbor = 0.0;
@@ -1673,203 +1844,148 @@ vtkSmartPointer<vtkPolyData> ConnectSkeletonFragments(vtkSmartPointer<vtkPolyDat
     #ifdef DEBUG
         printf("Connecting fragmented skeleton segments...\n");
     #endif
-    
-    // 1. Find all endpoints
-    std::vector<vtkIdType> endpoints;
-    vtkSmartPointer<vtkPolyData> ConnectedSkeleton = vtkSmartPointer<vtkPolyData>::New();
-    ConnectedSkeleton -> DeepCopy(Skeleton);
-    
-    // Build connectivity relationships
-    ConnectedSkeleton -> BuildLinks();
-    
-    // Find endpoints (degree-1 points)
-    for (vtkIdType pointId = 0; pointId < ConnectedSkeleton->GetNumberOfPoints(); pointId++) {
-        vtkSmartPointer<vtkIdList> cellIds = vtkSmartPointer<vtkIdList>::New();
-        ConnectedSkeleton->GetPointCells(pointId, cellIds);
-        
-        // Calculate how many edges this point connects to
-        int degree = 0;
-        for (vtkIdType i = 0; i < cellIds->GetNumberOfIds(); i++) {
-            vtkCell* cell = ConnectedSkeleton->GetCell(cellIds->GetId(i));
-            if (cell->GetPointId(0) == pointId || cell->GetPointId(cell->GetNumberOfPoints()-1) == pointId) {
-                degree++;
-            }
+
+    vtkIdType cellId, i, N = Skeleton -> GetNumberOfPoints();
+
+    // 1. Degree of every point and components of the skeleton, in a
+    // single pass over the cells. The degree counts the edges that
+    // start or end at a point.
+    std::vector<int> Degree(N,0);
+    std::vector<long long> Parent(N);
+    for (i = 0; i < N; i++) Parent[i] = i;
+
+    vtkSmartPointer<vtkCellArray> newLines = vtkSmartPointer<vtkCellArray>::New();
+    for (cellId = 0; cellId < Skeleton->GetNumberOfCells(); cellId++) {
+        vtkCell* cell = Skeleton->GetCell(cellId);
+        vtkIdType n = cell->GetNumberOfPoints();
+        if (n == 0) continue;
+        vtkIdType first = cell->GetPointId(0), last = cell->GetPointId(n-1);
+        Degree[first]++;
+        if (last != first) Degree[last]++;
+        long long root = FindRoot(Parent,first);
+        for (i = 1; i < n; i++) {
+            long long r = FindRoot(Parent,cell->GetPointId(i));
+            if (r != root) Parent[r] = root;
         }
-        
-        if (degree == 1) {
-            endpoints.push_back(pointId);
+        // Existing line segments are kept
+        newLines->InsertNextCell(cell);
+    }
+
+    std::vector<vtkIdType> endpoints;
+    std::vector<double> X;
+    for (i = 0; i < N; i++) {
+        if (Degree[i] == 1) {
+            double r[3];
+            Skeleton->GetPoint(i,r);
+            endpoints.push_back(i);
+            X.insert(X.end(),r,r+3);
         }
     }
-    
+
     #ifdef DEBUG
         printf("\tFound %d endpoints\n", (int)endpoints.size());
     #endif
-    
-    // 2. Create connections for endpoint pairs
+
+    // 2. Endpoint pairs within the gap distance, closest first. A pair
+    // is bridged only if its endpoints are still in different
+    // components, so fragments are joined by their shortest gaps and
+    // no loops are created.
+    std::vector<_mitoPointPair> Pairs;
+    FindPointPairs(X,0.1,max_gap_distance,Pairs);
+
     std::vector<std::pair<vtkIdType, vtkIdType>> connections_to_add;
-    
-    for (size_t i = 0; i < endpoints.size(); i++) {
-        for (size_t j = i + 1; j < endpoints.size(); j++) {
-            vtkIdType point1 = endpoints[i];
-            vtkIdType point2 = endpoints[j];
-            
-            double p1[3], p2[3];
-            ConnectedSkeleton->GetPoint(point1, p1);
-            ConnectedSkeleton->GetPoint(point2, p2);
-            
-            // Calculate Euclidean distance
-            double distance = sqrt(
-                (p1[0] - p2[0]) * (p1[0] - p2[0]) +
-                (p1[1] - p2[1]) * (p1[1] - p2[1]) +
-                (p1[2] - p2[2]) * (p1[2] - p2[2])
-            );
-            
-            // If distance is within reasonable range, mark for connection
-            if (distance <= max_gap_distance && distance > 0.1) {
-                // Check if these two points are already in the same connected component
-                bool already_connected = false;
-                
-                // Simple check: if reachable through existing edges, don't add new connection
-                // (Simplified handling, should do proper connectivity check)
-                
-                if (!already_connected) {
-                    connections_to_add.push_back(std::make_pair(point1, point2));
-                }
-            }
+    for (size_t k = 0; k < Pairs.size(); k++) {
+        vtkIdType point1 = endpoints[Pairs[k].i];
+        vtkIdType point2 = endpoints[Pairs[k].j];
+        long long r1 = FindRoot(Parent,point1);
+        long long r2 = FindRoot(Parent,point2);
+        if (r1 != r2) {
+            Parent[r2] = r1;
+            connections_to_add.push_back(std::make_pair(point1, point2));
         }
     }
-    
+
     #ifdef DEBUG
         printf("\tAdding %d connections\n", (int)connections_to_add.size());
     #endif
-    
-    // 3. Add new connections
-    vtkSmartPointer<vtkCellArray> newLines = vtkSmartPointer<vtkCellArray>::New();
-    
-    // Copy existing line segments
-    for (vtkIdType cellId = 0; cellId < ConnectedSkeleton->GetNumberOfCells(); cellId++) {
-        vtkCell* cell = ConnectedSkeleton->GetCell(cellId);
-        newLines->InsertNextCell(cell);
-    }
-    
-    // Add new connection line segments
+
+    // 3. Add new connection line segments
     for (const auto& connection : connections_to_add) {
         vtkSmartPointer<vtkLine> line = vtkSmartPointer<vtkLine>::New();
         line->GetPointIds()->SetId(0, connection.first);
         line->GetPointIds()->SetId(1, connection.second);
         newLines->InsertNextCell(line);
     }
-    
+
     // 4. Create new PolyData
     vtkSmartPointer<vtkPolyData> ResultSkeleton = vtkSmartPointer<vtkPolyData>::New();
-    ResultSkeleton->SetPoints(ConnectedSkeleton->GetPoints());
+    ResultSkeleton->SetPoints(Skeleton->GetPoints());
     ResultSkeleton->SetLines(newLines);
-    
-    // Copy point data
-    ResultSkeleton->GetPointData()->DeepCopy(ConnectedSkeleton->GetPointData());
-    
+
+    // The point data is shared with the input skeleton, which is discarded
+    ResultSkeleton->GetPointData()->ShallowCopy(Skeleton->GetPointData());
+
     #ifdef DEBUG
         printf("Skeleton fragment connection completed.\n");
     #endif
-    
+
     return ResultSkeleton;
 }
 
-void FillHoles(vtkSmartPointer<vtkImageData> ImageData) {
+void FillHoles(vtkSmartPointer<vtkImageData> ImageData, bool flood) {
 
     #ifdef DEBUG
         printf("\tSearching for holes in the image...\n");
     #endif
 
-    int *Dim = ImageData -> GetDimensions();
-    vtkIdType N = ImageData -> GetNumberOfPoints();
-
-    vtkIdType i, s, ido, id;
+    if (flood && ImageData -> GetScalarType() == VTK_UNSIGNED_CHAR) {
+        long long nfilled = FillHolesFromFaces((unsigned char*)ImageData->GetScalarPointer(),ImageData->GetDimensions());
+        ImageData -> GetPointData() -> GetScalars() -> Modified();
+        #ifdef DEBUG
+            printf("\tNumber of filled voxels: %lld\n",nfilled);
+        #else
+            (void)nfilled;
+        #endif
+        return;
+    }
 
     int x, y, z;
-    double v, r[3];
-    bool find = true;
-    long long int ro[3];
-    long int scluster, label;
-    ro[0] = Dim[0] * Dim[1] * Dim[2];
-    ro[1] = Dim[0] * Dim[1];
-
-    vtkSmartPointer<vtkIdList> CurrA = vtkSmartPointer<vtkIdList>::New();
-    vtkSmartPointer<vtkIdList> NextA = vtkSmartPointer<vtkIdList>::New();
-    vtkSmartPointer<vtkTypeInt64Array> CSz = vtkSmartPointer<vtkTypeInt64Array>::New();
-    vtkSmartPointer<vtkTypeInt64Array> Volume = vtkSmartPointer<vtkTypeInt64Array>::New();
-    Volume -> SetNumberOfComponents(1);
-    Volume -> SetNumberOfTuples(N);
-    Volume -> FillComponent(0,0);
+    int *Dim = ImageData -> GetDimensions();
+    vtkIdType id, N = ImageData -> GetNumberOfPoints();
 
-    for (x = 1; x < Dim[0]-1; x++) {
+    // Background voxels away from the image border.
+    std::vector<unsigned char> Mask(N,0);
+    for (z = 1; z < Dim[2]-1; z++) {
         for (y = 1; y < Dim[1]-1; y++) {
-            for (z = 1; z < Dim[2]-1; z++) {
-                double point[3] = {(double)x, (double)y, (double)z};
-                id = ImageData -> FindPoint(point);
-                if ((unsigned short int)ImageData->GetScalarComponentAsDouble(x,y,z,0)) {
-                    Volume -> SetTuple1(id,0);
-                } else {
-                    Volume -> SetTuple1(id,1);
+            for (x = 1; x < Dim[0]-1; x++) {
+                id = x + (vtkIdType)Dim[0]*(y + (vtkIdType)Dim[1]*z);
+                if (!(unsigned short int)ImageData->GetScalarComponentAsDouble(x,y,z,0)) {
+                    Mask[id] = 1;
                 }
             }
         }
     }
 
-    Volume -> Modified();
-
-    label = 0;
-    while (find) {
-        for (s = 0; s < CurrA->GetNumberOfIds(); s++) {
-            ido = CurrA -> GetId(s);
-            ImageData -> GetPoint(ido,r);
-            x = (int)r[0]; y = (int)r[1]; z = (int)r[2];
-            for (i = 0; i < 6; i++) {
-                double point[3] = {(double)(x+ssdx_sort[i]), (double)(y+ssdy_sort[i]), (double)(z+ssdz_sort[i])};
-                id = ImageData -> FindPoint(point);
-                v = Volume -> GetTuple1(id);
-                if ((long int)v > 0) {
-                    NextA -> InsertNextId(id);
-                    Volume -> SetTuple1(id,-label);
-                    scluster++;
-                }
-            }
-        }
-        if (!NextA->GetNumberOfIds()) {
-            find = false;
-            for (id=ro[0]; id--;) {
-                v = Volume -> GetTuple1(id);
-                if ((long int)v > 0) {
-                    find = true;
-                    ro[0] = id;
-                    break;
-                }
-            }
-            if (label) {
-                CSz -> InsertNextTuple1(scluster);
+    // The component labeled 1 is the one that contains the background
+    // voxel with the largest id and is taken as the outside of the cell.
+    // Every other background component is a hole.
+    std::vector<_mitoRun> Runs;
+    std::vector<long int> Label, CSz;
+    LabelConnectedRuns(Mask.data(),Dim,6,Runs,Label,CSz);
+
+    vtkDataArray *Scalars = ImageData -> GetPointData() -> GetScalars();
+    for (size_t r = 0; r < Runs.size(); r++) {
+        if (Label[r] > 1) {
+            id = (vtkIdType)(Runs[r].row * Dim[0]);
+            for (x = Runs[r].x0; x <= Runs[r].x1; x++) {
+                Scalars -> SetTuple1(id+x,255);
             }
-            if (find) {
-                label++;
-                scluster = 1;
-                Volume -> SetTuple1(id,-label);
-                CurrA -> InsertNextId(id);
-            }
-        } else {
-            CurrA -> Reset();
-            CurrA -> DeepCopy(NextA);
-            NextA -> Reset();
-        }
-    }
-
-    for (id = N; id--;) {
-        if ((long int)Volume->GetTuple1(id)<-1) {
-            ImageData -> GetPointData() -> GetScalars() -> SetTuple1(id,255);
         }
     }
-    ImageData -> GetPointData() -> GetScalars() -> Modified();
+    Scalars -> Modified();
 
     #ifdef DEBUG
-        printf("\tNumber of filled holes: %ld\n",(long int)CSz->GetNumberOfTuples()-1);
+        printf("\tNumber of filled holes: %ld\n",(long int)CSz.size()-1);
     #endif
 
 }
@@ -1878,525 +1994,476 @@ void FillHoles(vtkSmartPointer<vtkImageData> ImageData) {
    ROUTINES FOR VESSELNESS CALCUATION VIA DISCRETE APPROCH
 =================================================================*/
 
-void GetImageDerivativeDiscrete(vtkSmartPointer<vtkDataArray> Image, int *dim, char direction, vtkSmartPointer<vtkFloatArray> Derivative) {
-    // Debug output removed
-
-    double d, f1, f2;
-    vtkIdType i, j, k;
-    if (direction=='x') {
-        for (i = (vtkIdType)dim[0]; i--;) {
-            for (j = (vtkIdType)dim[1]; j--;) {
-                for (k = (vtkIdType)dim[2]; k--;) {
-                    if (i==0) {
-                        Image -> GetTuple(GetId(1,j,k,dim),&f1);
-                        Image -> GetTuple(GetId(0,j,k,dim),&f2);
-                    }
-                    if (i==dim[0]-1) {
-                        Image -> GetTuple(GetId(dim[0]-1,j,k,dim),&f1);
-                        Image -> GetTuple(GetId(dim[0]-2,j,k,dim),&f2);
-                    }
-                    if (i>0&i<dim[0]-1) {
-                        Image -> GetTuple(GetId(i+1,j,k,dim),&f1);
-                        Image -> GetTuple(GetId(i-1,j,k,dim),&f2);
-                        f1 /= 2.0; f2 /= 2.0;
+// Frobenius norm of the Hessian of the smoothed volume ImageG over the
+// z-planes [z0,z1), evaluated tile by tile. Returns the maximum norm.
+// When Fro is given it receives the norm of each voxel, and when
+// FThresh is given the maximum norm of each xy block and z-plane,
+// indexed as (BX[x]*nblks+BY[y])*Dim[2]+z. Tile rows are distributed
+// over threads, so the maxima are reduced per thread first and merged
+// at the end.
+static float HessianFrobeniusPass(const float *ImageG, int *Dim, int z0, int z1, float *Fro, std::vector<double> *FThresh, const int *BX, const int *BY, int nblks) {
+
+    const int nty = (Dim[1]+MITO_TILE_Y-1) / MITO_TILE_Y;
+    const int nrows = (z1-z0) * nty;
+    float fmax = 0.0;
+
+    #pragma omp parallel
+    {
+        std::vector<float> Tile(6*MITO_TILE_X*MITO_TILE_Y);
+        float *T[6];
+        for (int e = 0; e < 6; e++) T[e] = &Tile[e*MITO_TILE_X*MITO_TILE_Y];
+
+        std::vector<double> FT;
+        if (FThresh) FT.assign(FThresh->size(),0.0);
+
+        float fro, tmax = 0.0;
+        double H[3][3], frobnorm;
+
+        #pragma omp for schedule(dynamic)
+        for (int r = 0; r < nrows; r++) {
+            int z = z0 + r / nty;
+            int y0 = (r % nty) * MITO_TILE_Y;
+            int y1 = (y0+MITO_TILE_Y < Dim[1]) ? y0+MITO_TILE_Y : Dim[1];
+            for (int x0 = 0; x0 < Dim[0]; x0 += MITO_TILE_X) {
+                int x1 = (x0+MITO_TILE_X < Dim[0]) ? x0+MITO_TILE_X : Dim[0];
+                int tx = x1 - x0;
+                GetHessianTile(ImageG,Dim,z,y0,y1,x0,x1,T);
+                for (int y = y0; y < y1; y++) {
+                    for (int x = x0; x < x1; x++) {
+                        vtkIdType t = (vtkIdType)(y-y0)*tx + (x-x0);
+                        H[0][0]=T[MITO_HXX][t]; H[0][1]=T[MITO_HXY][t]; H[0][2]=T[MITO_HXZ][t];
+                        H[1][0]=T[MITO_HXY][t]; H[1][1]=T[MITO_HYY][t]; H[1][2]=T[MITO_HYZ][t];
+                        H[2][0]=T[MITO_HXZ][t]; H[2][1]=T[MITO_HYZ][t]; H[2][2]=T[MITO_HZZ][t];
+                        frobnorm = FrobeniusNorm(H);
+                        fro = (float)frobnorm;
+                        tmax = (fro > tmax) ? fro : tmax;
+                        if (Fro) Fro[GetId(x,y,z,Dim)] = fro;
+                        if (FThresh) {
+                            double &ft = FT[((size_t)BX[x]*nblks+BY[y])*Dim[2]+z];
+                            ft = (frobnorm > ft) ? frobnorm : ft;
+                        }
                     }
-                    d = f1 - f2;
-                    Derivative -> SetTuple(GetId(i,j,k,dim),&d);
                 }
             }
         }
-    }
 
-    if (direction=='y') {
-        for (i = (vtkIdType)dim[0]; i--;) {
-            for (j = (vtkIdType)dim[1]; j--;) {
-                for (k = (vtkIdType)dim[2]; k--;) {
-                    if (j==0) {
-                        Image -> GetTuple(GetId(i,1,k,dim),&f1);
-                        Image -> GetTuple(GetId(i,0,k,dim),&f2);
-                    }
-                    if (j==dim[1]-1) {
-                        Image -> GetTuple(GetId(i,dim[1]-1,k,dim),&f1);
-                        Image -> GetTuple(GetId(i,dim[1]-2,k,dim),&f2);
-                    }
-                    if (j>0&j<dim[1]-1) {
-                        Image -> GetTuple(GetId(i,j+1,k,dim),&f1);
-                        Image -> GetTuple(GetId(i,j-1,k,dim),&f2);
-                        f1 /= 2.0; f2 /= 2.0;
-                    }
-                    d = f1 - f2;
-                    Derivative -> SetTuple(GetId(i,j,k,dim),&d);
+        #pragma omp critical
+        {
+            fmax = (tmax > fmax) ? tmax : fmax;
+            if (FThresh) {
+                for (size_t k = 0; k < FT.size(); k++) {
+                    if (FT[k] > (*FThresh)[k]) (*FThresh)[k] = FT[k];
                 }
             }
         }
     }
 
-    if (direction=='z') {
-        for (i = (vtkIdType)dim[0]; i--;) {
-            for (j = (vtkIdType)dim[1]; j--;) {
-                for (k = (vtkIdType)dim[2]; k--;) {
-                    if (k==0) {
-                        Image -> GetTuple(GetId(i,j,1,dim),&f1);
-                        Image -> GetTuple(GetId(i,j,0,dim),&f2);
-                    }
-                    if (k==dim[2]-1) {
-                        Image -> GetTuple(GetId(i,j,dim[2]-1,dim),&f1);
-                        Image -> GetTuple(GetId(i,j,dim[2]-2,dim),&f2);
+    return fmax;
+}
+
+// Second Hessian pass. The voxels of each tile that pass the Frobenius
+// threshold and have negative trace are gathered into a batch, and the
+// eigenvalues and vesselness of the batch are computed together. V
+// keeps the maximum vesselness over the scales, so the eigenvalues are
+// never stored for the whole volume. A voxel passes the threshold when
+// its norm is not below fthresh or, when Fro is given, when the mean
+// norm of its 6-neighbours (zero at the borders) is not below the
+// threshold FThresh of its block. With jacobi the eigenvalues come from
+// vtkMath::Diagonalize3x3 instead of the closed-form solution.
+template <typename Real>
+static void HessianVesselnessPass(const float *ImageG, int *Dim, double fthresh, const float *Fro, const std::vector<double> *FThresh, const int *BX, const int *BY, int nblks, bool jacobi, Real *V) {
+
+    const int nty = (Dim[1]+MITO_TILE_Y-1) / MITO_TILE_Y;
+    const int nrows = Dim[2] * nty;
+    const size_t ntile = MITO_TILE_X*MITO_TILE_Y;
+
+    #pragma omp parallel
+    {
+        std::vector<float> Tile(6*ntile);
+        float *T[6];
+        for (int e = 0; e < 6; e++) T[e] = &Tile[e*ntile];
+
+        // Batch of candidate voxels: six Hessian entries, three
+        // eigenvalues and the vesselness of each.
+        std::vector<double> Batch(10*ntile);
+        double *B[6];
+        for (int e = 0; e < 6; e++) B[e] = &Batch[e*ntile];
+        double *L1 = &Batch[6*ntile], *L2 = &Batch[7*ntile], *L3 = &Batch[8*ntile], *Vb = &Batch[9*ntile];
+        std::vector<vtkIdType> Ids(ntile);
+
+        double H[3][3], Eva[3], Eve[3][3];
+
+        #pragma omp for schedule(dynamic)
+        for (int r = 0; r < nrows; r++) {
+            int z = r / nty;
+            int y0 = (r % nty) * MITO_TILE_Y;
+            int y1 = (y0+MITO_TILE_Y < Dim[1]) ? y0+MITO_TILE_Y : Dim[1];
+            for (int x0 = 0; x0 < Dim[0]; x0 += MITO_TILE_X) {
+                int x1 = (x0+MITO_TILE_X < Dim[0]) ? x0+MITO_TILE_X : Dim[0];
+                int tx = x1 - x0;
+                GetHessianTile(ImageG,Dim,z,y0,y1,x0,x1,T);
+                size_t n = 0;
+                for (int y = y0; y < y1; y++) {
+                    for (int x = x0; x < x1; x++) {
+                        vtkIdType t = (vtkIdType)(y-y0)*tx + (x-x0);
+                        H[0][0]=T[MITO_HXX][t]; H[0][1]=T[MITO_HXY][t]; H[0][2]=T[MITO_HXZ][t];
+                        H[1][0]=T[MITO_HXY][t]; H[1][1]=T[MITO_HYY][t]; H[1][2]=T[MITO_HYZ][t];
+                        H[2][0]=T[MITO_HXZ][t]; H[2][1]=T[MITO_HYZ][t]; H[2][2]=T[MITO_HZZ][t];
+                        if (!(H[0][0]+H[1][1]+H[2][2]<0.0)) continue;
+                        if (Fro) {
+                            double frobneigh = 0.0;
+                            if (x>0&&x<Dim[0]-1&&y>0&&y<Dim[1]-1&&z>0&&z<Dim[2]-1) {
+                                for (int j = 0; j < 6; j++) {
+                                    frobneigh += Fro[GetId(x+ssdx_sort[j],y+ssdy_sort[j],z+ssdz_sort[j],Dim)];
+                                }
+                                frobneigh /= 6.0;
+                            }
+                            if ( frobneigh < (*FThresh)[((size_t)BX[x]*nblks+BY[y])*Dim[2]+z] ) continue;
+                        } else {
+                            if ( (float)FrobeniusNorm(H) < fthresh ) continue;
+                        }
+                        for (int e = 0; e < 6; e++) B[e][n] = T[e][t];
+                        Ids[n++] = GetId(x,y,z,Dim);
                     }
-                    if (k>0&k<dim[2]-1) {
-                        Image -> GetTuple(GetId(i,j,k+1,dim),&f1);
-                        Image -> GetTuple(GetId(i,j,k-1,dim),&f2);
-                        f1 /= 2.0; f2 /= 2.0;
+                }
+                if (!n) continue;
+                if (jacobi) {
+                    for (size_t i = 0; i < n; i++) {
+                        H[0][0]=B[MITO_HXX][i]; H[0][1]=B[MITO_HXY][i]; H[0][2]=B[MITO_HXZ][i];
+                        H[1][0]=B[MITO_HXY][i]; H[1][1]=B[MITO_HYY][i]; H[1][2]=B[MITO_HYZ][i];
+                        H[2][0]=B[MITO_HXZ][i]; H[2][1]=B[MITO_HYZ][i]; H[2][2]=B[MITO_HZZ][i];
+                        vtkMath::Diagonalize3x3(H,Eva,Eve);
+                        L1[i] = Eva[0]; L2[i] = Eva[1]; L3[i] = Eva[2];
+                        Sort(&L1[i],&L2[i],&L3[i]);
                     }
-                    d = f1 - f2;
-                    Derivative -> SetTuple(GetId(i,j,k,dim),&d);
+                } else {
+                    GetSymmetricEigenvalues(B,n,L1,L2,L3);
+                }
+                GetVesselnessFromEigenvalues(L1,L2,L3,n,Vb);
+                for (size_t i = 0; i < n; i++) {
+                    if ( Vb[i] > V[Ids[i]] ) V[Ids[i]] = (Real)Vb[i];
                 }
             }
         }
     }
-
 }
 
-void GetHessianEigenvaluesDiscrete(double sigma, vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkDoubleArray> L1, vtkSmartPointer<vtkDoubleArray> L2, vtkSmartPointer<vtkDoubleArray> L3) {
-    // Debug output removed
-
-    int *Dim = Image -> GetDimensions();
-    vtkIdType id, N = Image -> GetNumberOfPoints();
-    double H[3][3], Eva[3], Eve[3][3], dxx, dyy, dzz, dxy, dxz, dyz, l1, l2, l3, frobnorm;
-
-    // Debug output removed
-
-    vtkSmartPointer<vtkImageGaussianSmooth> Gauss = vtkSmartPointer<vtkImageGaussianSmooth>::New();
+// Image smoothed at scale sigma, as a float buffer. Gauss and Buffer
+// hold the storage and must outlive the returned pointer.
+static const float *GetSmoothedImage(double sigma, vtkImageData *Image, _mitoScaleSpace *Space, vtkSmartPointer<vtkImageGaussianSmooth> &Gauss, std::vector<float> &Buffer, _mitoProfile *Profile) {
+    _mitoStageTimer Timer(Profile,"Gaussian",Image->GetNumberOfPoints());
+    if (Space) {
+        return Space -> GetLevel(sigma,sigma,sigma);
+    }
+    Gauss = vtkSmartPointer<vtkImageGaussianSmooth>::New();
     Gauss -> SetInputData(Image);
     Gauss -> SetDimensionality(3);
     Gauss -> SetRadiusFactors(10,10,10);
     Gauss -> SetStandardDeviations(sigma,sigma,sigma);
     Gauss -> Update();
+    return GetScalarsAsFloat(Gauss->GetOutput()->GetPointData()->GetScalars(),Buffer);
+}
 
-    vtkFloatArray *ImageG = (vtkFloatArray*) Gauss -> GetOutput() -> GetPointData() -> GetScalars();
-
-    vtkSmartPointer<vtkFloatArray> Dx = vtkSmartPointer<vtkFloatArray>::New(); Dx -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Dy = vtkSmartPointer<vtkFloatArray>::New(); Dy -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Dz = vtkSmartPointer<vtkFloatArray>::New(); Dz -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Dxx = vtkSmartPointer<vtkFloatArray>::New(); Dxx -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Dyy = vtkSmartPointer<vtkFloatArray>::New(); Dyy -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Dzz = vtkSmartPointer<vtkFloatArray>::New(); Dzz -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Dxy = vtkSmartPointer<vtkFloatArray>::New(); Dxy -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Dxz = vtkSmartPointer<vtkFloatArray>::New(); Dxz -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Dyz = vtkSmartPointer<vtkFloatArray>::New(); Dyz -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Fro = vtkSmartPointer<vtkFloatArray>::New();
-    Fro -> SetNumberOfComponents(1);
-    Fro -> SetNumberOfTuples(N);
-
-    GetImageDerivativeDiscrete(ImageG,Dim,'x',Dx);
-    GetImageDerivativeDiscrete(ImageG,Dim,'y',Dy);
-    GetImageDerivativeDiscrete(ImageG,Dim,'z',Dz);
-    GetImageDerivativeDiscrete(Dx,Dim,'x',Dxx);
-    GetImageDerivativeDiscrete(Dy,Dim,'y',Dyy);
-    GetImageDerivativeDiscrete(Dz,Dim,'z',Dzz);
-    GetImageDerivativeDiscrete(Dy,Dim,'x',Dxy);
-    GetImageDerivativeDiscrete(Dz,Dim,'x',Dxz);
-    GetImageDerivativeDiscrete(Dz,Dim,'y',Dyz);
-
-    for ( id = N; id--; ) {
-        l1 = l2 = l3 = 0.0;
-        H[0][0]=Dxx->GetTuple1(id); H[0][1]=Dxy->GetTuple1(id); H[0][2]=Dxz->GetTuple1(id);
-        H[1][0]=Dxy->GetTuple1(id); H[1][1]=Dyy->GetTuple1(id); H[1][2]=Dyz->GetTuple1(id);
-        H[2][0]=Dxz->GetTuple1(id); H[2][1]=Dyz->GetTuple1(id); H[2][2]=Dzz->GetTuple1(id);
-        frobnorm = FrobeniusNorm(H);
-        if (H[0][0]+H[1][1]+H[2][2]<0.0) {
-            vtkMath::Diagonalize3x3(H,Eva,Eve);
-            l1 = Eva[0]; l2 = Eva[1]; l3 = Eva[2];
-            Sort(&l1,&l2,&l3);
-        }
-        L1 -> SetTuple1(id,l1);
-        L2 -> SetTuple1(id,l2);
-        L3 -> SetTuple1(id,l3);
-        Fro -> SetTuple1(id,frobnorm);
-    }
-    double ftresh,frobenius_norm_range[2];
-    Fro -> GetRange(frobenius_norm_range);
-    ftresh = sqrt(frobenius_norm_range[1]);
-
-    for ( id = N; id--; ) {
-        if ( Fro->GetTuple1(id) < ftresh) {
-            L1 -> SetTuple1(id,0.0);
-            L2 -> SetTuple1(id,0.0);
-            L3 -> SetTuple1(id,0.0);
-        }
-    }
-    L1 -> Modified();
-    L2 -> Modified();
-    L3 -> Modified();
-
-}
-
-void GetHessianEigenvaluesDiscreteZDependentThreshold(double sigma, vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkDoubleArray> L1, vtkSmartPointer<vtkDoubleArray> L2, vtkSmartPointer<vtkDoubleArray> L3, _mitoObject *mitoObject) {
-    // Debug output removed
+/* ================================================================
+   VESSELNESS ROUTINE
+=================================================================*/
+
+// The GPU always derives each scale from the previous one, and so
+// does the CPU when a -device gpu run falls back to it. The divergence
+// then depends on where it ran only within the tolerance of -device gpu.
+static bool UsesScaleSpace(const _mitoObject *mitoObject) {
+    return mitoObject->_scale_space || mitoObject->_device == MITO_DEVICE_GPU;
+}
+
+vtkSmartPointer<vtkDataArray> NewVesselnessArray(const _mitoObject *mitoObject, vtkIdType N) {
+    vtkSmartPointer<vtkDataArray> VSSS;
+    if (mitoObject->_storage_double) {
+        VSSS = vtkSmartPointer<vtkDoubleArray>::New();
+    } else {
+        VSSS = vtkSmartPointer<vtkFloatArray>::New();
+    }
+    VSSS -> SetNumberOfComponents(1);
+    VSSS -> SetNumberOfTuples(N);
+    VSSS -> FillComponent(0,0.0);
+    return VSSS;
+}
+
+void GetVesselness(double sigma, vtkSmartPointer<vtkImageData> Image, vtkDataArray *VSSS, _mitoObject *mitoObject, _mitoScaleSpace *Space, const float *FroMax) {
 
     int *Dim = Image -> GetDimensions();
-    vtkIdType id, N = Image -> GetNumberOfPoints();
-    double H[3][3], Eva[3], Eve[3][3], dxx, dyy, dzz, dxy, dxz, dyz, l1, l2, l3, frobnorm;
+    vtkIdType N = Image -> GetNumberOfPoints();
 
-    // Debug output removed
+    std::vector<float> Buffer;
+    vtkSmartPointer<vtkImageGaussianSmooth> Gauss;
+    const float *ImageG = GetSmoothedImage(sigma,Image,Space,Gauss,Buffer,mitoObject->Profile);
 
-    vtkSmartPointer<vtkImageGaussianSmooth> Gauss = vtkSmartPointer<vtkImageGaussianSmooth>::New();
-    Gauss -> SetInputData(Image);
-    Gauss -> SetDimensionality(3);
-    Gauss -> SetRadiusFactors(10,10,10);
-    Gauss -> SetStandardDeviations(sigma,sigma,sigma);
-    Gauss -> Update();
+    _mitoStageTimer Timer(mitoObject->Profile,"Hessian",N);
 
-    vtkFloatArray *ImageG = (vtkFloatArray*) Gauss -> GetOutput() -> GetPointData() -> GetScalars();
-
-    vtkSmartPointer<vtkFloatArray> Dx = vtkSmartPointer<vtkFloatArray>::New(); Dx -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Dy = vtkSmartPointer<vtkFloatArray>::New(); Dy -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Dz = vtkSmartPointer<vtkFloatArray>::New(); Dz -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Dxx = vtkSmartPointer<vtkFloatArray>::New(); Dxx -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Dyy = vtkSmartPointer<vtkFloatArray>::New(); Dyy -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Dzz = vtkSmartPointer<vtkFloatArray>::New(); Dzz -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Dxy = vtkSmartPointer<vtkFloatArray>::New(); Dxy -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Dxz = vtkSmartPointer<vtkFloatArray>::New(); Dxz -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Dyz = vtkSmartPointer<vtkFloatArray>::New(); Dyz -> SetNumberOfTuples(N);
-    vtkSmartPointer<vtkFloatArray> Fro = vtkSmartPointer<vtkFloatArray>::New();
-    Fro -> SetNumberOfComponents(1);
-    Fro -> SetNumberOfTuples(N);
-
-    GetImageDerivativeDiscrete(ImageG,Dim,'x',Dx);
-    GetImageDerivativeDiscrete(ImageG,Dim,'y',Dy);
-    GetImageDerivativeDiscrete(ImageG,Dim,'z',Dz);
-    GetImageDerivativeDiscrete(Dx,Dim,'x',Dxx);
-    GetImageDerivativeDiscrete(Dy,Dim,'y',Dyy);
-    GetImageDerivativeDiscrete(Dz,Dim,'z',Dzz);
-    GetImageDerivativeDiscrete(Dy,Dim,'x',Dxy);
-    GetImageDerivativeDiscrete(Dz,Dim,'x',Dxz);
-    GetImageDerivativeDiscrete(Dz,Dim,'y',Dyz);
+    // Float or double vesselness (-storage)
+    float *VF = (VSSS -> GetDataType() == VTK_FLOAT) ? (float*)VSSS -> GetVoidPointer(0) : NULL;
+    double *VD = (VF) ? NULL : (double*)VSSS -> GetVoidPointer(0);
 
-    int x, y, z;
-    int nblks = mitoObject->_nblks;
-
-    double ***FThresh = new double**[nblks];
-    for ( int qx = nblks; qx--; ) {
-        FThresh[qx] = new double*[nblks];
-        for ( int qy = nblks; qy--; ) {
-            FThresh[qx][qy] = new double[Dim[2]];
-            for ( id = Dim[2]; id--; ) {
-                FThresh[qx][qy][id] = 0.0;
-            }
-        }
-    }
+    if (mitoObject->_adaptive_threshold) {
 
-    for ( id = N; id--; ) {
-        l1 = l2 = l3 = 0.0;
-        H[0][0]=Dxx->GetTuple1(id); H[0][1]=Dxy->GetTuple1(id); H[0][2]=Dxz->GetTuple1(id);
-        H[1][0]=Dxy->GetTuple1(id); H[1][1]=Dyy->GetTuple1(id); H[1][2]=Dyz->GetTuple1(id);
-        H[2][0]=Dxz->GetTuple1(id); H[2][1]=Dyz->GetTuple1(id); H[2][2]=Dzz->GetTuple1(id);
-        frobnorm = FrobeniusNorm(H);
-        if (H[0][0]+H[1][1]+H[2][2]<0.0) {
-            vtkMath::Diagonalize3x3(H,Eva,Eve);
-            l1 = Eva[0]; l2 = Eva[1]; l3 = Eva[2];
-            Sort(&l1,&l2,&l3);
-        }
-        L1 -> SetTuple1(id,l1);
-        L2 -> SetTuple1(id,l2);
-        L3 -> SetTuple1(id,l3);
-        Fro -> SetTuple1(id,frobnorm);
-        x = GetX(id,Dim);
-        y = GetY(id,Dim);
-        z = GetZ(id,Dim);
-        FThresh[int((1.0*nblks*x)/Dim[0])][int((1.0*nblks*y)/Dim[1])][z] = (frobnorm > FThresh[int((1.0*nblks*x)/Dim[0])][int((1.0*nblks*y)/Dim[1])][z]) ? frobnorm : FThresh[int((1.0*nblks*x)/Dim[0])][int((1.0*nblks*y)/Dim[1])][z];
-    }
-
-    for ( z = Dim[2]; z--; ) {
-        for ( x = nblks; x--; ) {
-            for ( y = nblks; y--; ) {
-                FThresh[x][y][z] = sqrt(FThresh[x][y][z]);
-            }
-        }
-    }
+        int x, y;
+        int nblks = mitoObject->_nblks;
 
-    //
-    // Testing Region-Based Threshold
-    //
-    
-    int j;
-    double frobneigh;
-    for ( id = N; id--; ) {
-        x = GetX(id,Dim);
-        y = GetY(id,Dim);
-        z = GetZ(id,Dim);
-        frobneigh = 0.0;
-        if (x>0&&x<Dim[0]-1&&y>0&&y<Dim[1]-1&&z>0&&z<Dim[2]-1) {
-            for (j = 0; j < 6; j++) {
-                frobneigh += Fro -> GetTuple1(GetId(x+ssdx_sort[j],y+ssdy_sort[j],z+ssdz_sort[j],Dim));
-            }
-            frobneigh /= 6.0;
+        // Block index of each column and row. FThresh holds one value
+        // per block and z-plane: FThresh[(bx*nblks+by)*Dim[2]+z].
+        std::vector<int> BX(Dim[0]), BY(Dim[1]);
+        for (x = Dim[0]; x--;) BX[x] = int((1.0*nblks*x)/Dim[0]);
+        for (y = Dim[1]; y--;) BY[y] = int((1.0*nblks*y)/Dim[1]);
+        std::vector<double> FThresh((size_t)nblks*nblks*Dim[2],0.0);
+        std::vector<float> Fro(N);
+
+        HessianFrobeniusPass(ImageG,Dim,0,Dim[2],&Fro[0],&FThresh,&BX[0],&BY[0],nblks);
+
+        for ( vtkIdType id = (vtkIdType)FThresh.size(); id--; ) {
+            FThresh[id] = sqrt(FThresh[id]);
         }
-        if ( frobneigh < FThresh[int((1.0*nblks*x)/Dim[0])][int((1.0*nblks*y)/Dim[1])][z] ) {
-            L1 -> SetTuple1(id,0.0);
-            L2 -> SetTuple1(id,0.0);
-            L3 -> SetTuple1(id,0.0);
+
+        if (VF) {
+            HessianVesselnessPass(ImageG,Dim,0.0,&Fro[0],&FThresh,&BX[0],&BY[0],nblks,mitoObject->_eigen_jacobi,VF);
+        } else {
+            HessianVesselnessPass(ImageG,Dim,0.0,&Fro[0],&FThresh,&BX[0],&BY[0],nblks,mitoObject->_eigen_jacobi,VD);
         }
-    }
-    L1 -> Modified();
-    L2 -> Modified();
-    L3 -> Modified();
 
-    for ( int qx = nblks; qx--; ) {
-        for ( int qy = nblks; qy--; ) {
-            delete[] FThresh[qx][qy];
+    } else {
+
+        float fmax = (FroMax) ? *FroMax : HessianFrobeniusPass(ImageG,Dim,0,Dim[2],NULL,NULL,NULL,NULL,0);
+        if (VF) {
+            HessianVesselnessPass(ImageG,Dim,sqrt((double)fmax),NULL,NULL,NULL,NULL,0,mitoObject->_eigen_jacobi,VF);
+        } else {
+            HessianVesselnessPass(ImageG,Dim,sqrt((double)fmax),NULL,NULL,NULL,NULL,0,mitoObject->_eigen_jacobi,VD);
         }
-        delete[] FThresh[qx];
+
     }
-    delete[] FThresh;
 
+    VSSS -> Modified();
 }
 
 /* ================================================================
-   VESSELNESS ROUTINE
+   DIVERGENCE FILTER
 =================================================================*/
 
-void GetVesselness(double sigma, vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkDoubleArray> L1, vtkSmartPointer<vtkDoubleArray> L2, vtkSmartPointer<vtkDoubleArray> L3, _mitoObject *mitoObject) {
-
-    // Debug output removed
+// Divergence filter of the float or double vesselness S, in place
+template <typename Real> static void DivergenceFilter(int *Dim, Real *S) {
 
-    double c = 500.0;
-    double beta = 0.5;
-    double alpha = 0.5;
-    double std = 2 * c * c;
-    double rbd = 2 * beta * beta;
-    double rad = 2 * alpha * alpha;
-    double l1, l2, l3, ra, ran, rb, rbn, st, stn, ft_old, ft_new;
-    vtkIdType id, N = Image -> GetNumberOfPoints();
+    // The stencil reaches r planes away, so the result of plane z is
+    // kept in a ring of r+1 planes and written over the input once
+    // plane z+r is done and no plane left needs it. Voxels closer than
+    // r to the border are zero.
+    const int r = MITO_DIVERGENCE_STEP+1;
+    const vtkIdType nplane = (vtkIdType)Dim[0] * Dim[1];
+    std::vector<Real> Ring((r+1)*nplane);
 
-    if (mitoObject->_adaptive_threshold) {
-        GetHessianEigenvaluesDiscreteZDependentThreshold(sigma,Image,L1,L2,L3,mitoObject);
-    } else {
-        GetHessianEigenvaluesDiscrete(sigma,Image,L1,L2,L3);
+    for (int z = r; z < Dim[2]-r; z++) {
+        Real *D = &Ring[(z%(r+1))*nplane];
+        #pragma omp parallel for schedule(dynamic)
+        for (int y = 0; y < Dim[1]; y++) {
+            Real *Row = D + (vtkIdType)y*Dim[0];
+            memset(Row,0,Dim[0]*sizeof(Real));
+            if (y < r || y >= Dim[1]-r) continue;
+            for (int x = r; x < Dim[0]-r; x++) {
+                Row[x] = (Real)GetDivergenceAt(S,GetId(x,y,z,Dim),Dim[0],nplane);
+            }
+        }
+        if (z-r >= r) {
+            memcpy(S+(z-r)*nplane,&Ring[((z-r)%(r+1))*nplane],nplane*sizeof(Real));
+        }
     }
-    
-    for ( id = N; id--; ) {
-        l1 = L1 -> GetTuple1(id);
-        l2 = L2 -> GetTuple1(id);
-        l3 = L3 -> GetTuple1(id);
-        if (l2<0&&l3<0) {
-
-            ra = fabs(l2) / fabs(l3);
-            ran = -ra * ra;
-
-            rb = fabs(l1) / sqrt(l2*l3);
-            rbn = -rb * rb;
-
-            st = sqrt(l1*l1+l2*l2+l3*l3);
-            stn = -st * st;
-
-            ft_new = (1-exp(ran/rad)) * exp(rbn/rbd) * (1-exp(stn/std));
-
-            //L1 is used to return vesselness values
-            L1 -> SetTuple1(id,ft_new);
-
-        } else L1 -> SetTuple1(id,0.0);
+    for (int z = std::max(r,Dim[2]-2*r); z < Dim[2]-r; z++) {
+        memcpy(S+z*nplane,&Ring[(z%(r+1))*nplane],nplane*sizeof(Real));
+    }
+    for (int z = 0; z < Dim[2]; z++) {
+        if (z < r || z >= Dim[2]-r) memset(S+z*nplane,0,nplane*sizeof(Real));
     }
-    L1 -> Modified();
 }
 
-/* ================================================================
-   DIVERGENCE FILTER
-=================================================================*/
-
-void GetDivergenceFilter(int *Dim, vtkSmartPointer<vtkDoubleArray> Scalars) {
+void GetDivergenceFilter(int *Dim, vtkDataArray *Scalars) {
 
     #ifdef DEBUG
         printf("Calculating Divergent Filter...\n");
     #endif
 
-    vtkIdType id;
-    int j, i;
-    int x, y, z, s = 2;
-    double v, norm, V[6][3];
-    int Dx[6] = {1,-1,0,0,0,0};
-    int Dy[6] = {0,0,1,-1,0,0};
-    int Dz[6] = {0,0,0,0,1,-1};
-    int MI[3][3] = {{1,0,0},{0,1,0},{0,0,1}};
-
-    vtkSmartPointer<vtkDoubleArray> Div = vtkSmartPointer<vtkDoubleArray>::New();
-    Div -> SetNumberOfComponents(1);
-    Div -> SetNumberOfTuples(Scalars->GetNumberOfTuples());
-    Div -> FillComponent(0,0.0);
-
-    for (z = s+1; z < Dim[2]-s-1; z++) {
-        for (y = s+1; y < Dim[1]-s-1; y++) {
-            for (x = s+1; x < Dim[0]-s-1; x++) {
-                v = 0.0;
-                id = GetId(x,y,z,Dim);
-                if (Scalars->GetTuple1(id)) {
-                    for (i = 0; i < 6; i++) {
-                        for (j = 0; j < 3; j++) {
-                            V[i][j]  = Scalars -> GetTuple1(GetId(x+s*Dx[i]+MI[j][0],y+s*Dy[i]+MI[j][1],z+s*Dz[i]+MI[j][2],Dim));
-                            V[i][j] -= Scalars -> GetTuple1(GetId(x+s*Dx[i]-MI[j][0],y+s*Dy[i]-MI[j][1],z+s*Dz[i]-MI[j][2],Dim));
-                        }
-                        norm = sqrt(pow(V[i][0],2)+pow(V[i][1],2)+pow(V[i][2],2));
-                        if (norm) {V[i][0]/=norm; V[i][1]/=norm; V[i][2]/=norm; }
-                    }
-                    v = (V[0][0]-V[1][0])+(V[2][1]-V[3][1])+(V[4][2]-V[5][2]);
-                    v = (v<0) ? -v / 6.0 : 0.0;
-                }
-                Div -> InsertTuple1(id,v);
-            }
-        }
+    if (Scalars -> GetDataType() == VTK_FLOAT) {
+        DivergenceFilter(Dim,(float*)Scalars -> GetVoidPointer(0));
+    } else {
+        DivergenceFilter(Dim,(double*)Scalars -> GetVoidPointer(0));
     }
-    Div -> Modified();
-    Scalars -> DeepCopy(Div);
     Scalars -> Modified();
 
 }
 
 /* ================================================================
-   WIDTH ANALYSIS
+   SKELETON ATTRIBUTES
 =================================================================*/
 
-void EstimateTubuleWidth(vtkSmartPointer<vtkPolyData> Skeleton, vtkSmartPointer<vtkPolyData> Surface, _mitoObject *mitoObject) {
+void GetSkeletonAttributes(vtkSmartPointer<vtkPolyData> Skeleton, vtkSmartPointer<vtkPolyData> Surface, vtkSmartPointer<vtkImageData> Distance, vtkSmartPointer<vtkImageData> ImageData, int nneigh, _mitoObject *mitoObject) {
 
     #ifdef DEBUG
-        printf("Calculating tubules width...\n");
+        printf("Calculating tubules width, length and intensity...\n");
     #endif
 
-    vtkIdType N = Skeleton -> GetNumberOfPoints();
-    vtkSmartPointer<vtkDoubleArray> Width = vtkSmartPointer<vtkDoubleArray>::New();
-    Width -> SetName("Width");
-    Width -> SetNumberOfComponents(1);
-    Width -> SetNumberOfTuples(N);
+    vtkIdType id, edge, N = Skeleton -> GetNumberOfPoints();
+    vtkIdType NE = Skeleton -> GetNumberOfCells();
+
+    // Flat copies of the points and of the point ids of each edge:
+    // the points of edge e are EdgePoints[EdgeStart[e]] to
+    // EdgePoints[EdgeStart[e+1]-1].
+    std::vector<double> X(3*N);
+    for (id = 0; id < N; id++) Skeleton -> GetPoint(id,&X[3*id]);
+
+    std::vector<vtkIdType> EdgeStart(NE+1,0), EdgePoints;
+    for (edge = 0; edge < NE; edge++) {
+        vtkCell *Cell = Skeleton -> GetCell(edge);
+        for (vtkIdType n = 0; n < Cell -> GetNumberOfPoints(); n++) {
+            EdgePoints.push_back(Cell -> GetPointId(n));
+        }
+        EdgeStart[edge+1] = (vtkIdType)EdgePoints.size();
+    }
+    const vtkIdType NS = (vtkIdType)EdgePoints.size();
 
     #ifdef DEBUG
         printf("\tGenerating point locator...\n");
     #endif
 
-    vtkSmartPointer<vtkKdTreePointLocator> Tree = vtkSmartPointer<vtkKdTreePointLocator>::New();
-    Tree -> SetDataSet(Surface);
-    Tree -> BuildLocator();
-
-    int k, n = 3;
-    vtkIdType id, idk;
-    double r[3], rk[3], w;
-    vtkSmartPointer<vtkIdList> List = vtkSmartPointer<vtkIdList>::New();
-    
-    double av_w = 0.0, sd_w = 0.0;
-
-    for (id = 0; id < N; id++) {
-        w = 0;
-        Skeleton -> GetPoint(id,r);
-        Tree -> FindClosestNPoints(n,r,List);
-        for (k = 0; k < n; k++) {
-            idk = List -> GetId(k);
-            Surface -> GetPoint(idk,rk);
-            w += 2.0*sqrt( pow(r[0]-rk[0],2) + pow(r[1]-rk[1],2) + pow(r[2]-rk[2],2) );
-        }
-        w /= n;
-        av_w += w;
-        sd_w += w*w;
-        Width -> SetTuple1(id,w);
-
+    // vtkStaticPointLocator can be queried from several threads at
+    // once. The k-d tree of older VTK versions is queried serially.
+    #ifdef MITO_STATIC_LOCATOR
+        vtkSmartPointer<vtkStaticPointLocator> Tree = vtkSmartPointer<vtkStaticPointLocator>::New();
+        const bool parallel = true;
+    #else
+        vtkSmartPointer<vtkKdTreePointLocator> Tree = vtkSmartPointer<vtkKdTreePointLocator>::New();
+        const bool parallel = (bool)Distance;
+    #endif
+    if (!Distance) {
+        Tree -> SetDataSet(Surface);
+        Tree -> BuildLocator();
     }
-    Width -> Modified();
-    Skeleton -> GetPointData() -> SetScalars(Width);
 
-    attribute newAtt_1 = {"Average width (um)",av_w / N};
-    mitoObject -> attributes.push_back(newAtt_1);
-    attribute newAtt_2 = {"Std width (um)",sqrt(sd_w/N - (av_w/N)*(av_w/N))};
-    mitoObject -> attributes.push_back(newAtt_2);
+    // Distances are read from the voxel under each point, or from its
+    // farthest neighbor when the point is off the segmentation
+    const float *D = (Distance) ? (const float*)Distance -> GetScalarPointer() : NULL;
+    int *DDim = (Distance) ? Distance -> GetDimensions() : NULL;
 
-}
+    int *Dim = ImageData -> GetDimensions();
+    vtkDataArray *Scalars = ImageData -> GetPointData() -> GetScalars();
 
-/* ================================================================
-   TUBULES LENGTH
-=================================================================*/
+    std::vector<double> W(N), I(N), H(NS,0.0);
+    const int n = 3;
 
-void EstimateTubuleLength(vtkSmartPointer<vtkPolyData> Skeleton) {
+    #pragma omp parallel if(parallel)
+    {
+        vtkSmartPointer<vtkIdList> List = vtkSmartPointer<vtkIdList>::New();
+        double rk[3];
 
-    vtkIdType N = Skeleton -> GetNumberOfPoints();
-    vtkSmartPointer<vtkDoubleArray> Length = vtkSmartPointer<vtkDoubleArray>::New();
-    Length -> SetName("Length");
-    Length -> SetNumberOfComponents(1);
-    Length -> SetNumberOfTuples(N);
+        #pragma omp for schedule(dynamic,256)
+        for (vtkIdType id = 0; id < N; id++) {
+            const double *r = &X[3*id];
+
+            // WIDTH
+            if (D) {
+                int x = round(r[0] / mitoObject->_dxy - mitoObject->Ox);
+                int y = round(r[1] / mitoObject->_dxy - mitoObject->Oy);
+                int z = round(r[2] / mitoObject->_dz - mitoObject->Oz);
+                double d = 0.0;
+                if (x>=0 && y>=0 && z>=0 && x<DDim[0] && y<DDim[1] && z<DDim[2]) d = D[GetId(x,y,z,DDim)];
+                for (int k = 0; d == 0.0 && k < 26; k++) {
+                    int xk = x+ssdx_sort[k], yk = y+ssdy_sort[k], zk = z+ssdz_sort[k];
+                    if (xk>=0 && yk>=0 && zk>=0 && xk<DDim[0] && yk<DDim[1] && zk<DDim[2])
+                        d = std::max(d,(double)D[GetId(xk,yk,zk,DDim)]);
+                }
+                W[id] = std::max(0.0,2.0*d - mitoObject->_dxy);
+            } else {
+                double w = 0.0;
+                Tree -> FindClosestNPoints(n,r,List);
+                for (int k = 0; k < n; k++) {
+                    Surface -> GetPoint(List->GetId(k),rk);
+                    w += 2.0*sqrt((r[0]-rk[0])*(r[0]-rk[0]) + (r[1]-rk[1])*(r[1]-rk[1]) + (r[2]-rk[2])*(r[2]-rk[2]));
+                }
+                W[id] = w / n;
+            }
 
-    double h, r1[3], r2[3], R1, R2, length;
-    vtkPoints *Points = Skeleton -> GetPoints();
-    for (vtkIdType edge=Skeleton->GetNumberOfCells();edge--;) {
-        length = 0.0;
-        for (vtkIdType n = 1; n < Skeleton->GetCell(edge)->GetNumberOfPoints(); n++) {
-            Skeleton -> GetPoint(Skeleton->GetCell(edge)->GetPointId(n-1),r1);
-            Skeleton -> GetPoint(Skeleton->GetCell(edge)->GetPointId(n  ),r2);
-            h = sqrt(pow(r2[0]-r1[0],2)+pow(r2[1]-r1[1],2)+pow(r2[2]-r1[2],2));
-            length += h;
+            // INTENSITY
+            int x = round(r[0] / mitoObject->_dxy);
+            int y = round(r[1] / mitoObject->_dxy);
+            int z = round(r[2] / mitoObject->_dz);
+            double v = 0.0;
+            for (int k = 0; k < nneigh; k++) {
+                int xk = x+ssdx_sort[k], yk = y+ssdy_sort[k], zk = z+ssdz_sort[k];
+                if (xk>=0 && yk>=0 && zk>=0 && xk<Dim[0] && yk<Dim[1] && zk<Dim[2])
+                    v += Scalars -> GetComponent(GetId(xk,yk,zk,Dim),0);
+            }
+            I[id] = v / ((double)nneigh);
         }
-        for (vtkIdType n = 0; n < Skeleton->GetCell(edge)->GetNumberOfPoints(); n++) {
-            Length -> SetTuple1(Skeleton->GetCell(edge)->GetPointId(n),length);
+
+        // Segment lengths: H[s] is the distance between EdgePoints[s-1]
+        // and EdgePoints[s] when both belong to the same edge.
+        #pragma omp for schedule(static)
+        for (vtkIdType e = 0; e < NE; e++) {
+            for (vtkIdType s = EdgeStart[e]+1; s < EdgeStart[e+1]; s++) {
+                const double *r1 = &X[3*EdgePoints[s-1]];
+                const double *r2 = &X[3*EdgePoints[s]];
+                H[s] = sqrt((r2[0]-r1[0])*(r2[0]-r1[0])+(r2[1]-r1[1])*(r2[1]-r1[1])+(r2[2]-r1[2])*(r2[2]-r1[2]));
+            }
         }
     }
 
-    Length -> Modified();
-    Skeleton -> GetPointData() -> AddArray(Length);
-
-}
-
-/* ================================================================
-   INTENSITY MAPPING
-=================================================================*/
-
-void MapImageIntensity(vtkSmartPointer<vtkPolyData> Skeleton, vtkSmartPointer<vtkImageData> ImageData, int nneigh) {
+    // Sums run serially in the order of the original serial code, so
+    // the results do not depend on the number of threads.
+    double av_w = 0.0, sd_w = 0.0;
+    for (id = 0; id < N; id++) {
+        av_w += W[id];
+        sd_w += W[id]*W[id];
+    }
 
-    int *Dim = ImageData -> GetDimensions();
+    // The length of an edge is assigned to all of its points. Edges
+    // are visited backwards, so junctions keep the length of the
+    // first edge that contains them.
+    double length, total_length = 0.0;
+    std::vector<double> L(N);
+    for (edge = NE; edge--;) {
+        length = 0.0;
+        for (vtkIdType s = EdgeStart[edge]+1; s < EdgeStart[edge+1]; s++) length += H[s];
+        for (vtkIdType s = EdgeStart[edge]; s < EdgeStart[edge+1]; s++) L[EdgePoints[s]] = length;
+        for (vtkIdType s = EdgeStart[edge]+1; s < EdgeStart[edge+1]; s++) total_length += H[s];
+    }
 
-    vtkIdType N = Skeleton -> GetNumberOfPoints();
+    vtkSmartPointer<vtkDoubleArray> Width = vtkSmartPointer<vtkDoubleArray>::New();
+    Width -> SetName("Width");
+    Width -> SetNumberOfComponents(1);
+    Width -> SetNumberOfTuples(N);
+    vtkSmartPointer<vtkDoubleArray> Length = vtkSmartPointer<vtkDoubleArray>::New();
+    Length -> SetName("Length");
+    Length -> SetNumberOfComponents(1);
+    Length -> SetNumberOfTuples(N);
     vtkSmartPointer<vtkDoubleArray> Intensity = vtkSmartPointer<vtkDoubleArray>::New();
     Intensity -> SetName("Intensity");
     Intensity -> SetNumberOfComponents(1);
     Intensity -> SetNumberOfTuples(N);
-
-    vtkIdType id;
-    int x, y, z, k;
-    double v, r[3];
-    for (id = 0; id < N; id++) {
-        v = 0;
-        Skeleton -> GetPoint(id,r);
-        x = round(r[0] / _dxy);
-        y = round(r[1] / _dxy);
-        z = round(r[2] / _dz);
-        for (k = 0; k < nneigh; k++) {
-            if ((x+ssdx_sort[k]>=0)&&(y+ssdy_sort[k]>=0)&&(z+ssdz_sort[k]>=0)&&(x+ssdx_sort[k]<Dim[0])&&(y+ssdy_sort[k]<Dim[1])&&(z+ssdz_sort[k]<Dim[2]))
-                v += ImageData -> GetScalarComponentAsDouble(x+ssdx_sort[k],y+ssdy_sort[k],z+ssdz_sort[k],0);
-        }
-        Intensity -> SetTuple1(id,v/((double)nneigh));
+    if (N) {
+        std::copy(W.begin(),W.end(),Width->GetPointer(0));
+        std::copy(L.begin(),L.end(),Length->GetPointer(0));
+        std::copy(I.begin(),I.end(),Intensity->GetPointer(0));
     }
+    Width -> Modified();
+    Length -> Modified();
     Intensity -> Modified();
+    Skeleton -> GetPointData() -> SetScalars(Width);
+    Skeleton -> GetPointData() -> AddArray(Length);
     Skeleton -> GetPointData() -> AddArray(Intensity);
 
-}
-
-/* ================================================================
-   WIDTH-CORRECTED VOLUME
-=================================================================*/
-
-void GetVolumeFromSkeletonLengthAndWidth(vtkSmartPointer<vtkPolyData> PolyData, _mitoObject *mitoObject) {
-    double h, r1[3], r2[3], R1, R2, volume = 0.0, length = 0.0;
-    vtkPoints *Points = PolyData -> GetPoints();
-    for (vtkIdType edge=PolyData->GetNumberOfCells();edge--;) {
-        for (vtkIdType n = 1; n < PolyData->GetCell(edge)->GetNumberOfPoints(); n++) {
-            PolyData -> GetPoint(PolyData->GetCell(edge)->GetPointId(n-1),r1);
-            PolyData -> GetPoint(PolyData->GetCell(edge)->GetPointId(n  ),r2);
-            R1 = 0.5*PolyData -> GetPointData() -> GetArray("Width") -> GetTuple1(PolyData->GetCell(edge)->GetPointId(n-1));
-            R2 = 0.5*PolyData -> GetPointData() -> GetArray("Width") -> GetTuple1(PolyData->GetCell(edge)->GetPointId(n  ));
-            h = sqrt(pow(r2[0]-r1[0],2)+pow(r2[1]-r1[1],2)+pow(r2[2]-r1[2],2));
-            length += h;
-            volume += 3.141592 / 3.0 * h * (R1*R1+R2*R2+R1*R2);
-        }
-    }
-    attribute newAtt_1 = {"Total length (um)",length};
+    attribute newAtt_1 = {"Average width (um)",av_w / N};
     mitoObject -> attributes.push_back(newAtt_1);
-    attribute newAtt_2 = {"Volume from length (um3)",length * (acos(-1.0)*pow(_rad,2))};
+    attribute newAtt_2 = {"Std width (um)",sqrt(sd_w/N - (av_w/N)*(av_w/N))};
     mitoObject -> attributes.push_back(newAtt_2);
-}
+    attribute newAtt_3 = {"Total length (um)",total_length};
+    mitoObject -> attributes.push_back(newAtt_3);
+    attribute newAtt_4 = {"Volume from length (um3)",total_length * (acos(-1.0)*pow(mitoObject->_rad,2))};
+    mitoObject -> attributes.push_back(newAtt_4);
 
+}
 
 /* ================================================================
    TOPOLOGICAL ATTRIBUTES FROM SKELETON
@@ -2438,10 +2505,578 @@ void GetTopologicalAttributes(vtkSmartPointer<vtkPolyData> PolyData, _mitoObject
 }
 
 /* ================================================================
-   MULTISCALE VESSELNESS
+   SLAB STREAMING
 =================================================================*/
 
-int MultiscaleVesselness(_mitoObject *mitoObject) {     
+// Why the settings cannot be streamed, or NULL if they can.
+static const char *GetStreamSlabsConflict(const _mitoObject *mitoObject) {
+    if (mitoObject->Type != "TIF") return "only TIFF stacks can be streamed";
+    if (mitoObject->_binary_input) return "-binary input is already segmented";
+    if (mitoObject->_z_adaptive) return "-z-adaptive normalizes whole z-blocks";
+    if (mitoObject->_enhance_connectivity) return "-enhance-connectivity needs the whole divergence volume";
+    if (mitoObject->_resample > 0) return "-resample needs the whole stack";
+    if (mitoObject->_export_image_resampled) return "-export_image_resampled needs the whole stack";
+    if (mitoObject->_div_threshold <= 0) return "a positive -threshold is required";
+    return NULL;
+}
+
+// Planes read above and below each slab: the reach of the Gaussian
+// smoothing, the two planes used by the second-order differences
+// and the s+1 planes used by the divergence filter. The smoothing
+// reaches the kernel radius of the largest scale, or with the
+// scale-space the sum of the radii of the increments that lead to it,
+// since each level is smoothed from the previous one.
+static int GetStreamSlabsHalo(const _mitoObject *mitoObject) {
+    int reach = 0;
+    double sigma, sigma_prev = 0.0;
+    for ( sigma = mitoObject->_sigmai; sigma <= mitoObject->_sigmaf+0.5*mitoObject->_dsigma; sigma += mitoObject->_dsigma ) {
+        if (UsesScaleSpace(mitoObject)) {
+            // Same increments as _mitoScaleSpace::GetLevel
+            double sd = sqrt(std::max(0.0,sigma*sigma-sigma_prev*sigma_prev));
+            if (sd >= 1E-3) reach += (int)ceil(MITO_GAUSS_TRUNCATE*sd);
+        } else {
+            reach = (int)ceil(10.0*sigma);
+        }
+        sigma_prev = sigma;
+    }
+    return reach + 2 + 3;
+}
+
+bool CanStreamSlabs(_mitoObject *mitoObject) {
+
+    const char *reason = GetStreamSlabsConflict(mitoObject);
+
+    if (!reason) {
+        int nz;
+        _mitoStack Stack;
+        if ( mitoObject->_mmap_input && Stack.Open(mitoObject->FileName+".tif") ) {
+            nz = Stack.Dim[2];
+        } else {
+            vtkSmartPointer<vtkTIFFReader> TIFFReader = vtkSmartPointer<vtkTIFFReader>::New();
+            TIFFReader -> SetFileName((mitoObject->FileName+".tif").c_str());
+            TIFFReader -> UpdateInformation();
+            int *Ext = TIFFReader -> GetDataExtent();
+            nz = Ext[5] - Ext[4] + 1;
+        }
+        if (nz < 2) reason = "2D images are processed in memory";
+    }
+
+    if (reason) {
+        printf("Warning: -stream-slab ignored for %s (%s).\n",mitoObject->FileName.c_str(),reason);
+        return false;
+    }
+    return true;
+}
+
+// Reads the planes [za,zb] of the TIFF stack and converts them to
+// 8-bit with the intensity range of the whole stack, like
+// Convert16To8bit does for the whole volume.
+static vtkSmartPointer<vtkImageData> ReadSlab(vtkTIFFReader *TIFFReader, const _mitoStack *Stack, int *Dim, int za, int zb, const double *range) {
+
+    vtkSmartPointer<vtkImageData> Part = ReadPlanes(TIFFReader,Stack,Dim,za,zb);
+    vtkDataArray *Scalars = Part -> GetPointData() -> GetScalars();
+    vtkIdType id, N = Scalars -> GetNumberOfTuples();
+
+    vtkSmartPointer<vtkImageData> Slab = vtkSmartPointer<vtkImageData>::New();
+    Slab -> SetDimensions(Dim[0],Dim[1],zb-za+1);
+    Slab -> SetSpacing(Part->GetSpacing());
+    Slab -> SetOrigin(0,0,0);
+
+    vtkSmartPointer<vtkUnsignedCharArray> ScalarsChar = vtkSmartPointer<vtkUnsignedCharArray>::New();
+    ScalarsChar -> SetNumberOfComponents(1);
+    ScalarsChar -> SetNumberOfTuples(N);
+    unsigned char *C = ScalarsChar -> GetPointer(0);
+
+    if (Scalars -> GetDataType() == VTK_UNSIGNED_CHAR) {
+        const unsigned char *S = (unsigned char*)Scalars -> GetVoidPointer(0);
+        for (id = N; id--;) C[id] = S[id];
+    } else {
+        const unsigned short *S = (unsigned short*)Scalars -> GetVoidPointer(0);
+        for (id = N; id--;) C[id] = (unsigned char)(255.0 * (S[id]-range[0]) / (range[1]-range[0]));
+    }
+    ScalarsChar -> Modified();
+
+    Slab -> GetPointData() -> SetScalars(ScalarsChar);
+    return Slab;
+}
+
+vtkSmartPointer<vtkImageData> SegmentInSlabs(_mitoObject *mitoObject) {
+
+    vtkSmartPointer<vtkTIFFReader> TIFFReader = vtkSmartPointer<vtkTIFFReader>::New();
+    if ( !TIFFReader -> CanReadFile((mitoObject->FileName+".tif").c_str()) ) {
+        printf("File %s cannnot be opened.\n",(mitoObject->FileName+".tif").c_str());
+        return NULL;
+    }
+    TIFFReader -> SetFileName((mitoObject->FileName+".tif").c_str());
+    TIFFReader -> UpdateInformation();
+
+    int *Ext = TIFFReader -> GetDataExtent();
+    int Dim[3] = {Ext[1]-Ext[0]+1, Ext[3]-Ext[2]+1, Ext[5]-Ext[4]+1};
+    const int nslab = mitoObject->_stream_slab;
+
+    // Planes are decoded straight from the mapped file with -mmap
+    _mitoStack MappedStack;
+    const _mitoStack *Stack = NULL;
+    if ( mitoObject->_mmap_input && MappedStack.Open(mitoObject->FileName+".tif") ) {
+        Stack = &MappedStack;
+        Dim[0] = Stack->Dim[0]; Dim[1] = Stack->Dim[1]; Dim[2] = Stack->Dim[2];
+    }
+
+    // Scales of the loop in MultiscaleVesselness
+    int nsigma = 0;
+    double sigma;
+    for ( sigma = mitoObject->_sigmai; sigma <= mitoObject->_sigmaf+0.5*mitoObject->_dsigma; sigma += mitoObject->_dsigma ) {
+        nsigma++;
+    }
+
+    const int halo = GetStreamSlabsHalo(mitoObject);
+
+    #ifdef DEBUG
+        printf("Streaming %dx%dx%d in slabs of %d planes (halo = %d)\n",Dim[0],Dim[1],Dim[2],nslab,halo);
+    #endif
+
+    // Intensity range of the whole stack
+    int z0, z1, za, zb;
+    double range[2] = {DBL_MAX, -DBL_MAX};
+    _mitoStageTimer RangeTimer(mitoObject->Profile,"Intensity range",(long long)Dim[0]*Dim[1]*Dim[2]);
+    for (z0 = 0; z0 < Dim[2]; z0 += nslab) {
+        z1 = std::min(z0+nslab,Dim[2]);
+        vtkSmartPointer<vtkImageData> Part = ReadPlanes(TIFFReader,Stack,Dim,z0,z1-1);
+        if ( Part -> GetNumberOfPoints() == 0 ) {
+            printf("File %s cannot be read.\n",(mitoObject->FileName+".tif").c_str());
+            return NULL;
+        }
+        if ( Part -> GetScalarType() != VTK_UNSIGNED_CHAR && Part -> GetScalarType() != VTK_UNSIGNED_SHORT ) {
+            printf("Format not supported.\n");
+            return NULL;
+        }
+        if ( z0 == 0 ) {
+            double *Origin = Part -> GetOrigin();
+            mitoObject->Ox = Origin[0];
+            mitoObject->Oy = Origin[1];
+            mitoObject->Oz = Origin[2];
+        }
+        double r[2];
+        Part -> GetPointData() -> GetScalars() -> GetRange(r);
+        range[0] = std::min(range[0],r[0]);
+        range[1] = std::max(range[1],r[1]);
+    }
+    RangeTimer.Stop();
+
+    // The global Frobenius threshold needs the maximum over the whole
+    // volume for every scale before any slab can be thresholded. The
+    // adaptive threshold only depends on each z-plane.
+    std::vector<float> FroMax(nsigma,0.0);
+    if (!mitoObject->_adaptive_threshold) {
+        _mitoStageTimer Timer(mitoObject->Profile,"Frobenius maximum",(long long)Dim[0]*Dim[1]*Dim[2]);
+        for (z0 = 0; z0 < Dim[2]; z0 += nslab) {
+            z1 = std::min(z0+nslab,Dim[2]);
+            za = std::max(0,z0-halo);
+            zb = std::min(Dim[2]-1,z1-1+halo);
+            vtkSmartPointer<vtkImageData> Slab = ReadSlab(TIFFReader,Stack,Dim,za,zb,range);
+            int *SDim = Slab -> GetDimensions();
+
+            std::vector<float> SpaceBuffer;
+            _mitoScaleSpace Space;
+            if (UsesScaleSpace(mitoObject)) {
+                Space.SetInput(GetScalarsAsFloat(Slab->GetPointData()->GetScalars(),SpaceBuffer),SDim);
+            }
+
+            int k = 0;
+            for ( sigma = mitoObject->_sigmai; sigma <= mitoObject->_sigmaf+0.5*mitoObject->_dsigma; sigma += mitoObject->_dsigma, k++ ) {
+                std::vector<float> Buffer;
+                vtkSmartPointer<vtkImageGaussianSmooth> Gauss;
+                const float *ImageG = GetSmoothedImage(sigma,Slab,(UsesScaleSpace(mitoObject)) ? &Space : NULL,Gauss,Buffer,mitoObject->Profile);
+                FroMax[k] = std::max(FroMax[k],HessianFrobeniusPass(ImageG,SDim,z0-za,z1-za,NULL,NULL,NULL,NULL,0));
+            }
+        }
+    }
+
+    // Output binary volume
+    vtkSmartPointer<vtkImageData> Binary = vtkSmartPointer<vtkImageData>::New();
+    Binary -> SetDimensions(Dim);
+    Binary -> SetOrigin(0,0,0);
+    vtkSmartPointer<vtkUnsignedCharArray> BinaryScalars = vtkSmartPointer<vtkUnsignedCharArray>::New();
+    BinaryScalars -> SetNumberOfComponents(1);
+    BinaryScalars -> SetNumberOfTuples((vtkIdType)Dim[0]*Dim[1]*Dim[2]);
+    unsigned char *B = BinaryScalars -> GetPointer(0);
+
+    for (z0 = 0; z0 < Dim[2]; z0 += nslab) {
+        z1 = std::min(z0+nslab,Dim[2]);
+        za = std::max(0,z0-halo);
+        zb = std::min(Dim[2]-1,z1-1+halo);
+
+        #ifdef DEBUG
+            printf("\tSlab [%d,%d) read as [%d,%d]\n",z0,z1,za,zb);
+        #endif
+
+        char name[64];
+        snprintf(name,sizeof(name),"Slab z=%d-%d",z0,z1-1);
+        _mitoStageTimer Timer(mitoObject->Profile,name,(long long)Dim[0]*Dim[1]*(z1-z0));
+
+        vtkSmartPointer<vtkImageData> Slab = ReadSlab(TIFFReader,Stack,Dim,za,zb,range);
+        if (z0 == 0) Binary -> SetSpacing(Slab->GetSpacing());
+        int *SDim = Slab -> GetDimensions();
+        vtkIdType NS = Slab -> GetNumberOfPoints();
+
+        //VESSELNESS
+        //----------
+
+        vtkSmartPointer<vtkDataArray> VSSS = NewVesselnessArray(mitoObject,NS);
+
+        std::vector<float> SpaceBuffer;
+        _mitoScaleSpace Space;
+        if (UsesScaleSpace(mitoObject)) {
+            Space.SetInput(GetScalarsAsFloat(Slab->GetPointData()->GetScalars(),SpaceBuffer),SDim);
+        }
+
+        int k = 0;
+        for ( sigma = mitoObject->_sigmai; sigma <= mitoObject->_sigmaf+0.5*mitoObject->_dsigma; sigma += mitoObject->_dsigma, k++ ) {
+
+            GetVesselness(sigma,Slab,VSSS,mitoObject,(UsesScaleSpace(mitoObject)) ? &Space : NULL,(mitoObject->_adaptive_threshold) ? NULL : &FroMax[k]);
+
+        }
+        VSSS -> Modified();
+
+        //DIVERGENCE FILTER
+        //-----------------
+
+        _mitoStageTimer DivTimer(mitoObject->Profile,"Divergence",NS);
+        GetDivergenceFilter(SDim,VSSS);
+        DivTimer.Stop();
+
+        //BINARIZATION OF THE PLANES OWNED BY THE SLAB
+        //--------------------------------------------
+
+        const float *VF = (VSSS -> GetDataType() == VTK_FLOAT) ? (float*)VSSS -> GetVoidPointer(0) : NULL;
+        const double *VD = (VF) ? NULL : (double*)VSSS -> GetVoidPointer(0);
+
+        #pragma omp parallel for
+        for (int z = z0; z < z1; z++) {
+            for (int y = 0; y < Dim[1]; y++) {
+                for (int x = 0; x < Dim[0]; x++) {
+                    vtkIdType id = GetId(x,y,z,Dim);
+                    // Boundaries are cleared as in CleanImageBoundaries
+                    if (x == 0 || y == 0 || z == 0 || x == Dim[0]-1 || y == Dim[1]-1 || z == Dim[2]-1) {
+                        B[id] = 0;
+                    } else {
+                        vtkIdType sid = GetId(x,y,z-za,SDim);
+                        double v = (VF) ? VF[sid] : VD[sid];
+                        B[id] = (v <= mitoObject->_div_threshold) ? 0 : 255;
+                    }
+                }
+            }
+        }
+
+    }
+    BinaryScalars -> Modified();
+    Binary -> GetPointData() -> SetScalars(BinaryScalars);
+
+    //SMALL COMPONENTS
+    //----------------
+    // The 6-connected components above the threshold are exactly
+    // the components of the binary image.
+    if (mitoObject->_smart_component_filtering) {
+        _mitoStageTimer Timer(mitoObject->Profile,"Component filtering");
+        std::vector<_mitoRun> Runs;
+        std::vector<long int> Label, CSz;
+        long int ncc = LabelConnectedRuns(B,Dim,6,Runs,Label,CSz);
+        Timer.SetCount(ncc);
+        if (ncc > 1) {
+            for (size_t r = 0; r < Runs.size(); r++) {
+                if (CSz[Label[r]-1] <= mitoObject->_min_component_size) {
+                    memset(B+Runs[r].row*Dim[0]+Runs[r].x0,0,Runs[r].x1-Runs[r].x0+1);
+                }
+            }
+            BinaryScalars -> Modified();
+        }
+    }
+
+    //FILLING HOLES
+    //-------------
+    if (mitoObject->_improve_skeleton_quality) {
+        _mitoStageTimer Timer(mitoObject->Profile,"FillHoles",Binary->GetNumberOfPoints());
+        FillHoles(Binary,mitoObject->_fill_holes_flood);
+    }
+
+    // EXPORT SEGMENTED IMAGE
+    // ----------------------
+    if (mitoObject->_export_image_binary) {
+        _mitoStageTimer Timer(mitoObject->Profile,"Export binary");
+        vtkSmartPointer<vtkTIFFWriter> tif_writer = vtkSmartPointer<vtkTIFFWriter>::New();
+        tif_writer->SetInputData(Binary);
+        tif_writer->SetFileName((mitoObject->FileName + "_binary.tif").c_str());
+        tif_writer->Write();
+    }
+
+    //MAX PROJECTION
+    //--------------
+
+    if (!mitoObject->Result) {
+        _mitoStageTimer ProjTimer(mitoObject->Profile,"Max projection");
+        ExportMaxProjection(Binary,(mitoObject->FileName+".png").c_str());
+    }
+
+    return Binary;
+}
+
+/* ================================================================
+   STAGE CACHE
+=================================================================*/
+
+// Header of the cache files of the divergence (.mgdiv, followed by
+// the divergence as floats) and of the segmentation (.mgseg, followed
+// by the binary mask, one byte per voxel, and the divergence after
+// the component filtering as floats)
+struct _mitoCacheHeader {
+    char magic[8];
+    uint64_t key;
+    int32_t Dim[3];
+    int32_t reserved;
+};
+
+static const char MITO_DIVERGENCE_MAGIC[8] = {'M','G','D','I','V',0,0,1};
+static const char MITO_SEGMENTATION_MAGIC[8] = {'M','G','S','E','G',0,0,1};
+
+// Opens the cache file FileName and checks its header. Returns NULL
+// unless the file exists and matches magic, key and Dim.
+static FILE *OpenCache(std::string FileName, const char *magic, uint64_t key, const int *Dim) {
+    FILE *f = fopen(FileName.c_str(),"rb");
+    if ( !f ) return NULL;
+    _mitoCacheHeader Header;
+    bool valid = fread(&Header,sizeof(Header),1,f) == 1;
+    valid = valid && !memcmp(Header.magic,magic,8) && Header.key == key;
+    valid = valid && Header.Dim[0] == Dim[0] && Header.Dim[1] == Dim[1] && Header.Dim[2] == Dim[2];
+    if ( !valid ) {
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+// Creates FileName.tmp and writes the header of the cache file.
+// Returns NULL if it cannot be written.
+static FILE *CreateCache(std::string FileName, const char *magic, uint64_t key, const int *Dim) {
+    FILE *f = fopen((FileName+".tmp").c_str(),"wb");
+    if ( !f ) return NULL;
+    _mitoCacheHeader Header;
+    memset(&Header,0,sizeof(Header));
+    memcpy(Header.magic,magic,8);
+    Header.key = key;
+    for (int k = 0; k < 3; k++) Header.Dim[k] = Dim[k];
+    if ( fwrite(&Header,sizeof(Header),1,f) != 1 ) {
+        fclose(f);
+        remove((FileName+".tmp").c_str());
+        return NULL;
+    }
+    return f;
+}
+
+// Closes a file of CreateCache and renames it to FileName once
+// complete, so a run reading the cache never sees part of a file.
+static bool CommitCache(std::string FileName, FILE *f, bool valid) {
+    valid = (fclose(f) == 0) && valid;
+    remove(FileName.c_str());
+    if ( !valid || rename((FileName+".tmp").c_str(),FileName.c_str()) ) {
+        remove((FileName+".tmp").c_str());
+        return false;
+    }
+    return true;
+}
+
+// Name of the cache file of mitoObject with this key and extension
+static std::string GetCacheName(const _mitoObject *mitoObject, uint64_t key, const char *ext) {
+    char name[48];
+    snprintf(name,sizeof(name),".%016llx.%s",(unsigned long long)key,ext);
+    return mitoObject->FileName + name;
+}
+
+// Key of the divergence of the 8-bit Image: its voxels and every
+// option of the vesselness and the divergence filter.
+static uint64_t GetDivergenceKey(const _mitoObject *mitoObject, vtkImageData *Image) {
+    uint64_t h = MitoHash(MITOGRAPH_VERSION.c_str(),MITOGRAPH_VERSION.size());
+    int *Dim = Image -> GetDimensions();
+    h = MitoHash(Dim,3*sizeof(int),h);
+    double Scales[3] = {mitoObject->_sigmai, mitoObject->_sigmaf, mitoObject->_dsigma};
+    h = MitoHash(Scales,sizeof(Scales),h);
+    int Options[4] = {(mitoObject->_adaptive_threshold) ? mitoObject->_nblks : 0, (int)UsesScaleSpace(mitoObject), (int)mitoObject->_eigen_jacobi, (int)mitoObject->_storage_double};
+    h = MitoHash(Options,sizeof(Options),h);
+    vtkDataArray *Scalars = Image -> GetPointData() -> GetScalars();
+    return MitoHash(Scalars->GetVoidPointer(0),(size_t)Scalars->GetNumberOfTuples()*Scalars->GetDataTypeSize(),h);
+}
+
+// Key of the segmentation of the divergence with the given key: the
+// divergence and every option of the segmentation.
+static uint64_t GetSegmentationKey(const _mitoObject *mitoObject, uint64_t key) {
+    uint64_t h = MitoHash(&key,sizeof(key));
+    double threshold = mitoObject->_div_threshold;
+    h = MitoHash(&threshold,sizeof(threshold),h);
+    int Options[8] = {(int)mitoObject->_z_adaptive, (int)mitoObject->_z_enhanced, mitoObject->_z_block_size,
+                      (mitoObject->_smart_component_filtering) ? mitoObject->_min_component_size : 0,
+                      (int)mitoObject->_enhance_connectivity, (int)mitoObject->_improve_skeleton_quality,
+                      (int)mitoObject->_fill_holes_flood, 0};
+    return MitoHash(Options,sizeof(Options),h);
+}
+
+// The caches hold the divergence as float. Float scalars are read
+// and written as they are, double ones through a buffer.
+static bool ReadFloatScalars(FILE *f, vtkDataArray *Scalars) {
+    size_t N = (size_t)Scalars -> GetNumberOfTuples();
+    if (Scalars -> GetDataType() == VTK_FLOAT) {
+        return fread(Scalars->GetVoidPointer(0),sizeof(float),N,f) == N;
+    }
+    double *V = (double*)Scalars -> GetVoidPointer(0);
+    std::vector<float> Buffer(1<<20);
+    for (size_t id = 0; id < N; id += Buffer.size()) {
+        size_t n = std::min(Buffer.size(),N-id);
+        if (fread(&Buffer[0],sizeof(float),n,f) != n) return false;
+        for (size_t k = 0; k < n; k++) V[id+k] = Buffer[k];
+    }
+    return true;
+}
+
+static bool WriteFloatScalars(FILE *f, vtkDataArray *Scalars) {
+    size_t N = (size_t)Scalars -> GetNumberOfTuples();
+    if (Scalars -> GetDataType() == VTK_FLOAT) {
+        return fwrite(Scalars->GetVoidPointer(0),sizeof(float),N,f) == N;
+    }
+    const double *V = (const double*)Scalars -> GetVoidPointer(0);
+    std::vector<float> Buffer(1<<20);
+    for (size_t id = 0; id < N; id += Buffer.size()) {
+        size_t n = std::min(Buffer.size(),N-id);
+        for (size_t k = 0; k < n; k++) Buffer[k] = (float)V[id+k];
+        if (fwrite(&Buffer[0],sizeof(float),n,f) != n) return false;
+    }
+    return true;
+}
+
+// Double scalars rounded to float like the caches, so the results
+// do not depend on whether a cache was read
+static void RoundToFloat(vtkDataArray *Scalars) {
+    if (Scalars -> GetDataType() != VTK_DOUBLE) return;
+    double *V = (double*)Scalars -> GetVoidPointer(0);
+    for (vtkIdType id = Scalars -> GetNumberOfTuples(); id--;) V[id] = (float)V[id];
+    Scalars -> Modified();
+}
+
+static vtkSmartPointer<vtkImageData> ReadDivergenceCache(const _mitoObject *mitoObject, std::string FileName, uint64_t key, vtkImageData *Image) {
+
+    FILE *f = OpenCache(FileName,MITO_DIVERGENCE_MAGIC,key,Image->GetDimensions());
+    if ( !f ) return NULL;
+
+    vtkSmartPointer<vtkDataArray> Scalars = NewVesselnessArray(mitoObject,Image->GetNumberOfPoints());
+    bool valid = ReadFloatScalars(f,Scalars);
+    fclose(f);
+    if ( !valid ) return NULL;
+
+    vtkSmartPointer<vtkImageData> ImageEnhanced = vtkSmartPointer<vtkImageData>::New();
+    ImageEnhanced -> ShallowCopy(Image);
+    ImageEnhanced -> GetPointData() -> SetScalars(Scalars);
+    return ImageEnhanced;
+}
+
+static bool WriteDivergenceCache(std::string FileName, uint64_t key, vtkImageData *ImageEnhanced) {
+
+    FILE *f = CreateCache(FileName,MITO_DIVERGENCE_MAGIC,key,ImageEnhanced->GetDimensions());
+    if ( !f ) return false;
+
+    bool valid = WriteFloatScalars(f,ImageEnhanced->GetPointData()->GetScalars());
+    return CommitCache(FileName,f,valid);
+}
+
+vtkSmartPointer<vtkImageData> GetCachedDivergence(_mitoObject *mitoObject, vtkSmartPointer<vtkImageData> Image, uint64_t &key) {
+
+    key = 0;
+    if ( !mitoObject->_sweep_cache && !mitoObject->_cache_stages ) return GetDivergenceImage(mitoObject,Image);
+
+    vtkIdType N = Image -> GetNumberOfPoints();
+    key = GetDivergenceKey(mitoObject,Image);
+    std::string CacheName = GetCacheName(mitoObject,key,"mgdiv");
+
+    vtkSmartPointer<vtkImageData> ImageEnhanced;
+    {
+        _mitoStageTimer Timer(mitoObject->Profile,"Read divergence cache",N);
+        ImageEnhanced = ReadDivergenceCache(mitoObject,CacheName,key,Image);
+    }
+    if ( ImageEnhanced ) return ImageEnhanced;
+
+    ImageEnhanced = GetDivergenceImage(mitoObject,Image);
+
+    _mitoStageTimer Timer(mitoObject->Profile,"Write divergence cache",N);
+    if ( !WriteDivergenceCache(CacheName,key,ImageEnhanced) ) {
+        printf("Divergence cache %s cannot be written.\n",CacheName.c_str());
+    }
+    RoundToFloat(ImageEnhanced->GetPointData()->GetScalars());
+
+    return ImageEnhanced;
+}
+
+bool ReadSegmentationCache(_mitoObject *mitoObject, uint64_t key, vtkSmartPointer<vtkImageData> ImageEnhanced, vtkSmartPointer<vtkImageData> &Binary) {
+
+    if ( !mitoObject->_cache_stages || !key ) return false;
+
+    key = GetSegmentationKey(mitoObject,key);
+    vtkIdType N = ImageEnhanced -> GetNumberOfPoints();
+    _mitoStageTimer Timer(mitoObject->Profile,"Read segmentation cache",N);
+    std::string CacheName = GetCacheName(mitoObject,key,"mgseg");
+    FILE *f = OpenCache(CacheName,MITO_SEGMENTATION_MAGIC,key,ImageEnhanced->GetDimensions());
+    if ( !f ) return false;
+
+    vtkSmartPointer<vtkUnsignedCharArray> Mask = vtkSmartPointer<vtkUnsignedCharArray>::New();
+    Mask -> SetNumberOfTuples(N);
+    bool valid = fread(Mask->GetPointer(0),1,(size_t)N,f) == (size_t)N;
+
+    // The divergence is read aside so that a truncated file leaves
+    // ImageEnhanced as it was and the file is segmented again
+    vtkSmartPointer<vtkDataArray> Scalars = NewVesselnessArray(mitoObject,N);
+    valid = valid && ReadFloatScalars(f,Scalars);
+    fclose(f);
+
+    if ( !valid ) {
+        printf("Warning: segmentation cache %s is truncated and will be rebuilt.\n",CacheName.c_str());
+        remove(CacheName.c_str());
+        return false;
+    }
+
+    vtkDataArray *Divergence = ImageEnhanced -> GetPointData() -> GetScalars();
+    memcpy(Divergence->GetVoidPointer(0),Scalars->GetVoidPointer(0),(size_t)N*Divergence->GetDataTypeSize());
+    Divergence -> Modified();
+    Binary = vtkSmartPointer<vtkImageData>::New();
+    Binary -> ShallowCopy(ImageEnhanced);
+    Binary -> GetPointData() -> SetScalars(Mask);
+    return true;
+}
+
+void WriteSegmentationCache(_mitoObject *mitoObject, uint64_t key, vtkImageData *ImageEnhanced, vtkImageData *Binary) {
+
+    if ( !mitoObject->_cache_stages || !key ) return;
+
+    key = GetSegmentationKey(mitoObject,key);
+    vtkIdType N = Binary -> GetNumberOfPoints();
+    std::string CacheName = GetCacheName(mitoObject,key,"mgseg");
+    _mitoStageTimer Timer(mitoObject->Profile,"Write segmentation cache",N);
+
+    // Rounded to float like the cache, so the surface does not depend
+    // on whether the cache was read
+    RoundToFloat(ImageEnhanced->GetPointData()->GetScalars());
+
+    FILE *f = CreateCache(CacheName,MITO_SEGMENTATION_MAGIC,key,Binary->GetDimensions());
+    bool valid = f && fwrite(Binary->GetPointData()->GetScalars()->GetVoidPointer(0),1,(size_t)N,f) == (size_t)N;
+    valid = valid && WriteFloatScalars(f,ImageEnhanced->GetPointData()->GetScalars());
+    if ( !f || !CommitCache(CacheName,f,valid) ) {
+        printf("Segmentation cache %s cannot be written.\n",CacheName.c_str());
+    }
+}
+
+void RemoveSegmentationCache(_mitoObject *mitoObject, uint64_t key) {
+    if ( mitoObject->_cache_stages && key ) remove(GetCacheName(mitoObject,GetSegmentationKey(mitoObject,key),"mgseg").c_str());
+}
+
+/* ================================================================
+   MULTISCALE VESSELNESS
+=================================================================*/
+
+vtkSmartPointer<vtkImageData> LoadStack(_mitoObject *mitoObject, vtkSmartPointer<vtkImageData> &Raw) {
 
     vtkIdType id;
     int x, y, z, *Dim;
@@ -2449,30 +3084,56 @@ int MultiscaleVesselness(_mitoObject *mitoObject) {
     vtkSmartPointer<vtkTIFFReader> TIFFReader;
     vtkSmartPointer<vtkStructuredPointsReader> STRUCReader;
 
+    _mitoStageTimer LoadTimer(mitoObject->Profile,"Load");
+
     if ( mitoObject->Type == "TIF" ) {
 
-        // Loading multi-paged TIFF file (Supported by VTK 6.2 and higher)
-        TIFFReader = vtkSmartPointer<vtkTIFFReader>::New();
-        int errlog = TIFFReader -> CanReadFile((mitoObject->FileName+".tif").c_str());
-        // File cannot be opened
-        if ( !errlog ) {
-            printf("File %s cannnot be opened.\n",(mitoObject->FileName+".tif").c_str());
-            return -1;
+        // Uncompressed stacks are memory-mapped with -mmap, anything
+        // else goes through vtkTIFFReader. Stacks given through the
+        // library API are not read.
+        _mitoStack Stack;
+        if ( mitoObject->Input ) {
+
+            Raw = mitoObject->Input;
+
+        } else if ( mitoObject->_mmap_input && Stack.Open(mitoObject->FileName+".tif") ) {
+
+            Raw = ReadMappedStack(Stack,0,Stack.Dim[2]-1);
+
+        } else {
+
+            // Loading multi-paged TIFF file (Supported by VTK 6.2 and higher)
+            TIFFReader = vtkSmartPointer<vtkTIFFReader>::New();
+            int errlog = TIFFReader -> CanReadFile((mitoObject->FileName+".tif").c_str());
+            // File cannot be opened
+            if ( !errlog ) {
+                printf("File %s cannnot be opened.\n",(mitoObject->FileName+".tif").c_str());
+                return NULL;
+            }
+            TIFFReader -> SetFileName((mitoObject->FileName+".tif").c_str());
+            TIFFReader -> Update();
+
+            // Corrupted or unsupported file
+            if ( TIFFReader -> GetOutput() -> GetNumberOfPoints() == 0 ) {
+                printf("File %s cannot be read.\n",(mitoObject->FileName+".tif").c_str());
+                return NULL;
+            }
+
+            Raw = TIFFReader -> GetOutput();
+
         }
-        TIFFReader -> SetFileName((mitoObject->FileName+".tif").c_str());
-        TIFFReader -> Update();
 
-        Dim = TIFFReader -> GetOutput() -> GetDimensions();
+        Dim = Raw -> GetDimensions();
 
         // Exporting resampled images
 
-        if ( _export_image_resampled ) {
-            SaveImageData(TIFFReader->GetOutput(),(mitoObject->FileName+"_resampled.tif").c_str(),true);
+        if ( mitoObject->_export_image_resampled ) {
+            SaveImageData(Raw,(mitoObject->FileName+"_resampled.tif").c_str(),true,mitoObject->_dz/mitoObject->_dxy);
         }
 
         if ( Dim[2] == 1 ) {
 
-            double avg_bkgrd = SampleBackgroundIntensity(TIFFReader->GetOutput()->GetPointData()->GetScalars());
+            double avg_bkgrd = SampleBackgroundIntensity(Raw->GetPointData()->GetScalars());
 
             #ifdef DEBUG
                 printf("2D Image Detected...\n");
@@ -2497,7 +3158,7 @@ int MultiscaleVesselness(_mitoObject *mitoObject) {
                         if ( (z<2) || (z>sz-3) ) {
                             v = avg_bkgrd + 0.1*PoissonGen(avg_bkgrd);
                         } else {
-                            v = TIFFReader -> GetOutput() -> GetScalarComponentAsDouble(x,y,0,0);
+                            v = Raw -> GetScalarComponentAsDouble(x,y,0,0);
                         }
                         double point[3] = {(double)x, (double)y, (double)z};
                         id = Image -> FindPoint(point);
@@ -2512,24 +3173,24 @@ int MultiscaleVesselness(_mitoObject *mitoObject) {
 
         } else {
 
-            if (_resample > 0) {
+            if (mitoObject->_resample > 0) {
 
                 vtkSmartPointer<vtkImageResample> Resample = vtkSmartPointer<vtkImageResample>::New();
                 Resample -> SetInterpolationModeToLinear();
                 Resample -> SetDimensionality(3);
-                Resample -> SetInputData(TIFFReader->GetOutput());
+                Resample -> SetInputData(Raw);
                 Resample -> SetAxisMagnificationFactor(0,1.0);
                 Resample -> SetAxisMagnificationFactor(1,1.0);
-                Resample -> SetAxisMagnificationFactor(2,_resample/_dxy);
+                Resample -> SetAxisMagnificationFactor(2,mitoObject->_resample/mitoObject->_dxy);
                 Resample -> Update();
 
                 Image = Resample -> GetOutput();
 
-                _dz = _dxy;
+                mitoObject->_dz = mitoObject->_dxy;
             
             } else {
 
-                Image = TIFFReader -> GetOutput();
+                Image = Raw;
 
             }
 
@@ -2541,12 +3202,17 @@ int MultiscaleVesselness(_mitoObject *mitoObject) {
         STRUCReader -> SetFileName((mitoObject->FileName+"-mitovolume.vtk").c_str());
         STRUCReader -> Update();
 
-        Image = STRUCReader -> GetOutput();
+        Image = Raw = STRUCReader -> GetOutput();
+
+        if ( Image -> GetNumberOfPoints() == 0 ) {
+            printf("File %s cannot be read.\n",(mitoObject->FileName+"-mitovolume.vtk").c_str());
+            return NULL;
+        }
 
     } else {
 
         printf("Format not recognized.\n");
-        return EXIT_FAILURE;
+        return NULL;
 
     }
 
@@ -2567,354 +3233,1687 @@ int MultiscaleVesselness(_mitoObject *mitoObject) {
         Image = Convert16To8bit(Image);
     }
 
+    if (!Image) {
+        printf("Format not supported.\n");
+        return NULL;
+    }
+
     Dim = Image -> GetDimensions();
 
+    LoadTimer.SetCount((long long)Dim[0]*Dim[1]*Dim[2]);
+    LoadTimer.Stop();
+
     #ifdef DEBUG
         printf("MitoGraph %s [DEBUG mode]\n",MITOGRAPH_VERSION.c_str());
         printf("File name: %s\n",mitoObject->FileName.c_str());
         printf("Volume dimensions: %dx%dx%d\n",Dim[0],Dim[1],Dim[2]);
         printf("Scales to run: [%1.3f:%1.3f:%1.3f]\n",mitoObject->_sigmai,mitoObject->_dsigma,mitoObject->_sigmaf);
-        printf("Threshold: %1.5f\n",_div_threshold);
+        printf("Threshold: %1.5f\n",mitoObject->_div_threshold);
+    #endif
+
+    return Image;
+}
+
+// Why the vesselness of mitoObject cannot run on the GPU, or NULL if
+// it can.
+static const char *GetDeviceConflict(const _mitoObject *mitoObject, std::string &Error) {
+    #ifdef MITOGRAPH_HAVE_CUDA
+        if (mitoObject->_adaptive_threshold) return "-adaptive runs on the CPU";
+        if (mitoObject->_eigen_jacobi) return "-eigen-jacobi runs on the CPU";
+        if (!CanUseCudaDevice(Error)) return Error.c_str();
+        return NULL;
+    #else
+        return "built without CUDA";
     #endif
+}
 
-    if (!Image) printf("Format not supported.\n");
+// Divergence of Image computed on the GPU into VSSS. Returns false,
+// with a warning, when it has to be computed on the CPU instead.
+static bool GetDivergenceOnDevice(_mitoObject *mitoObject, vtkSmartPointer<vtkImageData> Image, vtkDataArray *VSSS) {
 
-    vtkSmartPointer<vtkImageData> Binary;
-    vtkSmartPointer<vtkContourFilter> Filter = vtkSmartPointer<vtkContourFilter>::New();
+    std::string Error;
+    const char *reason = GetDeviceConflict(mitoObject,Error);
+
+    #ifdef MITOGRAPH_HAVE_CUDA
+        if (!reason) {
+            std::vector<double> Sigmas;
+            for (double sigma = mitoObject->_sigmai; sigma <= mitoObject->_sigmaf+0.5*mitoObject->_dsigma; sigma += mitoObject->_dsigma) {
+                Sigmas.push_back(sigma);
+            }
+            std::vector<float> Buffer;
+            const float *Input = GetScalarsAsFloat(Image->GetPointData()->GetScalars(),Buffer);
+            int status;
+            if (VSSS -> GetDataType() == VTK_FLOAT) {
+                status = GetDivergenceCuda(Input,Image->GetDimensions(),Sigmas,(float*)VSSS->GetVoidPointer(0),mitoObject->Profile,Error);
+            } else {
+                status = GetDivergenceCuda(Input,Image->GetDimensions(),Sigmas,(double*)VSSS->GetVoidPointer(0),mitoObject->Profile,Error);
+            }
+            if (status == EXIT_SUCCESS) return true;
+            reason = Error.c_str();
+        }
+    #endif
+
+    printf("Warning: -device gpu ignored for %s (%s).\n",mitoObject->FileName.c_str(),reason);
+    return false;
+}
+
+vtkSmartPointer<vtkImageData> GetDivergenceImage(_mitoObject *mitoObject, vtkSmartPointer<vtkImageData> Image) {
+
+    int *Dim = Image -> GetDimensions();
     vtkIdType N = Image -> GetNumberOfPoints();
 
-    if (!mitoObject->_binary_input) {
+    vtkSmartPointer<vtkDataArray> VSSS = NewVesselnessArray(mitoObject,N);
 
-        //VESSELNESS
-        //----------
+    // The GPU returns the divergence directly
+    if ( mitoObject->_device == MITO_DEVICE_GPU && GetDivergenceOnDevice(mitoObject,Image,VSSS) ) {
+        VSSS -> Modified();
+        vtkSmartPointer<vtkImageData> ImageEnhanced = vtkSmartPointer<vtkImageData>::New();
+        ImageEnhanced -> ShallowCopy(Image);
+        ImageEnhanced -> GetPointData() -> SetScalars(VSSS);
+        ImageEnhanced -> SetDimensions(Dim);
+        return ImageEnhanced;
+    }
 
-        vtkSmartPointer<vtkDoubleArray> AUX1 = vtkSmartPointer<vtkDoubleArray>::New();
-        vtkSmartPointer<vtkDoubleArray> AUX2 = vtkSmartPointer<vtkDoubleArray>::New();
-        vtkSmartPointer<vtkDoubleArray> AUX3 = vtkSmartPointer<vtkDoubleArray>::New();
-        vtkSmartPointer<vtkDoubleArray> VSSS = vtkSmartPointer<vtkDoubleArray>::New();
+    //VESSELNESS
+    //----------
 
-        AUX1 -> SetNumberOfTuples(N);
-        AUX2 -> SetNumberOfTuples(N);
-        AUX3 -> SetNumberOfTuples(N);
-        VSSS -> SetNumberOfTuples(N);
-        AUX1 -> FillComponent(0,0.0);
-        AUX2 -> FillComponent(0,0.0);
-        AUX3 -> FillComponent(0,0.0);
-        VSSS -> FillComponent(0,0.0);
+    double sigma;
 
-        double sigma, vn, vo;
+    // Each scale is derived from the previous one when the
+    // scale-space is enabled, or when -device gpu fell back to the
+    // CPU. Its levels are released with the scope once the last
+    // scale is done.
+    {
+        std::vector<float> SpaceBuffer;
+        _mitoScaleSpace Space;
+        if (UsesScaleSpace(mitoObject)) {
+            Space.SetInput(GetScalarsAsFloat(Image->GetPointData()->GetScalars(),SpaceBuffer),Dim);
+        }
 
         for ( sigma = mitoObject->_sigmai; sigma <= mitoObject->_sigmaf+0.5*mitoObject->_dsigma; sigma += mitoObject->_dsigma ) {
-            
+        
             #ifdef DEBUG
                 printf("Running sigma = %1.3f\n",sigma);
             #endif
-            
-            GetVesselness(sigma,Image,AUX1,AUX2,AUX3,mitoObject);
-            
-            for ( id = N; id--; ) {
-                vn = AUX1 -> GetTuple1(id);
-                vo = VSSS -> GetTuple1(id);
-                if ( vn > vo ) {
-                    VSSS -> SetTuple1(id,vn);
-                }
-            }
+
+            char name[64];
+            snprintf(name,sizeof(name),"Vesselness sigma=%1.3f",sigma);
+            _mitoStageTimer Timer(mitoObject->Profile,name,N);
+        
+            GetVesselness(sigma,Image,VSSS,mitoObject,(UsesScaleSpace(mitoObject)) ? &Space : NULL,NULL);
 
         }
-        VSSS -> Modified();
+    }
+    VSSS -> Modified();
 
-        #ifdef DEBUG
-            vtkSmartPointer<vtkImageData> ImageVess = vtkSmartPointer<vtkImageData>::New();
-            ImageVess -> ShallowCopy(Image);
-            ImageVess -> GetPointData() -> SetScalars(VSSS);
-            ImageVess -> SetDimensions(Dim);
+    #ifdef DEBUG
+        vtkSmartPointer<vtkImageData> ImageVess = vtkSmartPointer<vtkImageData>::New();
+        ImageVess -> ShallowCopy(Image);
+        ImageVess -> GetPointData() -> SetScalars(VSSS);
+        ImageVess -> SetDimensions(Dim);
 
-            SaveImageData(ImageVess,(mitoObject->FileName+"_vess.tif").c_str());
-        #endif
+        SaveImageData(ImageVess,(mitoObject->FileName+"_vess.tif").c_str());
+    #endif
 
-        //DIVERGENCE FILTER
-        //-----------------
+    //DIVERGENCE FILTER
+    //-----------------
+
+    _mitoStageTimer DivTimer(mitoObject->Profile,"Divergence",N);
+    GetDivergenceFilter(Dim,VSSS);
+    DivTimer.Stop();
+
+    // The divergence is handed over to ImageEnhanced
+    vtkSmartPointer<vtkImageData> ImageEnhanced = vtkSmartPointer<vtkImageData>::New();
+    ImageEnhanced -> ShallowCopy(Image);
+    ImageEnhanced -> GetPointData() -> SetScalars(VSSS);
+    ImageEnhanced -> SetDimensions(Dim);
+
+    #ifdef DEBUG
+        SaveImageData(BinarizeAndConvertDoubleToChar(ImageEnhanced,-1),(mitoObject->FileName+"_div.tif").c_str());
+    #endif
+
+    return ImageEnhanced;
+}
+
+int ProcessDivergenceImage(_mitoObject *mitoObject, vtkSmartPointer<vtkImageData> &ImageEnhanced, vtkSmartPointer<vtkImageData> Raw, uint64_t key) {
+
+    vtkIdType N = ImageEnhanced -> GetNumberOfPoints();
+    vtkSmartPointer<vtkImageData> Binary;
+
+    // The segmentation of an interrupted run of -cache-stages is reused
+    if ( !ReadSegmentationCache(mitoObject,key,ImageEnhanced,Binary) ) {
+        Binary = SegmentDivergenceImage(mitoObject,ImageEnhanced);
+        WriteSegmentationCache(mitoObject,key,ImageEnhanced,Binary);
+    }
 
-        GetDivergenceFilter(Dim,VSSS);
+    // EXPORT SEGMENTED IMAGE
+    // ----------------------
+    if (mitoObject->_export_image_binary) {
+        _mitoStageTimer Timer(mitoObject->Profile,"Export binary");
+        vtkSmartPointer<vtkTIFFWriter> tif_writer = vtkSmartPointer<vtkTIFFWriter>::New();
+        tif_writer->SetInputData(Binary);
+        tif_writer->SetFileName((mitoObject->FileName + "_binary.tif").c_str());
+        tif_writer->Write();
+    }
+
+    //MAX PROJECTION
+    //--------------
+
+    if (!mitoObject->Result) {
+        _mitoStageTimer ProjTimer(mitoObject->Profile,"Max projection");
+        ExportMaxProjection(Binary,(mitoObject->FileName+".png").c_str());
+    }
+
+    // The divergence is released once the surface is extracted
+    int status = ProcessBinaryImage(mitoObject,Binary,ImageEnhanced,mitoObject->_div_threshold,Raw);
+
+    // Only an interrupted run needs the segmentation again
+    if ( status == EXIT_SUCCESS ) RemoveSegmentationCache(mitoObject,key);
+
+    return status;
+}
+
+vtkSmartPointer<vtkImageData> SegmentDivergenceImage(_mitoObject *mitoObject, vtkSmartPointer<vtkImageData> &ImageEnhanced) {
+
+    vtkIdType id;
+    vtkIdType N = ImageEnhanced -> GetNumberOfPoints();
+    vtkSmartPointer<vtkImageData> Binary;
+
+    #ifdef DEBUG
+        printf("Clear boundaries and removing tiny components...\n");
+    #endif
+
+    _mitoStageTimer CCTimer(mitoObject->Profile,"Component filtering");
+
+    CleanImageBoundaries(ImageEnhanced);
+
+    long int cluster;
+    std::vector<long int> CSz;
+    vtkSmartPointer<vtkTypeInt32Array> Volume = vtkSmartPointer<vtkTypeInt32Array>::New();
+    Volume -> SetNumberOfComponents(1);
+    Volume -> SetNumberOfTuples(N);
+    Volume -> FillComponent(0,0);
+    long int ncc = LabelConnectedComponents(ImageEnhanced,Volume,CSz,6,mitoObject->_div_threshold); // can use _mitoObj here
+    CCTimer.SetCount(ncc);
+
+    if (ncc > 1 && mitoObject->_smart_component_filtering) {
+        // Use user-specified component size, or automatic based on threshold sensitivity
+        int min_component_size = mitoObject->_min_component_size;
+        
+        #ifdef DEBUG
+            printf("\tRemoving components smaller than %d voxels...\n", min_component_size);
+        #endif
+        
+        const int *L = Volume -> GetPointer(0);
+        for (id = N; id--;) {
+            cluster = L[id];
+            if (cluster < 0) {
+                if (CSz[-cluster-1] <= min_component_size) {
+                    ImageEnhanced -> GetPointData() -> GetScalars() -> SetTuple1(id,0);
+                }
+            }
+        }
+    }
+    Volume = NULL;
+    CCTimer.Stop();
+
+    //STRUCTURAL CONNECTIVITY ENHANCEMENT
+    //-----------------------------------
+    if (mitoObject->_enhance_connectivity) {
+        #ifdef DEBUG
+            printf("Enhancing structural connectivity before binarization...\n");
+        #endif
+        
+        // Use stronger connectivity enhancement for sensitive threshold settings
+        double enhancement_strength = (mitoObject->_div_threshold < 0.1) ? 2.0 : 1.5;
+        _mitoStageTimer Timer(mitoObject->Profile,"Connectivity enhancement",N);
+        ImageEnhanced = EnhanceStructuralConnectivity(ImageEnhanced, enhancement_strength, mitoObject->_scale_space);
+    }
+
+    //BINARIZATION
+    //------------
+    _mitoStageTimer BinTimer(mitoObject->Profile,(!mitoObject->_z_adaptive) ? "Binarization" : (mitoObject->_z_enhanced) ? "Binarization z-block enhanced" : "Binarization z-block",N);
+    if (mitoObject->_z_adaptive) {
+        if (mitoObject->_z_enhanced) {
+            // Use enhanced z-block segmentation with overlapping blocks and foreground detection
+            Binary = BinarizeAndConvertDoubleToCharZBlockEnhanced(ImageEnhanced, mitoObject->_div_threshold, mitoObject->_z_block_size);
+        } else {
+            // Use simple z-block segmentation - just like running multiple non z-adaptive segmentations
+            Binary = BinarizeAndConvertDoubleToCharZBlockSimple(ImageEnhanced, mitoObject->_div_threshold, mitoObject->_z_block_size);
+        }
+    } else {
+        Binary = BinarizeAndConvertDoubleToChar(ImageEnhanced,mitoObject->_div_threshold); // can use _mitoObj here
+    }
+    BinTimer.Stop();
+
+    //FILLING HOLES
+    //-------------
+    if (mitoObject->_improve_skeleton_quality) {
+        _mitoStageTimer Timer(mitoObject->Profile,"FillHoles",N);
+        FillHoles(Binary,mitoObject->_fill_holes_flood);
+    }
+
+    return Binary;
+}
+
+int MultiscaleVesselness(_mitoObject *mitoObject) {     
+
+    // Large stacks are segmented slab by slab
+    if ( mitoObject->_stream_slab > 0 && CanStreamSlabs(mitoObject) ) {
+        vtkSmartPointer<vtkImageData> Binary = SegmentInSlabs(mitoObject);
+        if (!Binary) return EXIT_FAILURE;
+        // The divergence volume is not kept, so the surface is
+        // placed halfway between foreground and background voxels.
+        vtkSmartPointer<vtkImageData> Field = Binary;
+        return ProcessBinaryImage(mitoObject,Binary,Field,127.5,NULL);
+    }
+
+    // Output set of a sweep: the divergence is shared with the other
+    // output sets being segmented at the same time, so each one works
+    // on its own copy
+    if ( mitoObject->Divergence ) {
+        static std::mutex CopyMutex;
+        vtkSmartPointer<vtkImageData> ImageEnhanced = vtkSmartPointer<vtkImageData>::New();
+        {
+            std::lock_guard<std::mutex> lock(CopyMutex);
+            ImageEnhanced -> DeepCopy(mitoObject->Divergence);
+        }
+        return ProcessDivergenceImage(mitoObject,ImageEnhanced,mitoObject->Input,0);
+    }
+
+    vtkSmartPointer<vtkImageData> Raw;
+    vtkSmartPointer<vtkImageData> Image = LoadStack(mitoObject,Raw);
+    if (!Image) return EXIT_FAILURE;
+
+    if (!mitoObject->_binary_input) {
+
+        // The 8-bit stack is not needed once the divergence is computed
+        uint64_t key;
+        vtkSmartPointer<vtkImageData> ImageEnhanced = GetCachedDivergence(mitoObject,Image,key);
+        Image = NULL;
+
+        return ProcessDivergenceImage(mitoObject,ImageEnhanced,Raw,key);
+
+    }
+
+    // The thinning erodes Binary in place, so it is only copied
+    // when it would also be the raw stack read for the intensities
+    vtkSmartPointer<vtkImageData> Binary;
+    if (Image == Raw) {
+        Binary = vtkSmartPointer<vtkImageData>::New();
+        Binary -> DeepCopy(Image);
+    } else {
+        Binary = Image;
+    }
+
+    vtkSmartPointer<vtkImageData> Field = Binary;
+    return ProcessBinaryImage(mitoObject,Binary,Field,0.5,Raw);
+}
+
+vtkSmartPointer<vtkPolyData> ExtractSurface(_mitoObject *mitoObject, vtkSmartPointer<vtkImageData> Field, double value, vtkSmartPointer<vtkImageData> Binary) {
+
+    vtkSmartPointer<vtkPolyData> Surface = vtkSmartPointer<vtkPolyData>::New();
+    vtkSmartPointer<vtkPoints> Points = vtkSmartPointer<vtkPoints>::New();
+    Surface -> SetPoints(Points);
+    if (mitoObject->_surface == MITO_SURFACE_OFF) return Surface;
+
+    // Naive surface nets over the cells around the segmentation, for
+    // the scalar types the fields come in
+    int Type = Field -> GetScalarType();
+    if (mitoObject->_surface == MITO_SURFACE_NARROW_BAND && Binary -> GetScalarType() == VTK_UNSIGNED_CHAR &&
+        (Type == VTK_DOUBLE || Type == VTK_FLOAT || Type == VTK_UNSIGNED_CHAR)) {
+
+        int *Dim = Field -> GetDimensions();
+        const unsigned char *Mask = (const unsigned char*)Binary -> GetScalarPointer();
+        std::vector<double> X;
+        std::vector<long long> Quads;
+        if (Type == VTK_DOUBLE) {
+            GetNarrowBandSurface((const double*)Field->GetScalarPointer(),Mask,Dim,value,2,X,Quads);
+        } else if (Type == VTK_FLOAT) {
+            GetNarrowBandSurface((const float*)Field->GetScalarPointer(),Mask,Dim,value,2,X,Quads);
+        } else {
+            GetNarrowBandSurface((const unsigned char*)Field->GetScalarPointer(),Mask,Dim,value,2,X,Quads);
+        }
+
+        double *Origin = Field -> GetOrigin();
+        double *Spacing = Field -> GetSpacing();
+        vtkIdType NP = (vtkIdType)(X.size() / 3);
+        Points -> SetNumberOfPoints(NP);
+        for (vtkIdType id = 0; id < NP; id++) {
+            Points -> SetPoint(id,Origin[0]+Spacing[0]*X[3*id],Origin[1]+Spacing[1]*X[3*id+1],Origin[2]+Spacing[2]*X[3*id+2]);
+        }
+        vtkSmartPointer<vtkCellArray> Polys = vtkSmartPointer<vtkCellArray>::New();
+        for (size_t q = 0; q < Quads.size(); q += 4) {
+            vtkIdType Quad[4] = {(vtkIdType)Quads[q], (vtkIdType)Quads[q+1], (vtkIdType)Quads[q+2], (vtkIdType)Quads[q+3]};
+            Polys -> InsertNextCell(4,Quad);
+        }
+        Surface -> SetPolys(Polys);
+        return Surface;
+    }
+
+    // Both filters also extract the zero level, as the surface always
+    // has been
+    #ifdef MITO_FLYING_EDGES
+        if (mitoObject->_surface == MITO_SURFACE_FLYING_EDGES) {
+            vtkSmartPointer<vtkFlyingEdges3D> Filter = vtkSmartPointer<vtkFlyingEdges3D>::New();
+            Filter -> SetInputData(Field);
+            Filter -> SetValue(1,value);
+            Filter -> Update();
+            Surface -> ShallowCopy(Filter->GetOutput());
+            return Surface;
+        }
+    #endif
+
+    vtkSmartPointer<vtkContourFilter> Filter = vtkSmartPointer<vtkContourFilter>::New();
+    Filter -> SetInputData(Field);
+    Filter -> SetValue(1,value);
+    Filter -> Update();
+    Surface -> ShallowCopy(Filter->GetOutput());
+    return Surface;
+}
+
+vtkSmartPointer<vtkImageData> GetDistanceImage(vtkSmartPointer<vtkImageData> Binary, _mitoObject *mitoObject) {
+
+    int *Dim = Binary -> GetDimensions();
+    vtkIdType N = Binary -> GetNumberOfPoints();
+    std::vector<unsigned char> Buffer;
+    const unsigned char *Mask;
+    if (Binary -> GetScalarType() == VTK_UNSIGNED_CHAR) {
+        Mask = (const unsigned char*)Binary -> GetScalarPointer();
+    } else {
+        vtkDataArray *Scalars = Binary -> GetPointData() -> GetScalars();
+        Buffer.resize(N);
+        for (vtkIdType id = 0; id < N; id++) Buffer[id] = (Scalars -> GetTuple1(id) > 0) ? 255 : 0;
+        Mask = (N) ? &Buffer[0] : NULL;
+    }
+
+    vtkSmartPointer<vtkFloatArray> Scalars = vtkSmartPointer<vtkFloatArray>::New();
+    Scalars -> SetNumberOfTuples(N);
+    double Spacing[3] = {mitoObject->_dxy, mitoObject->_dxy, mitoObject->_dz};
+    if (N) GetDistanceTransform(Mask,Dim,Spacing,Scalars->GetPointer(0));
+
+    vtkSmartPointer<vtkImageData> Distance = vtkSmartPointer<vtkImageData>::New();
+    Distance -> SetDimensions(Dim);
+    Distance -> GetPointData() -> SetScalars(Scalars);
+    return Distance;
+}
+
+int ProcessBinaryImage(_mitoObject *mitoObject, vtkSmartPointer<vtkImageData> Binary, vtkSmartPointer<vtkImageData> &Field, double value, vtkSmartPointer<vtkImageData> Raw) {
+
+    vtkIdType id;
+    vtkIdType N = Binary -> GetNumberOfPoints();
+    vtkSmartPointer<vtkTIFFReader> TIFFReader;
+    vtkSmartPointer<vtkStructuredPointsReader> STRUCReader;
+
+    // Segmentation returned by the library API, before the thinning
+    // erodes Binary
+    if (mitoObject->Result) {
+        int *BDim = Binary -> GetDimensions();
+        for (int k = 0; k < 3; k++) mitoObject->Result->Dim[k] = BDim[k];
+        vtkDataArray *Scalars = Binary -> GetPointData() -> GetScalars();
+        mitoObject->Result->Mask.resize(N);
+        for (id = 0; id < N; id++) mitoObject->Result->Mask[id] = (Scalars -> GetTuple1(id) > 0) ? 255 : 0;
+    }
+
+    _mitoStageTimer SurfTimer(mitoObject->Profile,"Contouring");
+
+    // The surface is all that is needed from the divergence, which is
+    // released before the thinning
+    vtkSmartPointer<vtkPolyData> Surface = ExtractSurface(mitoObject,Field,value,Binary);
+    Field = NULL;
+    ScalePolyData(Surface,mitoObject);
+    SurfTimer.SetCount(Surface->GetNumberOfPoints());
+    SurfTimer.Stop();
+
+    //SAVING SURFACE
+    //--------------
+
+    if (!mitoObject->Result && mitoObject->_surface != MITO_SURFACE_OFF) {
+        _mitoStageTimer SaveTimer(mitoObject->Profile,"Save surface");
+        SavePolyData(Surface,(mitoObject->FileName+"_mitosurface.vtk").c_str());
+    }
+
+
+    //CONNECTED COMPONENTS FOR GRAPH ANALYSIS
+    //---------------------------------------
+
+    std::vector<long int> CSz;
+    vtkSmartPointer<vtkTypeInt32Array> CCVolume = vtkSmartPointer<vtkTypeInt32Array>::New();
+    if (mitoObject->_analyze) {
+
+        _mitoStageTimer Timer(mitoObject->Profile,"Connected components",N);
+
+        CCVolume -> SetNumberOfComponents(1);
+        CCVolume -> SetNumberOfTuples(N);
+        CCVolume -> FillComponent(0,0);
+
+        long int ncc = LabelConnectedComponents(Binary,CCVolume,CSz,26,0);
+
+    }
+
+    // Widths from the distance transform, always used without a
+    // surface, from Binary before the thinning
+    vtkSmartPointer<vtkImageData> Distance;
+    if (mitoObject->_width_dt || mitoObject->_surface == MITO_SURFACE_OFF) {
+        _mitoStageTimer Timer(mitoObject->Profile,"Distance transform",N);
+        Distance = GetDistanceImage(Binary,mitoObject);
+    }
+
+    //SKELETONIZATION
+    //---------------
+
+    vtkSmartPointer<vtkPolyData> Skeleton = Thinning3D(Binary,mitoObject);
+
+    //CLEANING POLUDATA
+    vtkSmartPointer<vtkCleanPolyData> Clean = vtkSmartPointer<vtkCleanPolyData>::New();
+    Clean -> SetInputData(Skeleton);
+    Clean -> Update();
+
+    Skeleton = Clean -> GetOutput();
+
+    //FRAGMENT CONNECTION
+    //-------------------
+    if (mitoObject->_enhance_connectivity) {
+        #ifdef DEBUG
+            printf("Applying skeleton fragment connection...\n");
+        #endif
+        
+        // Adjust gap distance based on pixel size and threshold
+        double gap_distance = 3.0 * mitoObject->_dxy; // Base gap distance
+        if (mitoObject->_div_threshold < 0.1) {
+            gap_distance = 5.0 * mitoObject->_dxy; // For sensitive settings, allow larger gaps
+        }
+        
+        _mitoStageTimer Timer(mitoObject->Profile,"ConnectSkeletonFragments",Skeleton->GetNumberOfPoints());
+        Skeleton = ConnectSkeletonFragments(Skeleton, gap_distance);
+        Timer.Stop();
+        
+        // Clean up the skeleton after connection
+        vtkSmartPointer<vtkCleanPolyData> CleanAfterConnection = vtkSmartPointer<vtkCleanPolyData>::New();
+        CleanAfterConnection -> SetInputData(Skeleton);
+        CleanAfterConnection -> Update();
+        Skeleton = CleanAfterConnection -> GetOutput();
+    }
+
+    //CONNECTED COMPONENTS FOR GRAPH ANALYSIS
+    //---------------------------------------
+
+    if (mitoObject->_analyze) {
+
+        // GraphAnalyzer.R reads the text file
+        FILE *fvol = NULL;
+        if (mitoObject->_output_text || mitoObject->_analyze_r) {
+            fvol = fopen((mitoObject->FileName+".cc").c_str(),"w");
+            fprintf(fvol,"Node\tBelonging_CC\tVol_Of_Belonging_CC_From_Img_(um3)\n");
+        }
+        std::vector<int32_t> CCNode, CCId;
+        std::vector<double> CCVol;
+
+        double r[3], vol;
+        long int node_id, cc_id, cc_tmp;
+        for (id = 0; id < Skeleton->GetNumberOfPoints(); id++) {
+            node_id = (long int)Skeleton -> GetPointData() -> GetArray("Nodes") -> GetTuple1(id);
+            if (node_id > -1) {
+                Skeleton -> GetPoint(id,r);
+                for (char i = 0; i < 6; i++) {
+                    double point[3] = {(double)((int)r[0]+ssdx_sort[i]), (double)((int)r[1]+ssdy_sort[i]), (double)((int)r[2]+ssdz_sort[i])};
+                    cc_id = (long int)CCVolume->GetTuple1(Binary -> FindPoint(point));
+                    // printf("%d\t%d\n",(int)node_id,(int)cc_id);
+                    if (cc_id < 0) break;
+                }
+                if (cc_id < 0) {
+                    vol = CSz[-cc_id-1]*(mitoObject->_dxy*mitoObject->_dxy*mitoObject->_dz);
+                    if (fvol) fprintf(fvol,"%d\t%d\t%1.5f\n",(int)(node_id),(int)std::abs(cc_id),vol);
+                } else {
+                    // If the voxel falls off the binary structure we assign volume zero.
+                    // This will not affect the final report of volume per cc, once we
+                    // use the max() function to get the volume of a given component.
+                    vol = 0.0;
+                    if (fvol) fprintf(fvol,"%d\t%d\t0.00000\n",(int)(node_id),(int)std::abs(cc_id));
+                }
+                if (mitoObject->Columns) {
+                    CCNode.push_back((int32_t)node_id);
+                    CCId.push_back((int32_t)std::abs(cc_id));
+                    CCVol.push_back(vol);
+                }
+                if (mitoObject->Graph) {
+                    mitoObject->Graph -> CCNode.push_back(node_id);
+                    mitoObject->Graph -> CCVolume.push_back(RoundAsText(vol));
+                }
+            }
+        }
+
+        if (fvol) fclose(fvol);
+        if (mitoObject->Columns) {
+            mitoObject->Columns -> Add("cc.node",CCNode);
+            mitoObject->Columns -> Add("cc.component",CCId);
+            mitoObject->Columns -> Add("cc.volume",CCVol);
+        }
+
+    }
+
+    ScalePolyData(Skeleton,mitoObject);
+
+    //ORIGINAL IMAGE FOR THE INTENSITIES
+    //----------------------------------
+
+    // The stack loaded for the vesselness is reused when there is one
+    _mitoStack Stack;
+    vtkSmartPointer<vtkImageData> ImageData = Raw;
+    if ( !ImageData ) {
+
+        _mitoStageTimer Timer(mitoObject->Profile,"Load");
+
+        if ( mitoObject->Type == "TIF" && mitoObject->_mmap_input && Stack.Open(mitoObject->FileName+".tif") ) {
+
+            ImageData = ReadMappedStack(Stack,0,Stack.Dim[2]-1);
+
+        } else if ( mitoObject->Type == "TIF" ) {
+
+            TIFFReader = vtkSmartPointer<vtkTIFFReader>::New();
+            TIFFReader -> SetFileName((mitoObject->FileName+".tif").c_str());
+            TIFFReader -> Update();
+            ImageData = TIFFReader -> GetOutput();
+
+        } else {
+
+            STRUCReader = vtkSmartPointer<vtkStructuredPointsReader>::New();
+            STRUCReader -> SetFileName((mitoObject->FileName+"-mitovolume.vtk").c_str());
+            STRUCReader -> Update();
+            ImageData = STRUCReader -> GetOutput();
+
+        }
+
+    }
+
+    // Shifting the Stack to (0,0,0)
+    ImageData -> SetOrigin(0,0,0);
+
+    //TUBULES WIDTH, LENGTH AND INTENSITY
+    //-----------------------------------
+
+    _mitoStageTimer AttTimer(mitoObject->Profile,"Skeleton attributes",Skeleton->GetNumberOfPoints());
+    GetSkeletonAttributes(Skeleton,Surface,Distance,ImageData,6,mitoObject);
+    AttTimer.Stop();
+
+    vtkDataArray *W = Skeleton -> GetPointData() -> GetArray("Width");
+    vtkDataArray *I = Skeleton -> GetPointData() -> GetArray("Intensity");
+
+    vtkIdType p;
+    double r[3];
+    _mitoStageTimer TextTimer(mitoObject->Profile,"Export text",Skeleton->GetNumberOfPoints());
+    FILE *fw = NULL;
+    if (mitoObject->_output_text) {
+        fw = fopen((mitoObject->FileName+".txt").c_str(),"w");
+        fprintf(fw,"line_id\tpoint_id\tx\ty\tz\twidth_(um)\tpixel_intensity\n");
+    }
+    std::vector<int32_t> Line, Index;
+    std::vector<float> PX, PY, PZ, PW, PI;
+    for (vtkIdType edge = 0; edge < Skeleton -> GetNumberOfCells(); edge++) {
+        vtkCell *Cell = Skeleton -> GetCell(edge);
+        for (vtkIdType id = 0; id < Cell -> GetNumberOfPoints(); id++) {
+            p = Cell -> GetPointId(id);
+            Skeleton -> GetPoint(p,r);
+            if (fw) fprintf(fw,"%d\t%d\t%1.5f\t%1.5f\t%1.5f\t%1.5f\t%1.5f\n",(int)edge,(int)id,r[0],r[1],r[2],W->GetTuple1(p),I->GetTuple1(p));
+            if (mitoObject->Columns) {
+                Line.push_back((int32_t)edge);
+                Index.push_back((int32_t)id);
+                PX.push_back((float)r[0]);
+                PY.push_back((float)r[1]);
+                PZ.push_back((float)r[2]);
+                PW.push_back((float)W->GetTuple1(p));
+                PI.push_back((float)I->GetTuple1(p));
+            }
+        }
+    }
+    if (fw) fclose(fw);
+    if (mitoObject->Columns) {
+        mitoObject->Columns -> Add("point.line",Line);
+        mitoObject->Columns -> Add("point.index",Index);
+        mitoObject->Columns -> Add("point.x",PX);
+        mitoObject->Columns -> Add("point.y",PY);
+        mitoObject->Columns -> Add("point.z",PZ);
+        mitoObject->Columns -> Add("point.width",PW);
+        mitoObject->Columns -> Add("point.intensity",PI);
+    }
+    TextTimer.Stop();
+
+    if (mitoObject->Columns && !mitoObject->Result) {
+        _mitoStageTimer Timer(mitoObject->Profile,"Export binary",Skeleton->GetNumberOfPoints());
+        if (!mitoObject->Columns->Save(mitoObject->FileName+".mgb",mitoObject->_dxy,mitoObject->_dz,mitoObject->_output_compress)) {
+            printf("File %s.mgb cannot be saved.\n",mitoObject->FileName.c_str());
+        }
+    }
+
+    //GetTopologicalAttributes(Skeleton,mitoObject);
+
+    //SAVING SKELETON
+    //---------------
+
+    if (!mitoObject->Result) {
+        _mitoStageTimer SkellTimer(mitoObject->Profile,"Save skeleton",Skeleton->GetNumberOfPoints());
+        SavePolyData(Skeleton,(mitoObject->FileName+"_skeleton.vtk").c_str());
+    }
+
+    return 0;
+}
+
+/* ================================================================
+   GRAPH ANALYSIS
+=================================================================*/
+
+void RunGraphAnalysis(std::string FileName) {
+
+    //RUN R SCRIPT FOR GRAPH ANALYSIS
+    //-------------------------------
+
+    std::string cmd;
+    cmd = "Rscript --vanilla GraphAnalyzer.R " + FileName;
+    system(cmd.c_str());
+
+}
+
+// Number as write.table() prints it in R: at most 15 significant
+// digits, in fixed notation unless the scientific one is shorter.
+static std::string FormatAsR(double x) {
+
+    char buf[512];
+    if (std::isnan(x)) return "NaN";
+    if (std::isinf(x)) return (x > 0) ? "Inf" : "-Inf";
+    if (x == 0.0) return "0";
+
+    snprintf(buf,sizeof(buf),"%.14e",x);
+    const char *e = strchr(buf,'e');
+    int kp = atoi(e+1);
+    int nsig = 0;
+    for (const char *c = buf; c < e; c++) {
+        if (*c >= '0' && *c <= '9') nsig++;
+    }
+    for (const char *c = e-1; *c == '0'; c--) nsig--;
+
+    int neg = (x < 0) ? 1 : 0;
+    int rgt = std::max(0,nsig-kp-1);
+    int wF = neg + ((kp >= 0) ? kp+1 : 1) + rgt + (rgt > 0);
+    int wE = neg + (nsig > 1) + (nsig-1) + 4 + ((kp >= 100 || kp <= -100) ? 2 : 1);
+
+    if (wF <= wE) {
+        snprintf(buf,sizeof(buf),"%.*f",rgt,x);
+    } else {
+        snprintf(buf,sizeof(buf),"%.*e",nsig-1,x);
+    }
+    return buf;
+}
+
+void AnalyzeGraph(const _mitoObject *mitoObject) {
+
+    //GRAPH ANALYSIS OF GraphAnalyzer.R FROM THE GRAPH IN MEMORY
+    //----------------------------------------------------------
+
+    _mitoStageTimer Timer(mitoObject->Profile,"Graph analysis",mitoObject->Graph->Source.size());
+
+    std::vector<_mitoGraphComponent> Components;
+    long int nnodes = DecomposeGraph(*mitoObject->Graph,Components);
+
+    FILE *f = fopen((mitoObject->FileName+".mitograph").c_str(),"w");
+    if (!f) {
+        printf("File %s.mitograph cannot be saved.\n",mitoObject->FileName.c_str());
+        return;
+    }
+
+    char date[64];
+    time_t now = time(0);
+    struct tm t;
+    #ifdef _WIN32
+        localtime_s(&t,&now);
+    #else
+        localtime_r(&now,&t);
+    #endif
+    strftime(date,sizeof(date),"%Y-%m-%d %H:%M:%S",&t);
+
+    // Global values are read back from the text the R script parses
+    const char *Names[] = {"vol_from_voxels_(um)","avg_width_(um)","std_width_(um)","total_length_(um)","vol_from_length_(um3)"};
+    size_t i, natt = mitoObject->attributes.size();
+
+    fprintf(f,"::MitoGraph\n%s \n\nGLOBAL STATISTICS:\n\n",date);
+    for (i = 0; i < natt; i++) {
+        fprintf(f,"%s\t",(i < 5) ? Names[i] : mitoObject->attributes[i].name.c_str());
+    }
+    fprintf(f,"nodes\tedges\tcomponents\n");
+    for (i = 0; i < natt; i++) {
+        fprintf(f,"%s\t",FormatAsR(RoundAsText(mitoObject->attributes[i].value)).c_str());
+    }
+    fprintf(f,"%ld\t%ld\t%ld\n",nnodes,(long int)mitoObject->Graph->Source.size(),(long int)Components.size());
+
+    fprintf(f,"\nCOMPONENTS STATISTICS:\n\n");
+    fprintf(f,"nodes\tedges\tlength_(um)\tvol_from_img_(um3)\n");
+    for (i = 0; i < Components.size(); i++) {
+        const _mitoGraphComponent &C = Components[i];
+        fprintf(f,"%ld\t%ld\t%s\t%s\n",C.nodes,C.edges,FormatAsR(C.length).c_str(),std::isnan(C.volume) ? "NA" : FormatAsR(C.volume).c_str());
+    }
+
+    fclose(f);
+}
+
+/* ================================================================
+   BATCH PROCESSING
+=================================================================*/
+
+double GetBytesPerVoxel(const _mitoObject *mitoObject) {
+    double base = MITO_BYTES_PER_VOXEL + ((mitoObject->_storage_double) ? MITO_BYTES_PER_VOXEL_DOUBLE : 0);
+    double bytes = base;
+    if ( mitoObject->_adaptive_threshold ) bytes += MITO_BYTES_PER_VOXEL_ADAPTIVE;
+    if ( UsesScaleSpace(mitoObject) ) bytes += MITO_BYTES_PER_VOXEL_SCALE_SPACE;
+    // The enhancement runs after the vesselness buffers are released
+    if ( mitoObject->_enhance_connectivity ) bytes = std::max(bytes,base+((mitoObject->_storage_double) ? 2 : 1)*MITO_BYTES_PER_VOXEL_CONNECTIVITY);
+    return bytes;
+}
+
+double EstimateMemoryCost(const _mitoObject *mitoObject, std::string FileName) {
+
+    double nvoxels = 0.0;
+
+    if ( mitoObject->Type == "TIF" ) {
+
+        vtkSmartPointer<vtkTIFFReader> TIFFReader = vtkSmartPointer<vtkTIFFReader>::New();
+        if ( !TIFFReader -> CanReadFile((FileName+".tif").c_str()) ) return 0.0;
+        TIFFReader -> SetFileName((FileName+".tif").c_str());
+        TIFFReader -> UpdateInformation();
+        int *Ext = TIFFReader -> GetDataExtent();
+        if ( Ext[1] < Ext[0] || Ext[3] < Ext[2] || Ext[5] < Ext[4] ) return 0.0;
+        double nx = Ext[1] - Ext[0] + 1;
+        double ny = Ext[3] - Ext[2] + 1;
+        double nz = Ext[5] - Ext[4] + 1;
+        // 2D images are padded to 7 slices and stacks may be resampled
+        // along z before the vesselness is calculated.
+        if ( nz == 1 ) {
+            nz = 7;
+        } else if ( mitoObject->_resample > 0 ) {
+            nz *= mitoObject->_resample / mitoObject->_dxy;
+        } else if ( mitoObject->_stream_slab > 0 && !GetStreamSlabsConflict(mitoObject) ) {
+            double nzs = std::min(nz,(double)(mitoObject->_stream_slab + 2*GetStreamSlabsHalo(mitoObject)));
+            return nx * ny * (nz * MITO_BYTES_PER_VOXEL_STREAMED + nzs * GetBytesPerVoxel(mitoObject));
+        }
+        nvoxels = nx * ny * nz;
+
+    } else {
+
+        // Legacy VTK files store at least one byte per voxel, so the
+        // file size is an upper bound for the number of voxels.
+        FILE *f = fopen((FileName+"-mitovolume.vtk").c_str(),"rb");
+        if ( !f ) return 0.0;
+        fseek(f,0,SEEK_END);
+        nvoxels = (double)ftell(f);
+        fclose(f);
+
+    }
+
+    return nvoxels * GetBytesPerVoxel(mitoObject);
+}
+
+uint64_t GetParameterFingerprint(const _mitoObject *mitoObject) {
+
+    char buffer[1024];
+    snprintf(buffer,sizeof(buffer),"%s %s xy=%.17g z=%.17g rad=%.17g resample=%.17g scales=%.17g:%.17g:%.17g threshold=%.17g "
+                                   "adaptive=%d z-adaptive=%d:%d:%d connectivity=%d components=%d binary=%d precision=%d "
+                                   "scale-space=%d eigen-jacobi=%d fill-holes-flood=%d surface=%d width-dt=%d storage-double=%d stream-slab=%d analyze=%d:%d "
+                                   "outputs=%d%d%d%d%d%d%d%d%d",
+        MITOGRAPH_VERSION.c_str(),mitoObject->Type.c_str(),mitoObject->_dxy,mitoObject->_dz,mitoObject->_rad,mitoObject->_resample,
+        mitoObject->_sigmai,mitoObject->_sigmaf,mitoObject->_dsigma,mitoObject->_div_threshold,
+        (mitoObject->_adaptive_threshold) ? mitoObject->_nblks : 0,(int)mitoObject->_z_adaptive,(int)mitoObject->_z_enhanced,mitoObject->_z_block_size,
+        (int)mitoObject->_enhance_connectivity,(mitoObject->_smart_component_filtering) ? mitoObject->_min_component_size : 0,
+        (int)mitoObject->_binary_input,(int)mitoObject->_improve_skeleton_quality,
+        (int)UsesScaleSpace(mitoObject),(int)mitoObject->_eigen_jacobi,(int)mitoObject->_fill_holes_flood,mitoObject->_surface,(int)mitoObject->_width_dt,(int)mitoObject->_storage_double,mitoObject->_stream_slab,
+        (int)mitoObject->_analyze,(int)mitoObject->_analyze_r,
+        (int)mitoObject->_export_graph_files,(int)mitoObject->_export_image_binary,(int)mitoObject->_export_image_resampled,
+        (int)mitoObject->_scale_polydata_before_save,(int)mitoObject->_export_nodes_label,(int)mitoObject->_output_text,
+        (int)mitoObject->_output_binary,(int)mitoObject->_output_compress,(int)mitoObject->_profile);
+    uint64_t h = MitoHash(buffer,strlen(buffer));
+
+    for (size_t i = 0; i < mitoObject->Sweep.size(); i++) {
+        const _mitoTrial &Trial = mitoObject->Sweep[i];
+        snprintf(buffer,sizeof(buffer)," sweep=%s:%.17g:%d:%d:%d:%d",Trial.Suffix.c_str(),Trial._div_threshold,(int)Trial._z_adaptive,(int)Trial._z_enhanced,
+            Trial._z_block_size,(Trial._smart_component_filtering) ? Trial._min_component_size : 0);
+        h = MitoHash(buffer,strlen(buffer),h);
+    }
+
+    return h;
+}
+
+static bool FileExists(std::string FileName) {
+    FILE *f = fopen(FileName.c_str(),"rb");
+    if ( !f ) return false;
+    fclose(f);
+    return true;
+}
+
+// Whether the main outputs of mitoObject, or of each of its output
+// sets with -sweep, are on disk
+static bool HasOutputs(const _mitoObject *mitoObject) {
+    std::vector<std::string> Names;
+    if ( mitoObject->Sweep.empty() ) Names.push_back(mitoObject->FileName);
+    for (size_t i = 0; i < mitoObject->Sweep.size(); i++) Names.push_back(mitoObject->FileName+mitoObject->Sweep[i].Suffix);
+    bool text = mitoObject->_export_graph_files && (mitoObject->_output_text || mitoObject->_analyze_r);
+    for (size_t i = 0; i < Names.size(); i++) {
+        if ( !FileExists(Names[i]+".mitograph") || !FileExists(Names[i]+"_skeleton.vtk") ) return false;
+        if ( text && !FileExists(Names[i]+".gnet") ) return false;
+        if ( mitoObject->_output_binary && !FileExists(Names[i]+".mgb") ) return false;
+    }
+    return true;
+}
+
+// ProcessFile recorded in the manifest: skipped with -resume when the
+// manifest has it done with the same input and parameters, and its
+// outputs are still there.
+static int ProcessManifestFile(_mitoObject *mitoObject) {
+
+    _mitoManifest *Manifest = mitoObject->Manifest;
+
+    // Files are named relative to the folder, so that it can be moved
+    std::string Name = mitoObject->FileName;
+    if ( !Name.compare(0,mitoObject->Folder.size(),mitoObject->Folder) ) Name = Name.substr(mitoObject->Folder.size());
+
+    // The frames of a time-lapse are read ahead, and may not be files
+    // of their own, so their voxels are hashed instead
+    uint64_t input;
+    std::string Input = mitoObject->FileName + ((mitoObject->Type == "VTK") ? "-mitovolume.vtk" : ".tif");
+    if ( mitoObject->Input ) {
+        vtkDataArray *Scalars = mitoObject->Input -> GetPointData() -> GetScalars();
+        input = MitoHash(Scalars->GetVoidPointer(0),(size_t)Scalars->GetNumberOfTuples()*Scalars->GetDataTypeSize());
+    } else if ( !MitoHashFile(Input,input) ) {
+        printf("File %s cannot be read.\n",Input.c_str());
+        return EXIT_FAILURE;
+    }
+    uint64_t parameters = GetParameterFingerprint(mitoObject);
+
+    if ( mitoObject->_resume && Manifest->IsDone(Name,input,parameters) && HasOutputs(mitoObject) ) {
+        printf("Skipping %s, already processed.\n",Name.c_str());
+        return EXIT_SUCCESS;
+    }
+
+    Manifest -> Record(Name,"started",input,parameters);
+    mitoObject->Manifest = NULL;
+    int status = ProcessFile(mitoObject);
+    mitoObject->Manifest = Manifest;
+    Manifest -> Record(Name,(status == EXIT_SUCCESS) ? "done" : "failed",input,parameters);
+
+    return status;
+}
+
+// Serializes the writes of mitograph.config by the batch workers
+static std::mutex ConfigMutex;
+
+int ProcessFile(_mitoObject *mitoObject) {
+
+    if ( mitoObject->Manifest ) {
+        return ProcessManifestFile(mitoObject);
+    }
+
+    // All the output sets of a sweep are derived from one divergence
+    if ( !mitoObject->Sweep.empty() && !mitoObject->_checkonly ) {
+        return SweepFile(mitoObject);
+    }
+
+    #ifdef _OPENMP
+        if ( mitoObject->_nthreads > 0 ) omp_set_num_threads(mitoObject->_nthreads);
+    #endif
+
+    int status = EXIT_SUCCESS;
+
+    // Stages are recorded in the profile of this file only
+    _mitoProfile Profile;
+    mitoObject->Profile = (mitoObject->_profile) ? &Profile : NULL;
+
+    // Columns of the .mgb file, filled by the writers of the text files
+    _mitoColumns Columns;
+    mitoObject->Columns = (mitoObject->_output_binary) ? &Columns : NULL;
+
+    // Graph kept in memory for the analysis
+    _mitoGraph Graph;
+    mitoObject->Graph = (mitoObject->_analyze && !mitoObject->_analyze_r) ? &Graph : NULL;
+    _mitoStageTimer Timer(mitoObject->Profile,"Total");
+
+    try {
+
+        if ( mitoObject->_checkonly ) {
+
+            ExportDetailedMaxProjection(mitoObject);
+
+        } else {
+
+            status = MultiscaleVesselness(mitoObject);
+
+            if ( status == EXIT_SUCCESS ) {
+                _mitoStageTimer DumpTimer(mitoObject->Profile,"DumpResults");
+                DumpResults(*mitoObject);
+                DumpTimer.Stop();
+                // The configuration of a sweep is written once by SweepFile
+                if ( !mitoObject->Divergence ) {
+                    std::lock_guard<std::mutex> lock(ConfigMutex);
+                    ExportConfigFile(*mitoObject);
+                }
+            }
+
+        }
+
+        if ( status == EXIT_SUCCESS && mitoObject->_analyze_r ) {
+            RunGraphAnalysis(mitoObject->FileName);
+        } else if ( status == EXIT_SUCCESS && mitoObject->_analyze && !mitoObject->_checkonly ) {
+            AnalyzeGraph(mitoObject);
+        }
+
+    } catch (const std::exception &e) {
+
+        printf("Error processing %s: %s\n",mitoObject->FileName.c_str(),e.what());
+        status = EXIT_FAILURE;
+
+    } catch (...) {
+
+        printf("Error processing %s.\n",mitoObject->FileName.c_str());
+        status = EXIT_FAILURE;
+
+    }
+
+    Timer.Stop();
+    if ( mitoObject->Profile && status == EXIT_SUCCESS && !mitoObject->Profile->Save(mitoObject->FileName) ) {
+        printf("Profile of %s cannot be saved.\n",mitoObject->FileName.c_str());
+    }
+    mitoObject->Profile = NULL;
+    mitoObject->Columns = NULL;
+    mitoObject->Graph = NULL;
+
+    return (status == EXIT_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// State shared by the workers of RunBatch
+struct _batchState {
+    std::mutex Mutex;
+    std::condition_variable QueueNotEmpty;
+    std::condition_variable QueueNotFull;
+    std::condition_variable MemoryReleased;
+    std::list< std::pair<std::string,double> > Queue;
+    size_t capacity;
+    bool done;
+    int running;
+    double memory_in_use;
+    double max_memory;
+    std::vector<std::string> Failed;
+};
+
+static void BatchWorker(const _mitoObject *mitoObject, _batchState *State) {
+
+    while (true) {
+
+        std::pair<std::string,double> Job;
+
+        {
+            std::unique_lock<std::mutex> lock(State->Mutex);
+            while ( State->Queue.empty() && !State->done ) State->QueueNotEmpty.wait(lock);
+            if ( State->Queue.empty() ) return;
+            Job = State->Queue.front();
+            State->Queue.pop_front();
+            State->QueueNotFull.notify_one();
+
+            // Admission: wait until the file fits in the memory budget
+            if ( State->max_memory > 0 ) {
+                while ( State->running > 0 && State->memory_in_use + Job.second > State->max_memory ) {
+                    State->MemoryReleased.wait(lock);
+                }
+            }
+            State->running++;
+            State->memory_in_use += Job.second;
+        }
+
+        _mitoObject Context = *mitoObject;
+        Context.attributes.clear();
+        Context.FileName = Job.first;
+
+        int status = ProcessFile(&Context);
+
+        {
+            std::lock_guard<std::mutex> lock(State->Mutex);
+            State->running--;
+            State->memory_in_use -= Job.second;
+            if ( status != EXIT_SUCCESS ) State->Failed.push_back(Job.first);
+        }
+        State->MemoryReleased.notify_all();
+
+    }
+
+}
+
+int RunBatch(const _mitoObject *mitoObject, std::vector<std::string> &Files, int njobs, double max_memory) {
+
+    _batchState State;
+    State.capacity = 2 * (size_t)njobs;
+    State.done = false;
+    State.running = 0;
+    State.memory_in_use = 0.0;
+    State.max_memory = max_memory;
+
+    std::vector<std::thread> Workers;
+    for (int j = 0; j < njobs; j++) {
+        Workers.push_back(std::thread(BatchWorker,mitoObject,&State));
+    }
+
+    // Files are estimated and queued as the workers consume them,
+    // so only a few headers are read ahead of the processing.
+    for (size_t i = 0; i < Files.size(); i++) {
+
+        double cost = EstimateMemoryCost(mitoObject,Files[i]);
+
+        std::unique_lock<std::mutex> lock(State.Mutex);
+        if ( cost <= 0.0 ) {
+            printf("File %s cannot be read.\n",Files[i].c_str());
+            State.Failed.push_back(Files[i]);
+            continue;
+        }
+        while ( State.Queue.size() >= State.capacity ) State.QueueNotFull.wait(lock);
+        State.Queue.push_back(std::make_pair(Files[i],cost));
+        State.QueueNotEmpty.notify_one();
+
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(State.Mutex);
+        State.done = true;
+    }
+    State.QueueNotEmpty.notify_all();
+
+    for (int j = 0; j < njobs; j++) Workers[j].join();
+
+    printf("Batch finished: %d of %d files processed.\n",(int)(Files.size()-State.Failed.size()),(int)Files.size());
+    for (size_t i = 0; i < State.Failed.size(); i++) {
+        printf("\tFailed: %s\n",State.Failed[i].c_str());
+    }
+
+    return (int)State.Failed.size();
+}
+
+/* ================================================================
+   TIME-LAPSE
+=================================================================*/
+
+// Frame of a time-lapse: the planes [z0,z1] of the stack Source, or
+// all of them when z1 < 0
+struct _mitoFrame {
+    std::string Source;         // stack, without the .tif extension
+    std::string FileName;       // outputs of the frame
+    int z0, z1;
+};
+
+// Frames of a series and the table their results are appended to
+struct _mitoSeries {
+    std::string Table;
+    std::vector<_mitoFrame> Frames;
+};
+
+// Natural order of the names of the frames, in which t9 comes
+// before t10
+static bool IsEarlierFrame(const std::string &a, const std::string &b) {
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (isdigit((unsigned char)a[i]) && isdigit((unsigned char)b[j])) {
+            unsigned long long x = strtoull(a.c_str()+i,NULL,10);
+            unsigned long long y = strtoull(b.c_str()+j,NULL,10);
+            if (x != y) return x < y;
+            while (i < a.size() && isdigit((unsigned char)a[i])) i++;
+            while (j < b.size() && isdigit((unsigned char)b[j])) j++;
+        } else {
+            if (a[i] != b[j]) return a[i] < b[j];
+            i++; j++;
+        }
+    }
+    return a.size()-i < b.size()-j;
+}
+
+// Number of frames and of planes per frame of the stack FileName,
+// planes being given with -timelapse or 0 to take them from the
+// description of an ImageJ hyperstack. Returns false if the stack
+// cannot be read.
+static bool GetFrameCount(std::string FileName, int planes, int &nframes, int &nplanes) {
+    int nz = 0, frames = 1;
+    _mitoStack Stack;
+    if ( Stack.Open(FileName) ) {
+        nz = Stack.Dim[2];
+        frames = Stack.Frames;
+    } else {
+        vtkSmartPointer<vtkTIFFReader> TIFFReader = vtkSmartPointer<vtkTIFFReader>::New();
+        if ( !TIFFReader -> CanReadFile(FileName.c_str()) ) return false;
+        TIFFReader -> SetFileName(FileName.c_str());
+        TIFFReader -> UpdateInformation();
+        int *Ext = TIFFReader -> GetDataExtent();
+        nz = Ext[5] - Ext[4] + 1;
+    }
+    if ( nz < 1 ) return false;
+    nframes = frames;
+    nplanes = nz / frames;
+    // A stack shorter than a frame is taken as a single frame
+    if ( planes > 0 && nz >= planes ) {
+        if ( nz % planes ) {
+            printf("Warning: the last %d planes of %s are not a whole frame of -timelapse %d and are ignored.\n",nz%planes,FileName.c_str(),planes);
+        }
+        nframes = nz / planes;
+        nplanes = planes;
+    } else if ( planes > 0 ) {
+        nframes = 1;
+        nplanes = nz;
+    }
+    return true;
+}
 
-        vtkSmartPointer<vtkImageData> ImageEnhanced = vtkSmartPointer<vtkImageData>::New();
-        ImageEnhanced -> ShallowCopy(Image);
-        ImageEnhanced -> GetPointData() -> SetScalars(VSSS);
-        ImageEnhanced -> SetDimensions(Dim);
+// Splits Files into the series described in RunTimeLapse. Stacks that
+// cannot be read are kept as frames so that they are reported.
+static void GetTimeLapseSeries(const _mitoObject *mitoObject, std::vector<std::string> &Files, int planes, std::vector<_mitoSeries> &Series) {
 
-        #ifdef DEBUG
-            SaveImageData(BinarizeAndConvertDoubleToChar(ImageEnhanced,-1),(mitoObject->FileName+"_div.tif").c_str());
-        #endif
+    std::sort(Files.begin(),Files.end(),IsEarlierFrame);
 
-        #ifdef DEBUG
-            printf("Clear boundaries and removing tiny components...\n");
-        #endif
+    _mitoSeries Folder;
+    Folder.Table = mitoObject->Folder + "timelapse.mitograph";
 
-        CleanImageBoundaries(ImageEnhanced);
+    for (size_t i = 0; i < Files.size(); i++) {
 
-        long int cluster;
-        std::vector<long int> CSz;
-        vtkSmartPointer<vtkDoubleArray> Volume = vtkSmartPointer<vtkDoubleArray>::New();
-        Volume -> SetNumberOfComponents(1);
-        Volume -> SetNumberOfTuples(N);
-        Volume -> FillComponent(0,0);
-        long int ncc = LabelConnectedComponents(ImageEnhanced,Volume,CSz,6,_div_threshold); // can use _mitoObj here
+        int nframes, nplanes;
+        _mitoFrame Frame;
+        Frame.Source = Files[i];
+        Frame.FileName = Files[i];
+        Frame.z0 = 0;
+        Frame.z1 = -1;
 
-        if (ncc > 1 && mitoObject->_smart_component_filtering) {
-            // Use user-specified component size, or automatic based on threshold sensitivity
-            int min_component_size = mitoObject->_min_component_size;
-            
-            #ifdef DEBUG
-                printf("\tRemoving components smaller than %d voxels...\n", min_component_size);
-            #endif
-            
-            for (id = N; id--;) {
-                cluster = (long int)Volume -> GetTuple1(id);
-                if (cluster < 0) {
-                    if (CSz[-cluster-1] <= min_component_size) {
-                        ImageEnhanced -> GetPointData() -> GetScalars() -> SetTuple1(id,0);
-                    }
-                }
-            }
+        if ( !GetFrameCount(Files[i]+".tif",planes,nframes,nplanes) ) {
+            // Reported when the frame is read
+            Folder.Frames.push_back(Frame);
+            continue;
         }
 
-        //STRUCTURAL CONNECTIVITY ENHANCEMENT
-        //-----------------------------------
-        if (mitoObject->_enhance_connectivity) {
-            #ifdef DEBUG
-                printf("Enhancing structural connectivity before binarization...\n");
-            #endif
-            
-            // Use stronger connectivity enhancement for sensitive threshold settings
-            double enhancement_strength = (_div_threshold < 0.1) ? 2.0 : 1.5;
-            ImageEnhanced = EnhanceStructuralConnectivity(ImageEnhanced, enhancement_strength);
+        if ( nframes == 1 ) {
+            if ( planes > 0 ) Frame.z1 = nplanes-1;
+            Folder.Frames.push_back(Frame);
+            continue;
         }
 
-        //BINARIZATION
-        //------------
-        if (mitoObject->_z_adaptive) {
-            if (mitoObject->_z_enhanced) {
-                // Use enhanced z-block segmentation with overlapping blocks and foreground detection
-                Binary = BinarizeAndConvertDoubleToCharZBlockEnhanced(ImageEnhanced, _div_threshold, mitoObject->_z_block_size);
-            } else {
-                // Use simple z-block segmentation - just like running multiple non z-adaptive segmentations
-                Binary = BinarizeAndConvertDoubleToCharZBlockSimple(ImageEnhanced, _div_threshold, mitoObject->_z_block_size);
-            }
-        } else {
-            Binary = BinarizeAndConvertDoubleToChar(ImageEnhanced,_div_threshold); // can use _mitoObj here
+        _mitoSeries Stack;
+        Stack.Table = Files[i] + ".mitograph";
+        for (int t = 0; t < nframes; t++) {
+            char suffix[32];
+            snprintf(suffix,sizeof(suffix),"_t%04d",t+1);
+            Frame.FileName = Files[i] + suffix;
+            Frame.z0 = t*nplanes;
+            Frame.z1 = (t+1)*nplanes-1;
+            Stack.Frames.push_back(Frame);
         }
+        Series.push_back(Stack);
 
-        //FILLING HOLES
-        //-------------
-        if (_improve_skeleton_quality) FillHoles(Binary);
+    }
 
-        // EXPORT SEGMENTED IMAGE
-        // ----------------------
-        if (_export_image_binary) {
-            vtkSmartPointer<vtkTIFFWriter> tif_writer = vtkSmartPointer<vtkTIFFWriter>::New();
-            tif_writer->SetInputData(Binary);
-            tif_writer->SetFileName((mitoObject->FileName + "_binary.tif").c_str());
-            tif_writer->Write();
-        }
+    if ( !Folder.Frames.empty() ) Series.insert(Series.begin(),Folder);
+}
 
-        //MAX PROJECTION
-        //--------------
+// Raw planes of Frame, read like LoadStack reads a whole stack.
+// NULL if they cannot be read.
+static vtkSmartPointer<vtkImageData> ReadFrame(const _mitoFrame &Frame, bool mmap) {
 
-        ExportMaxProjection(Binary,(mitoObject->FileName+".png").c_str());
+    std::string FileName = Frame.Source + ".tif";
 
-        //CREATING SURFACE POLYDATA
-        //-------------------------
-        Filter -> SetInputData(ImageEnhanced);
-        Filter -> SetValue(1,_div_threshold);
+    _mitoStack Stack;
+    if ( mmap && Stack.Open(FileName) ) {
+        int z1 = (Frame.z1 < 0) ? Stack.Dim[2]-1 : Frame.z1;
+        if ( z1 >= Stack.Dim[2] ) return NULL;
+        return ReadMappedStack(Stack,Frame.z0,z1);
+    }
 
-    } else {
+    vtkSmartPointer<vtkTIFFReader> TIFFReader = vtkSmartPointer<vtkTIFFReader>::New();
+    if ( !TIFFReader -> CanReadFile(FileName.c_str()) ) return NULL;
+    TIFFReader -> SetFileName(FileName.c_str());
 
-        Binary = vtkSmartPointer<vtkImageData>::New();
-        Binary -> DeepCopy(Image);
+    if ( Frame.z1 < 0 ) {
+        TIFFReader -> Update();
+        if ( TIFFReader -> GetOutput() -> GetNumberOfPoints() == 0 ) return NULL;
+        return TIFFReader -> GetOutput();
+    }
 
-        //CREATING SURFACE POLYDATA
-        //-------------------------
-        Filter -> SetInputData(Binary);
-        Filter -> SetValue(1,0.5);
+    TIFFReader -> UpdateInformation();
+    int *Ext = TIFFReader -> GetDataExtent();
+    if ( Frame.z1 > Ext[5] ) return NULL;
+    int ext[6] = {Ext[0],Ext[1],Ext[2],Ext[3],Frame.z0,Frame.z1};
+    TIFFReader -> UpdateExtent(ext);
+
+    // The planes of the frame start at z = 0
+    vtkSmartPointer<vtkImageData> Raw = vtkSmartPointer<vtkImageData>::New();
+    Raw -> SetDimensions(ext[1]-ext[0]+1,ext[3]-ext[2]+1,ext[5]-ext[4]+1);
+    Raw -> SetSpacing(TIFFReader->GetOutput()->GetSpacing());
+    Raw -> SetOrigin(0,0,0);
+    Raw -> GetPointData() -> SetScalars(TIFFReader->GetOutput()->GetPointData()->GetScalars());
+    return Raw;
+}
 
+static void ReadFrameWorker(const _mitoFrame *Frame, bool mmap, vtkSmartPointer<vtkImageData> *Raw) {
+    try {
+        *Raw = ReadFrame(*Frame,mmap);
+    } catch (...) {
+        *Raw = NULL;
     }
+}
 
-    Filter -> Update();
+// Appends the row of the .mitograph file of frame t to Table, after
+// the header when it is the first row. Returns false if the file of
+// the frame cannot be read.
+static bool AppendFrameResults(FILE *Table, const _mitoFrame &Frame, int t, bool header) {
+    FILE *f = fopen((Frame.FileName+".mitograph").c_str(),"r");
+    if ( !f ) return false;
+    std::string Text;
+    char buffer[4096];
+    size_t n;
+    while ( (n = fread(buffer,1,sizeof(buffer),f)) > 0 ) Text.append(buffer,n);
+    fclose(f);
+    size_t eol = Text.find('\n');
+    if ( eol == std::string::npos ) return false;
+    std::string Names = Text.substr(0,eol);
+    std::string Values = Text.substr(eol+1);
+    if ( !Values.empty() && Values[Values.size()-1] == '\n' ) Values.erase(Values.size()-1);
+    if ( header ) fprintf(Table,"Frame\t%s\n",Names.c_str());
+    fprintf(Table,"%d\t%s\n",t+1,Values.c_str());
+    fflush(Table);
+    return true;
+}
 
-    vtkSmartPointer<vtkPolyData> Surface = Filter -> GetOutput();
-    ScalePolyData(Surface,mitoObject);
+int RunTimeLapse(const _mitoObject *mitoObject, std::vector<std::string> &Files, int planes) {
 
-    //SAVING SURFACE
-    //--------------
+    std::vector<_mitoSeries> Series;
+    GetTimeLapseSeries(mitoObject,Files,planes,Series);
 
-    SavePolyData(Surface,(mitoObject->FileName+"_mitosurface.vtk").c_str());
+    int nframes = 0, nfailed = 0;
+    bool mmap = mitoObject->_mmap_input;
 
+    for (size_t s = 0; s < Series.size(); s++) {
 
-    //CONNECTED COMPONENTS FOR GRAPH ANALYSIS
-    //---------------------------------------
+        const std::vector<_mitoFrame> &Frames = Series[s].Frames;
 
-    std::vector<long int> CSz;
-    vtkSmartPointer<vtkTypeInt64Array> CCVolume = vtkSmartPointer<vtkTypeInt64Array>::New();
-    if (mitoObject->_analyze) {
+        FILE *Table = fopen(Series[s].Table.c_str(),"w");
+        if ( !Table ) printf("Warning: %s cannot be written.\n",Series[s].Table.c_str());
+        bool header = true;
 
-        CCVolume -> SetNumberOfComponents(1);
-        CCVolume -> SetNumberOfTuples(N);
-        CCVolume -> FillComponent(0,0);
+        vtkSmartPointer<vtkImageData> Next;
+        std::thread Reader(ReadFrameWorker,&Frames[0],mmap,&Next);
 
-        long int ncc = LabelConnectedComponents(Binary,CCVolume,CSz,26,0);
+        for (size_t t = 0; t < Frames.size(); t++) {
 
-    }
+            // Latency of the frame, including the wait for its planes
+            _mitoProfile Latency;
+            size_t stage = Latency.Begin("Frame");
 
-    //SKELETONIZATION
-    //---------------
+            Reader.join();
+            vtkSmartPointer<vtkImageData> Raw = Next;
+            Next = NULL;
+            if ( t+1 < Frames.size() ) Reader = std::thread(ReadFrameWorker,&Frames[t+1],mmap,&Next);
 
-    vtkSmartPointer<vtkPolyData> Skeleton = Thinning3D(Binary,mitoObject);
+            int status = EXIT_FAILURE;
+            if ( Raw ) {
+                _mitoObject Context = *mitoObject;
+                Context.attributes.clear();
+                Context.FileName = Frames[t].FileName;
+                Context.Input = Raw;
+                status = ProcessFile(&Context);
+            } else {
+                printf("File %s cannot be read.\n",(Frames[t].Source+".tif").c_str());
+            }
 
-    //CLEANING POLUDATA
-    vtkSmartPointer<vtkCleanPolyData> Clean = vtkSmartPointer<vtkCleanPolyData>::New();
-    Clean -> SetInputData(Skeleton);
-    Clean -> Update();
+            if ( status == EXIT_SUCCESS && Table ) {
+                if ( AppendFrameResults(Table,Frames[t],(int)t,header) ) {
+                    header = false;
+                } else {
+                    printf("Warning: results of %s cannot be added to %s.\n",Frames[t].FileName.c_str(),Series[s].Table.c_str());
+                }
+            }
+            if ( status != EXIT_SUCCESS ) nfailed++;
+            nframes++;
 
-    Skeleton -> DeepCopy(Clean->GetOutput());
+            Latency.End(stage);
+            printf("Frame %d of %d: %s %s (%1.2f s).\n",(int)t+1,(int)Frames.size(),Frames[t].FileName.c_str(),(status == EXIT_SUCCESS) ? "done" : "failed",Latency.Stages[stage].Wall);
 
-    //FRAGMENT CONNECTION
-    //-------------------
-    if (mitoObject->_enhance_connectivity) {
-        #ifdef DEBUG
-            printf("Applying skeleton fragment connection...\n");
-        #endif
-        
-        // Adjust gap distance based on pixel size and threshold
-        double gap_distance = 3.0 * _dxy; // Base gap distance
-        if (_div_threshold < 0.1) {
-            gap_distance = 5.0 * _dxy; // For sensitive settings, allow larger gaps
         }
-        
-        Skeleton = ConnectSkeletonFragments(Skeleton, gap_distance);
-        
-        // Clean up the skeleton after connection
-        vtkSmartPointer<vtkCleanPolyData> CleanAfterConnection = vtkSmartPointer<vtkCleanPolyData>::New();
-        CleanAfterConnection -> SetInputData(Skeleton);
-        CleanAfterConnection -> Update();
-        Skeleton -> DeepCopy(CleanAfterConnection->GetOutput());
+
+        if ( Table ) fclose(Table);
+
     }
 
-    //CONNECTED COMPONENTS FOR GRAPH ANALYSIS
-    //---------------------------------------
+    printf("Time-lapse finished: %d of %d frames processed.\n",nframes-nfailed,nframes);
 
-    if (mitoObject->_analyze) {
+    return nfailed;
+}
 
-        FILE *fvol = fopen((mitoObject->FileName+".cc").c_str(),"w");
-        fprintf(fvol,"Node\tBelonging_CC\tVol_Of_Belonging_CC_From_Img_(um3)\n");
+/* ================================================================
+   PARAMETER SWEEP
+=================================================================*/
 
-        double r[3];
-        long int node_id, cc_id, cc_tmp;
-        for (id = 0; id < Skeleton->GetNumberOfPoints(); id++) {
-            node_id = (long int)Skeleton -> GetPointData() -> GetArray("Nodes") -> GetTuple1(id);
-            if (node_id > -1) {
-                Skeleton -> GetPoint(id,r);
-                for (char i = 0; i < 6; i++) {
-                    double point[3] = {(double)((int)r[0]+ssdx_sort[i]), (double)((int)r[1]+ssdy_sort[i]), (double)((int)r[2]+ssdz_sort[i])};
-                    cc_id = (long int)CCVolume->GetTuple1(Binary -> FindPoint(point));
-                    // printf("%d\t%d\n",(int)node_id,(int)cc_id);
-                    if (cc_id < 0) break;
+bool ParseSweep(const _mitoObject *mitoObject, const std::vector<std::string> &Lists, std::vector<_mitoTrial> &Trials) {
+
+    const char *VariantName[3] = {"global","z-block","z-enhanced"};
+    const char *VariantSuffix[3] = {"_global","_zblock","_zenhanced"};
+
+    if ( Lists.empty() ) {
+        printf("Use -sweep key=v1,v2,... with the keys threshold, variant, z-block-size or component-size.\n");
+        return false;
+    }
+
+    // Each list replaces the value given by the other flags
+    std::vector<double> Thresholds(1,mitoObject->_div_threshold);
+    std::vector<int> Variants(1,(mitoObject->_z_enhanced) ? 2 : (mitoObject->_z_adaptive) ? 1 : 0);
+    std::vector<int> BlockSizes(1,mitoObject->_z_block_size);
+    std::vector<int> ComponentSizes(1,(mitoObject->_smart_component_filtering) ? mitoObject->_min_component_size : 0);
+    bool swept[4] = {false,false,false,false};
+
+    for (size_t l = 0; l < Lists.size(); l++) {
+
+        size_t eq = Lists[l].find('=');
+        std::string Key = Lists[l].substr(0,eq);
+        std::vector<std::string> Values;
+        if ( eq != std::string::npos ) {
+            std::string List = Lists[l].substr(eq+1);
+            size_t start = 0, end;
+            do {
+                end = List.find(',',start);
+                std::string Value = List.substr(start,(end==std::string::npos) ? std::string::npos : end-start);
+                if ( !Value.empty() ) Values.push_back(Value);
+                start = end + 1;
+            } while ( end != std::string::npos );
+        }
+        if ( Values.empty() ) {
+            printf("Sweep list %s has no values, use key=v1,v2,...\n",Lists[l].c_str());
+            return false;
+        }
+
+        for (size_t k = 0; k < Values.size(); k++) {
+            char *end;
+            const char *v = Values[k].c_str();
+            if ( Key == "threshold" ) {
+                if (!swept[0]) Thresholds.clear();
+                swept[0] = true;
+                Thresholds.push_back(strtod(v,&end));
+                if ( *end ) {
+                    printf("Invalid threshold %s in -sweep.\n",v);
+                    return false;
                 }
-                if (cc_id < 0) {
-                    fprintf(fvol,"%d\t%d\t%1.5f\n",(int)(node_id),(int)std::abs(cc_id),CSz[-cc_id-1]*(_dxy*_dxy*_dz));
-                } else {
-                    // If the voxel falls off the binary structure we assign volume zero.
-                    // This will not affect the final report of volume per cc, once we
-                    // use the max() function to get the volume of a given component.
-                    fprintf(fvol,"%d\t%d\t0.00000\n",(int)(node_id),(int)std::abs(cc_id));
+            } else if ( Key == "variant" ) {
+                if (!swept[1]) Variants.clear();
+                swept[1] = true;
+                int variant = -1;
+                for (int j = 0; j < 3; j++) if ( Values[k] == VariantName[j] ) variant = j;
+                if ( variant < 0 ) {
+                    printf("Unknown variant %s in -sweep, use global, z-block or z-enhanced.\n",v);
+                    return false;
+                }
+                Variants.push_back(variant);
+            } else if ( Key == "z-block-size" || Key == "component-size" ) {
+                int min = (Key == "z-block-size") ? 1 : 0;
+                std::vector<int> &Sizes = (Key == "z-block-size") ? BlockSizes : ComponentSizes;
+                bool &swept_sizes = (Key == "z-block-size") ? swept[2] : swept[3];
+                if (!swept_sizes) Sizes.clear();
+                swept_sizes = true;
+                Sizes.push_back((int)strtol(v,&end,10));
+                if ( *end || Sizes.back() < min ) {
+                    printf("Invalid %s %s in -sweep.\n",Key.c_str(),v);
+                    return false;
                 }
+            } else {
+                printf("Unknown sweep key %s, use threshold, variant, z-block-size or component-size.\n",Key.c_str());
+                return false;
             }
         }
 
-        fclose(fvol);
-
     }
 
-    //TUBULES WIDTH
-    //-------------
+    // Cartesian product of the lists. The suffix names the swept values
+    // only, and repeated output sets are kept once.
+    char buffer[64];
+    Trials.clear();
+    for (size_t t = 0; t < Thresholds.size(); t++) {
+        for (size_t v = 0; v < Variants.size(); v++) {
+            for (size_t b = 0; b < BlockSizes.size(); b++) {
+                for (size_t c = 0; c < ComponentSizes.size(); c++) {
+
+                    // The global variant does not use the block size
+                    if ( Variants[v] == 0 && b > 0 ) continue;
+
+                    _mitoTrial Trial;
+                    Trial._div_threshold = Thresholds[t];
+                    Trial._z_adaptive = Variants[v] > 0;
+                    Trial._z_enhanced = Variants[v] == 2;
+                    Trial._z_block_size = BlockSizes[b];
+                    Trial._smart_component_filtering = ComponentSizes[c] > 0;
+                    Trial._min_component_size = (ComponentSizes[c] > 0) ? ComponentSizes[c] : mitoObject->_min_component_size;
+                    if ( swept[0] ) {
+                        snprintf(buffer,sizeof(buffer),"_th%g",Thresholds[t]);
+                        Trial.Suffix += buffer;
+                    }
+                    if ( swept[1] ) {
+                        Trial.Suffix += VariantSuffix[Variants[v]];
+                    }
+                    if ( swept[2] && Variants[v] > 0 ) {
+                        snprintf(buffer,sizeof(buffer),"_zbs%d",BlockSizes[b]);
+                        Trial.Suffix += buffer;
+                    }
+                    if ( swept[3] ) {
+                        snprintf(buffer,sizeof(buffer),"_cs%d",ComponentSizes[c]);
+                        Trial.Suffix += buffer;
+                    }
 
-    ScalePolyData(Skeleton,mitoObject);
+                    bool repeated = false;
+                    for (size_t i = 0; i < Trials.size(); i++) repeated |= (Trials[i].Suffix == Trial.Suffix);
+                    if ( !repeated ) Trials.push_back(Trial);
 
-    EstimateTubuleWidth(Skeleton,Surface,mitoObject);
+                }
+            }
+        }
+    }
 
-    EstimateTubuleLength(Skeleton);
+    return true;
+}
 
-    //INTENSITY PROFILE ALONG THE SKELETON
-    //------------------------------------
+// State shared by the workers of SweepFile
+struct _sweepState {
+    std::mutex Mutex;
+    const _mitoObject *mitoObject;              // options of the file once loaded
+    std::vector<const _mitoTrial*> Trials;      // output sets sharing the divergence
+    vtkSmartPointer<vtkImageData> Divergence;
+    vtkSmartPointer<vtkImageData> Raw;
+    size_t next;
+    int nfailed;
+};
 
-    vtkSmartPointer<vtkImageData> ImageData;
-    if ( mitoObject->Type == "TIF" ) {
+static void SweepWorker(_sweepState *State) {
 
-        TIFFReader = vtkSmartPointer<vtkTIFFReader>::New();
-        TIFFReader -> SetFileName((mitoObject->FileName+".tif").c_str());
-        TIFFReader -> Update();
-        ImageData = TIFFReader -> GetOutput();
+    while (true) {
 
-    } else {
+        const _mitoTrial *Trial;
 
-        STRUCReader = vtkSmartPointer<vtkStructuredPointsReader>::New();
-        STRUCReader -> SetFileName((mitoObject->FileName+"-mitovolume.vtk").c_str());
-        STRUCReader -> Update();
-        ImageData = STRUCReader -> GetOutput();
+        // ProcessBinaryImage moves the origin of the raw stack, so each
+        // output set gets its own copy sharing the voxels
+        vtkSmartPointer<vtkImageData> Raw = vtkSmartPointer<vtkImageData>::New();
+
+        {
+            std::lock_guard<std::mutex> lock(State->Mutex);
+            if ( State->next == State->Trials.size() ) return;
+            Trial = State->Trials[State->next++];
+            Raw -> ShallowCopy(State->Raw);
+        }
+
+        _mitoObject Context = *State->mitoObject;
+        Context.attributes.clear();
+        Context.Sweep.clear();
+        Context.FileName += Trial->Suffix;
+        Context._div_threshold = Trial->_div_threshold;
+        Context._z_adaptive = Trial->_z_adaptive;
+        Context._z_enhanced = Trial->_z_enhanced;
+        Context._z_block_size = Trial->_z_block_size;
+        Context._smart_component_filtering = Trial->_smart_component_filtering;
+        Context._min_component_size = Trial->_min_component_size;
+        Context.Input = Raw;
+        Context.Divergence = State->Divergence;
+        Context.Manifest = NULL;
+
+        int status = ProcessFile(&Context);
+
+        if ( status != EXIT_SUCCESS ) {
+            std::lock_guard<std::mutex> lock(State->Mutex);
+            State->nfailed++;
+        }
 
     }
 
-    // Shifting the Stack to (0,0,0)
-    ImageData -> SetOrigin(0,0,0);
+}
 
-    MapImageIntensity(Skeleton,ImageData,6);
+int SweepFile(_mitoObject *mitoObject) {
 
-    vtkDataArray *W = Skeleton -> GetPointData() -> GetArray("Width");
-    vtkDataArray *I = Skeleton -> GetPointData() -> GetArray("Intensity");
+    #ifdef _OPENMP
+        if ( mitoObject->_nthreads > 0 ) omp_set_num_threads(mitoObject->_nthreads);
+    #endif
 
-    vtkIdType p;
-    double r[3];
-    FILE *fw = fopen((mitoObject->FileName+".txt").c_str(),"w");
-    fprintf(fw,"line_id\tpoint_id\tx\ty\tz\twidth_(um)\tpixel_intensity\n");
-    for (vtkIdType edge = 0; edge < Skeleton -> GetNumberOfCells(); edge++) {
-        for (vtkIdType id = 0; id < Skeleton -> GetCell(edge) -> GetNumberOfPoints(); id++) {
-            p = Skeleton -> GetCell(edge) -> GetPointId(id);
-            Skeleton -> GetPoint(p,r);
-            fprintf(fw,"%d\t%d\t%1.5f\t%1.5f\t%1.5f\t%1.5f\t%1.5f\n",(int)edge,(int)id,r[0],r[1],r[2],W->GetTuple1(p),I->GetTuple1(p));
+    int nfailed = 0;
+    size_t ntrials = mitoObject->Sweep.size();
+
+    // Stages shared by the output sets are recorded in the profile of
+    // the file, the others in the profile of each output set
+    _mitoProfile Profile;
+    mitoObject->Profile = (mitoObject->_profile) ? &Profile : NULL;
+    _mitoStageTimer Timer(mitoObject->Profile,"Total");
+
+    std::vector<bool> Done(ntrials,false);
+    for (size_t i = 0; i < ntrials; i++) {
+
+        if ( Done[i] ) continue;
+        const _mitoTrial &First = mitoObject->Sweep[i];
+        uint64_t key;
+
+        // Output sets with the same 8-bit conversion share the divergence
+        _sweepState State;
+        State.next = 0;
+        State.nfailed = 0;
+        for (size_t j = i; j < ntrials; j++) {
+            const _mitoTrial &Trial = mitoObject->Sweep[j];
+            if ( !Done[j] && Trial._z_adaptive == First._z_adaptive && (!Trial._z_adaptive || Trial._z_block_size == First._z_block_size) ) {
+                State.Trials.push_back(&Trial);
+                Done[j] = true;
+            }
         }
-    }
-    fclose(fw);
 
-    GetVolumeFromSkeletonLengthAndWidth(Skeleton,mitoObject); //Validation needed
+        // LoadStack stores the origin of the stack and may change _dz
+        _mitoObject Context = *mitoObject;
+        Context._z_adaptive = First._z_adaptive;
+        Context._z_block_size = First._z_block_size;
 
-    //GetTopologicalAttributes(Skeleton,mitoObject);
+        try {
 
-    //SAVING SKELETON
-    //---------------
+            vtkSmartPointer<vtkImageData> Image = LoadStack(&Context,State.Raw);
+            if ( Image ) State.Divergence = GetCachedDivergence(&Context,Image,key);
 
-    SavePolyData(Skeleton,(mitoObject->FileName+"_skeleton.vtk").c_str());
+        } catch (const std::exception &e) {
 
-    return 0;
-}
+            printf("Error processing %s: %s\n",mitoObject->FileName.c_str(),e.what());
 
-/* ================================================================
-   GRAPH ANALYSIS
-=================================================================*/
+        } catch (...) {
 
-void RunGraphAnalysis(std::string FileName) {
+            printf("Error processing %s.\n",mitoObject->FileName.c_str());
 
-    //RUN R SCRIPT FOR GRAPH ANALYSIS
-    //-------------------------------
+        }
 
-    std::string cmd;
-    cmd = "Rscript --vanilla GraphAnalyzer.R " + FileName;
-    system(cmd.c_str());
+        if ( !State.Divergence ) {
+            nfailed += (int)State.Trials.size();
+            continue;
+        }
 
+        Context.Profile = NULL;
+        State.mitoObject = &Context;
+
+        int njobs = std::min(mitoObject->_sweep_jobs,(int)State.Trials.size());
+        std::vector<std::thread> Workers;
+        for (int j = 0; j < njobs; j++) {
+            Workers.push_back(std::thread(SweepWorker,&State));
+        }
+        for (int j = 0; j < njobs; j++) Workers[j].join();
+
+        nfailed += State.nfailed;
+
+    }
+
+    if ( nfailed < (int)ntrials ) {
+        std::lock_guard<std::mutex> lock(ConfigMutex);
+        ExportConfigFile(*mitoObject);
+    }
+
+    Timer.Stop();
+    if ( mitoObject->Profile && !nfailed && !mitoObject->Profile->Save(mitoObject->FileName) ) {
+        printf("Profile of %s cannot be saved.\n",mitoObject->FileName.c_str());
+    }
+    mitoObject->Profile = NULL;
+
+    return (nfailed) ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 /* ================================================================
    MAIN ROUTINE
 =================================================================*/
 
+void SetDefaultParameters(_mitoObject *mitoObject) {
+    mitoObject->Type = "TIF";
+    mitoObject->_analyze = false;
+    mitoObject->_analyze_r = false;
+    mitoObject->_binary_input = false;
+    mitoObject->_adaptive_threshold = false;
+    mitoObject->_nblks = 3;
+    mitoObject->_sigmai = 1.00;
+    mitoObject->_sigmaf = 1.50;
+    mitoObject->_nsigma = 6;
+    mitoObject->_z_adaptive = false;
+    mitoObject->_z_block_size = 8; // Improved default for better statistics
+    mitoObject->_z_enhanced = false; // Enhanced z-adaptive disabled by default
+    mitoObject->_enhance_connectivity = false; // Default off - user controlled
+    mitoObject->_smart_component_filtering = false; // Default off - user controlled  
+    mitoObject->_min_component_size = 5; // Default component size
+    mitoObject->_dxy = 0.0;
+    mitoObject->_dz = -1.0;
+    mitoObject->_rad = 0.150;
+    mitoObject->_div_threshold = 0.1666667;
+    mitoObject->_resample = -1.0;
+    mitoObject->_checkonly = false;
+    mitoObject->_checkonly_bin = 1;
+    mitoObject->_export_graph_files = true;
+    mitoObject->_export_image_binary = false;
+    mitoObject->_export_image_resampled = false;
+    mitoObject->_scale_polydata_before_save = true;
+    mitoObject->_export_nodes_label = true;
+    mitoObject->_improve_skeleton_quality = true;
+    mitoObject->_nthreads = 0;
+    mitoObject->_thinning_lut = false;
+    mitoObject->_scale_space = false;
+    mitoObject->_stream_slab = 0;
+    mitoObject->_mmap_input = false;
+    mitoObject->_profile = false;
+    mitoObject->_output_text = true;
+    mitoObject->_output_binary = false;
+    mitoObject->_output_compress = false;
+    mitoObject->_eigen_jacobi = false;
+    mitoObject->_fill_holes_flood = false;
+    mitoObject->_surface = MITO_SURFACE_CONTOUR;
+    mitoObject->_width_dt = false;
+    mitoObject->_device = MITO_DEVICE_CPU;
+    mitoObject->_storage_double = false;
+    mitoObject->_sweep_cache = false;
+    mitoObject->_cache_stages = false;
+    mitoObject->_resume = false;
+    mitoObject->_sweep_jobs = 1;
+    mitoObject->Sweep.clear();
+    mitoObject->Profile = NULL;
+    mitoObject->Columns = NULL;
+    mitoObject->Graph = NULL;
+    mitoObject->Input = NULL;
+    mitoObject->Divergence = NULL;
+    mitoObject->Manifest = NULL;
+    mitoObject->Result = NULL;
+}
+
+// mitograph_bench links this file without the command line program
+#ifndef MITOGRAPH_NO_MAIN
+
 int main(int argc, char *argv[]) {     
 
     int i;
@@ -2924,20 +4923,18 @@ int main(int argc, char *argv[]) {
 
     _mitoObject mitoObject;
 
-    mitoObject.Type = "TIF";
-    mitoObject._analyze = false;
-    mitoObject._binary_input = false;
-    mitoObject._adaptive_threshold = false;
-    mitoObject._nblks = 3;
-    mitoObject._sigmai = 1.00;
-    mitoObject._sigmaf = 1.50;
-    mitoObject._nsigma = 6;
-    mitoObject._z_adaptive = false;
-    mitoObject._z_block_size = 8; // Improved default for better statistics
-    mitoObject._z_enhanced = false; // Enhanced z-adaptive disabled by default
-    mitoObject._enhance_connectivity = false; // Default off - user controlled
-    mitoObject._smart_component_filtering = false; // Default off - user controlled  
-    mitoObject._min_component_size = 5; // Default component size
+    SetDefaultParameters(&mitoObject);
+
+    int _njobs = 1;
+    double _max_memory = -1.0;
+
+    bool _sweep = false;
+    std::vector<std::string> _sweep_lists;
+
+    bool _manifest = true;
+
+    bool _timelapse = false;
+    int _timelapse_planes = 0;
 
     // Collecting input parameters
     for (i = 0; i < argc; i++) {
@@ -2951,13 +4948,13 @@ int main(int argc, char *argv[]) {
             sprintf(_impath,"%s/",argv[i+1]);
         }
         if (!strcmp(argv[i],"-xy")) {
-            _dxy = atof(argv[i+1]);
+            mitoObject._dxy = atof(argv[i+1]);
         }
         if (!strcmp(argv[i],"-z")) {
-            _dz = atof(argv[i+1]);
+            mitoObject._dz = atof(argv[i+1]);
         }
         if (!strcmp(argv[i],"-rad")) {
-            _rad = atof(argv[i+1]);
+            mitoObject._rad = atof(argv[i+1]);
         }
         if (!strcmp(argv[i],"-scales")) {
             mitoObject._sigmai = atof(argv[i+1]);
@@ -2997,47 +4994,240 @@ int main(int argc, char *argv[]) {
             }
         }
         if (!strcmp(argv[i],"-threshold")) {
-            _div_threshold = (double)atof(argv[i+1]);
+            mitoObject._div_threshold = (double)atof(argv[i+1]);
         }
         if (!strcmp(argv[i],"-scale_off")) {
-            _scale_polydata_before_save = false;
+            mitoObject._scale_polydata_before_save = false;
         }        
         if (!strcmp(argv[i],"-graph_off")) {
-            _export_graph_files = false;
+            mitoObject._export_graph_files = false;
         }
         if (!strcmp(argv[i],"-labels_off")) {
-            _export_nodes_label = false;
+            mitoObject._export_nodes_label = false;
         }
         if (!strcmp(argv[i],"-checkonly")) {
-            _checkonly = true;
+            mitoObject._checkonly = true;
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                mitoObject._checkonly_bin = atoi(argv[i+1]);
+                if (mitoObject._checkonly_bin < 1) {
+                    printf("Warning: preview binning too small (%d), setting to minimum of 1\n", mitoObject._checkonly_bin);
+                    mitoObject._checkonly_bin = 1;
+                }
+            }
         }
         if (!strcmp(argv[i],"-precision_off")) {
-            _improve_skeleton_quality = false;
+            mitoObject._improve_skeleton_quality = false;
         }
         if (!strcmp(argv[i],"-export_image_resampled")) {
-            _export_image_resampled = true;
+            mitoObject._export_image_resampled = true;
         }
         if (!strcmp(argv[i], "-export_image_binary")) {
-            _export_image_binary = true;
+            mitoObject._export_image_binary = true;
         }
         if (!strcmp(argv[i],"-binary")) {
             mitoObject._binary_input = true;
         }
         if (!strcmp(argv[i],"-resample")) {
-            _resample = atof(argv[i+1]);
+            mitoObject._resample = atof(argv[i+1]);
         }
         if (!strcmp(argv[i],"-analyze")) {
             mitoObject._analyze = true;
         }
+        if (!strcmp(argv[i],"-analyze-r")) {
+            mitoObject._analyze = true;
+            mitoObject._analyze_r = true;
+        }
+        if (!strcmp(argv[i],"-threads")) {
+            mitoObject._nthreads = atoi(argv[i+1]);
+            #ifndef _OPENMP
+                printf("Warning: MitoGraph was built without OpenMP, -threads is ignored.\n");
+            #endif
+        }
+        if (!strcmp(argv[i],"-thinning-lut")) {
+            mitoObject._thinning_lut = true;
+        }
+        if (!strcmp(argv[i],"-scale-space")) {
+            mitoObject._scale_space = true;
+        }
+        if (!strcmp(argv[i],"-eigen-jacobi")) {
+            mitoObject._eigen_jacobi = true;
+        }
+        if (!strcmp(argv[i],"-fill-holes-flood")) {
+            mitoObject._fill_holes_flood = true;
+        }
+        if (!strcmp(argv[i],"-surface")) {
+            if (i+1 < argc && !strcmp(argv[i+1],"contour")) {
+                mitoObject._surface = MITO_SURFACE_CONTOUR;
+            } else if (i+1 < argc && !strcmp(argv[i+1],"flyingedges")) {
+                mitoObject._surface = MITO_SURFACE_FLYING_EDGES;
+            } else if (i+1 < argc && !strcmp(argv[i+1],"narrowband")) {
+                mitoObject._surface = MITO_SURFACE_NARROW_BAND;
+            } else if (i+1 < argc && !strcmp(argv[i+1],"off")) {
+                mitoObject._surface = MITO_SURFACE_OFF;
+            } else {
+                printf("Unknown surface, use -surface contour, flyingedges, narrowband or off.\n");
+                return -1;
+            }
+        }
+        if (!strcmp(argv[i],"-surface-off")) {
+            mitoObject._surface = MITO_SURFACE_OFF;
+        }
+        if (!strcmp(argv[i],"-width")) {
+            if (i+1 < argc && !strcmp(argv[i+1],"dt")) {
+                mitoObject._width_dt = true;
+            } else if (i+1 < argc && !strcmp(argv[i+1],"surface")) {
+                mitoObject._width_dt = false;
+            } else {
+                printf("Unknown width estimation, use -width dt or surface.\n");
+                return -1;
+            }
+        }
+        if (!strcmp(argv[i],"-device")) {
+            if (i+1 < argc && !strcmp(argv[i+1],"cpu")) {
+                mitoObject._device = MITO_DEVICE_CPU;
+            } else if (i+1 < argc && !strcmp(argv[i+1],"gpu")) {
+                mitoObject._device = MITO_DEVICE_GPU;
+            } else {
+                printf("Unknown device, use -device cpu or gpu.\n");
+                return -1;
+            }
+        }
+        if (!strcmp(argv[i],"-storage")) {
+            if (i+1 < argc && !strcmp(argv[i+1],"float")) {
+                mitoObject._storage_double = false;
+            } else if (i+1 < argc && !strcmp(argv[i+1],"double")) {
+                mitoObject._storage_double = true;
+            } else {
+                printf("Unknown storage, use -storage float or double.\n");
+                return -1;
+            }
+        }
+        if (!strcmp(argv[i],"-sweep")) {
+            _sweep = true;
+            for (int j = i+1; j < argc && argv[j][0] != '-'; j++) _sweep_lists.push_back(argv[j]);
+        }
+        if (!strcmp(argv[i],"-sweep-cache")) {
+            mitoObject._sweep_cache = true;
+        }
+        if (!strcmp(argv[i],"-cache-stages")) {
+            mitoObject._cache_stages = true;
+        }
+        if (!strcmp(argv[i],"-resume")) {
+            mitoObject._resume = true;
+        }
+        if (!strcmp(argv[i],"-manifest_off")) {
+            _manifest = false;
+        }
+        if (!strcmp(argv[i],"-timelapse")) {
+            _timelapse = true;
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                _timelapse_planes = atoi(argv[i+1]);
+                if (_timelapse_planes < 1) {
+                    printf("Unknown planes per frame, use -timelapse or -timelapse <planes>.\n");
+                    return -1;
+                }
+            }
+        }
+        if (!strcmp(argv[i],"-stream-slab")) {
+            mitoObject._stream_slab = atoi(argv[i+1]);
+        }
+        if (!strcmp(argv[i],"-mmap")) {
+            mitoObject._mmap_input = true;
+        }
+        if (!strcmp(argv[i],"-profile")) {
+            mitoObject._profile = true;
+        }
+        if (!strcmp(argv[i],"-output-format")) {
+            if (i+1 < argc && !strcmp(argv[i+1],"binary")) {
+                mitoObject._output_text = false;
+                mitoObject._output_binary = true;
+            } else if (i+1 < argc && !strcmp(argv[i+1],"both")) {
+                mitoObject._output_text = true;
+                mitoObject._output_binary = true;
+            } else if (i+1 < argc && !strcmp(argv[i+1],"text")) {
+                mitoObject._output_text = true;
+                mitoObject._output_binary = false;
+            } else {
+                printf("Unknown output format, use -output-format text, binary or both.\n");
+                return -1;
+            }
+        }
+        if (!strcmp(argv[i],"-output-compress")) {
+            mitoObject._output_compress = true;
+            if (!_mitoColumns::CanCompress()) {
+                printf("Warning: MitoGraph was built without zlib, the .mgb columns are stored uncompressed.\n");
+            }
+        }
+        if (!strcmp(argv[i],"-jobs")) {
+            _njobs = atoi(argv[i+1]);
+            if (_njobs < 1) {
+                printf("Warning: number of jobs too small (%d), setting to minimum of 1\n", _njobs);
+                _njobs = 1;
+            }
+        }
+        if (!strcmp(argv[i],"-max-memory")) {
+            _max_memory = atof(argv[i+1]) * 1024.0 * 1024.0;
+        }
     }
 
-    if (_dz < 0) {
+    if (mitoObject._dz < 0) {
 
         printf("Please, use -xy and -z to provide the pixel size.\n");
         return -1;
 
     }
 
+    // Frames are processed one at a time and in order
+    if (_timelapse) {
+
+        if (_vtk_input) {
+            printf("Warning: -timelapse is ignored with -vtk.\n");
+            _timelapse = false;
+        } else if (mitoObject._checkonly) {
+            printf("Warning: -timelapse is ignored with -checkonly.\n");
+            _timelapse = false;
+        }
+        if (_timelapse && _sweep) {
+            printf("Warning: -sweep is ignored with -timelapse.\n");
+            _sweep = false;
+        }
+        if (_timelapse && mitoObject._stream_slab > 0) {
+            printf("Warning: -stream-slab is ignored with -timelapse.\n");
+            mitoObject._stream_slab = 0;
+        }
+        if (_timelapse && _njobs > 1) {
+            printf("Warning: -jobs is ignored with -timelapse.\n");
+            _njobs = 1;
+        }
+
+    }
+
+    if (_sweep) {
+
+        if (!ParseSweep(&mitoObject,_sweep_lists,mitoObject.Sweep)) return -1;
+
+        if (mitoObject._binary_input) {
+            printf("Warning: -sweep is ignored with -binary.\n");
+            mitoObject.Sweep.clear();
+        }
+        if (!mitoObject.Sweep.empty() && mitoObject._stream_slab > 0) {
+            printf("Warning: -stream-slab is ignored with -sweep.\n");
+            mitoObject._stream_slab = 0;
+        }
+
+        // The jobs segment the output sets of one file at a time
+        if (!mitoObject.Sweep.empty()) {
+            mitoObject._sweep_jobs = _njobs;
+            _njobs = 1;
+            #ifdef _OPENMP
+                if (mitoObject._nthreads == 0 && mitoObject._sweep_jobs > 1) {
+                    mitoObject._nthreads = std::max(1,omp_get_max_threads()/mitoObject._sweep_jobs);
+                }
+            #endif
+        }
+
+    }
+
     std::vector<std::string> Files; // List of files to process
 
     if (_vtk_input) {
@@ -3052,32 +5242,60 @@ int main(int argc, char *argv[]) {
 
     mitoObject._dsigma = (mitoObject._nsigma>1) ? (mitoObject._sigmaf-mitoObject._sigmai) / (mitoObject._nsigma-1) : mitoObject._sigmaf;
 
+    // Progress of the run, read back by -resume
+    _mitoManifest Manifest;
+    if (_manifest && !mitoObject._checkonly) {
+        if (Manifest.Open(mitoObject.Folder+"mitograph.manifest")) {
+            mitoObject.Manifest = &Manifest;
+        } else {
+            printf("Warning: %smitograph.manifest cannot be written, -resume will not find this run.\n",mitoObject.Folder.c_str());
+        }
+    } else if (mitoObject._resume) {
+        printf("Warning: -resume needs the manifest and is ignored with -manifest_off.\n");
+    }
+
     // Debug output removed
 
-    for (int i = 0; i < Files.size(); i++) {
+    int nfailed = 0;
 
-        mitoObject.attributes.clear();
-        mitoObject.FileName = Files[i];
-        
-        if ( _checkonly ) {
+    if (_timelapse) {
 
-            ExportDetailedMaxProjection(&mitoObject);
+        nfailed = RunTimeLapse(&mitoObject,Files,_timelapse_planes);
 
-        } else {
+    } else if (_njobs == 1) {
+
+        for (int i = 0; i < Files.size(); i++) {
+
+            mitoObject.attributes.clear();
+            mitoObject.FileName = Files[i];
 
-            MultiscaleVesselness(&mitoObject);
-            DumpResults(mitoObject);
-            ExportConfigFile(mitoObject);
+            if ( ProcessFile(&mitoObject) != EXIT_SUCCESS ) nfailed++;
 
         }
 
-        if ( mitoObject._analyze ) {
-            RunGraphAnalysis(Files[i]);
+    } else {
+
+        // By default half of the physical memory is available to the
+        // batch and the OpenMP threads are split among the jobs.
+        if (_max_memory < 0) {
+            _max_memory = 0.0;
+            #if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+                _max_memory = 0.5 * (double)sysconf(_SC_PHYS_PAGES) * (double)sysconf(_SC_PAGESIZE);
+            #endif
         }
+        #ifdef _OPENMP
+            if (mitoObject._nthreads == 0) {
+                mitoObject._nthreads = std::max(1,omp_get_max_threads()/_njobs);
+            }
+        #endif
+
+        nfailed = RunBatch(&mitoObject,Files,_njobs,_max_memory);
 
     }
 
     // Debug output removed
 
-    return 0;
+    return (nfailed) ? EXIT_FAILURE : 0;
 }
+
+#endif
@@ -0,0 +1,160 @@
+// ==================================================================
+// MitoGraph: Quantifying Mitochondrial Content in Living Cells
+// Library interface: processing of stacks held in memory.
+// ==================================================================
+
+#include "includes.h"
+
+// Defined in MitoGraph.cxx
+void SetDefaultParameters(_mitoObject *mitoObject);
+int MultiscaleVesselness(_mitoObject *mitoObject);
+
+_mitoParameters::_mitoParameters() {
+    _mitoObject mitoObject;
+    SetDefaultParameters(&mitoObject);
+    dxy = 0.0;
+    dz = 0.0;
+    sigmai = mitoObject._sigmai;
+    sigmaf = mitoObject._sigmaf;
+    nsigma = mitoObject._nsigma;
+    threshold = mitoObject._div_threshold;
+    adaptive_blocks = 0;
+    z_adaptive = mitoObject._z_adaptive;
+    z_enhanced = mitoObject._z_enhanced;
+    z_block_size = mitoObject._z_block_size;
+    enhance_connectivity = mitoObject._enhance_connectivity;
+    min_component_size = 0;
+    analyze = false;
+    scale_space = mitoObject._scale_space;
+    thinning_lut = mitoObject._thinning_lut;
+    eigen_jacobi = mitoObject._eigen_jacobi;
+    fill_holes_flood = mitoObject._fill_holes_flood;
+    surface = mitoObject._surface;
+    width_dt = mitoObject._width_dt;
+    device = mitoObject._device;
+    storage_double = mitoObject._storage_double;
+    nthreads = 0;
+}
+
+template <class A, typename T>
+static int ProcessStack(const T *V, const int Dim[3], const _mitoParameters &Parameters, _mitoResult &Result) {
+
+    Result = _mitoResult();
+    Result.Dim[0] = Result.Dim[1] = Result.Dim[2] = 0;
+
+    if (!V || Dim[0] < 1 || Dim[1] < 1 || Dim[2] < 1) {
+        Result.Error = "Invalid stack.";
+        return EXIT_FAILURE;
+    }
+    if (Parameters.dxy <= 0.0 || Parameters.dz <= 0.0) {
+        Result.Error = "Pixel size and z-step must be positive.";
+        return EXIT_FAILURE;
+    }
+    if (Parameters.nsigma < 1 || Parameters.sigmai <= 0.0 || Parameters.sigmaf < Parameters.sigmai) {
+        Result.Error = "Invalid range of scales.";
+        return EXIT_FAILURE;
+    }
+
+    // Same settings as the command line program, with every output kept
+    // in memory
+    _mitoObject mitoObject;
+    SetDefaultParameters(&mitoObject);
+    mitoObject._dxy = Parameters.dxy;
+    mitoObject._dz = Parameters.dz;
+    mitoObject._sigmai = Parameters.sigmai;
+    mitoObject._sigmaf = Parameters.sigmaf;
+    mitoObject._nsigma = Parameters.nsigma;
+    mitoObject._dsigma = (mitoObject._nsigma>1) ? (mitoObject._sigmaf-mitoObject._sigmai) / (mitoObject._nsigma-1) : mitoObject._sigmaf;
+    mitoObject._div_threshold = Parameters.threshold;
+    mitoObject._adaptive_threshold = Parameters.adaptive_blocks > 0;
+    if (mitoObject._adaptive_threshold) mitoObject._nblks = Parameters.adaptive_blocks;
+    mitoObject._z_adaptive = Parameters.z_adaptive || Parameters.z_enhanced;
+    mitoObject._z_enhanced = Parameters.z_enhanced;
+    mitoObject._z_block_size = std::max(1,Parameters.z_block_size);
+    mitoObject._enhance_connectivity = Parameters.enhance_connectivity;
+    mitoObject._smart_component_filtering = Parameters.min_component_size > 0;
+    if (mitoObject._smart_component_filtering) mitoObject._min_component_size = Parameters.min_component_size;
+    mitoObject._analyze = Parameters.analyze;
+    mitoObject._scale_space = Parameters.scale_space;
+    mitoObject._thinning_lut = Parameters.thinning_lut;
+    mitoObject._eigen_jacobi = Parameters.eigen_jacobi;
+    mitoObject._fill_holes_flood = Parameters.fill_holes_flood;
+    mitoObject._surface = Parameters.surface;
+    mitoObject._width_dt = Parameters.width_dt;
+    mitoObject._device = Parameters.device;
+    mitoObject._storage_double = Parameters.storage_double;
+    mitoObject._nthreads = Parameters.nthreads;
+    mitoObject._output_text = false;
+    mitoObject._export_nodes_label = false;
+
+    vtkIdType N = (vtkIdType)Dim[0] * Dim[1] * Dim[2];
+    vtkSmartPointer<A> Scalars = vtkSmartPointer<A>::New();
+    Scalars -> SetNumberOfTuples(N);
+    memcpy(Scalars->GetPointer(0),V,N*sizeof(T));
+
+    vtkSmartPointer<vtkImageData> Image = vtkSmartPointer<vtkImageData>::New();
+    Image -> SetDimensions(Dim[0],Dim[1],Dim[2]);
+    Image -> GetPointData() -> SetScalars(Scalars);
+
+    _mitoColumns Columns;
+    mitoObject.Input = Image;
+    mitoObject.Columns = &Columns;
+    mitoObject.Result = &Result;
+
+    // The thread count is process-wide: the caller's is restored below
+    #ifdef _OPENMP
+        int omp_threads = omp_get_max_threads();
+        if ( mitoObject._nthreads > 0 ) omp_set_num_threads(mitoObject._nthreads);
+    #endif
+
+    int status;
+    try {
+        status = MultiscaleVesselness(&mitoObject);
+    } catch (const std::exception &e) {
+        Result.Error = e.what();
+        status = EXIT_FAILURE;
+    } catch (...) {
+        Result.Error = "Unknown error.";
+        status = EXIT_FAILURE;
+    }
+
+    #ifdef _OPENMP
+        if ( mitoObject._nthreads > 0 ) omp_set_num_threads(omp_threads);
+    #endif
+
+    if (status != EXIT_SUCCESS) {
+        if (Result.Error.empty()) Result.Error = "Stack cannot be processed.";
+        return EXIT_FAILURE;
+    }
+
+    Columns.Get("node.x",Result.NodeX);
+    Columns.Get("node.y",Result.NodeY);
+    Columns.Get("node.z",Result.NodeZ);
+    Columns.Get("edge.source",Result.EdgeSource);
+    Columns.Get("edge.target",Result.EdgeTarget);
+    Columns.Get("edge.length",Result.EdgeLength);
+    Columns.Get("point.line",Result.PointLine);
+    Columns.Get("point.index",Result.PointIndex);
+    Columns.Get("point.x",Result.PointX);
+    Columns.Get("point.y",Result.PointY);
+    Columns.Get("point.z",Result.PointZ);
+    Columns.Get("point.width",Result.PointWidth);
+    Columns.Get("point.intensity",Result.PointIntensity);
+    Columns.Get("cc.node",Result.CCNode);
+    Columns.Get("cc.component",Result.CCComponent);
+    Columns.Get("cc.volume",Result.CCVolume);
+
+    for (size_t i = 0; i < mitoObject.attributes.size(); i++) {
+        Result.Attributes.push_back(std::make_pair(mitoObject.attributes[i].name,mitoObject.attributes[i].value));
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int ProcessStack(const uint8_t *V, const int Dim[3], const _mitoParameters &Parameters, _mitoResult &Result) {
+    return ProcessStack<vtkUnsignedCharArray>(V,Dim,Parameters,Result);
+}
+
+int ProcessStack(const uint16_t *V, const int Dim[3], const _mitoParameters &Parameters, _mitoResult &Result) {
+    return ProcessStack<vtkUnsignedShortArray>(V,Dim,Parameters,Result);
+}
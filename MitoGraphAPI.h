@@ -0,0 +1,83 @@
+#ifndef MITOGRAPHAPI_H
+#define MITOGRAPHAPI_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+	//===========================================================================
+	//
+	//   Library interface of MitoGraph (target mitograph). A stack held in
+	//   memory is segmented, skeletonized and measured like a file given
+	//   to the command line program, and the outputs are returned in a
+	//   _mitoResult instead of being written: nothing is read from or
+	//   written to disk. Each call works on its own state, so several
+	//   stacks can be processed at once from different threads. Voxels
+	//   are ordered x fastest, then y, then z. Stacks with a single
+	//   plane are processed as 2D images.
+	//
+	//===========================================================================
+
+	struct _mitoParameters {
+
+		double dxy;                     // pixel size in um, required
+		double dz;                      // z-step in um, required
+		double sigmai, sigmaf;          // range of the Gaussian scales in pixels
+		int nsigma;                     // number of scales
+		double threshold;               // divergence threshold
+		int adaptive_blocks;            // blocks per side of the adaptive threshold, 0 for a global threshold
+		bool z_adaptive;                // -z-adaptive
+		bool z_enhanced;                // -z-enhanced, implies z_adaptive
+		int z_block_size;               // z-planes per block of the z-adaptive thresholds
+		bool enhance_connectivity;      // -enhance-connectivity
+		int min_component_size;         // components of this size or smaller are removed, 0 to keep all
+		bool analyze;                   // fill the connected component table (CCNode, ...)
+		bool scale_space;               // -scale-space
+		bool thinning_lut;              // -thinning-lut
+		bool eigen_jacobi;              // -eigen-jacobi
+		bool fill_holes_flood;          // -fill-holes-flood
+		int surface;                    // -surface: 0 contour, 1 flyingedges, 2 narrowband, 3 off
+		bool width_dt;                  // -width dt
+		int device;                     // -device: 0 cpu, 1 gpu
+		bool storage_double;            // -storage double
+		int nthreads;                   // OpenMP threads of the call, 0 for the default
+
+		// Same defaults as the command line program
+		_mitoParameters();
+	};
+
+	struct _mitoResult {
+
+		// Segmentation, 255 inside the mitochondria and 0 elsewhere. 2D
+		// images are padded with empty planes like in the .vtk outputs.
+		int Dim[3];
+		std::vector<unsigned char> Mask;
+
+		// Skeleton graph, as in the .gnet and .coo files. Coordinates in um.
+		std::vector<double> NodeX, NodeY, NodeZ;
+		std::vector<int32_t> EdgeSource, EdgeTarget;
+		std::vector<double> EdgeLength;
+
+		// Skeleton points, as in the .txt file
+		std::vector<int32_t> PointLine, PointIndex;
+		std::vector<float> PointX, PointY, PointZ, PointWidth, PointIntensity;
+
+		// Connected component of each node, as in the .cc file. Empty
+		// unless analyze is set.
+		std::vector<int32_t> CCNode, CCComponent;
+		std::vector<double> CCVolume;
+
+		// Attributes of the .mitograph file (volume, length, ...)
+		std::vector< std::pair<std::string,double> > Attributes;
+
+		// Reason of the failure when ProcessStack does not succeed
+		std::string Error;
+	};
+
+	// Processes the Dim[0] x Dim[1] x Dim[2] stack V. Returns EXIT_SUCCESS,
+	// or EXIT_FAILURE with Result.Error set.
+	int ProcessStack(const uint8_t *V, const int Dim[3], const _mitoParameters &Parameters, _mitoResult &Result);
+	int ProcessStack(const uint16_t *V, const int Dim[3], const _mitoParameters &Parameters, _mitoResult &Result);
+
+#endif
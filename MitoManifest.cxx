@@ -0,0 +1,98 @@
+// ==================================================================
+// MitoGraph: Quantifying Mitochondrial Content in Living Cells
+// Run manifest of a folder, read back by -resume.
+// ==================================================================
+
+#include <vector>
+#include <cstring>
+#include "MitoManifest.h"
+
+uint64_t MitoHash(const void *Data, size_t n, uint64_t h) {
+    const unsigned char *p = (const unsigned char*)Data;
+    for (size_t i = 0; i < n; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+bool MitoHashFile(const std::string &FileName, uint64_t &h) {
+    FILE *fin = fopen(FileName.c_str(),"rb");
+    if (!fin) return false;
+    std::vector<unsigned char> Buffer(1<<20);
+    size_t n;
+    h = MITO_HASH_SEED;
+    while ((n = fread(&Buffer[0],1,Buffer.size(),fin)) > 0) h = MitoHash(&Buffer[0],n,h);
+    bool valid = !ferror(fin);
+    fclose(fin);
+    return valid;
+}
+
+_mitoManifest::_mitoManifest() : f(NULL) {
+}
+
+_mitoManifest::~_mitoManifest() {
+    if (f) fclose(f);
+}
+
+bool _mitoManifest::Open(const std::string &FileName) {
+
+    bool exists = Read(FileName);
+
+    f = fopen(FileName.c_str(),"a");
+    if (!f) return false;
+    if (!exists) fprintf(f,"# MitoGraph manifest: status input_hash parameter_fingerprint file\n");
+    fflush(f);
+    return true;
+}
+
+bool _mitoManifest::Read(const std::string &FileName) {
+
+    // Lines are "status input parameters name", the hashes in hex. The
+    // name is last so that it may hold spaces.
+    FILE *fin = fopen(FileName.c_str(),"r");
+    if (!fin) return false;
+    char line[4096], status[16];
+    unsigned long long input, parameters;
+    int offset;
+    while (fgets(line,sizeof(line),fin)) {
+        if (line[0] == '#') continue;
+        if (sscanf(line,"%15s %llx %llx %n",status,&input,&parameters,&offset) != 3) continue;
+        std::string Name(line+offset);
+        while (!Name.empty() && (Name[Name.size()-1] == '\n' || Name[Name.size()-1] == '\r')) Name.erase(Name.size()-1);
+        _entry Entry;
+        Entry.Status = status;
+        Entry.input = input;
+        Entry.parameters = parameters;
+        Last[Name] = Entry;
+    }
+    fclose(fin);
+    return true;
+}
+
+void _mitoManifest::GetDone(std::vector<std::string> &Names) {
+    std::lock_guard<std::mutex> lock(Mutex);
+    std::map<std::string,_entry>::const_iterator it;
+    for (it = Last.begin(); it != Last.end(); it++) {
+        if (it->second.Status == "done") Names.push_back(it->first);
+    }
+}
+
+bool _mitoManifest::IsDone(const std::string &Name, uint64_t input, uint64_t parameters) {
+    std::lock_guard<std::mutex> lock(Mutex);
+    std::map<std::string,_entry>::const_iterator it = Last.find(Name);
+    return it != Last.end() && it->second.Status == "done" && it->second.input == input && it->second.parameters == parameters;
+}
+
+void _mitoManifest::Record(const std::string &Name, const char *status, uint64_t input, uint64_t parameters) {
+    std::lock_guard<std::mutex> lock(Mutex);
+    _entry Entry;
+    Entry.Status = status;
+    Entry.input = input;
+    Entry.parameters = parameters;
+    Last[Name] = Entry;
+    if (f) {
+        fprintf(f,"%s %016llx %016llx %s\n",status,(unsigned long long)input,(unsigned long long)parameters,Name.c_str());
+        fflush(f);
+    }
+}
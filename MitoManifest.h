@@ -0,0 +1,70 @@
+#ifndef MITOMANIFEST_H
+#define MITOMANIFEST_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+
+	//===========================================================================
+	//
+	//   Run manifest of a folder (mitograph.manifest, next to
+	//   mitograph.config). Each file of a run appends a "started" line
+	//   when it begins and a "done" line once all its outputs are
+	//   written. Both lines carry the hash of the input stack and the
+	//   fingerprint of the parameters. The last line of a file wins, so a
+	//   file whose processing was interrupted is never taken for done.
+	//   Lines are flushed as they are written and survive the run being
+	//   killed. -resume skips the files whose last line is done with the
+	//   same input and parameters. Like the rest of the kernels it does
+	//   not depend on VTK.
+	//
+	//===========================================================================
+
+	#define MITO_HASH_SEED 14695981039346656037ULL
+
+	// 64-bit FNV-1a hash of n bytes, continued from h
+	uint64_t MitoHash(const void *Data, size_t n, uint64_t h = MITO_HASH_SEED);
+
+	// Hash of the contents of the file FileName. Returns false if the
+	// file cannot be read.
+	bool MitoHashFile(const std::string &FileName, uint64_t &h);
+
+	struct _mitoManifest {
+
+		_mitoManifest();
+		~_mitoManifest();
+
+		// Reads the lines already in FileName, if any, and opens it to
+		// append the new ones. Returns false if it cannot be written.
+		bool Open(const std::string &FileName);
+
+		// Only reads the lines of FileName. Returns false if it cannot
+		// be read.
+		bool Read(const std::string &FileName);
+
+		// Names whose last line is done, in alphabetical order
+		void GetDone(std::vector<std::string> &Names);
+
+		// Whether the last line of Name is done with the same hashes
+		bool IsDone(const std::string &Name, uint64_t input, uint64_t parameters);
+
+		// Appends a line for Name. Can be called from several threads.
+		void Record(const std::string &Name, const char *status, uint64_t input, uint64_t parameters);
+
+	  private:
+
+		struct _entry {
+			std::string Status;
+			uint64_t input;
+			uint64_t parameters;
+		};
+
+		std::mutex Mutex;
+		std::map<std::string,_entry> Last;
+		FILE *f;
+	};
+
+#endif
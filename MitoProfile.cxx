@@ -0,0 +1,169 @@
+// ==================================================================
+// MitoGraph: Quantifying Mitochondrial Content in Living Cells
+// Per-stage timing and peak memory of the processing of a file.
+// ==================================================================
+
+#include <cstdio>
+#include <ctime>
+#include <chrono>
+#include "MitoProfile.h"
+
+#ifndef _WIN32
+    #include <sys/time.h>
+    #include <sys/resource.h>
+#endif
+
+static double GetWallTime() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double GetCpuTime() {
+    #if defined(_WIN32) || !defined(CLOCK_PROCESS_CPUTIME_ID)
+        return (double)std::clock() / CLOCKS_PER_SEC;
+    #else
+        struct timespec t;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID,&t);
+        return t.tv_sec + 1E-9 * t.tv_nsec;
+    #endif
+}
+
+// High-water mark of the resident set in kB, 0 when unknown.
+static long GetPeakRSS() {
+    #ifdef _WIN32
+        return 0;
+    #else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF,&usage)) return 0;
+        #ifdef __APPLE__
+            return (long)(usage.ru_maxrss / 1024);
+        #else
+            return (long)usage.ru_maxrss;
+        #endif
+    #endif
+}
+
+// Writes Text as a JSON string literal.
+static void WriteJSONString(FILE *f, const std::string &Text) {
+    fputc('"',f);
+    for (size_t i = 0; i < Text.size(); i++) {
+        unsigned char c = (unsigned char)Text[i];
+        if (c == '"' || c == '\\') {
+            fprintf(f,"\\%c",c);
+        } else if (c < 0x20) {
+            fprintf(f,"\\u%04x",c);
+        } else {
+            fputc(c,f);
+        }
+    }
+    fputc('"',f);
+}
+
+// Writes Text as a CSV field, quoted when needed.
+static void WriteCSVField(FILE *f, const std::string &Text) {
+    if (Text.find_first_of(",\"\n") == std::string::npos) {
+        fputs(Text.c_str(),f);
+        return;
+    }
+    fputc('"',f);
+    for (size_t i = 0; i < Text.size(); i++) {
+        if (Text[i] == '"') fputc('"',f);
+        fputc(Text[i],f);
+    }
+    fputc('"',f);
+}
+
+_mitoProfile::_mitoProfile() : Depth(0) {
+}
+
+size_t _mitoProfile::Begin(const std::string &Name) {
+    _stage S;
+    S.Name = Name;
+    S.Depth = Depth++;
+    S.Wall = S.Cpu = 0.0;
+    S.PeakRSS = 0;
+    S.Count = -1;
+    Stages.push_back(S);
+    WallStart.push_back(GetWallTime());
+    CpuStart.push_back(GetCpuTime());
+    return Stages.size() - 1;
+}
+
+void _mitoProfile::End(size_t stage, long long count) {
+    _stage &S = Stages[stage];
+    S.Wall = GetWallTime() - WallStart[stage];
+    S.Cpu = GetCpuTime() - CpuStart[stage];
+    S.PeakRSS = GetPeakRSS();
+    S.Count = count;
+    Depth--;
+}
+
+void _mitoProfile::AddCounter(const std::string &Name, long long value) {
+    _counter C = {Name, value};
+    Counters.push_back(C);
+}
+
+bool _mitoProfile::Save(const std::string &FileName) const {
+
+    size_t i;
+    size_t slash = FileName.find_last_of("/\\");
+    std::string Name = (slash == std::string::npos) ? FileName : FileName.substr(slash+1);
+
+    FILE *f = fopen((FileName+".profile.json").c_str(),"w");
+    if (!f) return false;
+    fprintf(f,"{\n  \"file\": ");
+    WriteJSONString(f,Name);
+    fprintf(f,",\n  \"peak_rss_kb\": %ld,\n  \"stages\": [",GetPeakRSS());
+    for (i = 0; i < Stages.size(); i++) {
+        const _stage &S = Stages[i];
+        fprintf(f,"%s\n    {\"name\": ",(i) ? "," : "");
+        WriteJSONString(f,S.Name);
+        fprintf(f,", \"depth\": %d, \"wall_s\": %1.6f, \"cpu_s\": %1.6f, \"peak_rss_kb\": %ld, \"count\": %lld}",S.Depth,S.Wall,S.Cpu,S.PeakRSS,S.Count);
+    }
+    fprintf(f,"\n  ],\n  \"counters\": [");
+    for (i = 0; i < Counters.size(); i++) {
+        fprintf(f,"%s\n    {\"name\": ",(i) ? "," : "");
+        WriteJSONString(f,Counters[i].Name);
+        fprintf(f,", \"value\": %lld}",Counters[i].Value);
+    }
+    fprintf(f,"\n  ]\n}\n");
+    fclose(f);
+
+    // One row per stage or counter, so the files of a whole batch can
+    // be concatenated and loaded as a single table.
+    f = fopen((FileName+".profile.csv").c_str(),"w");
+    if (!f) return false;
+    fprintf(f,"file,kind,name,depth,wall_s,cpu_s,peak_rss_kb,count\n");
+    for (i = 0; i < Stages.size(); i++) {
+        const _stage &S = Stages[i];
+        WriteCSVField(f,Name);
+        fprintf(f,",stage,");
+        WriteCSVField(f,S.Name);
+        fprintf(f,",%d,%1.6f,%1.6f,%ld,%lld\n",S.Depth,S.Wall,S.Cpu,S.PeakRSS,S.Count);
+    }
+    for (i = 0; i < Counters.size(); i++) {
+        WriteCSVField(f,Name);
+        fprintf(f,",counter,");
+        WriteCSVField(f,Counters[i].Name);
+        fprintf(f,",,,,,%lld\n",Counters[i].Value);
+    }
+    fclose(f);
+
+    return true;
+}
+
+_mitoStageTimer::_mitoStageTimer(_mitoProfile *Profile, const char *Name, long long count) : Profile(Profile), stage(0), count(count) {
+    if (Profile) stage = Profile -> Begin(Name);
+}
+
+_mitoStageTimer::~_mitoStageTimer() {
+    Stop();
+}
+
+void _mitoStageTimer::SetCount(long long count) {
+    this -> count = count;
+}
+
+void _mitoStageTimer::Stop() {
+    if (Profile) Profile -> End(stage,count);
+    Profile = NULL;
+}
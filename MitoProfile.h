@@ -0,0 +1,79 @@
+#ifndef MITOPROFILE_H
+#define MITOPROFILE_H
+
+#include <string>
+#include <vector>
+
+	//===========================================================================
+	//
+	//   Per-stage instrumentation enabled with -profile. Each file being
+	//   processed owns a _mitoProfile that records, for every stage, the wall
+	//   time, the CPU time of the process, the high-water mark of the resident
+	//   set and the number of voxels or points the stage worked on. Named
+	//   counters hold values that are not tied to a stage, such as the
+	//   deletions of each thinning iteration. CPU time and peak memory are
+	//   process-wide, so with -jobs they include the other files in flight.
+	//   Like the rest of the kernels it does not depend on VTK.
+	//
+	//===========================================================================
+
+	struct _mitoProfile {
+
+		struct _stage {
+			std::string Name;
+			int Depth;          // number of enclosing stages
+			double Wall;        // seconds
+			double Cpu;         // seconds of CPU time of the process
+			long PeakRSS;       // resident set high-water mark at the end (kB)
+			long long Count;    // voxels or points processed, -1 if unknown
+		};
+
+		struct _counter {
+			std::string Name;
+			long long Value;
+		};
+
+		std::vector<_stage> Stages;
+		std::vector<_counter> Counters;
+
+		_mitoProfile();
+
+		// Starts a stage nested in the stages currently open and returns
+		// its index, which is passed to End.
+		size_t Begin(const std::string &Name);
+		void End(size_t stage, long long count = -1);
+
+		void AddCounter(const std::string &Name, long long value);
+
+		// Writes FileName.profile.json and FileName.profile.csv. Returns
+		// false if either file cannot be created.
+		bool Save(const std::string &FileName) const;
+
+	  private:
+
+		int Depth;
+		std::vector<double> WallStart;
+		std::vector<double> CpuStart;
+	};
+
+	// Times the enclosing scope as a stage of Profile. Stop ends the
+	// stage early; nothing is recorded when Profile is NULL.
+	struct _mitoStageTimer {
+
+		_mitoStageTimer(_mitoProfile *Profile, const char *Name, long long count = -1);
+		~_mitoStageTimer();
+
+		void SetCount(long long count);
+		void Stop();
+
+	  private:
+
+		_mitoProfile *Profile;
+		size_t stage;
+		long long count;
+
+		_mitoStageTimer(const _mitoStageTimer&);
+		_mitoStageTimer &operator=(const _mitoStageTimer&);
+	};
+
+#endif
@@ -0,0 +1,293 @@
+// ==================================================================
+// MitoGraph: Quantifying Mitochondrial Content in Living Cells
+// Memory-mapped reader for uncompressed TIFF and BigTIFF stacks.
+// ==================================================================
+
+#include <cstdlib>
+#include <cstring>
+#include "MitoStack.h"
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+// TIFF tags used by the reader
+#define TIFF_NEWSUBFILETYPE     254
+#define TIFF_IMAGEWIDTH         256
+#define TIFF_IMAGELENGTH        257
+#define TIFF_BITSPERSAMPLE      258
+#define TIFF_COMPRESSION        259
+#define TIFF_IMAGEDESCRIPTION   270
+#define TIFF_STRIPOFFSETS       273
+#define TIFF_ORIENTATION        274
+#define TIFF_SAMPLESPERPIXEL    277
+#define TIFF_ROWSPERSTRIP       278
+#define TIFF_STRIPBYTECOUNTS    279
+#define TIFF_TILEWIDTH          322
+#define TIFF_SAMPLEFORMAT       339
+
+static inline bool HostIsLittleEndian() {
+    const unsigned short one = 1;
+    return *(const unsigned char*)&one == 1;
+}
+
+// Size in bytes of the TIFF field types, 0 for the unsupported ones.
+static inline int GetTypeSize(unsigned long long type) {
+    switch (type) {
+        case 1: case 2: case 6: case 7: return 1;   // BYTE, ASCII, SBYTE, UNDEFINED
+        case 3: case 8: return 2;                   // SHORT, SSHORT
+        case 4: case 9: case 13: return 4;          // LONG, SLONG, IFD
+        case 16: case 17: case 18: return 8;        // LONG8, SLONG8, IFD8
+        default: return 0;
+    }
+}
+
+_mitoStack::_mitoStack() : BitsPerSample(0), Frames(0), Map(NULL), MapSize(0), LittleEndian(true), Swap(false), BigTIFF(false) {
+    Dim[0] = Dim[1] = Dim[2] = 0;
+}
+
+_mitoStack::~_mitoStack() {
+    Close();
+}
+
+void _mitoStack::Close() {
+    #ifndef _WIN32
+        if (Map) munmap((void*)Map,MapSize);
+    #endif
+    Map = NULL;
+    MapSize = 0;
+    Planes.clear();
+    Dim[0] = Dim[1] = Dim[2] = 0;
+    Frames = 0;
+}
+
+unsigned long long _mitoStack::GetUInt(size_t pos, int nbytes) const {
+    unsigned long long v = 0;
+    for (int i = 0; i < nbytes; i++) {
+        unsigned long long b = Map[pos + (LittleEndian ? i : nbytes-1-i)];
+        v |= b << (8*i);
+    }
+    return v;
+}
+
+// k-th value of the IFD entry starting at entry. Values that fit in
+// the entry are stored in place, the others at the offset it holds.
+unsigned long long _mitoStack::GetTagValue(size_t entry, size_t k) const {
+    const int wsize = (BigTIFF) ? 8 : 4;
+    unsigned long long type = GetUInt(entry+2,2);
+    unsigned long long count = GetUInt(entry+4,wsize);
+    int tsize = GetTypeSize(type);
+    size_t pos = entry + 4 + wsize;
+    if (count*tsize > (unsigned long long)wsize) {
+        pos = (size_t)GetUInt(pos,wsize);
+    }
+    pos += k*tsize;
+    if (!tsize || k >= count || pos + tsize > MapSize) return 0;
+    return GetUInt(pos,tsize);
+}
+
+bool _mitoStack::ReadDirectory(unsigned long long pos, _plane &P, unsigned long long &next, std::string &Description) {
+
+    const int wsize = (BigTIFF) ? 8 : 4;
+    const int csize = (BigTIFF) ? 8 : 2;
+    const int esize = (BigTIFF) ? 20 : 12;
+
+    if (pos + csize > MapSize) return false;
+    unsigned long long n = GetUInt((size_t)pos,csize);
+    size_t first = (size_t)pos + csize;
+    if (first + n*esize + wsize > MapSize) return false;
+
+    unsigned long long width = 0, height = 0, bits = 1, compression = 1, spp = 1;
+    unsigned long long rps = 0xFFFFFFFFULL, orientation = 1, format = 1, subfile = 0;
+    size_t offsets = 0, counts = 0;
+    unsigned long long noffsets = 0, ncounts = 0;
+
+    for (unsigned long long e = 0; e < n; e++) {
+        size_t entry = first + e*esize;
+        unsigned long long tag = GetUInt(entry,2);
+        unsigned long long count = GetUInt(entry+4,wsize);
+        switch (tag) {
+            case TIFF_NEWSUBFILETYPE: subfile = GetTagValue(entry,0); break;
+            case TIFF_IMAGEWIDTH: width = GetTagValue(entry,0); break;
+            case TIFF_IMAGELENGTH: height = GetTagValue(entry,0); break;
+            case TIFF_BITSPERSAMPLE: bits = GetTagValue(entry,0); break;
+            case TIFF_COMPRESSION: compression = GetTagValue(entry,0); break;
+            case TIFF_ORIENTATION: orientation = GetTagValue(entry,0); break;
+            case TIFF_SAMPLESPERPIXEL: spp = GetTagValue(entry,0); break;
+            case TIFF_ROWSPERSTRIP: rps = GetTagValue(entry,0); break;
+            case TIFF_SAMPLEFORMAT: format = GetTagValue(entry,0); break;
+            case TIFF_TILEWIDTH: return false;
+            case TIFF_STRIPOFFSETS: offsets = entry; noffsets = count; break;
+            case TIFF_STRIPBYTECOUNTS: counts = entry; ncounts = count; break;
+            case TIFF_IMAGEDESCRIPTION:
+                if (Description.empty() && count > 1 && count < MapSize) {
+                    Description.resize((size_t)count-1);
+                    for (size_t k = 0; k < count-1; k++) Description[k] = (char)GetTagValue(entry,k);
+                }
+                break;
+        }
+    }
+
+    next = GetUInt(first + n*esize,wsize);
+
+    // Reduced-resolution copies and masks are not planes of the stack
+    if (subfile & 5) return false;
+
+    if (compression != 1 || spp != 1 || format != 1 || orientation != 1) return false;
+    if ((bits != 8 && bits != 16) || !width || !height || !offsets || !counts) return false;
+    if (width > 0x7FFFFFFF || height > 0x7FFFFFFF) return false;
+
+    if (Planes.empty()) {
+        Dim[0] = (int)width;
+        Dim[1] = (int)height;
+        BitsPerSample = (int)bits;
+    } else if (width != (unsigned long long)Dim[0] || height != (unsigned long long)Dim[1] || bits != (unsigned long long)BitsPerSample) {
+        return false;
+    }
+
+    if (rps > height) rps = height;
+    if (!rps) return false;
+    unsigned long long nstrips = (height + rps - 1) / rps;
+    if (noffsets != nstrips || ncounts != nstrips) return false;
+
+    // Every row of every strip must be inside the file
+    const unsigned long long rowbytes = width * bits / 8;
+    P.RowsPerStrip = rps;
+    P.Offset.resize((size_t)nstrips);
+    for (unsigned long long s = 0; s < nstrips; s++) {
+        unsigned long long rows = (s == nstrips-1) ? height - s*rps : rps;
+        P.Offset[s] = GetTagValue(offsets,s);
+        if (GetTagValue(counts,s) < rows*rowbytes) return false;
+        if (P.Offset[s] + rows*rowbytes > MapSize) return false;
+    }
+
+    return true;
+}
+
+bool _mitoStack::Open(const std::string &FileName) {
+
+    Close();
+
+    #ifdef _WIN32
+        return false;
+    #else
+        int fd = open(FileName.c_str(),O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd,&st) || st.st_size < 16) {
+            close(fd);
+            return false;
+        }
+        void *ptr = mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+        close(fd);
+        if (ptr == MAP_FAILED) return false;
+        Map = (const unsigned char*)ptr;
+        MapSize = (size_t)st.st_size;
+        #ifdef MADV_SEQUENTIAL
+            madvise(ptr,MapSize,MADV_SEQUENTIAL);
+        #endif
+    #endif
+
+    if (Map[0] == 'I' && Map[1] == 'I') {
+        LittleEndian = true;
+    } else if (Map[0] == 'M' && Map[1] == 'M') {
+        LittleEndian = false;
+    } else {
+        Close();
+        return false;
+    }
+    Swap = (LittleEndian != HostIsLittleEndian());
+
+    unsigned long long ifd, magic = GetUInt(2,2);
+    if (magic == 42) {
+        BigTIFF = false;
+        ifd = GetUInt(4,4);
+    } else if (magic == 43 && GetUInt(4,2) == 8) {
+        BigTIFF = true;
+        ifd = GetUInt(8,8);
+    } else {
+        Close();
+        return false;
+    }
+
+    // A directory is at least a few bytes long, which bounds the number
+    // of pages and protects against IFD chains that loop.
+    std::string Description;
+    size_t maxpages = MapSize / 8;
+    while (ifd && Planes.size() < maxpages) {
+        _plane P;
+        unsigned long long next;
+        if (!ReadDirectory(ifd,P,next,Description)) {
+            Close();
+            return false;
+        }
+        Planes.push_back(P);
+        ifd = next;
+    }
+
+    // ImageJ writes stacks over 4 GB as one directory followed by
+    // all the planes back to back.
+    size_t pos = Description.find("images=");
+    if (Planes.size() == 1 && !Description.compare(0,7,"ImageJ=") && pos != std::string::npos) {
+        unsigned long long nimages = strtoull(Description.c_str()+pos+7,NULL,10);
+        const unsigned long long rowbytes = (unsigned long long)Dim[0] * BitsPerSample / 8;
+        const unsigned long long planebytes = rowbytes * Dim[1];
+        _plane First = Planes[0];
+        bool contiguous = true;
+        for (size_t s = 1; s < First.Offset.size(); s++) {
+            contiguous &= (First.Offset[s] == First.Offset[s-1] + First.RowsPerStrip*rowbytes);
+        }
+        if (nimages > 1 && contiguous && First.Offset[0] + nimages*planebytes <= MapSize) {
+            Planes.resize((size_t)nimages);
+            for (size_t z = 0; z < Planes.size(); z++) {
+                Planes[z].RowsPerStrip = (unsigned long long)Dim[1];
+                Planes[z].Offset.assign(1,First.Offset[0] + z*planebytes);
+            }
+        }
+    }
+
+    if (Planes.empty() || Planes.size() > 0x7FFFFFFF) {
+        Close();
+        return false;
+    }
+    Dim[2] = (int)Planes.size();
+
+    // ImageJ stores hyperstacks with the planes of each time point
+    // next to each other
+    Frames = 1;
+    pos = Description.find("frames=");
+    if (!Description.compare(0,7,"ImageJ=") && pos != std::string::npos) {
+        unsigned long long nframes = strtoull(Description.c_str()+pos+7,NULL,10);
+        if (nframes > 1 && Dim[2] % nframes == 0) Frames = (int)nframes;
+    }
+
+    return true;
+}
+
+void _mitoStack::ReadPlanes(int z0, int z1, void *Buffer) const {
+
+    const size_t bps = (size_t)BitsPerSample / 8;
+    const size_t rowbytes = (size_t)Dim[0] * bps;
+    const size_t planebytes = rowbytes * Dim[1];
+
+    #pragma omp parallel for schedule(static)
+    for (int z = z0; z <= z1; z++) {
+        const _plane &P = Planes[z];
+        unsigned char *Plane = (unsigned char*)Buffer + (size_t)(z-z0)*planebytes;
+        for (int r = 0; r < Dim[1]; r++) {
+            unsigned long long s = r / P.RowsPerStrip;
+            const unsigned char *Src = Map + P.Offset[s] + (r - s*P.RowsPerStrip)*rowbytes;
+            unsigned char *Dst = Plane + (size_t)(Dim[1]-1-r)*rowbytes;
+            memcpy(Dst,Src,rowbytes);
+            if (Swap && bps == 2) {
+                for (size_t i = 0; i < rowbytes; i += 2) {
+                    unsigned char t = Dst[i]; Dst[i] = Dst[i+1]; Dst[i+1] = t;
+                }
+            }
+        }
+    }
+
+}
@@ -0,0 +1,78 @@
+#ifndef MITOSTACK_H
+#define MITOSTACK_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+class vtkImageData;
+template <class T> class vtkSmartPointer;
+
+	//===========================================================================
+	//
+	//   Memory-mapped reader for uncompressed TIFF and BigTIFF stacks. The file
+	//   is mapped once and planes are decoded only when they are requested,
+	//   so pages that are never touched are never read from disk. Supports a
+	//   single 8 or 16-bit unsigned sample per pixel stored in strips, in
+	//   either byte order, including the ImageJ layout for stacks over 4 GB
+	//   (one IFD followed by the contiguous planes). Anything else, such as
+	//   compressed or tiled files, is rejected by Open so that the caller can
+	//   fall back to vtkTIFFReader. Like the rest of the kernels it does not
+	//   depend on VTK.
+	//
+	//===========================================================================
+
+	struct _mitoStack {
+
+		int Dim[3];
+		int BitsPerSample;
+
+		// Time points of an ImageJ hyperstack, from the frames= entry of
+		// its description: the Dim[2] planes are then Frames frames of
+		// Dim[2]/Frames planes each. 1 for any other stack.
+		int Frames;
+
+		_mitoStack();
+		~_mitoStack();
+
+		// Maps FileName and reads the directory of every page. Returns
+		// false when the file cannot be mapped or is not supported.
+		bool Open(const std::string &FileName);
+		void Close();
+
+		// Copies the planes [z0,z1] into Buffer, which must hold
+		// Dim[0]*Dim[1]*(z1-z0+1) samples of BitsPerSample bits, in
+		// host byte order. Rows are stored bottom-up, i.e. the first row
+		// of the file goes to y = Dim[1]-1, as vtkTIFFReader does for
+		// top-left TIFF files.
+		void ReadPlanes(int z0, int z1, void *Buffer) const;
+
+	  private:
+
+		// Strips of one plane: file offset and rows per strip.
+		struct _plane {
+			std::vector<unsigned long long> Offset;
+			unsigned long long RowsPerStrip;
+		};
+
+		const unsigned char *Map;
+		size_t MapSize;
+		bool LittleEndian;
+		bool Swap;
+		bool BigTIFF;
+		std::vector<_plane> Planes;
+
+		unsigned long long GetUInt(size_t pos, int nbytes) const;
+		unsigned long long GetTagValue(size_t entry, size_t k) const;
+		bool ReadDirectory(unsigned long long pos, _plane &P, unsigned long long &next, std::string &Description);
+
+		_mitoStack(const _mitoStack&);
+		_mitoStack &operator=(const _mitoStack&);
+	};
+
+	// Copies the planes [z0,z1] of Stack into a new 8 or 16-bit
+	// ImageData with unit spacing and origin at zero. Defined with the
+	// VTK code of MitoGraph.cxx, for MitoGraph and the tools.
+	vtkSmartPointer<vtkImageData> ReadMappedStack(const _mitoStack &Stack, int z0, int z1);
+
+#endif
@@ -13,8 +13,9 @@
     int ssdz[26] = { 1, 1, 1, 0, 0, 0,-1,-1,-1, 1, 1, 1, 0, 0,-1,-1,-1, 1, 1, 1, 0, 0, 0,-1,-1,-1};
 
 // Routine used to save .gnet and .coo files representing
-// the skeleton of the mitochondrial network.
-void ExportGraphFiles(vtkSmartPointer<vtkPolyData> PolyData, long int nnodes, const char Prefix[]);
+// the skeleton of the mitochondrial network. The graph is also
+// added to the .mgb columns and to the in-memory graph of -analyze.
+void ExportGraphFiles(vtkSmartPointer<vtkPolyData> PolyData, long int nnodes, long int *ValidId, _mitoObject *mitoObject);
 
 // Routine to create the file _nodes.vtk. This file contains
 // little speres located at the junctions (nodes) coordinates
@@ -34,70 +35,58 @@ void SmoothEdgesCoordinates(vtkSmartPointer<vtkPolyData> PolyData, double sigma)
 
 // Estimate the mitochondrial volume by counting the number of
 // pixels in the binary image used as input for thinning.
-void GetVolumeFromVoxels(vtkSmartPointer<vtkImageData> Image, std::vector<attribute> *Atts);
+void GetVolumeFromVoxels(vtkSmartPointer<vtkImageData> Image, _mitoObject *mitoObject);
 
 // Estimate the mitochondrial volume by using the skeleton
 // total length and assuming constant radius.
-//void GetVolumeFromSkeletonLength(vtkSmartPointer<vtkPolyData> PolyData, double *attributes);
+//void GetVolumeFromSkeletonLength(vtkSmartPointer<vtkPolyData> PolyData, double *attributes, _mitoObject *mitoObject);
 
 // Calculate the length of a given edge.
-//double GetEdgeLength(vtkIdType edge, vtkSmartPointer<vtkPolyData> PolyData);
+//double GetEdgeLength(vtkIdType edge, vtkSmartPointer<vtkPolyData> PolyData, _mitoObject *mitoObject);
 
-// Returns the number of voxels around the voxel (x,y,z) with
-// value given different of "value".
-char GetNumberOfNeighborsWithoutValue(vtkSmartPointer<vtkImageData> Image, int x, int y, int z, long int value);
+// Returns the number of the 26 neighbors of voxel id that are
+// different of "value" in Mask. Offset holds the offsets of the
+// 26 neighbors in the flat arrays.
+char GetNumberOfNeighborsWithoutValue(const unsigned char *Mask, const vtkIdType *Offset, vtkIdType id, unsigned char value);
 
-// Returns the number of voxels around the voxel (x,y,z) with
-// value different of "value" in the vector "Volume".
-char GetNumberOfNeighborsWithoutValue(vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkTypeInt64Array> Volume, int x, int y, int z, long int value);
-
-// Returns the number of voxels around the voxel (x,y,z) with
-// value given by "value".
-char GetNumberOfNeighborsWithValue(vtkSmartPointer<vtkImageData> Image, int x, int y, int z, long int value);
-
-// Returns the number of voxels around the voxel (x,y,z) with
-// value "value" in the vector "Volume".
-char GetNumberOfNeighborsWithValue(vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkTypeInt64Array> Volume, int x, int y, int z, long int value);
+// Returns one neighbor of voxel id with value different of
+// "value" in Mask.
+vtkIdType GetOneNeighborWithoutValue(const unsigned char *Mask, const vtkIdType *Offset, vtkIdType id, unsigned char value);
 
-// Returns one neighbor of (x,y,z) with value "value" in the
+// Returns one neighbor of voxel id with value "value" in the
 // vector "Volume".
-vtkIdType GetOneNeighborWithValue(int x, int y, int z, vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkTypeInt64Array> Volume, long int value);
+vtkIdType GetOneNeighborWithValue(const long int *Volume, const vtkIdType *Offset, vtkIdType id, long int value);
 
-// Returns one neighbor of (x,y,z) with value different of
-// "value" in the vector "Volume".
-vtkIdType GetOneNeighborWithoutValue(int x, int y, int z, vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkTypeInt64Array> Volume, long int value);
-
-// Returns one neighbor of (x,y,z) with value different of
-// "value".
-vtkIdType GetOneNeighborWithoutValue(int x, int y, int z, vtkSmartPointer<vtkImageData> Image, long int value);
-
-// Merge together junctions that touch each other.
-bool JunctionsMerge(std::list<vtkIdType> Junctions, vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkTypeInt64Array> Volume);
+// Returns one neighbor of voxel id that is not empty and has a
+// value different of "value" in the vector "Volume".
+vtkIdType GetOneNeighborWithoutValue(const long int *Volume, const vtkIdType *Offset, vtkIdType id, long int value);
 
-// Track an edge starting at voxel (x,y,z) in the volume "Volume".
-std::list<vtkIdType> GetEdgeStartingAt(int x, int y, int z, vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkTypeInt64Array> Volume);
+// Merge together junctions that touch each other. Junction voxels
+// carry labels 1 to Junctions.size() in Volume and are relabeled
+// with the node they belong to, from 1 to the number of nodes. Each
+// node takes the smallest label of its voxels and nodes are numbered
+// in increasing order of that label. Returns the number of nodes.
+long int JunctionsMerge(const std::vector<vtkIdType> &Junctions, long int *Volume, const vtkIdType *Offset);
 
-// Returns an adjacency edge "edge_label".
-long int GetOneAdjacentEdge(vtkSmartPointer<vtkPolyData> PolyData, long int edge_label, long int junction_label, bool *found_on_left);
+// Track an edge starting at voxel id in the volume "Volume". The
+// voxels of the edge are appended to Edge and cleared in Volume.
+void GetEdgeStartingAt(vtkIdType id, long int *Volume, const vtkIdType *Offset, std::vector<vtkIdType> &Edge);
 
 // Track all the nodes and edges of a 3D structured thinned by
 // the routine Thinning3D.
 vtkSmartPointer<vtkPolyData> Skeletonization(vtkSmartPointer<vtkImageData> Image, _mitoObject *mitoObject);
 
-// Replace two edges A and B attached to a node of degree 2
-// with one edge C that corresponds to A + B. The degree of the
-// node is set to -1 and A and B are moreved from PolyData.
-bool MergeEdgesOfDegree2Nodes(vtkSmartPointer<vtkPolyData> PolyData, long int nedges_before_filtering, int *K);
-
-// After merging edges attached to nodes of degree 2, the original
-// edges must be deleted throught this routine.
-void RemoveCellsWithInvalidNodes(vtkSmartPointer<vtkPolyData> PolyData, int *K);
+// Replace every chain of edges attached through nodes of degree 2
+// with one edge. Edge e holds the point ids Ids[Start[e]] to
+// Ids[Start[e+1]-1], from source to target. The degree of the merged
+// nodes is set to -1 and the final edges are added to Lines.
+void MergeEdgesOfDegree2Nodes(const std::vector<vtkIdType> &Start, const std::vector<vtkIdType> &Ids, std::vector<int> &K, vtkSmartPointer<vtkCellArray> Lines);
 
 /* ================================================================
    I/O ROUTINES
 =================================================================*/
 
-void SaveImageData(vtkSmartPointer<vtkImageData> Image, const char FileName[], bool _resample) {
+void SaveImageData(vtkSmartPointer<vtkImageData> Image, const char FileName[], bool _resample, double _zscale) {
     #ifdef DEBUG
         printf("Saving ImageData File...\n");
     #endif
@@ -130,7 +119,7 @@ void SaveImageData(vtkSmartPointer<vtkImageData> Image, const char FileName[], b
 
         if (_resample) {
             #ifdef DEBUG
-                printf("\tResampling data...%f\t%f\n",_dxy,_dz);
+                printf("\tResampling data...%f\n",_zscale);
             #endif
             vtkSmartPointer<vtkImageResample> Resample = vtkSmartPointer<vtkImageResample>::New();
             Resample -> SetInterpolationModeToLinear();
@@ -138,7 +127,7 @@ void SaveImageData(vtkSmartPointer<vtkImageData> Image, const char FileName[], b
             Resample -> SetInputData(Image);  // Use original Image instead of Flip->GetOutput()
             Resample -> SetAxisMagnificationFactor(0,1.0);
             Resample -> SetAxisMagnificationFactor(1,1.0);
-            Resample -> SetAxisMagnificationFactor(2,_dz/_dxy);
+            Resample -> SetAxisMagnificationFactor(2,_zscale);
             Resample -> Update();
 
             vtkSmartPointer<vtkImageData> ImageResampled = Resample -> GetOutput();
@@ -183,13 +172,14 @@ void SavePolyData(vtkSmartPointer<vtkPolyData> PolyData, const char FileName[])
     #endif
 }
 
-void ExportGraphFiles(vtkSmartPointer<vtkPolyData> PolyData, long int nnodes, long int *ValidId, const char Prefix[]) {
+void ExportGraphFiles(vtkSmartPointer<vtkPolyData> PolyData, long int nnodes, long int *ValidId, _mitoObject *mitoObject) {
     
     #ifdef DEBUG
         // Debug output removed
     #endif
 
     char _fullpath[256];
+    const char *Prefix = mitoObject->FileName.c_str();
 
     vtkPoints *Points = PolyData -> GetPoints();
 
@@ -199,38 +189,78 @@ void ExportGraphFiles(vtkSmartPointer<vtkPolyData> PolyData, long int nnodes, lo
         if (ValidId[node]>=0) exact_nnodes++;
     }
 
-    sprintf(_fullpath,"%s.coo",Prefix);
-    FILE *fcoo = fopen(_fullpath,"w");
+    // Only the in-memory graph of -analyze is built with -graph_off.
+    // GraphAnalyzer.R reads the text files.
+    bool text = mitoObject->_export_graph_files && (mitoObject->_output_text || mitoObject->_analyze_r);
+    _mitoColumns *Columns = (mitoObject->_export_graph_files) ? mitoObject->Columns : NULL;
+    _mitoGraph *Graph = mitoObject->Graph;
+    std::vector<double> NodeX, NodeY, NodeZ;
+
+    FILE *fcoo = NULL;
+    if (text) {
+        sprintf(_fullpath,"%s.coo",Prefix);
+        fcoo = fopen(_fullpath,"w");
+    }
     for (node = 0; node < nnodes; node++) {
         if (ValidId[node]>=0) {
             Points -> GetPoint(node,r);
-            fprintf(fcoo,"%1.4f\t%1.4f\t%1.4f\n",_dxy*r[0],_dxy*r[1],_dz*r[2]);
+            if (fcoo) fprintf(fcoo,"%1.4f\t%1.4f\t%1.4f\n",mitoObject->_dxy*r[0],mitoObject->_dxy*r[1],mitoObject->_dz*r[2]);
+            if (Columns) {
+                NodeX.push_back(mitoObject->_dxy*r[0]);
+                NodeY.push_back(mitoObject->_dxy*r[1]);
+                NodeZ.push_back(mitoObject->_dz*r[2]);
+            }
         }
     }
-    fclose(fcoo);
+    if (fcoo) fclose(fcoo);
 
     double length;
     vtkIdType edge, npoints, i, j;
-    sprintf(_fullpath,"%s.gnet",Prefix);
-    FILE *fgnet = fopen(_fullpath,"w");
-    fprintf(fgnet,"%ld\n",exact_nnodes);
+    std::vector<int32_t> Source, Target;
+    std::vector<double> Length;
+
+    FILE *fgnet = NULL;
+    if (text) {
+        sprintf(_fullpath,"%s.gnet",Prefix);
+        fgnet = fopen(_fullpath,"w");
+        fprintf(fgnet,"%ld\n",exact_nnodes);
+    }
     for (edge = 0; edge < PolyData -> GetNumberOfCells(); edge++) {
         npoints = PolyData -> GetCell(edge) -> GetNumberOfPoints();
         i = PolyData -> GetCell(edge) -> GetPointId(0);
         j = PolyData -> GetCell(edge) -> GetPointId(npoints-1);
         if ( ValidId[i] >= 0 && ValidId[j] >= 0 ) {
-            length = GetEdgeLength(edge,PolyData);
-            fprintf(fgnet,"%ld\t%ld\t%1.5f\n",ValidId[i],ValidId[j],length);
+            length = GetEdgeLength(edge,PolyData,mitoObject);
+            if (fgnet) fprintf(fgnet,"%ld\t%ld\t%1.5f\n",ValidId[i],ValidId[j],length);
+            if (Columns) {
+                Source.push_back((int32_t)ValidId[i]);
+                Target.push_back((int32_t)ValidId[j]);
+                Length.push_back(length);
+            }
+            if (Graph) {
+                Graph -> Source.push_back(ValidId[i]);
+                Graph -> Target.push_back(ValidId[j]);
+                Graph -> Length.push_back(RoundAsText(length));
+            }
         }
     }
-    fclose(fgnet);
+    if (fgnet) fclose(fgnet);
+
+    if (Columns) {
+        Columns -> Add("node.x",NodeX);
+        Columns -> Add("node.y",NodeY);
+        Columns -> Add("node.z",NodeZ);
+        Columns -> Add("edge.source",Source);
+        Columns -> Add("edge.target",Target);
+        Columns -> Add("edge.length",Length);
+    }
 
 }
 
 void ExportNodes(vtkSmartPointer<vtkPolyData> PolyData, long int nnodes, long int *ValidId, _mitoObject *mitoObject) {
     
     #ifdef DEBUG
-        if (_export_nodes_label) {
+        if (mitoObject->_export_nodes_label) {
             // Debug output removed
         } else {
             // Debug output removed
@@ -253,9 +283,9 @@ void ExportNodes(vtkSmartPointer<vtkPolyData> PolyData, long int nnodes, long in
             #endif
         
             vtkSmartPointer<vtkSphereSource> Node = vtkSmartPointer<vtkSphereSource>::New();
-            if (_scale_polydata_before_save) {
-                Node -> SetRadius(2*_dxy);
-                Node -> SetCenter(_dxy*(r[0]+mitoObject->Ox),_dxy*(r[1]+mitoObject->Oy),_dz*(r[2]+mitoObject->Oz));
+            if (mitoObject->_scale_polydata_before_save) {
+                Node -> SetRadius(2*mitoObject->_dxy);
+                Node -> SetCenter(mitoObject->_dxy*(r[0]+mitoObject->Ox),mitoObject->_dxy*(r[1]+mitoObject->Oy),mitoObject->_dz*(r[2]+mitoObject->Oz));
             } else {
                 Node -> SetRadius(2.0);
                 Node -> SetCenter(r[0]+mitoObject->Ox,r[1]+mitoObject->Oy,r[2]+mitoObject->Oz);
@@ -267,16 +297,16 @@ void ExportNodes(vtkSmartPointer<vtkPolyData> PolyData, long int nnodes, long in
             Append -> AddInputData(Node->GetOutput());
             Append -> Update();
 
-            if (_export_nodes_label) {
+            if (mitoObject->_export_nodes_label) {
                 sprintf(node_txt,"%ld",ValidId[node]);
                 vtkSmartPointer<vtkVectorText> PolyText = vtkSmartPointer<vtkVectorText>::New();
                 PolyText -> SetText(node_txt);
                 PolyText -> Update();
 
                 vtkSmartPointer<vtkTransform> T = vtkSmartPointer<vtkTransform>::New();
-                if (_scale_polydata_before_save) {
-                    T -> Translate(_dxy*(r[0]+1+mitoObject->Ox),_dxy*(r[1]+1+mitoObject->Oy),_dz*(r[2]+mitoObject->Oz));
-                    T -> Scale(2*_dxy,2*_dxy,1);
+                if (mitoObject->_scale_polydata_before_save) {
+                    T -> Translate(mitoObject->_dxy*(r[0]+1+mitoObject->Ox),mitoObject->_dxy*(r[1]+1+mitoObject->Oy),mitoObject->_dz*(r[2]+mitoObject->Oz));
+                    T -> Scale(2*mitoObject->_dxy,2*mitoObject->_dxy,1);
                 } else {
                     T -> Translate(r[0]+2+mitoObject->Ox,r[1]+mitoObject->Oy,r[2]+mitoObject->Oz);
                     T -> Scale(2,2,1);
@@ -381,34 +411,34 @@ void SmoothEdgesCoordinates(vtkSmartPointer<vtkPolyData> PolyData, double sigma)
     PolyData -> Modified();
 }
 
-void GetVolumeFromVoxels(vtkSmartPointer<vtkImageData> Image, std::vector<attribute> *Atts) {
+void GetVolumeFromVoxels(vtkSmartPointer<vtkImageData> Image, _mitoObject *mitoObject) {
     double v;
     unsigned long int nv = 0;
     for (vtkIdType id=Image->GetNumberOfPoints();id--;) {
         v = Image -> GetPointData() -> GetScalars() -> GetTuple1(id);
         if (v) nv++;
     }
-    attribute newAtt = {"Volume from voxels",nv * (_dxy * _dxy * _dz)};
-    Atts -> push_back(newAtt);
+    attribute newAtt = {"Volume from voxels",nv * (mitoObject->_dxy * mitoObject->_dxy * mitoObject->_dz)};
+    mitoObject -> attributes.push_back(newAtt);
 }
 /*
-void GetVolumeFromSkeletonLength(vtkSmartPointer<vtkPolyData> PolyData, double *attributes) {
+void GetVolumeFromSkeletonLength(vtkSmartPointer<vtkPolyData> PolyData, double *attributes, _mitoObject *mitoObject) {
     double r1[3], r2[3], length = 0.0;
     vtkPoints *Points = PolyData -> GetPoints();
     for (vtkIdType edge=PolyData->GetNumberOfCells();edge--;) {
-        length += GetEdgeLength(edge,PolyData);
+        length += GetEdgeLength(edge,PolyData,mitoObject);
     }
     attributes[1] = length;
-    attributes[2] = length * (acos(-1.0)*pow(_rad,2));
+    attributes[2] = length * (acos(-1.0)*pow(mitoObject->_rad,2));
 }
 */
-double GetEdgeLength(vtkIdType edge, vtkSmartPointer<vtkPolyData> PolyData) {
+double GetEdgeLength(vtkIdType edge, vtkSmartPointer<vtkPolyData> PolyData, _mitoObject *mitoObject) {
     double r1[3], r2[3];
     double length = 0.0;
     for (vtkIdType n = 1; n < PolyData->GetCell(edge)->GetNumberOfPoints(); n++) {
         PolyData -> GetPoint(PolyData->GetCell(edge)->GetPointId(n-1),r1);
         PolyData -> GetPoint(PolyData->GetCell(edge)->GetPointId(n  ),r2);
-        length += sqrt(pow(_dxy*(r2[0]-r1[0]),2)+pow(_dxy*(r2[1]-r1[1]),2)+pow(_dz*(r2[2]-r1[2]),2));
+        length += sqrt(pow(mitoObject->_dxy*(r2[0]-r1[0]),2)+pow(mitoObject->_dxy*(r2[1]-r1[1]),2)+pow(mitoObject->_dz*(r2[2]-r1[2]),2));
     }
     return length;
 }
@@ -417,6 +447,15 @@ double GetEdgeLength(vtkIdType edge, vtkSmartPointer<vtkPolyData> PolyData) {
    THINNING 3D
 =================================================================*/
 
+// Thinning state of each voxel, packed in one byte: whether the
+// voxel belongs to the object, whether it is (or is scheduled to
+// be) on the surface and, for each of the six directions, whether
+// its current neighborhood is known not to match the masks.
+#define MITO_THIN_OBJECT  0x01
+#define MITO_THIN_SURFACE 0x02
+#define MITO_THIN_FAIL(d) (0x04 << (d))
+#define MITO_THIN_FAILED  0xFC
+
 vtkSmartPointer<vtkPolyData> Thinning3D(vtkSmartPointer<vtkImageData> ImageData, _mitoObject *mitoObject) {
 
     #ifdef DEBUG
@@ -424,81 +463,139 @@ vtkSmartPointer<vtkPolyData> Thinning3D(vtkSmartPointer<vtkImageData> ImageData,
     #endif
 
     vtkIdType N = ImageData -> GetNumberOfPoints();
-    GetVolumeFromVoxels(ImageData,&mitoObject->attributes);
+    GetVolumeFromVoxels(ImageData,mitoObject);
 
-    int x, y, z;
-    double r[3], v, vl;
+    _mitoStageTimer Timer(mitoObject->Profile,"Thinning3D",N);
+
+    int *Dim = ImageData -> GetDimensions();
     vtkIdType ndels, id;
-    ssThinVox *STV = new ssThinVox();
+    // The 144 masks are generated once and shared by every stack of the
+    // run, including the frames of a time-lapse and the batch workers
+    static ssThinVox STV;
 
     CleanImageBoundaries(ImageData);
 
-    int i, j, ***Vol = new int**[3];
-    for (i = 0; i < 3; i++) {
-        Vol[i] = new int*[3];
-            for (j = 0; j < 3; j++) {
-                Vol[i][j] = new int[3];
-            }
-    }
+    bool _lut = mitoObject->_thinning_lut;
+    if (_lut) ssThinVox::build_lookup_table();
+
+    int i;
+    unsigned int key;
 
     #ifdef DEBUG
         printf("Starting thinning process...\n");
     #endif
 
-    std::list<vtkIdType> ToBeDeleted;
-    std::list<vtkIdType> OnTheSurface;
-    std::list<vtkIdType>::iterator itId;
+    // Offsets of the 26 neighbors and of the 6 face neighbors. The
+    // boundaries of the volume are empty, so the neighbors of object
+    // voxels are always inside.
+    vtkIdType Offset[26];
+    for (i = 26; i--;) Offset[i] = ssdx[i] + ssdy[i]*(vtkIdType)Dim[0] + ssdz[i]*(vtkIdType)Dim[0]*Dim[1];
+    const vtkIdType Face[6] = {1,-1,(vtkIdType)Dim[0],-(vtkIdType)Dim[0],(vtkIdType)Dim[0]*Dim[1],-(vtkIdType)Dim[0]*Dim[1]};
 
-    do {
-        ndels = 0;
-        for (id = N; id--;) {
-            if (IsBorder(id, ImageData)) {
-                OnTheSurface.insert(OnTheSurface.begin(),id);
+    vtkDataArray *Scalars = ImageData -> GetPointData() -> GetScalars();
+    std::vector<unsigned char> State(N,0);
+    for (id = N; id--;) {
+        if (Scalars -> GetTuple1(id)) State[id] = MITO_THIN_OBJECT;
+    }
+
+    // Frontier holds the surface voxels that may still be deleted:
+    // voxels whose neighborhood is known to fail in all directions
+    // are dormant and leave the frontier until a neighbor is deleted.
+    // Voxels that become surface during an iteration wait in Pending
+    // for the next one, as the surface is defined at its beginning.
+    std::vector<vtkIdType> Frontier, Pending, ToBeDeleted;
+    for (id = 0; id < N; id++) {
+        if (State[id] & MITO_THIN_OBJECT) {
+            for (i = 0; i < 6; i++) {
+                if (!(State[id+Face[i]] & MITO_THIN_OBJECT)) {
+                    State[id] |= MITO_THIN_SURFACE;
+                    Frontier.push_back(id);
+                    break;
+                }
             }
         }
+    }
+
+    vtkIdType k, nk, q;
+    int iteration = 0;
+    do {
+        ndels = 0;
 
         for (int direction = 6; direction--;) {
-            for ( itId=OnTheSurface.begin(); itId!=OnTheSurface.end(); itId++) {
-                id = *itId;
-                ImageData -> GetPoint(id,r);
-                x = (int)r[0]; y = (int)r[1]; z = (int)r[2];
-                v = ImageData -> GetScalarComponentAsDouble(x,y,z,0);
-                if (v) {
-                    for (i = 26; i--;) {
-                        vl = ImageData -> GetScalarComponentAsDouble(x+ssdx[i],y+ssdy[i],z+ssdz[i],0);
-                        Vol[1+ssdx[i]][1+ssdy[i]][1+ssdz[i]] = (vl) ? 1 : 0;
+
+            // Deletions are only applied at the end of the sub-iteration,
+            // so the order in which voxels are tested does not matter.
+            for (k = 0, nk = 0; k < (vtkIdType)Frontier.size(); k++) {
+                id = Frontier[k];
+                if (!(State[id] & MITO_THIN_OBJECT)) continue;
+                if (!(State[id] & MITO_THIN_FAIL(direction))) {
+                    // Bit i of the key is the value of the i-th neighbor
+                    for (key = 0, i = 26; i--;) {
+                        key |= (unsigned int)(State[id+Offset[i]] & MITO_THIN_OBJECT) << i;
+                    }
+                    if ( _lut ? ssThinVox::match_lut(direction,key) : STV.match(direction,key) ) {
+                        ToBeDeleted.push_back(id);
+                    } else {
+                        State[id] |= MITO_THIN_FAIL(direction);
                     }
-                    if ( STV -> match(direction,Vol) ) ToBeDeleted.insert(ToBeDeleted.begin(),id);
                 }
+                if ((State[id] & MITO_THIN_FAILED) != MITO_THIN_FAILED) Frontier[nk++] = id;
             }
-            itId = ToBeDeleted.begin();
-            while (itId != ToBeDeleted.end()) {
-                ndels++;
-                ImageData -> GetPoint(*itId,r);
-                x = (int)r[0]; y = (int)r[1]; z = (int)r[2];
-                ImageData -> SetScalarComponentFromDouble(x,y,z,0,0);
-                ToBeDeleted.erase(itId++);
+            Frontier.resize(nk);
+
+            for (k = 0; k < (vtkIdType)ToBeDeleted.size(); k++) {
+                State[ToBeDeleted[k]] &= ~MITO_THIN_OBJECT;
+            }
+            for (k = 0; k < (vtkIdType)ToBeDeleted.size(); k++) {
+                for (i = 26; i--;) {
+                    q = ToBeDeleted[k] + Offset[i];
+                    if (!(State[q] & MITO_THIN_OBJECT)) continue;
+                    if (State[q] & MITO_THIN_SURFACE) {
+                        // The neighborhood of q changed: wake it up if dormant
+                        if ((State[q] & MITO_THIN_FAILED) == MITO_THIN_FAILED) Frontier.push_back(q);
+                        State[q] &= ~MITO_THIN_FAILED;
+                    } else if (ssdx[i]*ssdx[i]+ssdy[i]*ssdy[i]+ssdz[i]*ssdz[i] == 1) {
+                        State[q] |= MITO_THIN_SURFACE;
+                        Pending.push_back(q);
+                    }
+                }
             }
+            ndels += (vtkIdType)ToBeDeleted.size();
+            ToBeDeleted.clear();
+
         }
 
         #ifdef DEBUG
-            printf("\t#Surface = %llu / #Deletions = %llu\n",(long long int)OnTheSurface.size(),ndels);
+            printf("\t#Frontier = %llu / #Deletions = %llu\n",(long long int)Frontier.size(),(long long int)ndels);
         #endif
 
-        OnTheSurface.clear();
+        if (mitoObject->Profile) {
+            char name[64];
+            snprintf(name,sizeof(name),"Thinning3D iteration %d deletions",++iteration);
+            mitoObject->Profile -> AddCounter(name,(long long)ndels);
+        }
+
+        Frontier.insert(Frontier.end(),Pending.begin(),Pending.end());
+        Pending.clear();
 
     } while(ndels);
-    
-    delete STV;
+
+    for (id = N; id--;) {
+        if (!(State[id] & MITO_THIN_OBJECT) && Scalars -> GetTuple1(id)) Scalars -> SetTuple1(id,0);
+    }
+    Scalars -> Modified();
 
     #ifdef DEBUG
         printf("Thinning done!\n");
     #endif
 
-    OnTheSurface.clear();
-    ToBeDeleted.clear();
+    Timer.Stop();
 
-    return Skeletonization(ImageData,mitoObject);
+    _mitoStageTimer SkellTimer(mitoObject->Profile,"Skeletonization");
+    vtkSmartPointer<vtkPolyData> Skeleton = Skeletonization(ImageData,mitoObject);
+    SkellTimer.SetCount(Skeleton->GetNumberOfPoints());
+
+    return Skeleton;
 
 }
 
@@ -506,143 +603,76 @@ vtkSmartPointer<vtkPolyData> Thinning3D(vtkSmartPointer<vtkImageData> ImageData,
    SKELETONIZATION
 =================================================================*/
 
-char GetNumberOfNeighborsWithoutValue(vtkSmartPointer<vtkImageData> Image, int x, int y, int z, long int value) {
-    double r[3];
-    char nn = 0;
-    for (char k = 26; k--;) {
-        if (Image->GetScalarComponentAsDouble(x+ssdx[k],y+ssdy[k],z+ssdz[k],0) != value) nn++;
-    }
-    return nn;
-}
-
-char GetNumberOfNeighborsWithoutValue(vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkTypeInt64Array> Volume, int x, int y, int z, long int value) {
-    double r[3];
-    char nn = 0;
-    vtkIdType idk;
-    for (char k = 26; k--;) {
-        double point[3] = {(double)(x+ssdx[k]), (double)(y+ssdy[k]), (double)(z+ssdz[k])};
-        idk = Image->FindPoint(point);
-        if (Volume->GetTuple1(idk) != value) nn++;
-    }
-    return nn;
-}
-
-char GetNumberOfNeighborsWithValue(vtkSmartPointer<vtkImageData> Image, int x, int y, int z, long int value) {
-    double r[3];
-    char nn = 0;
-    for (char k = 26; k--;) {
-        if (Image->GetScalarComponentAsDouble(x+ssdx[k],y+ssdy[k],z+ssdz[k],0) == value) nn++;
-    }
-    return nn;
-}
-
-char GetNumberOfNeighborsWithValue(vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkTypeInt64Array> Volume, int x, int y, int z, long int value) {
-    double r[3];
+char GetNumberOfNeighborsWithoutValue(const unsigned char *Mask, const vtkIdType *Offset, vtkIdType id, unsigned char value) {
     char nn = 0;
-    vtkIdType idk;
     for (char k = 26; k--;) {
-        double point[3] = {(double)(x+ssdx[k]), (double)(y+ssdy[k]), (double)(z+ssdz[k])};
-        idk = Image -> FindPoint(point);
-        if (Volume->GetTuple1(idk) == value) nn++;
+        if (Mask[id+Offset[k]] != value) nn++;
     }
     return nn;
 }
 
-vtkIdType GetOneNeighborWithValue(int x, int y, int z, vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkTypeInt64Array> Volume, long int value) {
-    vtkIdType idk;
+vtkIdType GetOneNeighborWithoutValue(const unsigned char *Mask, const vtkIdType *Offset, vtkIdType id, unsigned char value) {
     for (char k = 26; k--;) {
-        double point[3] = {(double)(x+ssdx[k]), (double)(y+ssdy[k]), (double)(z+ssdz[k])};
-        idk = Image -> FindPoint(point);
-        if (Volume -> GetTuple1(idk) == value) {
-            return idk;
-        }
+        if (Mask[id+Offset[k]] != value) return id+Offset[k];
     }
     return 0;  // We can do it because, by construction the voxel at id 0 should always be empty
 }
 
-vtkIdType GetOneNeighborWithoutValue(int x, int y, int z, vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkTypeInt64Array> Volume, long int value) {
-    vtkIdType idk;
+vtkIdType GetOneNeighborWithValue(const long int *Volume, const vtkIdType *Offset, vtkIdType id, long int value) {
     for (char k = 26; k--;) {
-        double point[3] = {(double)(x+ssdx[k]), (double)(y+ssdy[k]), (double)(z+ssdz[k])};
-        idk = Image -> FindPoint(point);
-        if (Volume -> GetTuple1(idk) && Volume -> GetTuple1(idk) != value) {
-            return idk;
-        }
+        if (Volume[id+Offset[k]] == value) return id+Offset[k];
     }
     return 0;  // We can do it because, by construction the voxel at id 0 should always be empty
 }
 
-vtkIdType GetOneNeighborWithoutValue(int x, int y, int z, vtkSmartPointer<vtkImageData> Image, long int value) {
-    vtkIdType idk;
+vtkIdType GetOneNeighborWithoutValue(const long int *Volume, const vtkIdType *Offset, vtkIdType id, long int value) {
     for (char k = 26; k--;) {
-        double point[3] = {(double)(x+ssdx[k]), (double)(y+ssdy[k]), (double)(z+ssdz[k])};
-        idk = Image -> FindPoint(point);
-        if (Image->GetScalarComponentAsDouble(x+ssdx[k],y+ssdy[k],z+ssdz[k],0)!=value) return idk;
+        if (Volume[id+Offset[k]] && Volume[id+Offset[k]] != value) return id+Offset[k];
     }
     return 0;  // We can do it because, by construction the voxel at id 0 should always be empty
 }
 
-bool JunctionsMerge(std::list<vtkIdType> Junctions, vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkTypeInt64Array> Volume) {
-    char nk;
-    double r[3];
-    vtkIdType id;
-    int x, y, z, k;
-    bool _has_changed = false;
-    std::list<vtkIdType>::iterator itId;
-    long int junction_label, neigh_junction_label;
-    for (itId=Junctions.begin(); itId!=Junctions.end(); itId++) {
-        Image -> GetPoint(*itId,r);
-        junction_label = Volume -> GetTuple1(*itId);
-        x = (int)r[0]; y = (int)r[1]; z = (int)r[2];
-        for (k = 0; k < 26; k++) {
-            double point[3] = {(double)(x+ssdx[k]), (double)(y+ssdy[k]), (double)(z+ssdz[k])};
-            id = Image->FindPoint(point);
-            neigh_junction_label = Volume -> GetTuple1(id);
-            if (junction_label < neigh_junction_label) {
-                _has_changed = true;
-                Volume -> SetTuple1(id,junction_label);
+long int JunctionsMerge(const std::vector<vtkIdType> &Junctions, long int *Volume, const vtkIdType *Offset) {
+
+    // Union-find over the junction labels. The root of each set is
+    // its smallest label, the one that used to spread to all voxels
+    // of the junction when labels were propagated until convergence.
+    long long label, neigh_label, nlabels = (long long)Junctions.size();
+    std::vector<long long> Parent(nlabels+1);
+    for (label = 0; label <= nlabels; label++) Parent[label] = label;
+    for (size_t j = 0; j < Junctions.size(); j++) {
+        label = FindRoot(Parent,Volume[Junctions[j]]);
+        for (int k = 26; k--;) {
+            neigh_label = Volume[Junctions[j]+Offset[k]];
+            if (neigh_label > 0) {
+                neigh_label = FindRoot(Parent,neigh_label);
+                if (neigh_label < label) {
+                    Parent[label] = neigh_label;
+                    label = neigh_label;
+                } else if (label < neigh_label) {
+                    Parent[neigh_label] = label;
+                }
             }
         }
     }
-    Volume -> Modified();
-    return _has_changed;
-}
 
-std::list<vtkIdType> GetEdgeStartingAt(int x, int y, int z, vtkSmartPointer<vtkImageData> Image, vtkSmartPointer<vtkTypeInt64Array> Volume) {
-    double r[3];
-    vtkIdType idk;
-    std::list<vtkIdType> Edge;
-    do {
-        idk = GetOneNeighborWithValue(x,y,z,Image,Volume,-1);
-        if (idk) {
-            Volume -> SetTuple1(idk,0);
-            Edge.insert(Edge.end(),idk);
-            Image -> GetPoint(idk,r);
-            x = (int)r[0]; y = (int)r[1]; z = (int)r[2];
-        }
-    } while(idk);
-    return Edge;
+    // Nodes are numbered in increasing order of their root label
+    long int nnodes = 0;
+    std::vector<long int> Node(nlabels+1,0);
+    for (label = 1; label <= nlabels; label++) {
+        if (FindRoot(Parent,label) == label) Node[label] = ++nnodes;
+    }
+    for (size_t j = 0; j < Junctions.size(); j++) {
+        Volume[Junctions[j]] = Node[FindRoot(Parent,Volume[Junctions[j]])];
+    }
+    return nnodes;
 }
 
-long int GetOneAdjacentEdge(vtkSmartPointer<vtkPolyData> PolyData, long int edge_label, long int original_source, bool *_common_source) {
-    vtkCell *Edge;
-    long int source, target;
-    for (long int edge = PolyData->GetNumberOfCells();edge--;) {
-        if (edge != edge_label) {
-            Edge = PolyData -> GetCell((vtkIdType)edge);
-            source = Edge -> GetPointId(0);
-            target = Edge -> GetPointId(Edge->GetNumberOfPoints()-1);
-            if (original_source==source) {
-                *_common_source = true;
-                return edge;
-            }
-            if (original_source==target) {
-                *_common_source = false;
-                return edge;
-            }
-        }
+void GetEdgeStartingAt(vtkIdType id, long int *Volume, const vtkIdType *Offset, std::vector<vtkIdType> &Edge) {
+    while ((id = GetOneNeighborWithValue(Volume,Offset,id,-1))) {
+        Volume[id] = 0;
+        Edge.push_back(id);
     }
-    return -1;
 }
 
 vtkSmartPointer<vtkPolyData> Skeletonization(vtkSmartPointer<vtkImageData> Image, _mitoObject *mitoObject) {
@@ -652,116 +682,105 @@ vtkSmartPointer<vtkPolyData> Skeletonization(vtkSmartPointer<vtkImageData> Image
     #endif
 
     double r[3];
-    int x, y, z;
-    vtkIdType id;
+    vtkIdType id, idn;
     long int junction_label = 1;
+    int *Dim = Image -> GetDimensions();
     vtkIdType N = Image -> GetNumberOfPoints();
-    std::list<vtkIdType> Junctions;
-    std::list<vtkIdType>::iterator itId;
+
+    // The boundaries of the volume are empty, so the 26 neighbors of
+    // the skeleton voxels are always inside.
+    vtkIdType Offset[26];
+    for (int k = 26; k--;) Offset[k] = ssdx[k] + ssdy[k]*(vtkIdType)Dim[0] + ssdz[k]*(vtkIdType)Dim[0]*Dim[1];
+
+    vtkDataArray *Scalars = Image -> GetPointData() -> GetScalars();
+    std::vector<unsigned char> Mask(N,0);
+    for (id = N; id--;) {
+        if (Scalars -> GetTuple1(id)) Mask[id] = 1;
+    }
 
     // Inside this IF statement, isolated voxels and isolated pairs of voxels
     // are expanded. If this is not done, these voxels will not be detected.
     // This requires O(N).
-    if (_improve_skeleton_quality) {
+    if (mitoObject->_improve_skeleton_quality) {
 
         #ifdef DEBUG
             printf("Improving skeletonization [step 1: isolated single and pair of voxels]\n");
         #endif
 
         char nn;
-        double rn[3];
-        vtkIdType idn;
-        int xn, yn, zn;
         for (id = N; id--;) {
-            Image -> GetPoint(id,r);
-            x = (int)r[0]; y = (int)r[1]; z = (int)r[2];
-            if (Image->GetScalarComponentAsDouble(x,y,z,0)) {
-                nn = GetNumberOfNeighborsWithoutValue(Image,x,y,z,0);
+            if (Mask[id]) {
+                nn = GetNumberOfNeighborsWithoutValue(Mask.data(),Offset,id,0);
                 if (nn==0) {
                     // Expanding isolated voxel
-                    Image -> SetScalarComponentFromDouble(x+1,y,z,0,255);
-                    Image -> SetScalarComponentFromDouble(x-1,y,z,0,255);
+                    Mask[id+1] = Mask[id-1] = 1;
                 } else if (nn==1) {
-                    idn = GetOneNeighborWithoutValue(x,y,z,Image,0);
-                    Image -> GetPoint(idn,rn);
-                    xn = (int)rn[0]; yn = (int)rn[1]; zn = (int)rn[2];
-                    if (GetNumberOfNeighborsWithoutValue(Image,xn,yn,zn,0)==1) {
+                    idn = GetOneNeighborWithoutValue(Mask.data(),Offset,id,0);
+                    if (GetNumberOfNeighborsWithoutValue(Mask.data(),Offset,idn,0)==1) {
                         // Expanding isolated pair of voxels
-                        Image -> SetScalarComponentFromDouble(x-(int)(rn[0]-r[0]),y-(int)(rn[1]-r[1]),z-(int)(rn[2]-r[2]),0,255);
-                        Image -> SetScalarComponentFromDouble(xn+(int)(rn[0]-r[0]),yn+(int)(rn[1]-r[1]),zn+(int)(rn[2]-r[2]),0,255);
-                    }                    
+                        Mask[id-(idn-id)] = 1;
+                        Mask[idn+(idn-id)] = 1;
+                    }
                 }
             }
         }
     }
 
-    vtkSmartPointer<vtkTypeInt64Array> Volume = vtkSmartPointer<vtkTypeInt64Array>::New();
-    Volume -> SetNumberOfComponents(1);
-    Volume -> SetNumberOfTuples(N);
+    // Labels of the skeleton voxels: 0 for the background, -1 for
+    // voxels not yet assigned to an edge and the junction label
+    // (later the node label) for junction voxels.
+    vtkIdType nvoxels = 0;
+    std::vector<long int> Volume(N,0);
+    for (id = N; id--;) {
+        if (Mask[id]) {
+            Volume[id] = -1;
+            nvoxels++;
+        }
+    }
+
+    std::vector<char> NN(N,0);
+    for (id = N; id--;) {
+        if (Mask[id]) NN[id] = GetNumberOfNeighborsWithoutValue(Mask.data(),Offset,id,0);
+    }
 
     // Inside this IF statement, we label all connected components
     // and we search for those cc that don't have junctions. If any
-    // is found, we force it to have a junction by adding its first
-    // voxel to the list Junctions. This fixes the problem of not
+    // is found, we force it to have a junction by adding its last
+    // voxel to the list Fixed. This fixes the problem of not
     // detecting loop-shaped ccs.
-    if (_improve_skeleton_quality) {
+    std::vector<vtkIdType> Junctions, Fixed;
+    if (mitoObject->_improve_skeleton_quality) {
         #ifdef DEBUG
             printf("Improving skeletonization [step 2: verifying connected components]\n");
         #endif
-        long int n_fixed = 0;
-        std::vector<long int> CSz;
-        long int cc, ncc = LabelConnectedComponents(Image,Volume,CSz,26,0);
-
-        bool *HasJunction = new bool[ncc];
-        for (cc = ncc; cc--;) HasJunction[cc] = 0;
-        for (id = N; id--;) {
-            Image -> GetPoint(id,r);
-            x = (int)r[0]; y = (int)r[1]; z = (int)r[2];
-            cc = (long int)Volume -> GetTuple1(id);
-            if (cc) {
-                if (GetNumberOfNeighborsWithValue(Image,Volume,x,y,z,cc) != 2) {
-                    HasJunction[(unsigned long int)(-cc-1)] = true;
-                }
+        std::vector<_mitoRun> Runs;
+        std::vector<long int> Label, CSz;
+        long int cc, ncc = LabelConnectedRuns(Mask.data(),Dim,26,Runs,Label,CSz);
+
+        // Components are labeled in decreasing order of their last voxel,
+        // the order in which a backward scan meets them.
+        std::vector<bool> HasJunction(ncc,false);
+        std::vector<vtkIdType> Last(ncc,0);
+        for (size_t run = 0; run < Runs.size(); run++) {
+            cc = Label[run] - 1;
+            id = (vtkIdType)(Runs[run].row * Dim[0]);
+            for (int x = Runs[run].x0; x <= Runs[run].x1; x++) {
+                if (NN[id+x] != 2) HasJunction[cc] = true;
             }
-            Image -> SetScalarComponentFromDouble(x,y,z,0,-cc);
+            Last[cc] = id + Runs[run].x1;
         }
-        for (id = N; id--;) {
-            Image -> GetPoint(id,r);
-            x = (int)r[0]; y = (int)r[1]; z = (int)r[2];
-            cc = (long int)Volume -> GetTuple1(id);
-            if (cc) {
-                if (!HasJunction[(unsigned long int)(-cc-1)]) {
-                    HasJunction[(unsigned long int)(-cc-1)] = true;
-                    Junctions.insert(Junctions.begin(),id);
-                    Volume -> SetTuple1(id,junction_label);
-                    junction_label++;
-                    n_fixed++;
-                } else {
-                    Volume -> SetTuple1(id,-1);
-                }
-            } else {
-                Volume -> SetTuple1(id,0);
+        for (cc = 0; cc < ncc; cc++) {
+            if (!HasJunction[cc]) {
+                Fixed.push_back(Last[cc]);
+                Volume[Last[cc]] = junction_label;
+                junction_label++;
             }
         }
-        delete[] HasJunction;
 
         #ifdef DEBUG
-            printf("\t#Components fixed = %ld\n",n_fixed);
+            printf("\t#Components fixed = %ld\n",(long int)Fixed.size());
         #endif
 
-        Image -> GetPointData() -> GetScalars() -> Modified();
-
-    } else {
-
-        for (id = N; id--;) {
-            if (Image -> GetPointData() -> GetScalars() -> GetTuple1(id)) {
-                Volume -> SetTuple1(id,-1);
-            } else {
-                Volume -> SetTuple1(id,0);
-            }
-        }
-        Volume -> Modified();
-
     }
 
     #ifdef DEBUG
@@ -769,18 +788,21 @@ vtkSmartPointer<vtkPolyData> Skeletonization(vtkSmartPointer<vtkImageData> Image
         printf("\tSearching for junctions...\n");
     #endif
 
+    // Junctions are labeled in decreasing order of voxel id, after the
+    // fixed ones, and listed in increasing order of voxel id, before the
+    // fixed ones.
     for (id = N; id--;) {
-        Image -> GetPoint(id,r);
-        x = (int)r[0]; y = (int)r[1]; z = (int)r[2];
-        if (Image->GetScalarComponentAsDouble(x,y,z,0)) {
-            if (GetNumberOfNeighborsWithoutValue(Image,x,y,z,0) != 2) {
-                Junctions.insert(Junctions.begin(),id);
-                Volume -> SetTuple1(id,junction_label);
-                junction_label++;
-            }
+        if (Mask[id] && NN[id] != 2) {
+            Junctions.push_back(id);
+            Volume[id] = junction_label;
+            junction_label++;
         }
     }
-    Volume -> Modified();
+    std::reverse(Junctions.begin(),Junctions.end());
+    Junctions.insert(Junctions.end(),Fixed.rbegin(),Fixed.rend());
+
+    std::vector<unsigned char>().swap(Mask);
+    std::vector<char>().swap(NN);
 
     if (!Junctions.size()) {
         printf("Z-stack seems to be empty. Aborting...\n");
@@ -788,92 +810,66 @@ vtkSmartPointer<vtkPolyData> Skeletonization(vtkSmartPointer<vtkImageData> Image
     }
 
     #ifdef DEBUG
-        printf("\t#Junctions before merging = %ld\n",Junctions.size());
+        printf("\t#Junctions before merging = %ld\n",(long int)Junctions.size());
     #endif
 
     // MERGING: During the merging process, voxels belonging to
     // the same junction are merged together forming nodes.
-    while (JunctionsMerge(Junctions,Image,Volume));
-
-    // Listing all nodes label we have until this point
-    std::list<long int> Labels;
-    std::list<long int>::iterator itLabel;
-    for (itId=Junctions.begin(); itId!=Junctions.end(); itId++) {
-        Labels.insert(Labels.begin(),(long int)Volume->GetTuple1(*itId));
-    }
-
-    // UNIQUE of labels
-    Labels.sort(); // must sort first
-    Labels.unique();
-    long int NumberOfNodes = Labels.size();
+    long int NumberOfNodes = JunctionsMerge(Junctions,Volume.data(),Offset);
 
     #ifdef DEBUG
         printf("\t#Junctions (nodes) after merging = %ld\n",NumberOfNodes);
     #endif
 
     // COORDINATES of nodes
-    // Vectors with static size to make the average calculation easy.
     long int node;
-    double *X = new double[NumberOfNodes]; //Vector for x-coordinate
-    double *Y = new double[NumberOfNodes]; //Vector for y-coordinate
-    double *Z = new double[NumberOfNodes]; //Vector for z-coordinate
-    double *S = new double[NumberOfNodes]; //Vector for junctions size
-       int *K = new int[NumberOfNodes];    //Vector for junctions degree
-    for (node = 0; node < NumberOfNodes; node++) {
-        K[node] = 0;
-        X[node] = Y[node] = Z[node] = S[node] = 0.0;
-    }
-
-    for (itId=Junctions.begin(); itId!=Junctions.end(); itId++) {
-        junction_label = (long int)Volume -> GetTuple1(*itId);
-        itLabel = std::find(Labels.begin(),Labels.end(),junction_label);
-        node = (long int)std::distance(Labels.begin(),itLabel);
-        Volume -> SetTuple1(*itId,node+1);
-        Image -> GetPoint(*itId,r);
+    std::vector<double> X(NumberOfNodes,0.0); //Vector for x-coordinate
+    std::vector<double> Y(NumberOfNodes,0.0); //Vector for y-coordinate
+    std::vector<double> Z(NumberOfNodes,0.0); //Vector for z-coordinate
+    std::vector<double> S(NumberOfNodes,0.0); //Vector for junctions size
+    std::vector<int>    K(NumberOfNodes,0);   //Vector for junctions degree
+
+    for (size_t j = 0; j < Junctions.size(); j++) {
+        node = Volume[Junctions[j]] - 1;
+        Image -> GetPoint(Junctions[j],r);
         X[node] += r[0];
         Y[node] += r[1];
         Z[node] += r[2];
         S[node] ++;
     }
-    Volume -> Modified();
 
-    // Dynamic list to make easy the insertion of the coordinates
-    // of remaining voxels detected during the edge tracking process.
-    std::list<double> PointsListX;
-    std::list<double> PointsListY;
-    std::list<double> PointsListZ;
-    for (node=0;node<NumberOfNodes;node++) {
-        PointsListX.insert(PointsListX.end(),X[node]/S[node]);
-        PointsListY.insert(PointsListY.end(),Y[node]/S[node]);
-        PointsListZ.insert(PointsListZ.end(),Z[node]/S[node]);
+    // Coordinates of the nodes followed by the coordinates of the
+    // voxels of the edges, in the order they are tracked.
+    std::vector<double> Coords;
+    Coords.reserve(3*(NumberOfNodes+nvoxels));
+    for (node = 0; node < NumberOfNodes; node++) {
+        Coords.push_back(X[node]/S[node]);
+        Coords.push_back(Y[node]/S[node]);
+        Coords.push_back(Z[node]/S[node]);
     }
 
-    delete[] X; delete[] Y; delete[] Z; delete[] S;
-
-    // CellArray to add new edges as they are being tracked.
-    vtkSmartPointer<vtkCellArray> EdgeArray = vtkSmartPointer<vtkCellArray>::New();
+    // Edges are stored one after the other in EdgeIds, edge e going
+    // from EdgeStart[e] to EdgeStart[e+1].
+    std::vector<vtkIdType> Edge, EdgeIds, EdgeStart(1,0);
+    EdgeIds.reserve(nvoxels+2*Junctions.size());
 
     bool _should_add;
-    itId = Junctions.begin();
-    long int voxel_label = NumberOfNodes;
-    long int junction_label_left, junction_label_right;
+    vtkIdType voxel_label = NumberOfNodes;
     long int source_node, target_node;
-    while (itId != Junctions.end()) {
-        Image -> GetPoint(*itId,r);
-        x = (int)r[0]; y = (int)r[1]; z = (int)r[2];
-        if (GetNumberOfNeighborsWithValue(Image,Volume,x,y,z,-1)) {
-            _should_add = true;
+    for (size_t j = 0; j < Junctions.size(); j++) {
 
-            //Tracking new edge
-            std::list<vtkIdType> Edge = GetEdgeStartingAt(x,y,z,Image,Volume);
+        source_node = Volume[Junctions[j]];
 
-            //Identifying junctions on left side of the edge
-            source_node = Volume -> GetTuple1(*itId);
+        while (true) {
+
+            //Tracking new edge
+            Edge.clear();
+            GetEdgeStartingAt(Junctions[j],Volume.data(),Offset,Edge);
+            if (Edge.empty()) break;
+            _should_add = true;
 
             //Identifying junctions on right side of the edge
-            Image -> GetPoint(Edge.back(),r);
-            x = (int)r[0]; y = (int)r[1]; z = (int)r[2];
-            target_node = Volume -> GetTuple1(GetOneNeighborWithoutValue(x,y,z,Image,Volume,source_node));
+            target_node = Volume[GetOneNeighborWithoutValue(Volume.data(),Offset,Edge.back(),source_node)];
 
             // When target_node is equal to 0 at this point, we are
             // dealing with loops. These loops can be real loops or noise
@@ -887,65 +883,53 @@ vtkSmartPointer<vtkPolyData> Skeletonization(vtkSmartPointer<vtkImageData> Image
             }
 
             if (_should_add) {
-                // Creating new cell for this edge
-                EdgeArray -> InsertNextCell(Edge.size()+2);
                 // Adding node 1
-                EdgeArray -> InsertCellPoint(source_node-1);
+                EdgeIds.push_back(source_node-1);
                 // Addint the new points coordinates as well as the edge itself
-                for (std::list<vtkIdType>::iterator itIde=Edge.begin(); itIde!=Edge.end(); itIde++) {
-                    Image -> GetPoint(*itIde,r);
-                    PointsListX.insert(PointsListX.end(),r[0]);
-                    PointsListY.insert(PointsListY.end(),r[1]);
-                    PointsListZ.insert(PointsListZ.end(),r[2]);
-                    EdgeArray -> InsertCellPoint(voxel_label);
+                for (size_t i = 0; i < Edge.size(); i++) {
+                    Image -> GetPoint(Edge[i],r);
+                    Coords.push_back(r[0]);
+                    Coords.push_back(r[1]);
+                    Coords.push_back(r[2]);
+                    EdgeIds.push_back(voxel_label);
                     voxel_label++;
                 }
                 // Adding node 2
-                EdgeArray -> InsertCellPoint(target_node-1);
+                EdgeIds.push_back(target_node-1);
+                EdgeStart.push_back((vtkIdType)EdgeIds.size());
                 // Updating nodes degree
                 K[source_node-1]++;
                 K[target_node-1]++;
             }
-            
-        } else {
-            Junctions.erase(itId++);
         }
     }
 
+    std::vector<long int>().swap(Volume);
+
     vtkSmartPointer<vtkPoints> Points = vtkSmartPointer<vtkPoints>::New();
-    Points -> SetNumberOfPoints(PointsListX.size());
+    Points -> SetNumberOfPoints(voxel_label);
 
     #ifdef DEBUG
         printf("#Points in vtkPoints = %lld\n",Points -> GetNumberOfPoints());
     #endif
 
-    voxel_label = 0;
-    std::list<double>::iterator itX = PointsListX.begin();
-    std::list<double>::iterator itY = PointsListY.begin();
-    std::list<double>::iterator itZ = PointsListZ.begin();
-    while (itX != PointsListX.end()) {
-        Points -> SetPoint(voxel_label,*itX,*itY,*itZ);
-        itX++; itY++; itZ++;
-        voxel_label++;
+    for (id = 0; id < voxel_label; id++) {
+        Points -> SetPoint(id,Coords[3*id],Coords[3*id+1],Coords[3*id+2]);
     }
     Points -> Modified();
 
-    PointsListX.clear();
-    PointsListY.clear();
-    PointsListZ.clear();
-
-    // Creating raw polyData
-    vtkSmartPointer<vtkPolyData> PolyData = vtkPolyData::New();
-    PolyData -> SetPoints(Points);
-    PolyData -> SetLines(EdgeArray);
-    PolyData -> Modified();
-    PolyData -> BuildLinks();
-
-    long int nedges_before_filtering = PolyData -> GetNumberOfCells();
+    long int nedges_before_filtering = (long int)EdgeStart.size() - 1;
 
     #ifdef DEBUG
         printf("\t#Edges before filtering = %ld\n",nedges_before_filtering);
-        SavePolyData(PolyData,(mitoObject->FileName+"_skeleton_raw.vtk").c_str());
+        vtkSmartPointer<vtkCellArray> RawArray = vtkSmartPointer<vtkCellArray>::New();
+        for (long int edge = 0; edge < nedges_before_filtering; edge++) {
+            RawArray -> InsertNextCell(EdgeStart[edge+1]-EdgeStart[edge],&EdgeIds[EdgeStart[edge]]);
+        }
+        vtkSmartPointer<vtkPolyData> RawPolyData = vtkSmartPointer<vtkPolyData>::New();
+        RawPolyData -> SetPoints(Points);
+        RawPolyData -> SetLines(RawArray);
+        SavePolyData(RawPolyData,(mitoObject->FileName+"_skeleton_raw.vtk").c_str());
     #endif
 
     // PolyData filtering by removing degree-2 nodes. These nodes rise
@@ -957,9 +941,15 @@ vtkSmartPointer<vtkPolyData> Skeletonization(vtkSmartPointer<vtkImageData> Image
         printf("\t#Filtering...\n");
     #endif
 
-    while (
-        MergeEdgesOfDegree2Nodes(PolyData,nedges_before_filtering,K)
-    );
+    vtkSmartPointer<vtkCellArray> EdgeArray = vtkSmartPointer<vtkCellArray>::New();
+    MergeEdgesOfDegree2Nodes(EdgeStart,EdgeIds,K,EdgeArray);
+
+    // Creating polyData
+    vtkSmartPointer<vtkPolyData> PolyData = vtkSmartPointer<vtkPolyData>::New();
+    PolyData -> SetPoints(Points);
+    PolyData -> SetLines(EdgeArray);
+    PolyData -> Modified();
+    PolyData -> BuildLinks();
 
     #ifdef DEBUG
         printf("\t#Creating new ids...\n");
@@ -1012,101 +1002,132 @@ vtkSmartPointer<vtkPolyData> Skeletonization(vtkSmartPointer<vtkImageData> Image
 
     SmoothEdgesCoordinates(PolyData,3);
 
-    if (_export_graph_files) ExportGraphFiles(PolyData,NumberOfNodes,ValidId,mitoObject->FileName.c_str());
+    if (mitoObject->_export_graph_files || mitoObject->Graph) ExportGraphFiles(PolyData,NumberOfNodes,ValidId,mitoObject);
+
+    if (!mitoObject->Result) ExportNodes(PolyData,NumberOfNodes,ValidId,mitoObject);
 
-    ExportNodes(PolyData,NumberOfNodes,ValidId,mitoObject);
+    delete[] ValidId;
 
     return PolyData;
 }
 
-bool MergeEdgesOfDegree2Nodes(vtkSmartPointer<vtkPolyData> PolyData, long int nedges_before_filtering, int *K) {
+// Piece of a merged edge during its expansion: the points of edge,
+// reversed or not, without the first one when skip is set.
+struct _mitoEdgePiece {
+    long long edge;
+    bool reversed, skip;
+};
+
+void MergeEdgesOfDegree2Nodes(const std::vector<vtkIdType> &Start, const std::vector<vtkIdType> &Ids, std::vector<int> &K, vtkSmartPointer<vtkCellArray> Lines) {
 
     // Given this edge: (source) o---->----o (target), it's necessary
     // to check whether either source or target are nodes of degree 2.
+    // Edges are visited in order and the merged edge is appended at
+    // the end. An edge that cannot be merged never becomes mergeable,
+    // so a single pass gives the same edges, in the same order, as
+    // restarting from the first edge after each merge. Merged edges
+    // are only recorded as the pair of edges they are made of and
+    // their points are written at the end.
+
+    long long e, n, v, nedges = (long long)Start.size() - 1;
+    std::vector<vtkIdType> Source(nedges), Target(nedges);
+    std::vector<long long> Parent(nedges);
+
+    // First two edges attached to each node, which are all the edges
+    // of the nodes of degree 2.
+    std::vector<long long> Attached(2*K.size(),-1);
+    for (e = 0; e < nedges; e++) {
+        Source[e] = Ids[Start[e]];
+        Target[e] = Ids[Start[e+1]-1];
+        Parent[e] = e;
+        for (int end = 0; end < 2; end++) {
+            v = end ? Target[e] : Source[e];
+            if (Attached[2*v] < 0) Attached[2*v] = e; else if (Attached[2*v+1] < 0) Attached[2*v+1] = e;
+        }
+    }
 
-    std::list<vtkIdType> Merg;
-    std::list<vtkIdType>::iterator itId;
+    // Merged edge nedges+m is A[m] followed by B[m] without its first
+    // point, each of them possibly reversed. Parent maps an edge to the
+    // merged edge that replaced it.
+    std::vector<long long> A, B;
+    std::vector<bool> RevA, RevB;
 
-    vtkCell *Edge, *NeighEdge;
-    long int i, source, target, edge, edge_length, neigh_edge, neigh_edge_length;
-    bool _common_source, _merged = false;
+    bool _common_source;
+    for (e = 0; e < (long long)Source.size(); e++) {
 
-    for (edge = 0; edge < PolyData -> GetNumberOfCells(); edge++) {
+        if (Parent[e] != e || Source[e] == Target[e]) continue;
+
+        v = (K[Source[e]]==2) ? Source[e] : ((K[Target[e]]==2) ? Target[e] : -1);
+        if (v < 0) continue;
 
-        Edge = PolyData -> GetCell(edge);
-        edge_length = Edge -> GetNumberOfPoints();
-        source = (long int)Edge -> GetPointId(0);
-        target = (long int)Edge -> GetPointId(Edge->GetNumberOfPoints()-1);
+        n = FindRoot(Parent,Attached[2*v]);
+        if (n == e) n = FindRoot(Parent,Attached[2*v+1]);
+        if (n == e) continue;
+        _common_source = (Source[n] == v);
 
-        if (K[source]==2 && source!=target) {
+        if (v == Source[e]) {
 
             //  [  neigh  | original ]
             //  o----?----o---->-----o
             //            s          t
 
-            _merged = true;
-            neigh_edge = GetOneAdjacentEdge(PolyData,edge,source,&_common_source);
-            NeighEdge = PolyData -> GetCell((vtkIdType)neigh_edge);
-            neigh_edge_length = NeighEdge -> GetNumberOfPoints();
-
             if (_common_source) {//  o----<----o---->----o
-                for (i=0;i<edge_length;i++)
-                    Merg.insert(Merg.begin(),PolyData->GetCell(edge)->GetPointId(i));
-                for (i=1;i<neigh_edge_length;i++)
-                    Merg.insert(Merg.end(),PolyData->GetCell(neigh_edge)->GetPointId(i));
+                A.push_back(e); RevA.push_back(true);
+                B.push_back(n); RevB.push_back(false);
             } else { //  o---->----o---->----o
-                for (i=0;i<neigh_edge_length;i++)
-                    Merg.insert(Merg.end(),PolyData->GetCell(neigh_edge)->GetPointId(i));                
-                for (i=1;i<edge_length;i++)
-                    Merg.insert(Merg.end(),PolyData->GetCell(edge)->GetPointId(i));
+                A.push_back(n); RevA.push_back(false);
+                B.push_back(e); RevB.push_back(false);
             }
-            K[source] = -1; // Tagged as not valid node
 
-        } else if (K[target]==2 && source!=target) {
+        } else {
 
             //  [ original |  neigh  ]
             //  o---->-----o----?----o
             //  s          t
 
-            _merged = true;
-            neigh_edge = GetOneAdjacentEdge(PolyData,edge,target,&_common_source);
-            NeighEdge = PolyData -> GetCell((vtkIdType)neigh_edge);
-            neigh_edge_length = NeighEdge -> GetNumberOfPoints();
-
-            if (_common_source) {//  o---->----o---->----o
-                for (i=0;i<edge_length;i++)
-                    Merg.insert(Merg.end(),PolyData->GetCell(edge)->GetPointId(i));
-                for (i=1;i<neigh_edge_length;i++)
-                    Merg.insert(Merg.end(),PolyData->GetCell(neigh_edge)->GetPointId(i));
-            } else {//  o---->----o----<----o
-                for (i=0;i<edge_length;i++)
-                    Merg.insert(Merg.end(),PolyData->GetCell(edge)->GetPointId(i));
-                for (i=neigh_edge_length-1;i--;)
-                    Merg.insert(Merg.end(),PolyData->GetCell(neigh_edge)->GetPointId(i));                
-            }
-            K[target] = -1; // Tagged as not valid node
+            A.push_back(e); RevA.push_back(false);
+            B.push_back(n); RevB.push_back(!_common_source);
         }
+        K[v] = -1; // Tagged as not valid node
 
-        if (_merged) {
-            i = 0;
-            // Removing the two pieces that were merged together
-            PolyData -> BuildLinks();
-            PolyData -> DeleteCell(edge);
-            PolyData -> DeleteCell(neigh_edge);
-            PolyData -> RemoveDeletedCells();
-            // Adding the new "merged" edge
-            std::vector<vtkIdType> IdList(Merg.size());
-            for (itId=Merg.begin(); itId!=Merg.end(); itId++) {
-                IdList[i] = *itId;
-                i++;
+        Source.push_back(RevA.back() ? Target[A.back()] : Source[A.back()]);
+        Target.push_back(RevB.back() ? Source[B.back()] : Target[B.back()]);
+        Parent.push_back((long long)Parent.size());
+        Parent[e] = Parent[n] = Parent.back();
+    }
+
+    // Writing the edges left, expanding the merged ones. The reverse of
+    // A + B is reverse(B) + reverse(A), as both share the merged node.
+    long long i, length;
+    std::vector<vtkIdType> Merg;
+    std::vector<_mitoEdgePiece> Pieces;
+    for (e = 0; e < (long long)Source.size(); e++) {
+        if (Parent[e] != e) continue;
+        Merg.clear();
+        _mitoEdgePiece Piece = {e,false,false};
+        Pieces.push_back(Piece);
+        while (!Pieces.empty()) {
+            Piece = Pieces.back();
+            Pieces.pop_back();
+            if (Piece.edge < nedges) {
+                length = Start[Piece.edge+1] - Start[Piece.edge];
+                for (i = Piece.skip ? 1 : 0; i < length; i++) {
+                    Merg.push_back(Ids[Piece.reversed ? Start[Piece.edge+1]-1-i : Start[Piece.edge]+i]);
+                }
+            } else {
+                n = Piece.edge - nedges;
+                _mitoEdgePiece First = {A[n],(bool)RevA[n],Piece.skip};
+                _mitoEdgePiece Second = {B[n],(bool)RevB[n],true};
+                if (Piece.reversed) {
+                    First.edge = B[n]; First.reversed = !RevB[n];
+                    Second.edge = A[n]; Second.reversed = !RevA[n];
+                }
+                Pieces.push_back(Second);
+                Pieces.push_back(First);
             }
-            PolyData -> InsertNextCell(VTK_POLY_LINE,Merg.size(),IdList.data());
-            Merg.clear();
-            return true;
         }
-
+        Lines -> InsertNextCell((vtkIdType)Merg.size(),Merg.data());
     }
-    return false;
 }
 
 long int LabelConnectedComponents(vtkSmartPointer<vtkImageData> ImageData, vtkSmartPointer<vtkDataArray> Volume, std::vector<long int> &CSz, int ngbh, double threshold) {
@@ -1116,70 +1137,39 @@ long int LabelConnectedComponents(vtkSmartPointer<vtkImageData> ImageData, vtkSm
     #endif
 
     int *Dim = ImageData -> GetDimensions();
+    vtkIdType id, N = ImageData -> GetNumberOfPoints();
+
+    std::vector<unsigned char> Mask(N);
+    vtkDataArray *Scalars = ImageData -> GetPointData() -> GetScalars();
+    if (Scalars -> GetDataType() == VTK_UNSIGNED_CHAR) {
+        const unsigned char *V = (unsigned char*)Scalars -> GetVoidPointer(0);
+        for (id = 0; id < N; id++) Mask[id] = ((double)V[id] > threshold) ? 1 : 0;
+    } else if (Scalars -> GetDataType() == VTK_FLOAT) {
+        const float *V = (float*)Scalars -> GetVoidPointer(0);
+        for (id = 0; id < N; id++) Mask[id] = ((double)V[id] > threshold) ? 1 : 0;
+    } else {
+        for (id = 0; id < N; id++) Mask[id] = (Scalars->GetTuple1(id) > threshold) ? 1 : 0;
+    }
 
-    vtkIdType i, s, ido, id;
-
-    int x, y, z;
-    double v, r[3];
-    bool find = true;
-    long long int ro[3];
-    long int scluster, label;
-    ro[0] = Dim[0] * Dim[1] * Dim[2];
-    ro[1] = Dim[0] * Dim[1];
-
-    vtkSmartPointer<vtkIdList> CurrA = vtkSmartPointer<vtkIdList>::New();
-    vtkSmartPointer<vtkIdList> NextA = vtkSmartPointer<vtkIdList>::New();
-
-    Volume -> CopyComponent(0,ImageData->GetPointData()->GetScalars(),0);
-    Volume -> Modified();
-
-    label = 0;
-    while (find) {
-        for (s = 0; s < CurrA->GetNumberOfIds(); s++) {
-            ido = CurrA -> GetId(s);
-            ImageData -> GetPoint(ido,r);
-            x = (int)r[0]; y = (int)r[1]; z = (int)r[2];
-            for (i = 0; i < ngbh; i++) {
-                double point[3] = {(double)(x+ssdx_sort[i]), (double)(y+ssdy_sort[i]), (double)(z+ssdz_sort[i])};
-                id = ImageData -> FindPoint(point);
-                v = Volume -> GetTuple1(id);
-                if (v > threshold) {
-                    NextA -> InsertNextId(id);
-                    Volume -> SetTuple1(id,-label);
-                    scluster++;
-                }
-            }
-        }
-        if (!NextA->GetNumberOfIds()) {
-            find = false;
-            for (id=ro[0]; id--;) {
-                v = Volume -> GetTuple1(id);
-                if (v > threshold) {
-                    find = true;
-                    ro[0] = id;
-                    break;
-                }
-            }
-            if (label) {
-                CSz.push_back(scluster);
-            }
-            if (find) {
-                label++;
-                scluster = 1;
-                Volume -> SetTuple1(id,-label);
-                CurrA -> InsertNextId(id);
-            }
-        } else {
-            CurrA -> Reset();
-            CurrA -> DeepCopy(NextA);
-            NextA -> Reset();
+    // Voxels of component l are marked with -l, voxels below the
+    // threshold with 0.
+    std::vector<_mitoRun> Runs;
+    std::vector<long int> Label;
+    LabelConnectedRuns(Mask.data(),Dim,ngbh,Runs,Label,CSz);
+
+    Volume -> FillComponent(0,0);
+    int *L = (Volume -> GetDataType() == VTK_INT) ? (int*)Volume -> GetVoidPointer(0) : NULL;
+    for (size_t r = 0; r < Runs.size(); r++) {
+        id = (vtkIdType)(Runs[r].row * Dim[0]);
+        for (int x = Runs[r].x0; x <= Runs[r].x1; x++) {
+            if (L) L[id+x] = (int)-Label[r]; else Volume -> SetTuple1(id+x,-Label[r]);
         }
     }
+    Volume -> Modified();
 
     #ifdef DEBUG
         printf("\tNumber of detected components: %ld\n",(long int)CSz.size());
     #endif
 
-    //return (long int)CSz->GetNumberOfTuples();
     return (long int)CSz.size();
 }
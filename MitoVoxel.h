@@ -0,0 +1,187 @@
+#ifndef MITOVOXEL_H
+#define MITOVOXEL_H
+
+#include <cmath>
+
+	//===========================================================================
+	//
+	//   Per-voxel formulas of the vesselness chain: discrete differences,
+	//   Hessian, eigenvalues, vesselness and divergence stencil. They are
+	//   shared by the CPU kernels of MitoFilters.cxx and MitoGraph.cxx
+	//   and by the CUDA kernels of MitoCuda.cu, so that both devices
+	//   evaluate the same operations in the same order. Volumes are laid
+	//   out x-fastest, as in MitoFilters.h.
+	//
+	//===========================================================================
+
+	#ifdef __CUDACC__
+		#define MITO_HD __host__ __device__
+	#else
+		#define MITO_HD
+	#endif
+
+	// Difference rule at a given position along one axis. The first-order
+	// derivative there is s*(f[p+d1]-f[p+d2]): s = 1/2 for the central
+	// difference inside the volume and s = 1 for the one-sided differences
+	// at the two borders. Note that s*(a-b) rounds exactly like a/2-b/2.
+	struct _diffRule {
+		double s;
+		int d1, d2;
+	};
+
+	MITO_HD inline void SetDiffRule(int pos, int n, _diffRule &R) {
+		if (n < 2) {
+			R.s = 0.0; R.d1 = R.d2 = 0;
+		} else if (pos <= 0) {
+			R.s = 1.0; R.d1 = 1; R.d2 = 0;
+		} else if (pos >= n-1) {
+			R.s = 1.0; R.d1 = 0; R.d2 = -1;
+		} else {
+			R.s = 0.5; R.d1 = 1; R.d2 = -1;
+		}
+	}
+
+	// First-order difference at p along the axis with the given stride.
+	// Rounded to float, as the intermediate derivative volumes were.
+	MITO_HD inline float Diff(const float *f, long long p, const _diffRule &R, long long stride) {
+		return (float)(R.s*((double)f[p+R.d1*stride]-(double)f[p+R.d2*stride]));
+	}
+
+	// Difference along axis a of the first-order difference along axis b.
+	// Rb1 and Rb2 are the b-rules at the two points sampled by Ra.
+	MITO_HD inline float Diff2(const float *f, long long p, const _diffRule &Ra, long long sa, const _diffRule &Rb1, const _diffRule &Rb2, long long sb) {
+		return (float)(Ra.s*((double)Diff(f,p+Ra.d1*sa,Rb1,sb)-(double)Diff(f,p+Ra.d2*sa,Rb2,sb)));
+	}
+
+	// The six Hessian entries of voxel (x,y,z), in the MITO_HXX, ...,
+	// MITO_HYZ order, as GetHessianTile computes them
+	MITO_HD inline void GetHessianAt(const float *G, const int *Dim, int x, int y, int z, float H[6]) {
+		const long long sx = 1;
+		const long long sy = (long long)Dim[0];
+		const long long sz = (long long)Dim[0]*Dim[1];
+		const long long p = x + y*sy + z*sz;
+		_diffRule Rx, Rx1, Rx2, Ry, Ry1, Ry2, Rz, Rz1, Rz2;
+		SetDiffRule(x,Dim[0],Rx);
+		SetDiffRule(x+Rx.d1,Dim[0],Rx1);
+		SetDiffRule(x+Rx.d2,Dim[0],Rx2);
+		SetDiffRule(y,Dim[1],Ry);
+		SetDiffRule(y+Ry.d1,Dim[1],Ry1);
+		SetDiffRule(y+Ry.d2,Dim[1],Ry2);
+		SetDiffRule(z,Dim[2],Rz);
+		SetDiffRule(z+Rz.d1,Dim[2],Rz1);
+		SetDiffRule(z+Rz.d2,Dim[2],Rz2);
+		H[0] = Diff2(G,p,Rx,sx,Rx1,Rx2,sx);
+		H[1] = Diff2(G,p,Ry,sy,Ry1,Ry2,sy);
+		H[2] = Diff2(G,p,Rz,sz,Rz1,Rz2,sz);
+		H[3] = Diff2(G,p,Rx,sx,Ry,Ry,sy);
+		H[4] = Diff2(G,p,Rx,sx,Rz,Rz,sz);
+		H[5] = Diff2(G,p,Ry,sy,Rz,Rz,sz);
+	}
+
+	// Frobenius norm of the Hessian, summed in the order of FrobeniusNorm
+	// in MitoGraph.cxx
+	MITO_HD inline double GetHessianFrobeniusNorm(double xx, double yy, double zz, double xy, double xz, double yz) {
+		double f = 0.0;
+		f += zz*zz; f += yz*yz; f += xz*xz;
+		f += yz*yz; f += yy*yy; f += xy*xy;
+		f += xz*xz; f += xy*xy; f += xx*xx;
+		return sqrt(f);
+	}
+
+	// Eigenvalues of the symmetric matrix [a d e; d b f; e f c] from the
+	// trigonometric solution of its characteristic polynomial, sorted by
+	// increasing magnitude. See GetSymmetricEigenvalues.
+	MITO_HD inline void GetSymmetricEigenvaluesAt(double a, double b, double c, double d, double e, double f, double &l1, double &l2, double &l3) {
+
+		const double third = 1.0 / 3.0;
+		const double shift = 2.0 * acos(-1.0) / 3.0;
+
+		// A = qI + pB with B traceless and of unit Frobenius norm/sqrt(6),
+		// so that the eigenvalues of B are 2cos(phi + 2k pi/3) with
+		// cos(3phi) = det(B)/2.
+		double q = (a + b + c) * third;
+		double aq = a - q, bq = b - q, cq = c - q;
+		double p2 = aq*aq + bq*bq + cq*cq + 2.0*(d*d + e*e + f*f);
+		double p = sqrt(p2 / 6.0);
+		double det = aq*(bq*cq - f*f) - d*(d*cq - f*e) + e*(d*f - bq*e);
+		double r = (p > 0.0) ? det / (2.0*p*p*p) : 0.0;
+		r = (r < -1.0) ? -1.0 : (r > 1.0) ? 1.0 : r;
+		double phi = acos(r) * third;
+
+		// Decreasing order: e1 >= e2 >= e3
+		double e1 = q + 2.0*p*cos(phi);
+		double e3 = q + 2.0*p*cos(phi + shift);
+		double e2 = 3.0*q - e1 - e3;
+
+		// Same compare-and-swap sequence as Sort()
+		double t;
+		t = (fabs(e1) > fabs(e2)) ? e1 : e2; e1 = (fabs(e1) > fabs(e2)) ? e2 : e1; e2 = t;
+		t = (fabs(e2) > fabs(e3)) ? e2 : e3; e2 = (fabs(e2) > fabs(e3)) ? e3 : e2; e3 = t;
+		t = (fabs(e1) > fabs(e2)) ? e1 : e2; e1 = (fabs(e1) > fabs(e2)) ? e2 : e1; e2 = t;
+
+		l1 = e1;
+		l2 = e2;
+		l3 = e3;
+	}
+
+	// Vesselness of Frangi et al. from the eigenvalues sorted by
+	// magnitude, zero unless l2 and l3 are negative
+	MITO_HD inline double GetVesselnessAt(double l1, double l2, double l3) {
+
+		const double c = 500.0;
+		const double beta = 0.5;
+		const double alpha = 0.5;
+		const double std = 2 * c * c;
+		const double rbd = 2 * beta * beta;
+		const double rad = 2 * alpha * alpha;
+
+		bool tube = (l2 < 0 && l3 < 0);
+
+		// Evaluated on safe values where the voxel is not a tube
+		double s2 = (tube) ? l2 : -1.0;
+		double s3 = (tube) ? l3 : -1.0;
+
+		double ra = fabs(s2) / fabs(s3);
+		double ran = -ra * ra;
+
+		double rb = fabs(l1) / sqrt(s2*s3);
+		double rbn = -rb * rb;
+
+		double st = sqrt(l1*l1+l2*l2+l3*l3);
+		double stn = -st * st;
+
+		double v = (1-exp(ran/rad)) * exp(rbn/rbd) * (1-exp(stn/std));
+		return (tube) ? v : 0.0;
+	}
+
+	// Reach of the divergence stencil: the normalized gradients are taken
+	// MITO_DIVERGENCE_STEP voxels away along each axis, so voxels closer
+	// than MITO_DIVERGENCE_STEP+1 to the border have no divergence.
+	#define MITO_DIVERGENCE_STEP 2
+
+	// Divergence filter at voxel id of the vesselness S, whose strides
+	// along y and z are sy and sz: minus the divergence of the normalized
+	// gradients around the voxel, over 6, where it is negative. Zero
+	// where S is. Evaluated in double whether S is float or double.
+	template <typename T> MITO_HD inline double GetDivergenceAt(const T *S, long long id, long long sy, long long sz) {
+
+		if (!S[id]) return 0.0;
+
+		const long long s = MITO_DIVERGENCE_STEP;
+		const long long Step[6] = {s, -s, s*sy, -s*sy, s*sz, -s*sz};
+		const long long Axis[3] = {1, sy, sz};
+
+		double v, norm, V[6][3];
+		for (int i = 0; i < 6; i++) {
+			for (int j = 0; j < 3; j++) {
+				V[i][j]  = (double)S[id+Step[i]+Axis[j]];
+				V[i][j] -= (double)S[id+Step[i]-Axis[j]];
+			}
+			norm = sqrt(pow(V[i][0],2)+pow(V[i][1],2)+pow(V[i][2],2));
+			if (norm) {V[i][0]/=norm; V[i][1]/=norm; V[i][2]/=norm; }
+		}
+		v = (V[0][0]-V[1][0])+(V[2][1]-V[3][1])+(V[4][2]-V[5][2]);
+		return (v<0) ? -v / 6.0 : 0.0;
+	}
+
+#endif
@@ -0,0 +1,541 @@
+// ==================================================================
+// MitoGraph: Quantifying Mitochondrial Content in Living Cells
+// Kernel benchmarks on synthetic tubular networks (mitograph_bench).
+// ==================================================================
+
+#include <random>
+#include "ssThinning.h"
+#include "MitoThinning.h"
+
+/* ================================================================
+   ROUTINES OF MitoGraph.cxx
+=================================================================*/
+
+extern std::string MITOGRAPH_VERSION;
+
+void SetDefaultParameters(_mitoObject *mitoObject);
+const float *GetScalarsAsFloat(vtkDataArray *Scalars, std::vector<float> &Buffer);
+void ScalePolyData(vtkSmartPointer<vtkPolyData> PolyData, _mitoObject *mitoObject);
+vtkSmartPointer<vtkImageData> Convert16To8bit(vtkSmartPointer<vtkImageData> Image);
+void GetVesselness(double sigma, vtkSmartPointer<vtkImageData> Image, vtkDataArray *VSSS, _mitoObject *mitoObject, _mitoScaleSpace *Space, const float *FroMax);
+vtkSmartPointer<vtkDataArray> NewVesselnessArray(const _mitoObject *mitoObject, vtkIdType N);
+void GetDivergenceFilter(int *Dim, vtkDataArray *Scalars);
+vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToChar(vtkSmartPointer<vtkImageData> Image, double threshold);
+vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZAdaptive(vtkSmartPointer<vtkImageData> Image, double base_threshold);
+vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZAdaptiveConservative(vtkSmartPointer<vtkImageData> Image, double base_threshold, int z_block_size);
+vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZBlockSimple(vtkSmartPointer<vtkImageData> Image, double threshold, int z_block_size);
+vtkSmartPointer<vtkImageData> BinarizeAndConvertDoubleToCharZBlockEnhanced(vtkSmartPointer<vtkImageData> Image, double threshold, int z_block_size);
+void FillHoles(vtkSmartPointer<vtkImageData> ImageData, bool flood);
+vtkSmartPointer<vtkImageData> GetDistanceImage(vtkSmartPointer<vtkImageData> Binary, _mitoObject *mitoObject);
+vtkSmartPointer<vtkPolyData> ExtractSurface(_mitoObject *mitoObject, vtkSmartPointer<vtkImageData> Field, double value, vtkSmartPointer<vtkImageData> Binary);
+void GetSkeletonAttributes(vtkSmartPointer<vtkPolyData> Skeleton, vtkSmartPointer<vtkPolyData> Surface, vtkSmartPointer<vtkImageData> Distance, vtkSmartPointer<vtkImageData> ImageData, int nneigh, _mitoObject *mitoObject);
+
+/* ================================================================
+   SYNTHETIC NETWORKS
+=================================================================*/
+
+struct _benchVolume {
+    int Dim[3];
+    double dxy;             // pixel size in xy (um)
+    double anisotropy;      // dz / dxy
+    double density;         // tubes per 1000 um3
+    double radius;          // tubule radius (um)
+    double noise;           // standard deviation of the noise, relative to the tubule intensity
+    unsigned int seed;
+    long int ntubes;        // filled in by GenerateNetwork
+    long int nsegments;
+};
+
+// Random numbers from std::mt19937, whose sequence is fixed by the
+// standard, so that a seed gives the same volume on every platform.
+struct _benchRandom {
+    std::mt19937 G;
+    _benchRandom(unsigned int seed) : G(seed) {}
+    double Uniform() {
+        return (G() + 0.5) / 4294967296.0;
+    }
+    double Normal() {
+        double u = Uniform(), v = Uniform();
+        return sqrt(-2.0*log(u)) * cos(2.0*acos(-1.0)*v);
+    }
+};
+
+// Squared distance from p to the segment [a,b]
+static double SegmentDistance2(const double p[3], const double a[3], const double b[3]) {
+    double ab[3] = {b[0]-a[0],b[1]-a[1],b[2]-a[2]};
+    double ap[3] = {p[0]-a[0],p[1]-a[1],p[2]-a[2]};
+    double l2 = ab[0]*ab[0]+ab[1]*ab[1]+ab[2]*ab[2];
+    double t = (l2 > 0) ? (ap[0]*ab[0]+ap[1]*ab[1]+ap[2]*ab[2]) / l2 : 0.0;
+    t = (t < 0) ? 0 : (t > 1) ? 1 : t;
+    double d[3] = {ap[0]-t*ab[0],ap[1]-t*ab[1],ap[2]-t*ab[2]};
+    return d[0]*d[0]+d[1]*d[1]+d[2]*d[2];
+}
+
+// 16-bit stack of a network of tubules built from persistent random
+// walks of 0.25um steps, 30% of which branch off an existing tubule.
+// Tubules run mostly parallel to the xy-plane, as in yeast cells, and
+// have a gaussian cross section of width radius. The intensity is 100
+// for the background and 1100 on the tubules, plus gaussian noise.
+// Anisotropy only changes the sampling in z.
+static vtkSmartPointer<vtkImageData> GenerateNetwork(_benchVolume *V) {
+
+    const double step = 0.25;
+    const int nsteps = 20;
+    const double r = V->radius;
+    const double dz = V->dxy * V->anisotropy;
+    const double L[3] = {V->Dim[0]*V->dxy, V->Dim[1]*V->dxy, V->Dim[2]*dz};
+
+    _benchRandom R(V->seed);
+
+    V->ntubes = std::max(1L,(long int)(V->density * L[0]*L[1]*L[2] / 1000.0 + 0.5));
+
+    // Segments as x0,y0,z0,x1,y1,z1
+    std::vector<double> Seg;
+    for (long int t = 0; t < V->ntubes; t++) {
+        double p[3], u[3], n;
+        if (t && R.Uniform() < 0.3) {
+            size_t s = (size_t)(R.Uniform() * (Seg.size()/6));
+            for (int k = 0; k < 3; k++) p[k] = Seg[6*s+3+k];
+        } else {
+            for (int k = 0; k < 3; k++) p[k] = 2*r + R.Uniform()*std::max(0.0,L[k]-4*r);
+        }
+        for (int k = 0; k < 3; k++) u[k] = R.Normal();
+        u[2] *= 0.3;
+        for (int i = 0; i < nsteps; i++) {
+            for (int k = 0; k < 3; k++) u[k] += 0.3 * R.Normal();
+            n = sqrt(u[0]*u[0]+u[1]*u[1]+u[2]*u[2]);
+            if (n == 0) continue;
+            double q[3];
+            for (int k = 0; k < 3; k++) {
+                u[k] /= n;
+                q[k] = p[k] + step*u[k];
+                // Walls reflect the walk
+                if (q[k] < 2*r || q[k] > L[k]-2*r) {
+                    u[k] = -u[k];
+                    q[k] = std::min(std::max(p[k] + step*u[k],2*r),std::max(2*r,L[k]-2*r));
+                }
+            }
+            for (int k = 0; k < 3; k++) Seg.push_back(p[k]);
+            for (int k = 0; k < 3; k++) Seg.push_back(q[k]);
+            for (int k = 0; k < 3; k++) p[k] = q[k];
+        }
+    }
+    V->nsegments = (long int)(Seg.size() / 6);
+
+    // Tubule profile, the maximum over the segments
+    int *Dim = V->Dim;
+    vtkIdType N = (vtkIdType)Dim[0]*Dim[1]*Dim[2];
+    const double h[3] = {V->dxy, V->dxy, dz};
+    std::vector<float> I(N,0.0f);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int z = 0; z < Dim[2]; z++) {
+        double p[3];
+        p[2] = z * h[2];
+        for (size_t s = 0; s < Seg.size(); s += 6) {
+            const double *a = &Seg[s], *b = &Seg[s+3];
+            if (p[2] < std::min(a[2],b[2])-3*r || p[2] > std::max(a[2],b[2])+3*r) continue;
+            int lo[2], hi[2];
+            for (int k = 0; k < 2; k++) {
+                lo[k] = std::max(0,(int)floor((std::min(a[k],b[k])-3*r)/h[k]));
+                hi[k] = std::min(Dim[k]-1,(int)ceil((std::max(a[k],b[k])+3*r)/h[k]));
+            }
+            for (int y = lo[1]; y <= hi[1]; y++) {
+                p[1] = y * h[1];
+                for (int x = lo[0]; x <= hi[0]; x++) {
+                    p[0] = x * h[0];
+                    float v = (float)exp(-SegmentDistance2(p,a,b)/(2*r*r));
+                    float &w = I[x+(vtkIdType)Dim[0]*(y+(vtkIdType)Dim[1]*z)];
+                    if (v > w) w = v;
+                }
+            }
+        }
+    }
+
+    vtkSmartPointer<vtkUnsignedShortArray> Scalars = vtkSmartPointer<vtkUnsignedShortArray>::New();
+    Scalars -> SetNumberOfComponents(1);
+    Scalars -> SetNumberOfTuples(N);
+    unsigned short *S = Scalars -> GetPointer(0);
+    for (vtkIdType id = 0; id < N; id++) {
+        double v = 100.0 + 1000.0 * (I[id] + V->noise * R.Normal());
+        S[id] = (unsigned short)std::min(65535.0,std::max(0.0,floor(v+0.5)));
+    }
+
+    vtkSmartPointer<vtkImageData> Image = vtkSmartPointer<vtkImageData>::New();
+    Image -> SetDimensions(Dim);
+    Image -> SetSpacing(1,1,1);
+    Image -> SetOrigin(0,0,0);
+    Image -> GetPointData() -> SetScalars(Scalars);
+    return Image;
+}
+
+/* ================================================================
+   TIMINGS
+=================================================================*/
+
+// Runs of a kernel, gathered from the stages of the profile with the
+// same name.
+struct _benchKernel {
+    std::string Name;
+    int Depth;
+    long long Count;
+    long PeakRSS;
+    std::vector<double> Wall;
+    std::vector<double> Cpu;
+};
+
+static double Median(std::vector<double> V) {
+    if (V.empty()) return 0.0;
+    std::sort(V.begin(),V.end());
+    size_t n = V.size();
+    return (n % 2) ? V[n/2] : 0.5*(V[n/2-1]+V[n/2]);
+}
+
+static std::vector<_benchKernel> GetKernels(const _mitoProfile &Profile) {
+    std::vector<_benchKernel> Kernels;
+    for (size_t i = 0; i < Profile.Stages.size(); i++) {
+        const _mitoProfile::_stage &S = Profile.Stages[i];
+        size_t k = 0;
+        while (k < Kernels.size() && Kernels[k].Name != S.Name) k++;
+        if (k == Kernels.size()) {
+            _benchKernel K;
+            K.Name = S.Name;
+            K.Depth = S.Depth;
+            K.Count = S.Count;
+            K.PeakRSS = 0;
+            Kernels.push_back(K);
+        }
+        Kernels[k].Wall.push_back(S.Wall);
+        Kernels[k].Cpu.push_back(S.Cpu);
+        Kernels[k].PeakRSS = std::max(Kernels[k].PeakRSS,S.PeakRSS);
+    }
+    return Kernels;
+}
+
+static void SaveJSON(FILE *f, const _benchVolume &V, const _mitoObject &mitoObject, int nthreads, int repeat, double foreground, const std::vector<_benchKernel> &Kernels) {
+    fprintf(f,"{\n  \"mitograph\": \"%s\",\n",MITOGRAPH_VERSION.c_str());
+    fprintf(f,"  \"volume\": {\"size\": [%d, %d, %d], \"dxy\": %g, \"dz\": %g, \"density\": %g, \"radius\": %g, \"noise\": %g, \"seed\": %u, \"tubes\": %ld, \"segments\": %ld, \"foreground\": %1.6f},\n",
+        V.Dim[0],V.Dim[1],V.Dim[2],V.dxy,V.dxy*V.anisotropy,V.density,V.radius,V.noise,V.seed,V.ntubes,V.nsegments,foreground);
+    fprintf(f,"  \"parameters\": {\"scales\": [");
+    int k = 0;
+    for (double sigma = mitoObject._sigmai; sigma <= mitoObject._sigmaf+0.5*mitoObject._dsigma; sigma += mitoObject._dsigma, k++) {
+        fprintf(f,"%s%g",(k) ? ", " : "",sigma);
+    }
+    fprintf(f,"], \"threshold\": %g, \"z_block_size\": %d, \"adaptive\": %s, \"scale_space\": %s, \"thinning_lut\": %s, \"storage\": \"%s\"},\n",
+        mitoObject._div_threshold,mitoObject._z_block_size,mitoObject._adaptive_threshold?"true":"false",mitoObject._scale_space?"true":"false",mitoObject._thinning_lut?"true":"false",
+        mitoObject._storage_double?"double":"float");
+    fprintf(f,"  \"threads\": %d,\n  \"repeat\": %d,\n  \"kernels\": [",nthreads,repeat);
+    for (size_t i = 0; i < Kernels.size(); i++) {
+        const _benchKernel &K = Kernels[i];
+        double sum = 0.0, wmin = K.Wall[0];
+        for (size_t r = 0; r < K.Wall.size(); r++) {
+            sum += K.Wall[r];
+            wmin = std::min(wmin,K.Wall[r]);
+        }
+        fprintf(f,"%s\n    {\"name\": \"%s\", \"depth\": %d, \"count\": %lld, \"runs\": %d, \"wall_s\": [",(i) ? "," : "",K.Name.c_str(),K.Depth,K.Count,(int)K.Wall.size());
+        for (size_t r = 0; r < K.Wall.size(); r++) fprintf(f,"%s%1.6f",(r) ? ", " : "",K.Wall[r]);
+        fprintf(f,"], \"min_s\": %1.6f, \"median_s\": %1.6f, \"mean_s\": %1.6f, \"cpu_s\": %1.6f, \"peak_rss_kb\": %ld}",
+            wmin,Median(K.Wall),sum/K.Wall.size(),Median(K.Cpu),K.PeakRSS);
+    }
+    fprintf(f,"\n  ]\n}\n");
+}
+
+static vtkSmartPointer<vtkImageData> CopyImage(vtkImageData *Image) {
+    vtkSmartPointer<vtkImageData> Copy = vtkSmartPointer<vtkImageData>::New();
+    Copy -> DeepCopy(Image);
+    return Copy;
+}
+
+/* ================================================================
+   MAIN ROUTINE
+=================================================================*/
+
+int main(int argc, char *argv[]) {
+
+    int i;
+    int repeat = 3;
+    int nthreads = 0;
+    std::string Output, Volume;
+    bool _save_json = false;
+
+    _benchVolume V;
+    V.Dim[0] = V.Dim[1] = 256;
+    V.Dim[2] = 32;
+    V.dxy = 0.1;
+    V.anisotropy = 2.0;
+    V.density = 30.0;
+    V.radius = 0.15;
+    V.noise = 0.1;
+    V.seed = 1;
+
+    // Nothing is written to disk: Thinning3D would export the graph and
+    // the nodes on every repeat, inside its timed stages. A Result, as
+    // the library passes, skips the export of the nodes.
+    _mitoResult Result;
+    _mitoObject mitoObject;
+    SetDefaultParameters(&mitoObject);
+    mitoObject.FileName = "mitograph_bench";
+    mitoObject._export_graph_files = false;
+    mitoObject._output_text = false;
+    mitoObject._export_nodes_label = false;
+    mitoObject.Result = &Result;
+
+    for (i = 0; i < argc; i++) {
+        if (!strcmp(argv[i],"-size") && i+3 < argc) {
+            V.Dim[0] = atoi(argv[i+1]);
+            V.Dim[1] = atoi(argv[i+2]);
+            V.Dim[2] = atoi(argv[i+3]);
+        }
+        if (!strcmp(argv[i],"-xy")) {
+            V.dxy = atof(argv[i+1]);
+        }
+        if (!strcmp(argv[i],"-anisotropy")) {
+            V.anisotropy = atof(argv[i+1]);
+        }
+        if (!strcmp(argv[i],"-density")) {
+            V.density = atof(argv[i+1]);
+        }
+        if (!strcmp(argv[i],"-radius")) {
+            V.radius = atof(argv[i+1]);
+        }
+        if (!strcmp(argv[i],"-noise")) {
+            V.noise = atof(argv[i+1]);
+        }
+        if (!strcmp(argv[i],"-seed")) {
+            V.seed = (unsigned int)atoi(argv[i+1]);
+        }
+        if (!strcmp(argv[i],"-repeat")) {
+            repeat = atoi(argv[i+1]);
+        }
+        if (!strcmp(argv[i],"-threads")) {
+            nthreads = atoi(argv[i+1]);
+        }
+        if (!strcmp(argv[i],"-scales") && i+3 < argc) {
+            mitoObject._sigmai = atof(argv[i+1]);
+            mitoObject._sigmaf = atof(argv[i+2]);
+            mitoObject._nsigma = atoi(argv[i+3]);
+        }
+        if (!strcmp(argv[i],"-threshold")) {
+            mitoObject._div_threshold = atof(argv[i+1]);
+        }
+        if (!strcmp(argv[i],"-z-block-size")) {
+            mitoObject._z_block_size = atoi(argv[i+1]);
+        }
+        if (!strcmp(argv[i],"-adaptive")) {
+            mitoObject._adaptive_threshold = true;
+            mitoObject._nblks = atoi(argv[i+1]);
+        }
+        if (!strcmp(argv[i],"-scale-space")) {
+            mitoObject._scale_space = true;
+        }
+        if (!strcmp(argv[i],"-thinning-lut")) {
+            mitoObject._thinning_lut = true;
+        }
+        if (!strcmp(argv[i],"-storage") && i+1 < argc) {
+            mitoObject._storage_double = !strcmp(argv[i+1],"double");
+        }
+        if (!strcmp(argv[i],"-o")) {
+            Output = argv[i+1];
+            _save_json = true;
+        }
+        if (!strcmp(argv[i],"-save-volume")) {
+            Volume = argv[i+1];
+        }
+    }
+
+    if (V.Dim[0] < 8 || V.Dim[1] < 8 || V.Dim[2] < 3 || V.dxy <= 0 || V.anisotropy <= 0 || V.radius <= 0 || repeat < 1) {
+        printf("Invalid benchmark volume or number of repetitions.\n");
+        return EXIT_FAILURE;
+    }
+
+    mitoObject._dxy = V.dxy;
+    mitoObject._dz = V.dxy * V.anisotropy;
+    mitoObject._dsigma = (mitoObject._nsigma>1) ? (mitoObject._sigmaf-mitoObject._sigmai) / (mitoObject._nsigma-1) : mitoObject._sigmaf;
+    mitoObject.Ox = mitoObject.Oy = mitoObject.Oz = 0.0;
+
+    #ifdef _OPENMP
+        if (nthreads > 0) omp_set_num_threads(nthreads);
+        nthreads = omp_get_max_threads();
+    #else
+        nthreads = 1;
+    #endif
+
+    // The dataset is generated once and every kernel runs repeat times
+    // on a fresh copy of its input, which is not timed. Each kernel
+    // gets the output of the previous ones, as in MultiscaleVesselness.
+    vtkSmartPointer<vtkImageData> Raw = GenerateNetwork(&V);
+    if (!Volume.empty()) SaveImageData(Raw,Volume.c_str());
+
+    int *Dim = Raw -> GetDimensions();
+    vtkIdType id, N = Raw -> GetNumberOfPoints();
+    int r;
+
+    _mitoProfile Profile;
+    mitoObject.Profile = &Profile;
+
+    vtkSmartPointer<vtkImageData> Image = Convert16To8bit(Raw);
+
+    //VESSELNESS
+    vtkSmartPointer<vtkDataArray> VSSS;
+    for (r = 0; r < repeat; r++) {
+        VSSS = NewVesselnessArray(&mitoObject,N);
+        std::vector<float> SpaceBuffer;
+        _mitoScaleSpace Space;
+        size_t s = Profile.Begin("GetVesselness");
+        if (mitoObject._scale_space) {
+            Space.SetInput(GetScalarsAsFloat(Image->GetPointData()->GetScalars(),SpaceBuffer),Dim);
+        }
+        for (double sigma = mitoObject._sigmai; sigma <= mitoObject._sigmaf+0.5*mitoObject._dsigma; sigma += mitoObject._dsigma) {
+            GetVesselness(sigma,Image,VSSS,&mitoObject,(mitoObject._scale_space) ? &Space : NULL,NULL);
+        }
+        Profile.End(s,N);
+    }
+
+    //DIVERGENCE FILTER
+    vtkSmartPointer<vtkDataArray> Div = NewVesselnessArray(&mitoObject,N);
+    for (r = 0; r < repeat; r++) {
+        Div -> DeepCopy(VSSS);
+        size_t s = Profile.Begin("GetDivergenceFilter");
+        GetDivergenceFilter(Dim,Div);
+        Profile.End(s,N);
+    }
+
+    vtkSmartPointer<vtkImageData> ImageEnhanced = vtkSmartPointer<vtkImageData>::New();
+    ImageEnhanced -> ShallowCopy(Image);
+    ImageEnhanced -> GetPointData() -> SetScalars(Div);
+    CleanImageBoundaries(ImageEnhanced);
+
+    //BINARIZATION
+    vtkSmartPointer<vtkImageData> Binary;
+    for (r = 0; r < repeat; r++) {
+        size_t s = Profile.Begin("BinarizeAndConvertDoubleToChar");
+        Binary = BinarizeAndConvertDoubleToChar(ImageEnhanced,mitoObject._div_threshold);
+        Profile.End(s,N);
+    }
+    for (r = 0; r < repeat; r++) {
+        size_t s = Profile.Begin("BinarizeAndConvertDoubleToCharZBlockSimple");
+        BinarizeAndConvertDoubleToCharZBlockSimple(ImageEnhanced,mitoObject._div_threshold,mitoObject._z_block_size);
+        Profile.End(s,N);
+    }
+    for (r = 0; r < repeat; r++) {
+        size_t s = Profile.Begin("BinarizeAndConvertDoubleToCharZBlockEnhanced");
+        BinarizeAndConvertDoubleToCharZBlockEnhanced(ImageEnhanced,mitoObject._div_threshold,mitoObject._z_block_size);
+        Profile.End(s,N);
+    }
+    for (r = 0; r < repeat; r++) {
+        size_t s = Profile.Begin("BinarizeAndConvertDoubleToCharZAdaptive");
+        BinarizeAndConvertDoubleToCharZAdaptive(ImageEnhanced,mitoObject._div_threshold);
+        Profile.End(s,N);
+    }
+    for (r = 0; r < repeat; r++) {
+        size_t s = Profile.Begin("BinarizeAndConvertDoubleToCharZAdaptiveConservative");
+        BinarizeAndConvertDoubleToCharZAdaptiveConservative(ImageEnhanced,mitoObject._div_threshold,mitoObject._z_block_size);
+        Profile.End(s,N);
+    }
+
+    //FILLING HOLES
+    vtkSmartPointer<vtkImageData> Filled;
+    for (r = 0; r < repeat; r++) {
+        Filled = CopyImage(Binary);
+        size_t s = Profile.Begin("FillHolesFlood");
+        FillHoles(Filled,true);
+        Profile.End(s,N);
+    }
+    for (r = 0; r < repeat; r++) {
+        Filled = CopyImage(Binary);
+        size_t s = Profile.Begin("FillHoles");
+        FillHoles(Filled,false);
+        Profile.End(s,N);
+    }
+
+    long int nforeground = 0;
+    vtkDataArray *BinaryScalars = Filled -> GetPointData() -> GetScalars();
+    for (id = 0; id < N; id++) {
+        if (BinaryScalars -> GetTuple1(id)) nforeground++;
+    }
+
+    //CONNECTED COMPONENTS
+    for (r = 0; r < repeat; r++) {
+        std::vector<long int> CSz;
+        vtkSmartPointer<vtkTypeInt32Array> CCVolume = vtkSmartPointer<vtkTypeInt32Array>::New();
+        CCVolume -> SetNumberOfComponents(1);
+        CCVolume -> SetNumberOfTuples(N);
+        CCVolume -> FillComponent(0,0);
+        size_t s = Profile.Begin("LabelConnectedComponents");
+        LabelConnectedComponents(Filled,CCVolume,CSz,26,0);
+        Profile.End(s,N);
+    }
+
+    //THINNING AND SKELETONIZATION, timed by the stages of Thinning3D
+    vtkSmartPointer<vtkPolyData> Skeleton;
+    for (r = 0; r < repeat; r++) {
+        vtkSmartPointer<vtkImageData> Thinned = CopyImage(Filled);
+        mitoObject.attributes.clear();
+        Skeleton = Thinning3D(Thinned,&mitoObject);
+    }
+
+    //SURFACE, with each method of -surface. The widths use the contour.
+    const char *Surfaces[3] = {"Contour","FlyingEdges3D","NarrowBandSurface"};
+    vtkSmartPointer<vtkPolyData> Surface;
+    for (int method = 0; method < 3; method++) {
+        mitoObject._surface = method;
+        for (r = 0; r < repeat; r++) {
+            size_t s = Profile.Begin(Surfaces[method]);
+            vtkSmartPointer<vtkPolyData> Extracted = ExtractSurface(&mitoObject,ImageEnhanced,mitoObject._div_threshold,Filled);
+            Profile.End(s,Extracted->GetNumberOfPoints());
+            if (method == 0) Surface = Extracted;
+        }
+    }
+    mitoObject._surface = MITO_SURFACE_CONTOUR;
+    ScalePolyData(Surface,&mitoObject);
+
+    vtkSmartPointer<vtkCleanPolyData> Clean = vtkSmartPointer<vtkCleanPolyData>::New();
+    Clean -> SetInputData(Skeleton);
+    Clean -> Update();
+    Skeleton -> DeepCopy(Clean->GetOutput());
+    ScalePolyData(Skeleton,&mitoObject);
+
+    for (r = 0; r < repeat; r++) {
+        vtkSmartPointer<vtkPolyData> Copy = vtkSmartPointer<vtkPolyData>::New();
+        Copy -> DeepCopy(Skeleton);
+        mitoObject.attributes.clear();
+        size_t s = Profile.Begin("GetSkeletonAttributes");
+        GetSkeletonAttributes(Copy,Surface,NULL,Raw,6,&mitoObject);
+        Profile.End(s,Skeleton->GetNumberOfPoints());
+    }
+
+    //WIDTHS FROM THE DISTANCE TRANSFORM, -width dt
+    for (r = 0; r < repeat; r++) {
+        size_t s = Profile.Begin("GetDistanceTransform");
+        vtkSmartPointer<vtkImageData> Distance = GetDistanceImage(Filled,&mitoObject);
+        Profile.End(s,N);
+        vtkSmartPointer<vtkPolyData> Copy = vtkSmartPointer<vtkPolyData>::New();
+        Copy -> DeepCopy(Skeleton);
+        mitoObject.attributes.clear();
+        s = Profile.Begin("GetSkeletonAttributesDT");
+        GetSkeletonAttributes(Copy,Surface,Distance,Raw,6,&mitoObject);
+        Profile.End(s,Skeleton->GetNumberOfPoints());
+    }
+
+    mitoObject.Profile = NULL;
+
+    std::vector<_benchKernel> Kernels = GetKernels(Profile);
+    double foreground = (double)nforeground / N;
+
+    FILE *f = (_save_json) ? fopen(Output.c_str(),"w") : stdout;
+    if (!f) {
+        printf("File %s cannot be created.\n",Output.c_str());
+        return EXIT_FAILURE;
+    }
+    SaveJSON(f,V,mitoObject,nthreads,repeat,foreground,Kernels);
+    if (_save_json) {
+        fclose(f);
+        printf("%-52s %10s %12s\n","kernel","count","median (s)");
+        for (size_t k = 0; k < Kernels.size(); k++) {
+            std::string Name = std::string(2*Kernels[k].Depth,' ') + Kernels[k].Name;
+            printf("%-52s %10lld %12.6f\n",Name.c_str(),Kernels[k].Count,Median(Kernels[k].Wall));
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -7,10 +7,22 @@
 #include <cstdlib>
 #include <cstring>
 #include <float.h>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <stdexcept>
+#include <algorithm>
+#include <condition_variable>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #ifdef _WIN32
 #include "includes/dirent.h"
 #else
 #include <dirent.h>
+#include <unistd.h>
 #endif
 
 #include <vtkMath.h>
@@ -20,6 +32,7 @@
 #include <vtkCellArray.h>
 #include <vtkCell.h>
 #include <vtkIdList.h>
+#include <vtkTypeInt32Array.h>
 #include <vtkTypeInt64Array.h>
 #include <vtkImageData.h>
 #include <vtkDataArray.h>
@@ -57,6 +70,29 @@
 #include <vtkImageRFFT.h>
 #include <vtkImageCast.h>
 #include <vtkPoints.h>
+#include <vtkVersion.h>
+
+// Point locator that can be queried from several threads at once
+#if VTK_MAJOR_VERSION >= 8
+#include <vtkStaticPointLocator.h>
+#define MITO_STATIC_LOCATOR
+#endif
+
+// Multithreaded marching cubes (VTK's SMP backend)
+#if VTK_MAJOR_VERSION >= 8
+#include <vtkFlyingEdges3D.h>
+#define MITO_FLYING_EDGES
+#endif
+
+// Surface extraction, -surface
+#define MITO_SURFACE_CONTOUR 0
+#define MITO_SURFACE_FLYING_EDGES 1
+#define MITO_SURFACE_NARROW_BAND 2
+#define MITO_SURFACE_OFF 3
+
+// Device of the vesselness and divergence filter, -device
+#define MITO_DEVICE_CPU 0
+#define MITO_DEVICE_GPU 1
 
 #ifndef _MITOGRAPH_ENV_VARS
 
@@ -64,11 +100,31 @@
 
 	struct attribute { std::string name; double value; };
 
+	struct _mitoProfile;
+	struct _mitoColumns;
+	struct _mitoGraph;
+	struct _mitoResult;
+	struct _mitoManifest;
+
+	// Options of one output set of -sweep, applied on top of the options
+	// of the run. The same divergence is segmented for every output set
+	// that shares the 8-bit conversion (_z_adaptive and _z_block_size).
+	struct _mitoTrial {
+		std::string Suffix;             // appended to the file name of the outputs
+		double _div_threshold;
+		bool _z_adaptive;
+		bool _z_enhanced;
+		int _z_block_size;
+		bool _smart_component_filtering;
+		int _min_component_size;
+	};
+
 	struct _mitoObject {
 	    std::string Type;
 	    std::string Folder;
 	    std::string FileName;
 		bool _analyze;
+		bool _analyze_r;                // run GraphAnalyzer.R instead of the built-in analysis
 		bool _binary_input;
 	    double Ox;
 	    double Oy;
@@ -86,6 +142,53 @@
 		bool _smart_component_filtering;
 		int _min_component_size;
 
+		// Pixel sizes and run options. Each file being processed works
+		// on its own copy, so these may change per file (e.g. _dz is
+		// set to _dxy when the stack is resampled).
+		double _dxy;
+		double _dz;
+		double _rad;
+		double _div_threshold;
+		double _resample;
+		bool _checkonly;
+		int _checkonly_bin;             // voxels binned along x and y per pixel of the -checkonly preview
+		bool _export_graph_files;
+		bool _export_image_binary;
+		bool _export_image_resampled;
+		bool _scale_polydata_before_save;
+		bool _export_nodes_label;
+		bool _improve_skeleton_quality; // when true nodes with degree zero are expanded and detected,
+		                                // and all non-zero voxels are checked to be analyzed.
+		int _nthreads;                  // OpenMP threads per file, 0 for the default
+		bool _thinning_lut;             // use the 2^26 lookup table to match the thinning masks
+		bool _scale_space;              // derive each Gaussian scale from the previous one
+		int _stream_slab;               // z-planes per slab when streaming, 0 to load the whole stack
+		bool _mmap_input;               // read uncompressed (Big)TIFF stacks through a memory map
+		bool _profile;                  // write the stage timings next to the .mitograph file
+		bool _output_text;              // write the .gnet, .coo, .txt and .cc text files
+		bool _output_binary;            // write the same data to a columnar .mgb file
+		bool _output_compress;          // zlib-compress the columns of the .mgb file
+		bool _eigen_jacobi;             // Hessian eigenvalues with vtkMath::Diagonalize3x3 instead of the closed form
+		bool _fill_holes_flood;         // fill the background not reached from the faces of the stack
+		int _surface;                   // MITO_SURFACE_*, how the surface used for the widths is extracted
+		bool _width_dt;                 // widths from the distance transform of the binary image instead of the surface
+		int _device;                    // MITO_DEVICE_*, where the vesselness and divergence filter run
+		bool _storage_double;           // vesselness and divergence stored as double instead of float
+		bool _sweep_cache;              // keep the divergence of -sweep in a cache file next to the stack
+		bool _cache_stages;             // keep the divergence and the segmentation in cache files next to the stack
+		bool _resume;                   // skip the files the manifest records as done
+		int _sweep_jobs;                // output sets of -sweep segmented at the same time
+		std::vector<_mitoTrial> Sweep;  // output sets of -sweep, empty otherwise
+
+		_mitoProfile *Profile;          // stage timings of the file being processed, NULL unless -profile
+		_mitoColumns *Columns;          // columns of the .mgb file being built, NULL unless binary output
+		_mitoGraph *Graph;              // graph and .cc table of the file being processed, NULL unless -analyze
+		vtkImageData *Input;            // stack given in memory (library API, -sweep), NULL to read FileName
+		vtkImageData *Divergence;       // divergence shared by the output sets of -sweep, NULL to compute it
+		_mitoManifest *Manifest;        // run manifest of the folder, NULL with -manifest_off
+		_mitoResult *Result;            // outputs returned by the library API, NULL otherwise. Nothing is
+		                                // written to disk when it is set
+
 	    std::vector<attribute> attributes;
 	};
 
@@ -94,3 +197,12 @@
 // #define DEBUG
 #include "ssThinning.h"
 #include "MitoThinning.h"
+#include "MitoFilters.h"
+#include "MitoVoxel.h"
+#include "MitoCuda.h"
+#include "MitoStack.h"
+#include "MitoProfile.h"
+#include "MitoBinary.h"
+#include "MitoManifest.h"
+#include "MitoBatch.h"
+#include "MitoGraphAPI.h"
@@ -64,6 +64,20 @@
 			rotate(vector,vector90,axis);		 // 90� rotation
 		 rotate(vector90,vector180,axis);		 // 90� rotation
 		rotate(vector180,vector270,axis);		 // 90� rotation
+
+		compile();
+	}
+
+	void ssMask::compile() {
+		int *vec[4] = {vector,vector90,vector180,vector270};
+		for (int r=4;r--;) {
+			care[r] = value[r] = any[r] = 0;
+			for (int i=26;i--;) {
+				if (vec[r][i]==0||vec[r][i]==1) care[r] |= 1u << i;
+				if (vec[r][i]==1) value[r] |= 1u << i;
+				if (vec[r][i]==3) any[r] |= 1u << i;
+			}
+		}
 	}
 
 	void ssMask::print_mask() {
@@ -150,6 +164,27 @@
 		return false;
 	}
 
+	bool ssMask::match(unsigned int key) {
+		for (int r=0;r<4;r++) {
+			if ((key&care[r])==value[r] && (!any[r]||(key&any[r]))) return true;
+		}
+		return false;
+	}
+
+	void ssMask::fill_table(unsigned char *Table) {
+		unsigned int key, sub, free;			 // Enumerates all the subsets of
+		for (int r=4;r--;) {					 // the bits that are  not  fixed
+			free = ~care[r] & 0x3FFFFFF;		 // by the mask.
+			sub = free;
+			while (true) {
+				key = value[r] | sub;
+				if (!any[r]||(key&any[r])) Table[key>>3] |= (unsigned char)(1 << (key&7));
+				if (!sub) break;
+				sub = (sub-1) & free;
+			}
+		}
+	}
+
 	//===========================================================================
 
 	DirssMasks::DirssMasks(char direction) {	 // Constructor: the 24 maks  are
@@ -170,6 +205,17 @@
 		return false;
 	}
 
+	bool DirssMasks::match(unsigned int key) {
+		for (int i=6;i--;) {
+			if (BaseMasks[i].match(key)) return true;
+		}
+		return false;
+	}
+
+	void DirssMasks::fill_table(unsigned char *Table) {
+		for (int i=6;i--;) BaseMasks[i].fill_table(Table);
+	}
+
 	//===========================================================================
 
 	ssThinVox::ssThinVox() {					 // Constructor:
@@ -195,4 +241,21 @@
 		return false;
 	}
 
+	bool ssThinVox::match(int direction, unsigned int key) {
+		return DirMask[direction]->match(key);
+	}
+
+	std::vector<unsigned char> ssThinVox::LookupTable[6];
+
+	void ssThinVox::build_lookup_table() {
+		static std::once_flag built;
+		std::call_once(built,[](){
+			ssThinVox STV;
+			for (int d=6;d--;) {
+				LookupTable[d].assign(1<<23,0);	 // 2^26 bits (8 MB)
+				STV.DirMask[d]->fill_table(&LookupTable[d][0]);
+			}
+		});
+	}
+
 	//===========================================================================
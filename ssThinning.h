@@ -54,6 +54,13 @@
 		static bool matchf(int ***Vol, int *vec);
 		static void rotate(int vector[26],int *vector_rot,char axis);
 
+		unsigned int care[4];					 // Compiled  version of the four
+		unsigned int value[4];					 // masks   for   neighborhoods
+		unsigned int any[4];					 // packed as 26-bit keys:  bits
+												 // that must match, their values
+		void compile();							 // and bits of which at least one
+												 // must be 1 (index 3).
+
 	  public:
 		ssMask();
 		~ssMask();
@@ -67,6 +74,11 @@
 												 // matchs with the  neighborhood
 												 // of the voxel p  in the volume
 												 // Vol.
+		bool match(unsigned int key);			 // Same  test  for a neighborhood
+												 // packed as a key:  bit i is the
+												 // value of the neighbor  i.
+		void fill_table(unsigned char *Table);	 // Sets the bits of  all the keys
+												 // matched by the four masks.
 
 		void set_mask_from_u(int umask[26]);	 // Generates the four masks from
 												 // the   mask  "umask"   in   up
@@ -85,6 +97,8 @@
 			DirssMasks(char direction);			 // four  rotations.   Then,  the
 			~DirssMasks();						 // class DirMask includes 6x4=24
 			bool match(int ***Vol);		 		 // masks for the same direction.
+			bool match(unsigned int key);
+			void fill_table(unsigned char *Table);
 
 	};
 
@@ -101,6 +115,19 @@
 			ssThinVox();
 			~ssThinVox();
 			bool match(int direction, int ***V);
+			bool match(int direction, unsigned int key);
+
+												 // Lookup  table  with one bit per
+												 // key  (2^26) and direction.  It
+												 // is built once  and  shared  by
+												 // all instances and threads.
+			static void build_lookup_table();
+			static bool match_lut(int direction, unsigned int key) {
+				return (LookupTable[direction][key>>3] >> (key&7)) & 1;
+			}
+
+		private:
+			static std::vector<unsigned char> LookupTable[6];
 
 	};
 
@@ -1,749 +1,489 @@
 // ==================================================================
 // Liya Ding. 2016.04.
-// This code is developed based on the frame work of MitoGraph. 
+// This code is developed based on the frame work of MitoGraph.
 // It reuses a majority part of the code of MitoGraph.
-// MitoGraph is written by Matheus P. Viana, 
+// MitoGraph is written by Matheus P. Viana,
 // from Susanne Rafelski Lab, University of California Irvine
 // ==================================================================
 
-#include <list>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <string>
+#include <vector>
+#include <climits>
+#include <algorithm>
 
-#include <vtkMath.h>
-#include <vtkPolyLine.h>
-#include <vtkCellArray.h>
-#include <vtkLongArray.h>
+#include <vtkIntArray.h>
 #include <vtkImageData.h>
 #include <vtkDataArray.h>
-#include <vtkTransform.h>
-#include <vtkDataObject.h>
-#include <vtkFloatArray.h>
-#include <vtkVectorText.h>
-#include <vtkInformation.h>
-#include <vtkSphereSource.h>
 #include <vtkSmartPointer.h>
-#include <vtkStructuredPoints.h>
-#include <vtkInformationVector.h>
 #include <vtkUnsignedCharArray.h>
 #include <vtkUnsignedShortArray.h>
 #include <vtkStructuredPointsWriter.h>
-#include <vtkTransformPolyDataFilter.h>
-#include <vtkImageExtractComponents.h>
-#include <vtkStructuredPointsReader.h>
 #include <vtkImageGaussianSmooth.h>
-#include <vtkKdTreePointLocator.h>
 #include <vtkAppendPolyData.h>
-#include <vtkPolyDataReader.h>
 #include <vtkPolyDataWriter.h>
 #include <vtkContourFilter.h>
-#include <vtkDoubleArray.h>
 #include <vtkTIFFReader.h>
-#include <vtkTIFFWriter.h>
-#include <vtkPNGWriter.h>
 #include <vtkPointData.h>
-#include <vtkImageRFFT.h>
-#include <vtkImageCast.h>
 #include <vtkPoints.h>
-#include <vtkSmartPointer.h>
 #include <vtkDirectory.h>
-#include <vtkSmoothPolyDataFilter.h>
 #include <vtksys/SystemTools.hxx>
 #include <vtkImageResample.h>
-#include <string>
+
+#include "MitoStack.h"
+#include "MitoBatch.h"
 
 bool _DebugFlag = true;
-double _rad = 0.150;
 double _dxy, _dz = -1.0;
-bool _export_graph_files = true;
 bool _export_image_resampled = true;
-bool _adaptive_threshold = false;
-bool _scale_polydata_before_save = true;
-bool _improve_skeleton_quality = false;
-bool _export_nodes_label = true;
-double _div_threshold = 0.1666667;
-bool _checkonly = false;
-bool _width = false;
-bool _resampleonly = false;
+bool _mmap_input = false;
 bool _image_2_surface_flag = false;
-bool _filename_specific = false;
-
-
-    //               |------06------|
-    //               |------------------------18------------------------|
-    //               |---------------------------------------26----------------------------------|
-int ssdx_sort[26] = { 0,-1, 0, 1, 0, 0,-1, 0, 1, 0,-1, 1, 1,-1,-1, 0, 1, 0, -1, 1, 1,-1,-1, 1, 1,-1};
-int ssdy_sort[26] = { 0, 0,-1, 0, 1, 0, 0,-1, 0, 1,-1,-1, 1, 1, 0,-1, 0, 1, -1,-1, 1, 1,-1,-1, 1, 1};
-int ssdz_sort[26] = {-1, 0, 0, 0, 0, 1,-1,-1,-1,-1, 0, 0, 0, 0, 1, 1, 1, 1, -1,-1,-1,-1, 1, 1, 1, 1};
-
-// In order to acess the voxel (x,y,z) from ImageJ, I should use
-// GetId(x,(Dim[1]-1)-y,z,Dim);
-// Or change the volume orientation...
-
-/**========================================================
- Auxiliar functions
- =========================================================*/
-
-
-// This routine returns the x of the id-th point of a 3D volume
-// of size Dim[0]xDim[1]xDim[2]
- int  GetX(vtkIdType id, int *Dim);
-
-// This routine returns the y of the id-th point of a 3D volume
-// of size Dim[0]xDim[1]xDim[2]
- int  GetY(vtkIdType id, int *Dim);
-
-// This routine returns the z of the id-th point of a 3D volume
-// of size Dim[0]xDim[1]xDim[2]
- int  GetZ(vtkIdType id, int *Dim);
-
-// This routine returns the id of a point located at coordinate
-// (x,y,z) of a 3D volume of size Dim[0]xDim[1]xDim[2]
- vtkIdType GetId(int x, int y, int z, int *Dim);
-
-// Swap values
- void Swap(double *x, double *y);
 
-// Simple sorting algorithm and the output is such that
-// l3 >= l2 >= l3
- void Sort(double *l1, double *l2, double *l3);
+// Each object is smoothed with a Gaussian of this standard deviation.
+// vtkImageGaussianSmooth truncates it at 1.5 standard deviations, so
+// its kernel reaches at most SEG2PARA_RADIUS voxels.
+#define SEG2PARA_SIGMA 2.5
+#define SEG2PARA_RADIUS 4
 
-// Calculate the Frobenius norm of a given 3x3 matrix
-// http://mathworld.wolfram.com/FrobeniusNorm.html
- double FrobeniusNorm(double M[3][3]);
-
-// This routine scales the polydata points to the correct dimension
-// given by parameters _dxy and _dz.
- void ScalePolyData(vtkSmartPointer<vtkPolyData> PolyData);
- void PolyData2XYPixelScale(vtkSmartPointer<vtkPolyData> PolyData);
+// Value of the object voxels in the binary image that is smoothed.
+// Earlier versions wrote 40000 into an 8-bit array, which wrapped to
+// 64, and the contour value of 5 was chosen for it.
+#define SEG2PARA_FOREGROUND 64
 
 /* ================================================================
-   IMAGE TRANSFORM
+   I/O ROUTINES
 =================================================================*/
 
-// This routine converts 16-bit volumes into 8-bit volumes by
-// linearly scaling the original range of intensities [min,max]
-// in [0,255] (http://rsbweb.nih.gov/ij/docs/guide/146-28.html)
-   vtkSmartPointer<vtkImageData> Convert16To8bit(vtkSmartPointer<vtkImageData> Image);
+// Reads the label stack FileName, memory-mapped with -mmap when it is
+// an uncompressed TIFF. Returns NULL if it cannot be read.
+static vtkSmartPointer<vtkImageData> ReadLabels(const std::string &FileName);
 
-// Apply a threshold to a ImageData and converts the result in
-// a 8-bit ImageData.
-   vtkSmartPointer<vtkImageData> BinarizeAndConvertToDouble(vtkSmartPointer<vtkImageData> Image, double threshold);
+static void SaveImageData(vtkSmartPointer<vtkImageData> Image, const char FileName[], bool _resample = false);
+static void SavePolyData(vtkSmartPointer<vtkPolyData> PolyData, const char FileName[]);
 
-// Fill holes in the 3D image
-   void FillHoles(vtkSmartPointer<vtkImageData> ImageData);
+// This routine scales the z coordinate of the polydata points by
+// _dz/_dxy, so that they are in pixels along all the axes.
+static void PolyData2XYPixelScale(vtkSmartPointer<vtkPolyData> PolyData);
 
 /* ================================================================
-   I/O ROUTINES
+   OBJECTS
 =================================================================*/
 
-// Different utilities of this tool, major function
-   int utilities(const char FileName[]);
+// Bounding box of every label l >= 1 of the stack S in a single pass:
+// Bounds[6*l] to Bounds[6*l+5] receive xmin, xmax, ymin, ymax, zmin
+// and zmax, with xmin > xmax for the labels that are absent. A voxel
+// belongs to label l when l-0.1 <= v < l+0.1, and labels go up to the
+// largest value of the stack.
+template <typename T> static int GetLabelBounds(const T *S, const int *Dim, std::vector<int> &Bounds);
 
-   void SaveImageData(vtkSmartPointer<vtkImageData> Image, const char FileName[], bool _resample = false);
-   void SavePolyData(vtkSmartPointer<vtkPolyData> PolyData, const char FileName[], bool scale = _scale_polydata_before_save);
+// Object made of the voxels of label l inside the box [x0,x1]x[y0,y1]x
+// [z0,z1] of S, as an 8-bit image of that box placed at its position
+// in Image
+template <typename T> static vtkSmartPointer<vtkImageData> GetObjectImage(const T *S, vtkImageData *Image, int l, const int *Box);
 
-/* ================================================================*/
+// Smooth surface of every object of the label stack Image, each one
+// extracted from its bounding box only. The points of an object carry
+// its label as scalars.
+static vtkSmartPointer<vtkPolyData> GetObjectSurfaces(vtkSmartPointer<vtkImageData> Image);
 
-   void SaveImageData(vtkSmartPointer<vtkImageData> Image, const char FileName[], bool _resample) {
-
-   	if(_DebugFlag){
-   		printf("Saving ImageData File...\n");
-   	}
-
-   	vtkSmartPointer<vtkStructuredPointsWriter> writer = vtkSmartPointer<vtkStructuredPointsWriter>::New();
-
-   	if (_resample) {
-   		if(_DebugFlag){
-   			printf("\tResampling data...%f\t%f\n",_dxy,_dz);
-   		}
-   		vtkSmartPointer<vtkImageResample> Resample = vtkSmartPointer<vtkImageResample>::New();
-   		Resample -> SetInterpolationModeToLinear();
-   		Resample -> SetDimensionality(3);
-   		Resample -> SetInputData(Image);
-   		Resample -> SetAxisMagnificationFactor(0,1.0);
-   		Resample -> SetAxisMagnificationFactor(1,1.0);
-   		Resample -> SetAxisMagnificationFactor(2,_dz/_dxy);
-   		Resample -> Update();
-
-   		vtkSmartPointer<vtkImageData> ImageResampled = Resample -> GetOutput();
-   		ImageResampled -> SetSpacing(1,1,1);
-
-   		writer -> SetInputData(ImageResampled);
-   	} else {
-
-   		writer -> SetInputData(Image);
-
-   	}
-
-   	writer -> SetFileType(VTK_BINARY);
-   	writer -> SetFileName(FileName);
-   	writer -> Write();
-
-   	if(_DebugFlag){
-   		printf("\tFile Saved!\n");
-   	}
-   }
-
-   void SavePolyData(vtkSmartPointer<vtkPolyData> PolyData, const char FileName[], bool scale) {
-
-   	if(_DebugFlag){
-   		printf("Saving PolyData from XYZ list...\n");
-   	}
-
-   	if(_DebugFlag){
-   		printf("\t#Points in PolyData file: %llu.\n",(vtkIdType)PolyData->GetNumberOfPoints());
-   	}
-
-   	vtkSmartPointer<vtkPolyDataWriter> Writer = vtkSmartPointer<vtkPolyDataWriter>::New();
-   	Writer -> SetFileType(VTK_BINARY);
-   	Writer -> SetFileName(FileName);
-   	Writer -> SetInputData(PolyData);
-   	Writer -> Write();
-
-   	if(_DebugFlag){
-   		printf("\tFile Saved!\n");
-   	}
-   }
-
-/**========================================================
- Auxiliar functions
- =========================================================*/
-
- int GetX(vtkIdType id, int *Dim) {
- 	return (int) ( id % (vtkIdType)Dim[0] );
- }
-
- int GetY(vtkIdType id, int *Dim) {
- 	return (int) (  ( id % (vtkIdType)(Dim[0]*Dim[1]) ) / (vtkIdType)Dim[0]  );
- }
-
- int GetZ(vtkIdType id, int *Dim) {
- 	return (int) ( id / (vtkIdType)(Dim[0]*Dim[1]) );
- }
-
- vtkIdType GetId(int x, int y, int z, int *Dim) {
- 	return (vtkIdType)(x+y*Dim[0]+z*Dim[0]*Dim[1]);
- }
-
- vtkIdType GetReflectedId(int x, int y, int z, int *Dim) {
- 	int rx = ceil(0.5*Dim[0]);
- 	int ry = ceil(0.5*Dim[1]);
- 	int rz = ceil(0.5*Dim[2]);
- 	int sx = (x-(rx-0.5)<0) ? -rx : Dim[0]-rx;
- 	int sy = (y-(ry-0.5)<0) ? -ry : Dim[1]-ry;
- 	int sz = (z-(rz-0.5)<0) ? -rz : Dim[2]-rz;
- 	return GetId(x-sx,y-sy,z-sz,Dim);
- }
-
- void Swap(double *x, double *y) {
- 	double t = *y; *y = *x; *x = t;
- }
-
- void Sort(double *l1, double *l2, double *l3) {
- 	if (fabs(*l1) > fabs(*l2)) Swap(l1,l2);
- 	if (fabs(*l2) > fabs(*l3)) Swap(l2,l3);
- 	if (fabs(*l1) > fabs(*l2)) Swap(l1,l2);
- }
-
- double FrobeniusNorm(double M[3][3]) {
- 	double f = 0.0;
- 	for (int i = 3;i--;)
- 		for (int j = 3;j--;)
- 			f += M[i][j]*M[i][j];
- 		return sqrt(f);
- 	}
-
- 	void ScalePolyData(vtkSmartPointer<vtkPolyData> PolyData) {
- 		double r[3];
- 		vtkPoints *Points = PolyData -> GetPoints();
- 		for (vtkIdType id = 0; id < Points -> GetNumberOfPoints(); id++) {
- 			Points -> GetPoint(id,r);
- 			Points -> SetPoint(id,_dxy*r[0],_dxy*r[1],_dz*r[2]);
- 		}
- 		Points -> Modified();
- 	}
-
-
- 	void PolyData2XYPixelScale(vtkSmartPointer<vtkPolyData> PolyData) {
- 		double r[3];
- 		vtkPoints *Points = PolyData -> GetPoints();
- 		for (vtkIdType id = 0; id < Points -> GetNumberOfPoints(); id++) {
- 			Points -> GetPoint(id,r);
- 			Points -> SetPoint(id,r[0],r[1],r[2]*_dz/_dxy);
- 		}
- 		Points -> Modified();
- 	}
+// Different utilities of this tool, major function
+static int utilities(const std::string &FileName);
 
+/* ================================================================*/
 
-/* ================================================================
-   I/O ROUTINES
-=================================================================*/
+static vtkSmartPointer<vtkImageData> ReadLabels(const std::string &FileName) {
 
-/* ================================================================
-   IMAGE TRANSFORM
-=================================================================*/
+    vtkSmartPointer<vtkImageData> Image;
 
-   vtkSmartPointer<vtkImageData> Convert16To8bit(vtkSmartPointer<vtkImageData> Image) {
+    _mitoStack Stack;
+    if (_mmap_input && Stack.Open(FileName)) {
+        return ReadMappedStack(Stack,0,Stack.Dim[2]-1);
+    }
 
-    // 8-Bit images
-   	if (Image -> GetScalarType() == VTK_UNSIGNED_CHAR) {
+    // Loading multi-paged TIFF file (Supported by VTK 6.2 and higher)
+    vtkSmartPointer<vtkTIFFReader> TIFFReader = vtkSmartPointer<vtkTIFFReader>::New();
+    if (!TIFFReader -> CanReadFile(FileName.c_str())) {
+        printf("File %s cannnot be opened.\n",FileName.c_str());
+        return NULL;
+    }
+    TIFFReader -> SetFileName(FileName.c_str());
+    TIFFReader -> Update();
+
+    Image = TIFFReader -> GetOutput();
+    if (!Image -> GetNumberOfPoints()) {
+        printf("File %s cannot be read.\n",FileName.c_str());
+        return NULL;
+    }
+
+    return Image;
+}
 
-   		return Image;
+static void SaveImageData(vtkSmartPointer<vtkImageData> Image, const char FileName[], bool _resample) {
 
-    // 16-Bit images
-   	} else if (Image -> GetScalarType() == VTK_UNSIGNED_SHORT) {
+    if(_DebugFlag){
+        printf("Saving ImageData File...\n");
+    }
 
-   		if(_DebugFlag){
-   			printf("Converting from 16-bit to 8-bit...\n");
-   		}
+    vtkSmartPointer<vtkStructuredPointsWriter> writer = vtkSmartPointer<vtkStructuredPointsWriter>::New();
 
-   		vtkSmartPointer<vtkImageData> Image8 = vtkImageData::New();
-   		Image8 -> ShallowCopy(Image);
-
-   		vtkDataArray *ScalarsShort = Image -> GetPointData() -> GetScalars();
-   		unsigned long int N = ScalarsShort -> GetNumberOfTuples();
-   		double range[2];
-   		ScalarsShort -> GetRange(range);
-
-   		if(_DebugFlag){
-   			printf("\tOriginal intensities range: [%d-%d]\n",(int)range[0],(int)range[1]);
-   		}
-
-   		vtkSmartPointer<vtkUnsignedCharArray> ScalarsChar = vtkSmartPointer<vtkUnsignedCharArray>::New();
-   		ScalarsChar -> SetNumberOfComponents(1);
-   		ScalarsChar -> SetNumberOfTuples(N);
-
-   		double x, y;
-   		vtkIdType register id;
-   		for ( id = N; id--; ) {
-   			x = ScalarsShort -> GetTuple1(id);
-   			y = 255.0 * (x-range[0]) / (range[1]-range[0]);
-   			ScalarsChar -> SetTuple1(id,(unsigned char)y);
-   		}
-   		ScalarsChar -> Modified();
-
-   		Image8 -> GetPointData() -> SetScalars(ScalarsChar);
-   		return Image8;
-
-    // Other depth
-   	} else {
-   		return NULL;
-   	}
-   }
-
-   vtkSmartPointer<vtkImageData> BinarizeAndConvertToDouble(vtkSmartPointer<vtkImageData> Image, double threshold) {
-
-   	vtkSmartPointer<vtkImageData> Image16 = vtkImageData::New();
-   	Image16 -> ShallowCopy(Image);
-
-   	vtkDataArray *ScalarsDouble = Image -> GetPointData() -> GetScalars();
-   	unsigned long int N = ScalarsDouble -> GetNumberOfTuples();
-   	double range[2];
-   	ScalarsDouble -> GetRange(range);
-
-   	vtkSmartPointer<vtkUnsignedCharArray> ScalarsChar = vtkSmartPointer<vtkUnsignedCharArray>::New();
-   	ScalarsChar -> SetNumberOfComponents(1);
-   	ScalarsChar -> SetNumberOfTuples(N);
-
-   	double x;
-
-
-
-   	if (threshold > 0) {
-   		for ( vtkIdType id = N; id--; ) {
-   			x = ScalarsDouble -> GetTuple1(id);
-   			if (x< threshold-0.1) {
-   				ScalarsChar -> SetTuple1(id,0);
-   			} else {
-   				if(x< threshold+0.1)
-   				{
-   					ScalarsChar -> SetTuple1(id,40000);
-   				}
-   				else
-   				{
-   					ScalarsChar -> SetTuple1(id,0);
-   				}
-   			}
-   		}
-   	} else {
-   		for ( vtkIdType id = N; id--; ) {
-   			x = ScalarsDouble -> GetTuple1(id);
-   			ScalarsChar -> SetTuple1(id,(int)(40000*(x-range[0])/(range[1]-range[0])));
-   		}        
-   	}
-   	ScalarsChar -> Modified();
-
-   	Image16 -> GetPointData() -> SetScalars(ScalarsChar);
-   	return Image16;
-
-   }
-
-   void FillHoles(vtkSmartPointer<vtkImageData> ImageData) {
-
-   	if(_DebugFlag){
-   		printf("\tSearching for holes in the image...\n");
-   	}
-
-   	int *Dim = ImageData -> GetDimensions();
-   	vtkIdType N = ImageData -> GetNumberOfPoints();
-
-   	vtkIdType i, s, ido, id;
-
-   	int x, y, z;
-   	double v, r[3];
-   	bool find = true;
-   	long long int ro[3];
-   	long int scluster, label;
-   	ro[0] = Dim[0] * Dim[1] * Dim[2];
-   	ro[1] = Dim[0] * Dim[1];
-
-   	vtkSmartPointer<vtkIdList> CurrA = vtkSmartPointer<vtkIdList>::New();
-   	vtkSmartPointer<vtkIdList> NextA = vtkSmartPointer<vtkIdList>::New();
-   	vtkSmartPointer<vtkLongArray> CSz = vtkSmartPointer<vtkLongArray>::New();
-   	vtkSmartPointer<vtkLongArray> Volume = vtkSmartPointer<vtkLongArray>::New();
-   	Volume -> SetNumberOfComponents(1);
-   	Volume -> SetNumberOfTuples(N);
-   	Volume -> FillComponent(0,0);
-
-   	for (x = 1; x < Dim[0]-1; x++) {
-   		for (y = 1; y < Dim[1]-1; y++) {
-   			for (z = 1; z < Dim[2]-1; z++) {
-   				id = ImageData -> FindPoint(x,y,z);
-   				if ((unsigned short int)ImageData->GetScalarComponentAsDouble(x,y,z,0)) {
-   					Volume -> SetTuple1(id,0);
-   				} else {
-   					Volume -> SetTuple1(id,1);
-   				}
-   			}
-   		}
-   	}
-
-   	Volume -> Modified();
-
-   	label = 0;
-   	while (find) {
-   		for (s = 0; s < CurrA->GetNumberOfIds(); s++) {
-   			ido = CurrA -> GetId(s);
-   			ImageData -> GetPoint(ido,r);
-   			x = (int)r[0]; y = (int)r[1]; z = (int)r[2];
-   			for (i = 0; i < 6; i++) {
-   				id = ImageData -> FindPoint(x+ssdx_sort[i],y+ssdy_sort[i],z+ssdz_sort[i]);
-   				v = Volume -> GetTuple1(id);
-   				if ((long int)v > 0) {
-   					NextA -> InsertNextId(id);
-   					Volume -> SetTuple1(id,-label);
-   					scluster++;
-   				}
-   			}
-   		}
-   		if (!NextA->GetNumberOfIds()) {
-   			find = false;
-   			for (id=ro[0]; id--;) {
-   				v = Volume -> GetTuple1(id);
-   				if ((long int)v > 0) {
-   					find = true;
-   					ro[0] = id;
-   					break;
-   				}
-   			}
-   			if (label) {
-   				CSz -> InsertNextTuple1(scluster);
-   			}
-   			if (find) {
-   				label++;
-   				scluster = 1;
-   				Volume -> SetTuple1(id,-label);
-   				CurrA -> InsertNextId(id);
-   			}
-   		} else {
-   			CurrA -> Reset();
-   			CurrA -> DeepCopy(NextA);
-   			NextA -> Reset();
-   		}
-   	}
-
-   	for (id = N; id--;) {
-   		if ((long int)Volume->GetTuple1(id)<-1) {
-   			ImageData -> GetPointData() -> GetScalars() -> SetTuple1(id,255);
-   		}
-   	}
-   	ImageData -> GetPointData() -> GetScalars() -> Modified();
-
-   	if(_DebugFlag){
-   		printf("\tNumber of filled holes: %ld\n",(long int)CSz->GetNumberOfTuples()-1);
-   	}
-
-   }
+    if (_resample) {
+        if(_DebugFlag){
+            printf("\tResampling data...%f\t%f\n",_dxy,_dz);
+        }
+        vtkSmartPointer<vtkImageResample> Resample = vtkSmartPointer<vtkImageResample>::New();
+        Resample -> SetInterpolationModeToLinear();
+        Resample -> SetDimensionality(3);
+        Resample -> SetInputData(Image);
+        Resample -> SetAxisMagnificationFactor(0,1.0);
+        Resample -> SetAxisMagnificationFactor(1,1.0);
+        Resample -> SetAxisMagnificationFactor(2,_dz/_dxy);
+        Resample -> Update();
 
-/* ================================================================
-=================================================================*/
+        vtkSmartPointer<vtkImageData> ImageResampled = Resample -> GetOutput();
+        ImageResampled -> SetSpacing(1,1,1);
 
-   int utilities(const char FileName[]) {     
+        writer -> SetInputData(ImageResampled);
+    } else {
 
-    // Loading multi-paged TIFF file (Supported by VTK 6.2 and higher)
-   	char _fullpath[256];
-   	sprintf(_fullpath,"%s",FileName);
-
-   	vtkSmartPointer<vtkTIFFReader> TIFFReader = vtkSmartPointer<vtkTIFFReader>::New();
-   	int errlog = TIFFReader -> CanReadFile(_fullpath);
-    // File cannot be opened
-   	if (!errlog) {
-   		printf("File %s cannnot be opened.\n",_fullpath);
-   		return -1;
-   	}
-   	TIFFReader -> SetFileName(_fullpath);
-   	TIFFReader -> Update();
-
-   	int *Dim = TIFFReader -> GetOutput() -> GetDimensions();
-
-   	if(_DebugFlag){
-   		printf("Segmentation results to paraview volume and surfaces V1.0 [DEBUG mode]\n");
-   		printf("File name: %s\n",_fullpath);
-   		printf("Volume dimensions: %dx%dx%d\n",Dim[0],Dim[1],Dim[2]);
-   	}
+        writer -> SetInputData(Image);
 
-    // Exporting resampled images
-   	if (_export_image_resampled) {
-   		sprintf(_fullpath,"%s_resampled.vtk",FileName);
-   		SaveImageData(TIFFReader->GetOutput(),_fullpath,true);
-   	}
+    }
 
+    writer -> SetFileType(VTK_BINARY);
+    writer -> SetFileName(FileName);
+    writer -> Write();
 
-   	if(_image_2_surface_flag){
-   		vtkSmartPointer<vtkPolyData> AllNucContours= vtkSmartPointer<vtkPolyData>::New();
+    if(_DebugFlag){
+        printf("\tFile Saved!\n");
+    }
+}
 
+static void SavePolyData(vtkSmartPointer<vtkPolyData> PolyData, const char FileName[]) {
 
-   		vtkSmartPointer<vtkAppendPolyData> appendFilter =
-   		vtkSmartPointer<vtkAppendPolyData>::New();
+    if(_DebugFlag){
+        printf("Saving PolyData from XYZ list...\n");
+    }
 
-   		for( int objectNumber = 1; objectNumber<= TIFFReader-> GetOutput() -> GetScalarRange()[1]; objectNumber++)
-   		{
+    if(_DebugFlag){
+        printf("\t#Points in PolyData file: %lld.\n",(long long)PolyData->GetNumberOfPoints());
+    }
 
-   			vtkSmartPointer<vtkImageData> Binary = BinarizeAndConvertToDouble(TIFFReader->GetOutput(),objectNumber);
+    vtkSmartPointer<vtkPolyDataWriter> Writer = vtkSmartPointer<vtkPolyDataWriter>::New();
+    Writer -> SetFileType(VTK_BINARY);
+    Writer -> SetFileName(FileName);
+    Writer -> SetInputData(PolyData);
+    Writer -> Write();
 
+    if(_DebugFlag){
+        printf("\tFile Saved!\n");
+    }
+}
 
-	        //FillHoles(Binary);
+static void PolyData2XYPixelScale(vtkSmartPointer<vtkPolyData> PolyData) {
+    double r[3];
+    vtkPoints *Points = PolyData -> GetPoints();
+    if (!Points) return;
+    for (vtkIdType id = 0; id < Points -> GetNumberOfPoints(); id++) {
+        Points -> GetPoint(id,r);
+        Points -> SetPoint(id,r[0],r[1],r[2]*_dz/_dxy);
+    }
+    Points -> Modified();
+}
 
-   			vtkSmartPointer<vtkImageGaussianSmooth> SmoothImage = vtkSmartPointer<vtkImageGaussianSmooth>::New();
-   			SmoothImage -> SetInputData(Binary);        
-   			SmoothImage -> SetStandardDeviation(2.5);
-   			SmoothImage -> Update();
+/* ================================================================
+   OBJECTS
+=================================================================*/
 
-	        // get smooth surface
-   			vtkSmartPointer<vtkContourFilter> Filter = vtkSmartPointer<vtkContourFilter>::New();
-   			Filter -> SetInputData(SmoothImage->GetOutput());
+template <typename T> static int GetLabelBounds(const T *S, const int *Dim, std::vector<int> &Bounds) {
+
+    double vmax = 0.0;
+    size_t N = (size_t)Dim[0]*Dim[1]*Dim[2];
+    for (size_t id = 0; id < N; id++) vmax = std::max(vmax,(double)S[id]);
+
+    int nlabels = (int)floor(vmax);
+    Bounds.assign(6*((size_t)nlabels+1),0);
+    for (int l = 0; l <= nlabels; l++) {
+        Bounds[6*l+0] = Bounds[6*l+2] = Bounds[6*l+4] = INT_MAX;
+        Bounds[6*l+1] = Bounds[6*l+3] = Bounds[6*l+5] = -1;
+    }
+
+    size_t id = 0;
+    for (int z = 0; z < Dim[2]; z++) {
+        for (int y = 0; y < Dim[1]; y++) {
+            for (int x = 0; x < Dim[0]; x++, id++) {
+                double v = (double)S[id];
+                int l = (int)floor(v+0.5);
+                if (l < 1 || l > nlabels || v < l-0.1 || v >= l+0.1) continue;
+                int *B = &Bounds[6*l];
+                B[0] = std::min(B[0],x); B[1] = std::max(B[1],x);
+                B[2] = std::min(B[2],y); B[3] = std::max(B[3],y);
+                B[4] = std::min(B[4],z); B[5] = std::max(B[5],z);
+            }
+        }
+    }
+
+    return nlabels;
+}
 
-   			Filter -> SetValue(1,5);
-   			Filter -> Update();
+template <typename T> static vtkSmartPointer<vtkImageData> GetObjectImage(const T *S, vtkImageData *Image, int l, const int *Box) {
+
+    int *Dim = Image -> GetDimensions();
+    int nx = Box[1]-Box[0]+1, ny = Box[3]-Box[2]+1, nz = Box[5]-Box[4]+1;
+
+    double *o = Image -> GetOrigin();
+    double *s = Image -> GetSpacing();
+
+    vtkSmartPointer<vtkImageData> Binary = vtkSmartPointer<vtkImageData>::New();
+    Binary -> SetDimensions(nx,ny,nz);
+    Binary -> SetSpacing(s[0],s[1],s[2]);
+    Binary -> SetOrigin(o[0]+s[0]*Box[0],o[1]+s[1]*Box[2],o[2]+s[2]*Box[4]);
+
+    vtkSmartPointer<vtkUnsignedCharArray> ScalarsChar = vtkSmartPointer<vtkUnsignedCharArray>::New();
+    ScalarsChar -> SetNumberOfComponents(1);
+    ScalarsChar -> SetNumberOfTuples((vtkIdType)nx*ny*nz);
+    unsigned char *B = ScalarsChar -> GetPointer(0);
+
+    for (int z = 0; z < nz; z++) {
+        for (int y = 0; y < ny; y++) {
+            const T *R = S + Box[0] + (size_t)Dim[0]*((Box[2]+y) + (size_t)Dim[1]*(Box[4]+z));
+            for (int x = 0; x < nx; x++) {
+                double v = (double)R[x];
+                *B++ = (v >= l-0.1 && v < l+0.1) ? SEG2PARA_FOREGROUND : 0;
+            }
+        }
+    }
+    ScalarsChar -> Modified();
+
+    Binary -> GetPointData() -> SetScalars(ScalarsChar);
+    return Binary;
+}
 
-   			PolyData2XYPixelScale(Filter-> GetOutput() );
+static vtkSmartPointer<vtkPolyData> GetObjectSurfaces(vtkSmartPointer<vtkImageData> Image) {
+
+    int *Dim = Image -> GetDimensions();
+    void *S = Image -> GetScalarPointer();
+
+    // Labels stored as anything else than 8 or 16-bit integers are
+    // converted to float first
+    std::vector<float> Buffer;
+    int type = Image -> GetScalarType();
+    if (type != VTK_UNSIGNED_CHAR && type != VTK_UNSIGNED_SHORT) {
+        vtkDataArray *Scalars = Image -> GetPointData() -> GetScalars();
+        Buffer.resize(Scalars->GetNumberOfTuples());
+        for (vtkIdType id = 0; id < Scalars->GetNumberOfTuples(); id++) Buffer[id] = (float)Scalars->GetTuple1(id);
+        S = &Buffer[0];
+        type = VTK_FLOAT;
+    }
+
+    std::vector<int> Bounds;
+    int nlabels;
+    if (type == VTK_UNSIGNED_CHAR) {
+        nlabels = GetLabelBounds((const unsigned char*)S,Dim,Bounds);
+    } else if (type == VTK_UNSIGNED_SHORT) {
+        nlabels = GetLabelBounds((const unsigned short*)S,Dim,Bounds);
+    } else {
+        nlabels = GetLabelBounds((const float*)S,Dim,Bounds);
+    }
+
+    // Voxels farther than twice the kernel radius from an object take
+    // no part in its smoothed values, so the surface extracted from
+    // the box is the one of the whole stack, up to the order in which
+    // its points are numbered.
+    const int margin = 2*SEG2PARA_RADIUS + 1;
+
+    vtkSmartPointer<vtkAppendPolyData> appendFilter = vtkSmartPointer<vtkAppendPolyData>::New();
+
+    for (int objectNumber = 1; objectNumber <= nlabels; objectNumber++) {
+
+        const int *B = &Bounds[6*objectNumber];
+        if (B[0] > B[1]) continue;
+
+        int Box[6];
+        for (int d = 0; d < 3; d++) {
+            Box[2*d+0] = std::max(0,B[2*d+0]-margin);
+            Box[2*d+1] = std::min(Dim[d]-1,B[2*d+1]+margin);
+        }
+
+        vtkSmartPointer<vtkImageData> Binary;
+        if (type == VTK_UNSIGNED_CHAR) {
+            Binary = GetObjectImage((const unsigned char*)S,Image,objectNumber,Box);
+        } else if (type == VTK_UNSIGNED_SHORT) {
+            Binary = GetObjectImage((const unsigned short*)S,Image,objectNumber,Box);
+        } else {
+            Binary = GetObjectImage((const float*)S,Image,objectNumber,Box);
+        }
+
+        vtkSmartPointer<vtkImageGaussianSmooth> SmoothImage = vtkSmartPointer<vtkImageGaussianSmooth>::New();
+        SmoothImage -> SetInputData(Binary);
+        SmoothImage -> SetStandardDeviation(SEG2PARA_SIGMA);
+        SmoothImage -> Update();
+
+        // get smooth surface
+        vtkSmartPointer<vtkContourFilter> Filter = vtkSmartPointer<vtkContourFilter>::New();
+        Filter -> SetInputData(SmoothImage->GetOutput());
+        Filter -> SetValue(1,5);
+        Filter -> Update();
+
+        PolyData2XYPixelScale(Filter->GetOutput());
+
+        // Set the ID
+        vtkSmartPointer<vtkIntArray> ID = vtkSmartPointer<vtkIntArray>::New();
+        ID -> SetNumberOfValues(Filter->GetOutput()->GetNumberOfPoints());
+        for (vtkIdType ii = 0; ii < Filter->GetOutput()->GetNumberOfPoints(); ii++) {
+            ID -> SetValue(ii,objectNumber);
+        }
+        Filter -> GetOutput() -> GetPointData() -> SetScalars(ID);
+
+        // append to the group of polydata surfaces
+        vtkSmartPointer<vtkPolyData> input1 = vtkSmartPointer<vtkPolyData>::New();
+        input1 -> ShallowCopy(Filter->GetOutput());
+        appendFilter -> AddInputData(input1);
+    }
+
+    // All the objects are appended at once
+    appendFilter -> Update();
+
+    return appendFilter -> GetOutput();
+}
 
+/* ================================================================
+=================================================================*/
 
-   			vtkSmartPointer<vtkIntArray> ID = vtkSmartPointer<vtkIntArray>::New();
-   			ID->SetNumberOfValues(Filter -> GetOutput() -> GetNumberOfPoints() );
+static int utilities(const std::string &FileName) {
 
-	        // Set the ID
-   			for(int ii = 0; ii<Filter -> GetOutput() ->GetNumberOfPoints(); ii++ )
-   			{
-   				ID->SetValue(ii,objectNumber);
-   			}
+    vtkSmartPointer<vtkImageData> Image = ReadLabels(FileName);
+    if (!Image) return EXIT_FAILURE;
 
-   			Filter -> GetOutput() -> GetPointData() -> SetScalars(ID);
+    int *Dim = Image -> GetDimensions();
 
-	        // append to the group of polydata surfaces
-   			vtkSmartPointer<vtkPolyData> input1 =
-   			vtkSmartPointer<vtkPolyData>::New();
+    if(_DebugFlag){
+        printf("Segmentation results to paraview volume and surfaces V1.0 [DEBUG mode]\n");
+        printf("File name: %s\n",FileName.c_str());
+        printf("Volume dimensions: %dx%dx%d\n",Dim[0],Dim[1],Dim[2]);
+    }
 
+    // Exporting resampled images
+    if (_export_image_resampled) {
+        SaveImageData(Image,(FileName+"_resampled.vtk").c_str(),true);
+    }
 
-   			input1->ShallowCopy(Filter->GetOutput());
+    if (_image_2_surface_flag) {
+        SavePolyData(GetObjectSurfaces(Image),(FileName+"_smooth_surface_all.vtk").c_str());
+    }
 
+    printf("%s\t[done]\n",FileName.c_str());
 
-   			appendFilter->AddInputData(input1);
-   			appendFilter->Update();
-   		}
-   		sprintf(_fullpath,"%s_smooth_surface_all.vtk",FileName);
-   		SavePolyData(appendFilter->GetOutput(),_fullpath);
-   	} 
-   	return 0;
-   }
+    return EXIT_SUCCESS;
+}
 
 /* ================================================================
    MAIN ROUTINE
 =================================================================*/
 
-   int main(int argc, char *argv[]) {     
+int main(int argc, char *argv[]) {
 
-   	int i;
-   	char _impath[256];
-   	sprintf(_impath,"./examples/");
-   	char _filename[256];
-   	sprintf(_filename,"0");
+    int i;
+    std::string _impath = "./examples/";
+    std::string _filename, _listname;
+    int _njobs = 1;
 
     // Collecting input parameters
-   	for (i = 0; i < argc; i++) {
-   		printf("This argument: %s \n",argv[i]);
-
-   		if (!strcmp(argv[i],"-file")) {
-
-   			sprintf(_filename,"%s",argv[i+1]);
-   			_filename_specific = true;
-   			printf("Specified one file %s",_filename);
-   		}
-
-   		if (!strcmp(argv[i],"-path")) {
-
-   			sprintf(_impath,"%s",argv[i+1]);
-
-   			std::string fileString = _impath;
-
+    for (i = 0; i < argc; i++) {
+        printf("This argument: %s \n",argv[i]);
+
+        if (!strcmp(argv[i],"-file")) {
+            _filename = argv[i+1];
+            printf("Specified one file %s",_filename.c_str());
+        }
+        if (!strcmp(argv[i],"-path")) {
+            _impath = argv[i+1];
             // if not ended with /, add /
-   			if (!fileString.empty()){
-   				char lastChar = *fileString.rbegin();
-   				if( lastChar != '/'){
-   					sprintf(_impath,"%s/",argv[i+1]);
-   				}                  
-   			}
-
-
-   		}
-   		if (!strcmp(argv[i],"-xy")) {
-   			_dxy = atof(argv[i+1]);
-   		}
-   		if (!strcmp(argv[i],"-z")) {
-   			_dz = atof(argv[i+1]);
-   		}
-   		if (!strcmp(argv[i],"-export_image_resampled")) {
-   			_export_image_resampled = true;
-   		}
-   		if (!strcmp(argv[i],"-resampleonly")) {
-   			_resampleonly = true;
-   			_export_image_resampled = true;
-   		}
-   		if (!strcmp(argv[i],"-image_2_surface_flag")) {
-   			_image_2_surface_flag = true;
-   		}     
-   		if (!strcmp(argv[i],"-DebugFlag")) {
-   			_DebugFlag = true;
-   		}      
-
-   	}
-
-
-   	if (_dz<0) {        
-   		_dxy = 0.09;
-   		_dz = 0.2;
-   		_export_image_resampled = true;
-   		_improve_skeleton_quality = true;
-   		_DebugFlag = true;
-   		_div_threshold = 0.4;
-   		printf("Please, use -dxy and -dz to provide the pixel size.\n");
-        //return -1;
-   	}
-
-   	vtkSmartPointer<vtkDirectory> directory = vtkSmartPointer<vtkDirectory>::New();  
-   	int opened = directory->Open(_impath); 
-   	if(!opened)
-   	{
-   		std::cout << "Invalid directory!" << std::endl;
-   		return EXIT_FAILURE;
-   	}
-
-   	vtkSmartPointer<vtkLongArray>  TiffFilenameIndexList = vtkSmartPointer<vtkLongArray>::New();
-
-   	if(_filename_specific)
-   	{  
-   		int numberOfFiles = 1;  
-   		std::cout << "1 file " << numberOfFiles << std::endl;
-
-   		TiffFilenameIndexList -> SetNumberOfComponents(1);
-   		TiffFilenameIndexList -> SetNumberOfTuples(0);
-   		std::string fileString = _impath;
-
-   		if (!fileString.empty()){
-   			char lastChar = *fileString.rbegin();
-   			if( lastChar != '/'){
-   				fileString += "/";
-   			}
-   		}
-   		
-   		fileString += _filename;    
-
-   		TiffFilenameIndexList->InsertNextTuple1(1);  
-
-   	}
-   	else
-   	{
-   		int numberOfFiles = directory->GetNumberOfFiles();  
-   		std::cout << "Number of all files: " << numberOfFiles << std::endl;
-
-   		TiffFilenameIndexList -> SetNumberOfComponents(1);
-   		TiffFilenameIndexList -> SetNumberOfTuples(0);
-
-   		for (int i = 0; i < numberOfFiles; i++)
-   		{
-   			std::string fileString = _impath;
-
-   			if (!fileString.empty()){
-   				char lastChar = *fileString.rbegin();
-   				if( lastChar != '/'){
-   					fileString += "/";
-   				}
-   			}
-
-
-   			fileString += directory->GetFile(i); 
-   			std::string ext = vtksys::SystemTools::GetFilenameLastExtension(fileString);    
-
-
-   			if( (ext == ".tif")||(ext == ".tiff")) {
-
-   				std::cout << "Find tiff file(s): "  << std::endl;
-   				std::cout << fileString << std::endl;
-
-   				TiffFilenameIndexList->InsertNextTuple1(i);  
-   			}
-   		}  
-
-   	}
-    //
-
-   	char _tifffilename[512];
-
-
-   	for(int iTiffInd = 0 ; iTiffInd< TiffFilenameIndexList->GetNumberOfTuples();iTiffInd++) {
-   		std::string stdstr_tifffilename = _impath;
-   		if (!stdstr_tifffilename.empty()){
-   			char lastChar = *stdstr_tifffilename.rbegin();
-   			if( lastChar != '/'){
-   				stdstr_tifffilename += "/";
-   			}
-   		}
-
-   		if(_filename_specific)
-   		{ 
-   			stdstr_tifffilename += _filename;  
-   			std::cout << "Work on tiff file: "  << std::endl;
-   			std::cout << stdstr_tifffilename << std::endl;            
-   			sprintf(_tifffilename,stdstr_tifffilename.c_str());
-
-   		}   
-   		else
-   		{
-   			stdstr_tifffilename += directory->GetFile(TiffFilenameIndexList->GetTuple1(iTiffInd));  
-   			std::cout << "Work on tiff file: "  << std::endl;
-   			std::cout << stdstr_tifffilename << std::endl;
-
-   			sprintf(_tifffilename,stdstr_tifffilename.c_str());
-   		}
-
-    	// the core function for the tool
-   		utilities(_tifffilename);
-
-   		printf("%s\t[done]\n",_tifffilename);
-   	}
-
-   	return 0;
+            if (!_impath.empty() && *_impath.rbegin() != '/') {
+                _impath += "/";
+            }
+        }
+        if (!strcmp(argv[i],"-list")) {
+            _listname = argv[i+1];
+        }
+        if (!strcmp(argv[i],"-jobs")) {
+            _njobs = atoi(argv[i+1]);
+            if (_njobs < 1) {
+                printf("Warning: number of jobs too small (%d), setting to minimum of 1\n",_njobs);
+                _njobs = 1;
+            }
+        }
+        if (!strcmp(argv[i],"-mmap")) {
+            _mmap_input = true;
+        }
+        if (!strcmp(argv[i],"-xy")) {
+            _dxy = atof(argv[i+1]);
+        }
+        if (!strcmp(argv[i],"-z")) {
+            _dz = atof(argv[i+1]);
+        }
+        if (!strcmp(argv[i],"-export_image_resampled")) {
+            _export_image_resampled = true;
+        }
+        if (!strcmp(argv[i],"-image_2_surface_flag")) {
+            _image_2_surface_flag = true;
+        }
+        if (!strcmp(argv[i],"-DebugFlag")) {
+            _DebugFlag = true;
+        }
+    }
+
+    if (_dz<0) {
+        _dxy = 0.09;
+        _dz = 0.2;
+        _export_image_resampled = true;
+        _DebugFlag = true;
+        printf("Please, use -dxy and -dz to provide the pixel size.\n");
+    }
+
+    std::vector<std::string> Files;
+
+    if (!_listname.empty()) {
+
+        // Names without extension, such as those of a MitoGraph
+        // manifest, are taken as .tif stacks
+        std::vector<std::string> List;
+        if (!ReadInputList(_listname,List)) {
+            printf("File %s cannot be read.\n",_listname.c_str());
+            return EXIT_FAILURE;
+        }
+        for (size_t k = 0; k < List.size(); k++) {
+            std::string ext = vtksys::SystemTools::GetFilenameLastExtension(List[k]);
+            Files.push_back((ext == ".tif" || ext == ".tiff") ? List[k] : List[k]+".tif");
+        }
+
+    } else if (!_filename.empty()) {
+
+        Files.push_back(_impath+_filename);
+
+    } else {
+
+        vtkSmartPointer<vtkDirectory> directory = vtkSmartPointer<vtkDirectory>::New();
+        if (!directory->Open(_impath.c_str())) {
+            printf("Invalid directory!\n");
+            return EXIT_FAILURE;
+        }
+        for (vtkIdType k = 0; k < directory->GetNumberOfFiles(); k++) {
+            std::string fileString = _impath + directory->GetFile(k);
+            std::string ext = vtksys::SystemTools::GetFilenameLastExtension(fileString);
+            if ((ext == ".tif") || (ext == ".tiff")) {
+                printf("Find tiff file(s): \n%s\n",fileString.c_str());
+                Files.push_back(fileString);
+            }
+        }
+        std::sort(Files.begin(),Files.end());
+
+    }
+
+    // Files are processed concurrently with -jobs
+    int nfailed = RunJobs(Files,_njobs,utilities);
+
+    return (nfailed) ? EXIT_FAILURE : 0;
 }
@@ -5,46 +5,39 @@
 */
 
 #include "includes.h"
+#include "MitoBatch.h"
 
-int main(int argc, char *argv[]) {     
+static double _length_threshold = 0.0;
 
-    int i;
-    std::string _skpath;
-    std::string _rfpath;
-    double _dxy, _dz, _length_threshold;
-
-    // Collecting input parameters
-    for (i = 0; i < argc; i++) {
-        if (!strcmp(argv[i],"-skell")) {
-            _skpath = argv[i+1];
-        }
-        if (!strcmp(argv[i],"-reference")) {
-            _rfpath = argv[i+1];
-        }
-        if (!strcmp(argv[i],"-threshold")) {
-            _length_threshold = (double)atof(argv[i+1]);
-        }
-        if (!strcmp(argv[i],"-xy")) {
-            _dxy = atof(argv[i+1]);
-        }
-        if (!strcmp(argv[i],"-z")) {
-            _dz = atof(argv[i+1]);
-        }
-    }
+// Rasterizes the points of the skeleton _skpath whose Length is above
+// _length_threshold into a mask with the size and type of the stack
+// _rfpath.tif, written to _rfpath-mask.tif. Only the header of the
+// stack is read.
+static int Skell2Img(const std::string &_skpath, const std::string &_rfpath) {
 
     printf("Skeleton: %s\n",_skpath.c_str());
     printf("Reference Image: %s\n",_rfpath.c_str());
     printf("Threshold: %1.3f\n",_length_threshold);
 
     //
-    // Load Reference Image
+    // Size of the Reference Image
     //
 
     vtkSmartPointer<vtkTIFFReader> TIFFReader = vtkSmartPointer<vtkTIFFReader>::New();
+    if (!TIFFReader -> CanReadFile((_rfpath+".tif").c_str())) {
+        printf("File %s cannnot be opened.\n",(_rfpath+".tif").c_str());
+        return EXIT_FAILURE;
+    }
     TIFFReader -> SetFileName((_rfpath+".tif").c_str());
-    TIFFReader -> Update();
-    
-    vtkSmartPointer<vtkImageData> Image = TIFFReader -> GetOutput();
+    TIFFReader -> UpdateInformation();
+
+    int *Ext = TIFFReader -> GetDataExtent();
+
+    vtkSmartPointer<vtkImageData> Image = vtkSmartPointer<vtkImageData>::New();
+    Image -> SetExtent(Ext);
+    Image -> SetSpacing(TIFFReader->GetDataSpacing());
+    Image -> SetOrigin(TIFFReader->GetDataOrigin());
+    Image -> AllocateScalars(TIFFReader->GetDataScalarType(),1);
 
     Image -> GetPointData() -> GetScalars() -> FillComponent(0,0);
 
@@ -57,21 +50,26 @@ int main(int argc, char *argv[]) {
     PolyReader -> Update();
 
     vtkSmartPointer<vtkPolyData> Skell = PolyReader -> GetOutput();
-    
+
     printf("Number of Polydata Points: %d\n",(int)Skell->GetNumberOfPoints());
 
-    vtkIdType id, id2;
-    double r[3], length;
-    vtkSmartPointer<vtkCell> Edge;
+    vtkDataArray *Length = Skell -> GetPointData() -> GetArray("Length");
+    if (!Length) {
+        printf("File %s has no Length array.\n",_skpath.c_str());
+        return EXIT_FAILURE;
+    }
 
-    for (id = 0; id < Skell->GetNumberOfPoints(); id++) {
-        Skell -> GetPoint(id,r);
-        length = Skell -> GetPointData() -> GetArray("Length") -> GetTuple1(id);
+    vtkIdType id, vid;
+    double r[3];
+    vtkDataArray *Scalars = Image -> GetPointData() -> GetScalars();
 
-        if (length > _length_threshold) {
-            Image -> GetPointData() -> GetScalars() -> SetTuple1(Image->FindPoint((int)r[0],(int)r[1],0), 255);
+    for (id = 0; id < Skell->GetNumberOfPoints(); id++) {
+        if (Length -> GetTuple1(id) > _length_threshold) {
+            Skell -> GetPoint(id,r);
+            // Points that fall outside the image are skipped
+            vid = Image -> FindPoint((int)r[0],(int)r[1],0);
+            if (vid >= 0) Scalars -> SetTuple1(vid,255);
         }
-
     }
 
     vtkSmartPointer<vtkTIFFWriter> Writer = vtkSmartPointer<vtkTIFFWriter>::New();
@@ -79,5 +77,75 @@ int main(int argc, char *argv[]) {
     Writer -> SetFileName((_rfpath+"-mask.tif").c_str());
     Writer -> Write();
 
-    return 0;
+    return EXIT_SUCCESS;
+}
+
+// File of a batch: the skeleton is Name_skeleton.vtk and the reference
+// image Name.tif, as written by MitoGraph
+static int ProcessSkeleton(const std::string &Name) {
+    return Skell2Img(Name+"_skeleton.vtk",Name);
+}
+
+int main(int argc, char *argv[]) {
+
+    int i;
+    std::string _skpath;
+    std::string _rfpath;
+    std::string _impath;
+    std::string _listname;
+    int _njobs = 1;
+
+    // Collecting input parameters
+    for (i = 0; i < argc; i++) {
+        if (!strcmp(argv[i],"-skell")) {
+            _skpath = argv[i+1];
+        }
+        if (!strcmp(argv[i],"-reference")) {
+            _rfpath = argv[i+1];
+        }
+        if (!strcmp(argv[i],"-path")) {
+            _impath = argv[i+1];
+            if (!_impath.empty() && *_impath.rbegin() != '/') {
+                _impath += "/";
+            }
+        }
+        if (!strcmp(argv[i],"-list")) {
+            _listname = argv[i+1];
+        }
+        if (!strcmp(argv[i],"-jobs")) {
+            _njobs = atoi(argv[i+1]);
+            if (_njobs < 1) {
+                printf("Warning: number of jobs too small (%d), setting to minimum of 1\n",_njobs);
+                _njobs = 1;
+            }
+        }
+        if (!strcmp(argv[i],"-threshold")) {
+            _length_threshold = (double)atof(argv[i+1]);
+        }
+    }
+
+    if (_listname.empty() && _impath.empty()) {
+        return (Skell2Img(_skpath,_rfpath) == EXIT_SUCCESS) ? 0 : EXIT_FAILURE;
+    }
+
+    // Skeletons of a folder, or the files listed in a text file or in
+    // the manifest of a MitoGraph run
+    std::vector<std::string> Files;
+    if (!_listname.empty()) {
+        if (!ReadInputList(_listname,Files)) {
+            printf("File %s cannot be read.\n",_listname.c_str());
+            return EXIT_FAILURE;
+        }
+        for (size_t k = 0; k < Files.size(); k++) {
+            const std::string &F = Files[k];
+            if (F.size() > 13 && !F.compare(F.size()-13,13,"_skeleton.vtk")) Files[k] = F.substr(0,F.size()-13);
+            else if (F.size() > 4 && !F.compare(F.size()-4,4,".tif")) Files[k] = F.substr(0,F.size()-4);
+        }
+    } else {
+        ScanFolderForThisExtension(_impath,"_skeleton.vtk",&Files);
+    }
+
+    int nfailed = RunJobs(Files,_njobs,ProcessSkeleton);
+
+    return (nfailed) ? EXIT_FAILURE : 0;
 }